@@ -111,3 +111,33 @@ void Preference::setSamples(int value)
         emit samplesChanged();
     }
 }
+
+QString Preference::videoEncoderPath() const
+{
+    /* an empty path writes PNG images instead of encoding a video */
+    return m_settings.value("videoEncoderPath", "avconv").toString();
+}
+
+void Preference::setVideoEncoderPath(const QString &value)
+{
+    if (value != videoEncoderPath()) {
+        m_settings.setValue("videoEncoderPath", value);
+        emit videoEncoderPathChanged();
+    }
+}
+
+QString Preference::videoEncoderArguments() const
+{
+    /* raw frames are written to the standard input of the encoder */
+    static const QString kDefaultArguments = "-f rawvideo -pix_fmt bgra -s {width}x{height} -r {fps} -i - "
+            "-metadata title={title} -map 0 -qscale 1 -c:v png -y {output}";
+    return m_settings.value("videoEncoderArguments", kDefaultArguments).toString();
+}
+
+void Preference::setVideoEncoderArguments(const QString &value)
+{
+    if (value != videoEncoderArguments()) {
+        m_settings.setValue("videoEncoderArguments", value);
+        emit videoEncoderArgumentsChanged();
+    }
+}
@@ -48,6 +48,8 @@ class Preference : public QObject
     Q_PROPERTY(QRect windowRect READ windowRect WRITE setWindowRect NOTIFY windowRectChanged)
     Q_PROPERTY(QString fontFamily READ fontFamily WRITE setFontFamily NOTIFY fontFamilyChanged)
     Q_PROPERTY(int samples READ samples WRITE setSamples NOTIFY samplesChanged)
+    Q_PROPERTY(QString videoEncoderPath READ videoEncoderPath WRITE setVideoEncoderPath NOTIFY videoEncoderPathChanged)
+    Q_PROPERTY(QString videoEncoderArguments READ videoEncoderArguments WRITE setVideoEncoderArguments NOTIFY videoEncoderArgumentsChanged)
 
 public:
     explicit Preference(QObject *parent = 0);
@@ -62,11 +64,17 @@ public:
     void setFontFamily(const QString &value);
     int samples() const;
     void setSamples(int value);
+    QString videoEncoderPath() const;
+    void setVideoEncoderPath(const QString &value);
+    QString videoEncoderArguments() const;
+    void setVideoEncoderArguments(const QString &value);
 
 signals:
     void windowRectChanged();
     void fontFamilyChanged();
     void samplesChanged();
+    void videoEncoderPathChanged();
+    void videoEncoderArgumentsChanged();
 
 private:
     QSettings m_settings;
@@ -414,7 +414,7 @@ bool ProjectProxy::deleteModel(ModelProxy *value)
         }
         deleteMotion(value->childMotion());
         IModel *modelRef = value->data();
-        modelRef->leaveWorld(m_sceneWorld->dynamicWorldRef());
+        m_sceneWorld->removeModel(modelRef);
         setDirty(true);
         m_modelProxies.removeOne(value);
         m_instance2ModelProxyRefs.remove(modelRef);
@@ -712,7 +712,7 @@ void ProjectProxy::setPhysicsSimulationEnabled(bool value)
         foreach (ModelProxy *modelProxy, m_modelProxies) {
             modelProxy->data()->setPhysicsEnable(value);
         }
-        m_project->setWorldRef(value ? m_sceneWorld->dynamicWorldRef() : 0);
+        m_project->setPhysicsWorldRef(value ? m_sceneWorld.data() : 0);
         m_enablePhysicsSimulation = value;
         emit enablePhysicsSimulationChanged();
     }
@@ -998,7 +998,7 @@ void ProjectProxy::createProjectInstance()
 {
     m_project.reset(new XMLProject(m_delegate.data(), m_factory.data(), false));
     if (m_enablePhysicsSimulation) {
-        m_project->setWorldRef(m_sceneWorld->dynamicWorldRef());
+        m_project->setPhysicsWorldRef(m_sceneWorld.data());
     }
 }
 
@@ -1133,7 +1133,7 @@ void ProjectProxy::release()
     m_motionProxies.clear();
     m_cameraRefObject->releaseMotion();
     m_lightRefObject->releaseMotion();
-    m_project->setWorldRef(0);
+    m_project->setPhysicsWorldRef(0);
     connect(m_undoGroup.data(), &QUndoGroup::canUndoChanged, this, &ProjectProxy::canUndoChanged);
     connect(m_undoGroup.data(), &QUndoGroup::canRedoChanged, this, &ProjectProxy::canRedoChanged);
 }
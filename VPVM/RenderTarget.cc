@@ -48,7 +48,6 @@
 #include <QOpenGLShaderProgram>
 #include <QOpenGLVertexArrayObject>
 #include <QProcess>
-#include <QTemporaryDir>
 #include <IGizmo.h>
 
 #include "BoneRefObject.h"
@@ -212,14 +211,30 @@ class RenderTarget::EncodingTask : public QObject, public QRunnable {
     Q_OBJECT
 
 public:
+    /* frames are read back asynchronously with a ring of pixel pack buffers */
+    static const int kMaxPixelPackBuffers = 3;
+    /* the renderer blocks if the encoder falls behind by more than these frames */
+    static const int kMaxQueuedFrames = 8;
+
     EncodingTask()
         : QObject(),
-          m_estimatedFrameCount(0)
+          m_imageWriterSlots(kMaxQueuedFrames),
+          m_estimatedFrameCount(0),
+          m_numReadFrames(0),
+          m_pixelBufferSize(0),
+          m_running(false),
+          m_finished(false),
+          m_cancelled(false),
+          m_imageWriteFailed(false)
     {
         setAutoDelete(false);
+        for (int i = 0; i < kMaxPixelPackBuffers; i++) {
+            m_pixelBuffers[i] = 0;
+        }
     }
     ~EncodingTask() {
         stop();
+        waitForDone();
     }
 
     void setSize(const QSize &value) {
@@ -228,58 +243,110 @@ public:
     void setTitle(const QString &value) {
         m_title = value;
     }
-    void setInputImageFormat(const QString &value) {
-        m_inputImageFormat = value;
-    }
     void setOutputPath(const QString &value) {
         m_outputPath = value;
     }
-    void setOutputFormat(const QString &value) {
-        m_outputFormat = value;
+    void setEncoderPath(const QString &value) {
+        m_encoderPath = value;
+    }
+    void setEncoderArguments(const QString &value) {
+        m_encoderArguments = value;
     }
     void setEstimatedFrameCount(const qint64 value) {
         m_estimatedFrameCount = value;
     }
 
     void reset() {
-        m_workerId = QUuid::createUuid().toByteArray().toHex();
-        m_workerDir.reset(new QTemporaryDir());
-        m_workerDirPath = m_workerDir->path();
-        m_inputImageFormat = "bmp";
-        m_outputFormat = "png";
-        m_fbo.reset();
+        stop();
+        waitForDone();
+        QMutexLocker locker(&m_mutex);
+        m_frames.clear();
+        m_numReadFrames = 0;
+        m_finished = false;
+        m_cancelled = false;
+        m_imageWriteFailed = false;
     }
     QOpenGLFramebufferObject *generateFramebufferObject(QQuickWindow *win) {
-        if (!m_fbo) {
+        if (!m_fbo || m_fbo->size() != m_size) {
             m_fbo.reset(new QOpenGLFramebufferObject(m_size, ApplicationContext::framebufferObjectFormat(win)));
         }
         return m_fbo.data();
     }
-    QString generateFilename(const qreal &timeIndex) {
-        const QString &filename = QStringLiteral("%1-%2.%3")
-                .arg(m_workerId)
-                .arg(qRound64(timeIndex), 9, 10, QLatin1Char('0'))
-                .arg(m_inputImageFormat);
-        const QString &path = m_workerDirPath.absoluteFilePath(filename);
-        return path;
-    }
 
-    void stop() {
-        if (m_process && m_process->state() == QProcess::Running) {
-            m_process->kill();
-            VPVL2_LOG(INFO, "Tried killing encode process " << m_process->pid());
-            m_process->waitForFinished(5000);
-            if (m_process->isOpen()) {
-                m_process->terminate();
-                VPVL2_LOG(INFO, "Tried terminating encode process " << m_process->pid());
-                m_process->waitForFinished(5000);
+    /* called from the render thread after drawing a frame to the framebuffer object */
+    void readPixels(QOpenGLFramebufferObject *fbo) {
+        QOpenGLFramebufferObject *source = fbo;
+        if (fbo->format().samples() > 0) {
+            if (!m_resolveFbo || m_resolveFbo->size() != fbo->size()) {
+                m_resolveFbo.reset(new QOpenGLFramebufferObject(fbo->size()));
             }
-            if (m_process->state() == QProcess::Running) {
-                VPVL2_LOG(WARNING, "error=" << m_process->error());
+            QOpenGLFramebufferObject::blitFramebuffer(m_resolveFbo.data(), fbo);
+            source = m_resolveFbo.data();
+        }
+        const GLsizeiptr size = GLsizeiptr(m_size.width()) * m_size.height() * 4;
+        if (m_pixelBufferSize != size) {
+            releasePixelBuffers();
+            glGenBuffers(kMaxPixelPackBuffers, m_pixelBuffers);
+            for (int i = 0; i < kMaxPixelPackBuffers; i++) {
+                glBindBuffer(GL_PIXEL_PACK_BUFFER, m_pixelBuffers[i]);
+                glBufferData(GL_PIXEL_PACK_BUFFER, size, 0, GL_STREAM_READ);
             }
-            m_process.reset();
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            m_pixelBufferSize = size;
+        }
+        /* the buffer to reuse still has the frame read kMaxPixelPackBuffers frames ago */
+        const int index = int(m_numReadFrames % kMaxPixelPackBuffers);
+        if (m_numReadFrames >= quint64(kMaxPixelPackBuffers)) {
+            enqueueFrame(mapPixelBuffer(index));
+        }
+        source->bind();
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, m_pixelBuffers[index]);
+        glReadPixels(0, 0, m_size.width(), m_size.height(), GL_BGRA, GL_UNSIGNED_BYTE, 0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        source->bindDefault();
+        m_numReadFrames++;
+    }
+    /* called from the render thread after the last frame is read */
+    void finish() {
+        const quint64 offset = m_numReadFrames > quint64(kMaxPixelPackBuffers) ? m_numReadFrames - kMaxPixelPackBuffers : 0;
+        for (quint64 i = offset; i < m_numReadFrames; i++) {
+            enqueueFrame(mapPixelBuffer(int(i % kMaxPixelPackBuffers)));
+        }
+        releaseFramebuffers();
+        {
+            QMutexLocker locker(&m_mutex);
+            m_estimatedFrameCount = m_numReadFrames;
+            m_finished = true;
+            m_frameEnqueued.wakeAll();
+        }
+        emit encodeDidBegin();
+    }
+    /* must be called from the render thread */
+    void releaseFramebuffers() {
+        releasePixelBuffers();
+        m_resolveFbo.reset();
+        m_fbo.reset();
+    }
+
+    void stop() {
+        QMutexLocker locker(&m_mutex);
+        if (m_running) {
+            m_cancelled = true;
+            m_frameEnqueued.wakeAll();
+            m_frameDequeued.wakeAll();
+        }
+    }
+    void waitForDone() {
+        QMutexLocker locker(&m_mutex);
+        while (m_running) {
+            m_taskDone.wait(&m_mutex);
         }
     }
+    void start() {
+        QMutexLocker locker(&m_mutex);
+        m_running = true;
+        QThreadPool::globalInstance()->start(this);
+    }
 
 signals:
     void encodeDidBegin();
@@ -287,75 +354,252 @@ signals:
     void encodeDidFinish(bool isNormalExit);
 
 private:
-    void run() {
-        stop();
+    class ImageWriter : public QRunnable {
+    public:
+        ImageWriter(EncodingTask *parent, const QByteArray &bytes, const QString &path)
+            : m_parentRef(parent),
+              m_bytes(bytes),
+              m_path(path)
+        {
+        }
+        ~ImageWriter() {
+        }
+
+        void run() {
+            const QSize &size = m_parentRef->m_size;
+            const QImage image(reinterpret_cast<const uchar *>(m_bytes.constData()), size.width(), size.height(), QImage::Format_ARGB32);
+            if (!image.save(m_path, "PNG")) {
+                VPVL2_LOG(WARNING, "Cannot write an image to " << m_path.toStdString());
+                /* writers run on the pool threads concurrently */
+                QMutexLocker locker(&m_parentRef->m_mutex);
+                m_parentRef->m_imageWriteFailed = true;
+            }
+            m_parentRef->m_imageWriterSlots.release();
+        }
+
+    private:
+        EncodingTask *m_parentRef;
+        const QByteArray m_bytes;
+        const QString m_path;
+    };
+
+    QByteArray mapPixelBuffer(int index) const {
+        const int width = m_size.width(), height = m_size.height(), stride = width * 4;
+        QByteArray bytes(stride * height, Qt::Uninitialized);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, m_pixelBuffers[index]);
+        if (const char *address = static_cast<const char *>(glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY))) {
+            /* flip vertically because OpenGL stores rows from bottom to top */
+            char *dest = bytes.data();
+            for (int y = 0; y < height; y++) {
+                memcpy(dest + (height - y - 1) * stride, address + y * stride, stride);
+            }
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        else {
+            bytes.fill(0);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        return bytes;
+    }
+    void releasePixelBuffers() {
+        if (m_pixelBufferSize > 0) {
+            glDeleteBuffers(kMaxPixelPackBuffers, m_pixelBuffers);
+            for (int i = 0; i < kMaxPixelPackBuffers; i++) {
+                m_pixelBuffers[i] = 0;
+            }
+            m_pixelBufferSize = 0;
+        }
+    }
+    void enqueueFrame(const QByteArray &bytes) {
+        QMutexLocker locker(&m_mutex);
+        while (m_frames.size() >= kMaxQueuedFrames && !m_cancelled && !m_finished) {
+            m_frameDequeued.wait(&m_mutex);
+        }
+        if (!m_cancelled && !m_finished) {
+            m_frames.enqueue(bytes);
+            m_frameEnqueued.wakeOne();
+        }
+    }
+    bool dequeueFrame(QByteArray &bytes) {
+        QMutexLocker locker(&m_mutex);
+        while (m_frames.isEmpty() && !m_finished && !m_cancelled) {
+            m_frameEnqueued.wait(&m_mutex);
+        }
+        if (m_cancelled || m_frames.isEmpty()) {
+            return false;
+        }
+        bytes = m_frames.dequeue();
+        m_frameDequeued.wakeOne();
+        return true;
+    }
+    bool isCancelled() {
+        QMutexLocker locker(&m_mutex);
+        return m_cancelled;
+    }
+
+    QStringList createArguments() const {
         QStringList arguments;
-#ifndef QT_NO_DEBUG
-        arguments.append("-v");
-        arguments.append("debug");
-#endif
-        arguments.append("-r");
-        arguments.append(QStringLiteral("%1").arg(29.97));
-        arguments.append("-s");
-        arguments.append(QStringLiteral("%1x%2").arg(m_size.width()).arg(m_size.height()));
-        arguments.append("-qscale");
-        arguments.append("1");
-        arguments.append("-vcodec");
-        arguments.append(m_inputImageFormat);
-        arguments.append("-metadata");
-        arguments.append(QStringLiteral("title=\"%1\"").arg(m_title));
-        arguments.append("-i");
-        arguments.append(m_workerDirPath.absoluteFilePath(QStringLiteral("%1-%09d.%2").arg(m_workerId).arg(m_inputImageFormat)));
-        arguments.append("-map");
-        arguments.append("0");
-        arguments.append("-c:v");
-        arguments.append(m_outputFormat);
-        arguments.append("-y");
-        arguments.append(m_outputPath);
-        m_process.reset(new QProcess(this));
+        /* placeholders are replaced after splitting not to break arguments containing spaces */
+        foreach (QString argument, m_encoderArguments.split(QRegExp("\\s+"), QString::SkipEmptyParts)) {
+            argument.replace("{width}", QString::number(m_size.width()));
+            argument.replace("{height}", QString::number(m_size.height()));
+            argument.replace("{fps}", QString::number(29.97));
+            argument.replace("{title}", m_title);
+            argument.replace("{output}", m_outputPath);
+            arguments.append(argument);
+        }
+        return arguments;
+    }
+    bool startProcess() {
+        if (m_encoderPath.isEmpty()) {
+            return false;
+        }
+        const QStringList &arguments = createArguments();
+        m_process.reset(new QProcess());
         m_process->setArguments(arguments);
-        m_process->setProgram("/Users/hkrn/src/MMDAI/libav-src/avconv");
+        m_process->setProgram(m_encoderPath);
         m_process->setProcessChannelMode(QProcess::MergedChannels);
         /* disable color output from standard output */
-        QStringList environments = m_process->environment();
-        environments << "AV_LOG_FORCE_NOCOLOR" << "1";
+        QStringList environments = QProcess::systemEnvironment();
+        environments << "AV_LOG_FORCE_NOCOLOR=1";
         m_process->setEnvironment(environments);
         m_process->start();
         VPVL2_VLOG(1, "executable=" << m_process->program().toStdString() << " arguments=" << arguments.join(" ").toStdString());
         VPVL2_VLOG(2, "Waiting for starting encoding task");
-        m_process->waitForStarted();
-        emit encodeDidBegin();
+        if (!m_process->waitForStarted()) {
+            VPVL2_LOG(WARNING, "Cannot start the encoder " << m_encoderPath.toStdString() << ": " << m_process->errorString().toStdString());
+            m_process.reset();
+            return false;
+        }
         VPVL2_VLOG(1, "Started encoding task");
-        QRegExp regexp("^frame\\s*=\\s*(\\d+)");
-        while (m_process->waitForReadyRead()) {
-            const QByteArray &output = m_process->readAllStandardOutput();
-            if (regexp.indexIn(output) >= 0) {
-                quint64 proceeded = regexp.cap(1).toLongLong();
-                emit encodeDidProceed(proceeded, m_estimatedFrameCount);
+        return true;
+    }
+    bool writeFrame(const QByteArray &bytes) {
+        const char *ptr = bytes.constData();
+        qint64 rest = bytes.size();
+        while (rest > 0) {
+            qint64 written = m_process->write(ptr, rest);
+            if (written < 0) {
+                return false;
             }
+            ptr += written;
+            rest -= written;
+        }
+        while (m_process->bytesToWrite() > 0) {
+            if (!m_process->waitForBytesWritten()) {
+                return false;
+            }
+        }
+        return true;
+    }
+    void readProgress() {
+        QRegExp regexp("frame\\s*=\\s*(\\d+)");
+        const QString &output = QString::fromLocal8Bit(m_process->readAll());
+        if (regexp.lastIndexIn(output) >= 0) {
+            emit encodeDidProceed(regexp.cap(1).toULongLong(), m_estimatedFrameCount);
+        }
+    }
+    bool finishProcess() {
+        if (isCancelled()) {
+            m_process->kill();
+            VPVL2_LOG(INFO, "Tried killing encode process " << m_process->pid());
+            m_process->waitForFinished(5000);
+            return false;
         }
+        m_process->closeWriteChannel();
         VPVL2_VLOG(2, "Waiting for finishing encoding task");
-        m_process->waitForFinished();
+        while (m_process->waitForReadyRead(-1)) {
+            readProgress();
+        }
+        m_process->waitForFinished(-1);
         VPVL2_VLOG(1, "Finished encoding task");
-        emit encodeDidFinish(m_process->exitStatus() == QProcess::NormalExit);
-        m_process.reset();
-        m_workerDir.reset();
-        m_fbo.reset();
+        return m_process->exitStatus() == QProcess::NormalExit && m_process->exitCode() == 0;
+    }
+    QString generateImagePath(quint64 index) const {
+        const QString &filename = QStringLiteral("%1.png").arg(index, 9, 10, QLatin1Char('0'));
+        return m_imageDir.absoluteFilePath(filename);
+    }
+    bool prepareImageDirectory() {
+        const QFileInfo info(m_outputPath);
+        m_imageDir = info.absoluteDir();
+        const QString &name = QStringLiteral("%1-frames").arg(info.completeBaseName());
+        if (!m_imageDir.mkpath(name) || !m_imageDir.cd(name)) {
+            VPVL2_LOG(WARNING, "Cannot create the directory to write images: " << m_imageDir.absoluteFilePath(name).toStdString());
+            return false;
+        }
+        VPVL2_LOG(INFO, "Falling back to write images to " << m_imageDir.absolutePath().toStdString());
+        return true;
+    }
+    void run() {
+        bool piped = startProcess(), ok = piped || prepareImageDirectory();
+        m_imageWriterPool.setMaxThreadCount(qMax(QThread::idealThreadCount(), 1));
+        QByteArray bytes;
+        quint64 nframes = 0;
+        while (ok && dequeueFrame(bytes)) {
+            if (piped) {
+                ok = writeFrame(bytes);
+                readProgress();
+            }
+            else {
+                /* PNG encoding is the bottleneck so images are written in parallel */
+                m_imageWriterSlots.acquire();
+                m_imageWriterPool.start(new ImageWriter(this, bytes, generateImagePath(nframes)));
+                emit encodeDidProceed(nframes + 1, m_estimatedFrameCount);
+            }
+            nframes++;
+        }
+        {
+            /* stops accepting frames if the encoder is failed before the last frame */
+            QMutexLocker locker(&m_mutex);
+            m_finished = true;
+            m_frames.clear();
+            m_frameDequeued.wakeAll();
+        }
+        if (piped) {
+            ok = finishProcess() && ok;
+            m_process.reset();
+        }
+        else {
+            m_imageWriterPool.waitForDone();
+            QMutexLocker locker(&m_mutex);
+            ok = ok && !m_imageWriteFailed;
+        }
+        if (!isCancelled()) {
+            if (!ok) {
+                VPVL2_LOG(WARNING, "Failed encoding " << nframes << " frames to " << m_outputPath.toStdString());
+            }
+            emit encodeDidFinish(ok);
+        }
+        QMutexLocker locker(&m_mutex);
         m_estimatedFrameCount = 0;
+        m_running = false;
+        m_taskDone.wakeAll();
     }
 
     QScopedPointer<QProcess> m_process;
     QScopedPointer<QOpenGLFramebufferObject> m_fbo;
-    QScopedPointer<QTemporaryDir> m_workerDir;
-    QDir m_workerDirPath;
-    QString m_workerId;
+    QScopedPointer<QOpenGLFramebufferObject> m_resolveFbo;
+    QThreadPool m_imageWriterPool;
+    QSemaphore m_imageWriterSlots;
+    QMutex m_mutex;
+    QWaitCondition m_frameEnqueued;
+    QWaitCondition m_frameDequeued;
+    QWaitCondition m_taskDone;
+    QQueue<QByteArray> m_frames;
+    QDir m_imageDir;
     QSize m_size;
     QString m_title;
-    QString m_inputPath;
     QString m_outputPath;
-    QString m_inputImageFormat;
-    QString m_outputFormat;
+    QString m_encoderPath;
+    QString m_encoderArguments;
+    GLuint m_pixelBuffers[kMaxPixelPackBuffers];
     quint64 m_estimatedFrameCount;
+    quint64 m_numReadFrames;
+    GLsizeiptr m_pixelBufferSize;
+    bool m_running;
+    bool m_finished;
+    bool m_cancelled;
+    bool m_imageWriteFailed;
 };
 
 RenderTarget::RenderTarget(QQuickItem *parent)
@@ -644,6 +888,32 @@ void RenderTarget::setVisibleGizmoMasks(VisibleGizmoMasks value)
     }
 }
 
+QString RenderTarget::videoEncoderPath() const
+{
+    return m_videoEncoderPath;
+}
+
+void RenderTarget::setVideoEncoderPath(const QString &value)
+{
+    if (value != m_videoEncoderPath) {
+        m_videoEncoderPath = value;
+        emit videoEncoderPathChanged();
+    }
+}
+
+QString RenderTarget::videoEncoderArguments() const
+{
+    return m_videoEncoderArguments;
+}
+
+void RenderTarget::setVideoEncoderArguments(const QString &value)
+{
+    if (value != m_videoEncoderArguments) {
+        m_videoEncoderArguments = value;
+        emit videoEncoderArgumentsChanged();
+    }
+}
+
 QVector3D RenderTarget::snapGizmoStepSize() const
 {
     return m_snapStepSize;
@@ -708,14 +978,21 @@ void RenderTarget::exportVideo(const QUrl &url)
     m_encodingTask->setSize(m_exportSize);
     m_encodingTask->setTitle(m_projectProxyRef->title());
     m_encodingTask->setOutputPath(url.toLocalFile());
+    m_encodingTask->setEncoderPath(m_videoEncoderPath);
+    m_encodingTask->setEncoderArguments(m_videoEncoderArguments);
+    m_encodingTask->setEstimatedFrameCount(qRound64(m_projectProxyRef->durationTimeIndex()));
+    /* the encoder is started first to receive frames while rendering */
+    m_encodingTask->start();
     connect(window(), &QQuickWindow::beforeRendering, this, &RenderTarget::drawOffscreenForVideo, Qt::DirectConnection);
 }
 
 void RenderTarget::cancelExportVideo()
 {
-    disconnect(window(), &QQuickWindow::beforeRendering, this, &RenderTarget::drawOffscreenForVideo);
-    disconnect(window(), &QQuickWindow::afterRendering, this, &RenderTarget::startEncodingTask);
+    QQuickWindow *win = window();
+    disconnect(win, &QQuickWindow::beforeRendering, this, &RenderTarget::drawOffscreenForVideo);
     m_encodingTask->stop();
+    connect(win, &QQuickWindow::beforeRendering, this, &RenderTarget::releaseVideoFramebuffers, Qt::DirectConnection);
+    m_exportSize = QSize();
     emit encodeDidCancel();
 }
 
@@ -808,15 +1085,14 @@ void RenderTarget::drawOffscreenForVideo()
     drawScene();
     fbo->bindDefault();
     if (qFuzzyIsNull(m_projectProxyRef->differenceTimeIndex(m_currentTimeIndex))) {
-        m_encodingTask->setEstimatedFrameCount(m_currentTimeIndex);
         disconnect(win, &QQuickWindow::beforeRendering, this, &RenderTarget::drawOffscreenForVideo);
-        connect(win, &QQuickWindow::afterRendering, this, &RenderTarget::startEncodingTask);
+        m_encodingTask->finish();
+        m_exportSize = QSize();
     }
     else {
         const qreal &currentTimeIndex = m_currentTimeIndex;
-        const QString &path = m_encodingTask->generateFilename(currentTimeIndex);
+        m_encodingTask->readPixels(fbo);
         setCurrentTimeIndex(currentTimeIndex + 1);
-        fbo->toImage().save(path);
         emit videoFrameDidSave(currentTimeIndex, m_projectProxyRef->durationTimeIndex());
     }
 }
@@ -830,13 +1106,11 @@ void RenderTarget::writeExportedImage()
     m_exportSize = QSize();
 }
 
-void RenderTarget::startEncodingTask()
+void RenderTarget::releaseVideoFramebuffers()
 {
     Q_ASSERT(window());
-    Q_ASSERT(m_projectProxyRef);
-    disconnect(window(), &QQuickWindow::afterRendering, this, &RenderTarget::startEncodingTask);
-    QThreadPool::globalInstance()->start(m_encodingTask.data());
-    m_exportSize = QSize();
+    disconnect(window(), &QQuickWindow::beforeRendering, this, &RenderTarget::releaseVideoFramebuffers);
+    m_encodingTask->releaseFramebuffers();
 }
 
 void RenderTarget::syncExplicit()
@@ -891,6 +1165,8 @@ void RenderTarget::initialize()
 
 void RenderTarget::release()
 {
+    m_encodingTask->stop();
+    m_encodingTask->releaseFramebuffers();
     m_currentGizmoRef = 0;
     m_translationGizmo.reset();
     m_orientationGizmo.reset();
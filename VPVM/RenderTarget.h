@@ -60,7 +60,6 @@ class Grid;
 class QOpenGLFramebufferObject;
 class QOpenGLShaderProgram;
 class QOpenGLVertexArrayObject;
-class QTemporaryDir;
 class ProjectProxy;
 class IGizmo;
 
@@ -86,6 +85,8 @@ class RenderTarget : public QQuickItem
     Q_PROPERTY(ProjectProxy *project READ projectProxy WRITE setProjectProxy FINAL)
     Q_PROPERTY(EditModeType editMode READ editMode WRITE setEditMode NOTIFY editModeChanged FINAL)
     Q_PROPERTY(VisibleGizmoMasks visibleGizmoMasks READ visibleGizmoMasks WRITE setVisibleGizmoMasks NOTIFY visibleGizmoMasksChanged)
+    Q_PROPERTY(QString videoEncoderPath READ videoEncoderPath WRITE setVideoEncoderPath NOTIFY videoEncoderPathChanged FINAL)
+    Q_PROPERTY(QString videoEncoderArguments READ videoEncoderArguments WRITE setVideoEncoderArguments NOTIFY videoEncoderArgumentsChanged FINAL)
 
 public:
     enum EditModeType {
@@ -132,6 +133,10 @@ public:
     void setEditMode(EditModeType value);
     VisibleGizmoMasks visibleGizmoMasks() const;
     void setVisibleGizmoMasks(VisibleGizmoMasks value);
+    QString videoEncoderPath() const;
+    void setVideoEncoderPath(const QString &value);
+    QString videoEncoderArguments() const;
+    void setVideoEncoderArguments(const QString &value);
     QVector3D snapGizmoStepSize() const;
     void setSnapGizmoStepSize(const QVector3D &value);
     QVector3D snapOrientationGizmoStepSize() const;
@@ -163,6 +168,8 @@ signals:
     void projectionMatrixChanged();
     void editModeChanged();
     void visibleGizmoMasksChanged();
+    void videoEncoderPathChanged();
+    void videoEncoderArgumentsChanged();
     void modelDidUpload(ModelProxy *model);
     void allModelsDidUpload();
     void allModelsDidDelete();
@@ -182,7 +189,7 @@ private slots:
     void drawOffscreenForImage();
     void drawOffscreenForVideo();
     void writeExportedImage();
-    void startEncodingTask();
+    void releaseVideoFramebuffers();
     void syncExplicit();
     void syncMotionState();
     void syncImplicit();
@@ -226,6 +233,8 @@ private:
     ProjectProxy *m_projectProxyRef;
     IGizmo *m_currentGizmoRef;
     QColor m_screenColor;
+    QString m_videoEncoderPath;
+    QString m_videoEncoderArguments;
     QRect m_viewport;
     QMatrix4x4 m_editMatrix;
     qreal m_lastTimeIndex;
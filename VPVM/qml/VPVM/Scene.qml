@@ -344,6 +344,8 @@ Item {
         }
         project: projectDocument
         viewport: defaultViewportSetting
+        videoEncoderPath: applicationPreference.videoEncoderPath
+        videoEncoderArguments: applicationPreference.videoEncoderArguments
         width: viewport.width
         height: viewport.height
         onCurrentTimeIndexChanged: {
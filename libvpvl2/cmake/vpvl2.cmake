@@ -193,6 +193,13 @@ function(vpvl2_link_zlib target)
   endif()
 endfunction()
 
+function(vpvl2_link_threads target)
+  if(NOT WIN32 AND NOT VPVL2_LINK_INTEL_TBB)
+    find_package(Threads REQUIRED)
+    target_link_libraries(${target} ${CMAKE_THREAD_LIBS_INIT})
+  endif()
+endfunction()
+
 function(vpvl2_find_zlib)
   if(VPVL2_ENABLE_EXTENSIONS_ARCHIVE)
     if(NOT APPLE)
@@ -634,6 +641,26 @@ function(vpvl2_add_egl_renderer)
   endif()
 endfunction()
 
+function(vpvl2_add_batch_renderer)
+  if(VPVL2_BUILD_BATCH_RENDERER)
+    set(vpvl2_batch_sources "render/batch/main.cc")
+    set(VPVL2_EXECUTABLE vpvl2_batch)
+    add_executable(${VPVL2_EXECUTABLE} ${vpvl2_batch_sources})
+    if(VPVL2_ENABLE_OSMESA)
+      find_library(OSMESA_LIBRARY NAMES OSMesa osmesa)
+      target_link_libraries(${VPVL2_EXECUTABLE} ${OSMESA_LIBRARY})
+    elseif(VPVL2_LINK_EGL)
+      find_path(EGL_INCLUDE_DIR NAMES EGL/egl.h)
+      find_library(EGL_LIBRARY NAMES EGL)
+      include_directories(${EGL_INCLUDE_DIR})
+      target_link_libraries(${VPVL2_EXECUTABLE} ${EGL_LIBRARY})
+    else()
+      message(FATAL_ERROR "VPVL2_BUILD_BATCH_RENDERER requires VPVL2_ENABLE_OSMESA or VPVL2_LINK_EGL")
+    endif()
+    vpvl2_create_executable(${VPVL2_EXECUTABLE})
+  endif()
+endfunction()
+
 function(vpvl2_find_all)
   vpvl2_find_vpvl()
   vpvl2_find_nvfx()
@@ -670,6 +697,7 @@ function(vpvl2_link_all target)
   vpvl2_link_icu(${target})
   vpvl2_link_glog(${target})
   vpvl2_link_zlib(${target})
+  vpvl2_link_threads(${target})
   vpvl2_link_cg_runtime(${target})
   vpvl2_link_cl_runtime(${target})
   vpvl2_link_gl_runtime(${target})
@@ -100,6 +100,11 @@ public:
         kProfileRenderZPlotProcess,
         kProfileRenderZPlotMaterialDrawCall,
         kProfileUpdateModelProcess,
+        kProfileSeekMotionProcess,
+        kProfileUpdateMorphProcess,
+        kProfileSolveInverseKinematicsProcess,
+        kProfileStepPhysicsProcess,
+        kProfileSkinningModelProcess,
         kMaxProfileType
     };
     enum MatrixTypeFlags {
@@ -260,6 +265,8 @@ public:
      * プロファイルのセッションを開始します.
      *
      * arg の値は type の値によって変化します。タイマーを使ってベンチマークを行う実装を想定しています。
+     * kProfileSeekMotionProcess 以降の種類はアプリケーションコンテキストを経由せずに
+     * internal::Profiler に直接記録されるため、このメソッドには渡されません。
      *
      * @brief startProfileSession
      * @param type
@@ -95,6 +95,8 @@ public:
                             Vector3 &aabbMax) const = 0;
         virtual void setParallelUpdateEnable(bool value) = 0;
         virtual void setSkinningEnable(bool value) = 0;
+        /* 直前の update でスキニングされた材質の頂点 (輪郭線の頂点を含む) の AABB を返します。CPU でスキニングしていない場合は false を返します */
+        virtual bool getMaterialAabb(int materialIndex, Vector3 &aabbMin, Vector3 &aabbMax) const = 0;
     };
     struct StaticVertexBuffer : Buffer {
         virtual void update(void *address) const = 0;
@@ -115,6 +117,13 @@ public:
         virtual void update(void *address) = 0;
         virtual const float *bytes(int materialIndex) const = 0;
         virtual vsize size(int materialIndex) const = 0;
+        /* 材質はボーン行列のパレットが上限に収まるようにサブメッシュに分割されます */
+        virtual int countSubMeshes(int materialIndex) const = 0;
+        virtual void getSubMeshRange(int materialIndex, int subMeshIndex, int &offset, int &count) const = 0;
+        virtual const float *subMeshBytes(int materialIndex, int subMeshIndex) const = 0;
+        virtual vsize subMeshSize(int materialIndex, int subMeshIndex) const = 0;
+        /* StaticVertexBuffer#update で書き込まれたボーンのインデックスをパレット上のインデックスに置き換えます */
+        virtual void mapBoneIndices(void *address, const StaticVertexBuffer *staticBuffer) const = 0;
     };
     class PropertyEventListener {
     public:
@@ -53,7 +53,8 @@ class VPVL2_API IRenderEngine
 public:
     enum UpdateOptionFlags {
         kNone = 0,
-        kParallelUpdate = 1
+        kParallelUpdate = 1,
+        kSortOpaqueMaterials = 2
     };
 
     virtual ~IRenderEngine() {}
@@ -120,6 +121,9 @@ public:
     /**
      * IRenderEngien#update におけるオプションを設定します.
      *
+     * kSortOpaqueMaterials を指定すると連続する不透明な材質をテクスチャなどの状態順に並び替えて描画します。
+     * 半透明の材質はモデルの描画順序のまま描画されます。対応していないレンダリングエンジンでは無視されます。
+     *
      * @brief setUpdateOptions
      * @param options
      */
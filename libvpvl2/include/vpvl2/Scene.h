@@ -58,6 +58,15 @@ class IApplicationContext;
 class IRenderEngine;
 class IShadowMap;
 
+namespace extensions
+{
+class World;
+}
+namespace internal
+{
+class CullingContext;
+}
+
 class VPVL2_API Scene
 {
 public:
@@ -73,14 +82,21 @@ public:
         kMaxRenderEngineTypeFlags = 0x2
     };
     enum UpdateTypeFlags {
-        kUpdateModels         = 0x1,
-        kUpdateRenderEngines  = 0x2,
-        kUpdateCamera         = 0x4,
-        kUpdateLight          = 0x8,
-        kUpdateAll            = kUpdateModels | kUpdateRenderEngines | kUpdateCamera | kUpdateLight,
-        kResetMotionState     = 0x10,
-        kForceUpdateAllMorphs = 0x20,
-        kMaxUpdateTypeFlags   = 0x40
+        kUpdateModels          = 0x1,
+        kUpdateRenderEngines   = 0x2,
+        kUpdateCamera          = 0x4,
+        kUpdateLight           = 0x8,
+        kUpdateAll             = kUpdateModels | kUpdateRenderEngines | kUpdateCamera | kUpdateLight,
+        kResetMotionState      = 0x10,
+        kForceUpdateAllMorphs  = 0x20,
+        kParallelUpdateModels  = 0x40,
+        kResetDirtyMotionState = 0x80,
+        kMaxUpdateTypeFlags    = 0x100
+    };
+    enum CullingTypeFlags {
+        kFrustumCulling      = 0x1,
+        kOcclusionCulling    = 0x2,
+        kMaxCullingTypeFlags = 0x4
     };
     struct Deleter {
         void operator()(IModel *model) const {
@@ -369,6 +385,7 @@ public:
      * :kUpdateCamera|カメラモーション
      * :kUpdateLight|照明のモーション
      * :kUpdateAll|上記すべて
+     * :kParallelUpdateModels|モデル毎のモーションを並列に適用 (kUpdateModels と併用)
      *
      * @brief advance
      * @param delta
@@ -385,6 +402,7 @@ public:
      * :kUpdateCamera|カメラモーション
      * :kUpdateLight|照明のモーション
      * :kUpdateAll|上記すべて
+     * :kParallelUpdateModels|モデル毎のモーションを並列に適用 (kUpdateModels と併用)
      *
      * @brief seek
      * @param timeIndex
@@ -410,6 +428,17 @@ public:
      * :kUpdateCamera|カメラモーション
      * :kUpdateRenderEngine|レンダリングエンジン
      * :kUpdateAll|上記すべて
+     * :kParallelUpdateModels|モデル毎の更新を並列に実行 (kUpdateModels と併用)
+     * :kResetMotionState|全てのモデルの剛体の状態を初期化
+     * :kResetDirtyMotionState|状態が変更されたモデルの剛体の状態のみ初期化
+     *
+     * kParallelUpdateModels を指定した場合、各モデルのモーフ及びボーンの更新はモデル単位で並列に実行され、
+     * 物理演算との同期 (kResetMotionState) 及びレンダリングエンジンの更新の前に全て完了します。
+     *
+     * kResetDirtyMotionState で剛体の状態が初期化されるのは前回の初期化以降に追加されたモデル、seek でモーションが
+     * 適用されたモデル及び物理演算の有効無効状態が変更されたモデルのみです。joinWorld やボーンの編集など
+     * Scene の外で行われた変更は検出されないため、その場合は kResetMotionState を指定してください。
+     * 両方指定された場合は kResetMotionState が優先されます。
      *
      * @brief update
      * @param flags
@@ -596,12 +625,99 @@ public:
      * 物理世界が新しく設定された場合は全てのモデルにその物理世界に対して追加されます。
      * すでに物理世界が設定されていて新たに設定される場合は全てのモデルから前の物理世界の参照を削除し、
      * 新たに設定される物理世界の参照に設定するように変更されます。
+     * setPhysicsWorldRef で設定された World は解除されます。
      *
      * @brief setWorldRef
      * @param worldRef
      */
     void setWorldRef(btDiscreteDynamicsWorld *worldRef);
 
+    /**
+     * 物理世界の拡張クラス (extensions::World) のインスタンスの参照を設定します.
+     *
+     * 設定すると全てのモデルが World#addModel によって World に追加され、以後 addModel/removeModel で
+     * 追加または削除されるモデルも同様に World に対して追加または削除されます。
+     * kResetMotionState を含む update の呼び出し時は全てのアイランドが初期化され、kResetDirtyMotionState を含む
+     * 場合は状態が変更されたモデルを含むアイランドのみ初期化されます。
+     * setWorldRef で設定された物理世界は解除されます。0 を設定すると全てのモデルを World から削除します。
+     *
+     * VPVL2_ENABLE_EXTENSIONS_WORLD が無効の場合は何もしません。
+     *
+     * @brief setPhysicsWorldRef
+     * @param worldRef
+     */
+    void setPhysicsWorldRef(extensions::World *worldRef);
+
+    /**
+     * 物理演算結果のキャッシュが有効かを返します.
+     *
+     * @brief isPhysicsCacheEnabled
+     * @return
+     */
+    bool isPhysicsCacheEnabled() const;
+
+    /**
+     * 物理演算結果のキャッシュを有効にするかを設定します.
+     *
+     * 有効にすると kResetMotionState 及び kResetDirtyMotionState を含まない update の呼び出し時に PMX モデルの剛体の
+     * 姿勢をフレーム単位で記録し、いずれかを含む update の呼び出し時 (seek 後) は記録済みのフレームであれば物理演算を再実行せずに
+     * 記録された姿勢を復元します。無効にした場合は記録されたキャッシュを全て破棄します。
+     *
+     * @brief setPhysicsCacheEnable
+     * @param value
+     */
+    void setPhysicsCacheEnable(bool value);
+
+    /**
+     * model の timeIndex 以降の物理演算結果のキャッシュを破棄します.
+     *
+     * モーションのキーフレームを編集した場合に呼び出してください。model が NULL の場合は全てのモデルが対象になります。
+     * モデルのモーションが追加または削除された場合はそのモデルのキャッシュが自動的に破棄されます。
+     *
+     * @brief invalidatePhysicsCache
+     * @param model
+     * @param timeIndex
+     */
+    void invalidatePhysicsCache(const IModel *model, const IKeyframe::TimeIndex &timeIndex);
+
+    /**
+     * 材質単位の CPU による可視判定の種類を返します.
+     *
+     * @brief cullingFlags
+     * @return
+     */
+    int cullingFlags() const;
+
+    /**
+     * 材質単位の CPU による可視判定の種類を CullingTypeFlags の組み合わせで設定します.
+     *
+     * kFrustumCulling は初期状態で有効で、スキニング済みの頂点から求めた材質の AABB が各パスの視錐台の外にある場合に
+     * その材質の描画を省略します。kOcclusionCulling を有効にすると先に描画された不透明で大きな材質を低解像度の深度バッファに
+     * 書き込み、その背後に隠れる材質の描画を省略します。いずれも頂点シェーダまたは OpenCL でスキニングする場合は無効です。
+     *
+     * @brief setCullingFlags
+     * @param value
+     */
+    void setCullingFlags(int value);
+
+    /**
+     * 前回の update 以降に描画または可視判定で省略された材質単位の描画命令の数を返します.
+     *
+     * @brief getDrawCallCounts
+     * @param ndrawCalls
+     * @param nfrustumCulled
+     * @param nocclusionCulled
+     */
+    void getDrawCallCounts(int &ndrawCalls, int &nfrustumCulled, int &nocclusionCulled) const;
+
+    /**
+     * レンダリングエンジンが共有する可視判定のコンテキストの参照を返します.
+     *
+     * @brief cullingContextRef
+     * @return
+     */
+    internal::CullingContext *cullingContextRef() const;
+
 private:
     struct PrivateContext;
     PrivateContext *m_context;
@@ -70,11 +70,40 @@ public:
     explicit Archive(IEncoding *encoding);
     ~Archive();
 
+    /**
+     * Builds an index of the central directory without decoding entry names.
+     * Names are decoded lazily when an entry is looked up by name.
+     */
+    bool open(const IString *filename);
     bool open(const IString *filename, EntryNames &entries);
     bool close();
     bool uncompress(const EntrySet &entries);
     bool uncompressEntry(const UnicodeString &name);
+    /**
+     * Entries can be accessed by index from 0 to countEntries() - 1. Only the name of the given
+     * entry is decoded, so iterating with entryEndsWith doesn't decode names of other entries.
+     * entryEndsWith compares ASCII letters case insensitive like lookups by name.
+     */
+    bool uncompressEntry(int index);
+    int countEntries() const;
+    UnicodeString entryName(int index) const;
+    bool entryEndsWith(int index, const UnicodeString &suffix) const;
+    /**
+     * Inflates the entry into the caller provided buffer without caching it.
+     * The buffer must be at least the size returned by getEntrySize.
+     */
+    bool getEntrySize(const UnicodeString &name, vsize &size) const;
+    bool readEntry(const UnicodeString &name, uint8 *buffer, vsize size);
+    bool readEntry(const UnicodeString &name, std::string &buffer);
     void setBasePath(const UnicodeString &value);
+    /**
+     * Limits total bytes of uncompressed entries kept by uncompress and uncompressEntry.
+     * Least recently used entries are evicted and pointers from dataRef of them become invalid.
+     * Zero (default) means unlimited.
+     */
+    vsize maxCacheSize() const;
+    vsize cacheSize() const;
+    void setMaxCacheSize(vsize value);
     Archive::ErrorType error() const;
     const EntryNames entryNames() const;
     const std::string *dataRef(const UnicodeString &name) const;
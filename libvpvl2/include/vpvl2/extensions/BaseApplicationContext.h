@@ -43,6 +43,7 @@
 #include <vpvl2/IApplicationContext.h>
 #include <vpvl2/IEffect.h>
 #include <vpvl2/Scene.h>
+#include <vpvl2/extensions/TextureCache.h>
 #include <vpvl2/extensions/gl/FrameBufferObject.h>
 #include <vpvl2/extensions/icu4c/Encoding.h>
 
@@ -169,6 +170,10 @@ public:
         bool uploadTextureCached(const uint8 *data, vsize size, const UnicodeString &key, TextureDataBridge &bridge);
         bool cacheTexture(const UnicodeString &key, ITexture *textureRef, TextureDataBridge &bridge);
         int countCachedTextures() const;
+        static TextureCache::Key createSharedTextureKey(const uint8 *data, vsize size, const TextureDataBridge &bridge);
+        bool findSharedTexture(const UnicodeString &path, TextureDataBridge &bridge);
+        bool findSharedTexture(const TextureCache::Key &contentKey, const UnicodeString &key, const UnicodeString &path, TextureDataBridge &bridge);
+        bool shareTexture(const TextureCache::Key &contentKey, const UnicodeString &key, const UnicodeString &path, TextureDataBridge &bridge);
         ITexture *uploadTexture(const void *ptr, const extensions::gl::BaseSurface::Format &format, const Vector3 &size, bool mipmap, bool canOptimize) const;
         ITexture *uploadTexture(const uint8 *data, vsize size, bool mipmap);
         Archive *archiveRef() const;
@@ -176,9 +181,12 @@ public:
     private:
         typedef std::map<UnicodeString, ITexture *, icu4c::String::Less> TextureCacheMap;
         void generateMipmap(GLenum target) const;
+        ITexture *createTexture(const uint8 *data, vsize size, const TextureDataBridge &bridge);
+        static int sharedTextureFlags(const TextureDataBridge &bridge);
         const IString *m_directoryRef;
         Archive *m_archiveRef;
         BaseApplicationContext *m_applicationContextRef;
+        TextureCache *m_textureCacheRef;
         TextureCacheMap m_textureRefCache;
     };
 
@@ -276,6 +284,11 @@ public:
     void updateCameraMatrices(const glm::vec2 &size);
     void createShadowMap(const Vector3 &size);
     void renderShadowMap();
+    TextureCache *textureCacheRef();
+    int uploadDecodedTextures(int64 budget);
+    void waitForDecodedTextures();
+    int countPendingTextures() const;
+    bool saveProfileTrace(const UnicodeString &path);
 
     virtual bool mapFile(const UnicodeString &path, MapBuffer *bufferRef) const = 0;
     virtual bool unmapFile(MapBuffer *bufferRef) const = 0;
@@ -285,7 +298,10 @@ protected:
     static const UnicodeString createPath(const IString *directoryRef, const UnicodeString &name);
     static const UnicodeString createPath(const IString *directoryRef, const IString *name);
     bool uploadSystemToonTexture(const UnicodeString &name, TextureDataBridge &bridge, ModelContext *context);
+    bool loadToonColor(const IString *name, const ModelContext *context, Color &value) const;
     bool uploadTextureCached(const UnicodeString &name, const UnicodeString &path, TextureDataBridge &bridge, ModelContext *context);
+    bool uploadTextureShared(const UnicodeString &path, bool opaque, TextureDataBridge &bridge, ModelContext *context);
+    bool uploadTextureShared(const uint8 *data, vsize size, const UnicodeString &key, bool opaque, TextureDataBridge &bridge, ModelContext *context);
     UnicodeString toonDirectory() const;
     UnicodeString shaderDirectory() const;
     UnicodeString effectDirectory() const;
@@ -310,6 +326,7 @@ protected:
     GLuint m_textureSampler;
     GLuint m_toonTextureSampler;
     std::set<std::string> m_extensions;
+    TextureCache m_textureCache;
 #if defined(VPVL2_ENABLE_NVIDIA_CG) || defined(VPVL2_LINK_NVFX)
     typedef PointerHash<HashPtr, extensions::gl::FrameBufferObject> RenderTargetMap;
     typedef PointerHash<HashString, IEffect> Path2EffectMap;
@@ -343,6 +360,12 @@ private:
                                      GLsizei length, const GLchar *message, GLvoid *userData);
     void release();
 
+    class TextureLoader;
+    class ProfileTimer;
+    TextureLoader *textureLoaderRef();
+    TextureLoader *m_textureLoader;
+    ProfileTimer *m_profileTimer;
+
     VPVL2_DISABLE_COPY_AND_ASSIGN(BaseApplicationContext)
 };
 
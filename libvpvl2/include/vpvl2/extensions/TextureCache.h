@@ -0,0 +1,357 @@
+/**
+
+ Copyright (c) 2010-2013  hkrn
+
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or
+ without modification, are permitted provided that the following
+ conditions are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+ - Redistributions in binary form must reproduce the above
+   copyright notice, this list of conditions and the following
+   disclaimer in the documentation and/or other materials provided
+   with the distribution.
+ - Neither the name of the MMDAI project team nor the names of
+   its contributors may be used to endorse or promote products
+   derived from this software without specific prior written
+   permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#pragma once
+#ifndef VPVL2_EXTENSIONS_TEXTURECACHE_H_
+#define VPVL2_EXTENSIONS_TEXTURECACHE_H_
+
+#include <vpvl2/ITexture.h>
+
+/* STL */
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace vpvl2
+{
+namespace extensions
+{
+
+/**
+ * Texture cache shared across model contexts.
+ *
+ * Textures are keyed by a hash of the encoded image bytes (plus upload flags) and
+ * optionally by the resolved path as a fast path. Every user gets its own SharedTexture
+ * proxy; deleting the proxy drops the reference. Unreferenced textures stay resident
+ * until the memory budget is exceeded and are evicted in least-recently-used order.
+ *
+ * Textures are GL objects, so the cache must be used from the thread owning the context.
+ */
+class TextureCache {
+public:
+    static const vsize kDefaultBudget = 256 * 1024 * 1024;
+
+    struct Key {
+        Key()
+            : hash(0),
+              size(0),
+              flags(0)
+        {
+        }
+        Key(uint64 h, vsize s, int f)
+            : hash(h),
+              size(s),
+              flags(f)
+        {
+        }
+        bool operator<(const Key &other) const {
+            if (hash != other.hash) {
+                return hash < other.hash;
+            }
+            if (size != other.size) {
+                return size < other.size;
+            }
+            return flags < other.flags;
+        }
+        uint64 hash;
+        vsize size;
+        int flags;
+    };
+    class SharedTexture;
+
+    static uint64 hashBytes(const uint8 *data, vsize size) {
+        /* 64bit FNV-1a */
+        uint64 hash = 14695981039346656037ULL;
+        for (vsize i = 0; i < size; i++) {
+            hash ^= data[i];
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+    static Key createKey(const uint8 *data, vsize size, int flags) {
+        return Key(hashBytes(data, size), size, flags);
+    }
+    static vsize estimateBytes(const Vector3 &size, bool mipmap) {
+        /* all textures uploaded by BaseApplicationContext are RGBA8 */
+        vsize bytes = vsize(size.x()) * vsize(size.y()) * vsize(btMax(size.z(), Scalar(1))) * 4;
+        return mipmap ? bytes + bytes / 3 : bytes;
+    }
+
+    explicit TextureCache(vsize budget = kDefaultBudget)
+        : m_budget(budget),
+          m_totalBytes(0),
+          m_nhits(0),
+          m_nmisses(0),
+          m_nevictions(0)
+    {
+    }
+    ~TextureCache() {
+        purge();
+        /* referenced textures are deleted by the last SharedTexture instead */
+        for (EntryMap::const_iterator it = m_entries.begin(); it != m_entries.end(); ++it) {
+            it->second->cacheRef = 0;
+        }
+        m_entries.clear();
+        m_paths.clear();
+        m_textures.clear();
+    }
+
+    /**
+     * Returns a new reference to the texture cached with the path or null if not found.
+     */
+    SharedTexture *find(const std::string &path, int flags) {
+        PathMap::const_iterator it = m_paths.find(PathKey(path, flags));
+        if (it != m_paths.end()) {
+            m_nhits++;
+            return acquire(it->second);
+        }
+        return 0;
+    }
+    /**
+     * Returns a new reference to the texture cached with the content key or null if not found.
+     *
+     * The path is registered as an alias of the found texture when it is not empty.
+     */
+    SharedTexture *find(const Key &key, const std::string &path) {
+        EntryMap::const_iterator it = m_entries.find(key);
+        if (it != m_entries.end()) {
+            Entry *entry = it->second;
+            addPath(entry, path);
+            m_nhits++;
+            return acquire(entry);
+        }
+        m_nmisses++;
+        return 0;
+    }
+    /**
+     * Takes ownership of the texture and returns the first reference to it.
+     *
+     * The texture is deleted immediately if the key is already cached.
+     */
+    SharedTexture *insert(const Key &key, const std::string &path, ITexture *texture, vsize bytes) {
+        if (!texture) {
+            return 0;
+        }
+        EntryMap::const_iterator it = m_entries.find(key);
+        if (it != m_entries.end()) {
+            delete texture;
+            addPath(it->second, path);
+            return acquire(it->second);
+        }
+        Entry *entry = new Entry(this, key, texture, bytes);
+        m_entries.insert(std::make_pair(key, entry));
+        m_textures.insert(std::make_pair(texture, entry));
+        addPath(entry, path);
+        m_totalBytes += bytes;
+        SharedTexture *reference = acquire(entry);
+        evict();
+        return reference;
+    }
+    /**
+     * Updates the bytes charged to the cached texture.
+     *
+     * Asynchronously decoded textures are inserted as placeholders, so the real size is
+     * charged when the decoded image is uploaded. Does nothing if the texture is not cached.
+     */
+    void updateBytes(const ITexture *texture, vsize bytes) {
+        TextureMap::const_iterator it = m_textures.find(texture);
+        if (it != m_textures.end()) {
+            Entry *entry = it->second;
+            m_totalBytes = m_totalBytes - entry->bytes + bytes;
+            entry->bytes = bytes;
+            evict();
+        }
+    }
+    /**
+     * Deletes all textures that are not referenced.
+     */
+    void purge() {
+        while (!m_unused.empty()) {
+            Entry *entry = m_unused.back();
+            m_unused.pop_back();
+            remove(entry);
+        }
+    }
+    void setBudget(vsize value) {
+        m_budget = value;
+        evict();
+    }
+
+    vsize budget() const { return m_budget; }
+    vsize totalBytes() const { return m_totalBytes; }
+    int countTextures() const { return int(m_entries.size()); }
+    int countUnusedTextures() const { return int(m_unused.size()); }
+    int countHits() const { return m_nhits; }
+    int countMisses() const { return m_nmisses; }
+    int countEvictions() const { return m_nevictions; }
+    void resetCounters() {
+        m_nhits = m_nmisses = m_nevictions = 0;
+    }
+
+private:
+    typedef std::pair<std::string, int> PathKey;
+    struct Entry;
+    typedef std::list<Entry *> EntryList;
+    typedef std::map<Key, Entry *> EntryMap;
+    typedef std::map<PathKey, Entry *> PathMap;
+    typedef std::map<const ITexture *, Entry *> TextureMap;
+    struct Entry {
+        Entry(TextureCache *c, const Key &k, ITexture *t, vsize b)
+            : cacheRef(c),
+              key(k),
+              texture(t),
+              bytes(b),
+              nrefs(0),
+              unused(false)
+        {
+        }
+        ~Entry() {
+            delete texture;
+            texture = 0;
+            cacheRef = 0;
+        }
+        TextureCache *cacheRef;
+        Key key;
+        ITexture *texture;
+        vsize bytes;
+        int nrefs;
+        bool unused;
+        EntryList::iterator position;
+        std::vector<std::string> paths;
+    };
+
+    void addPath(Entry *entry, const std::string &path) {
+        if (!path.empty()) {
+            const PathKey key(path, entry->key.flags);
+            if (m_paths.find(key) == m_paths.end()) {
+                m_paths.insert(std::make_pair(key, entry));
+                entry->paths.push_back(path);
+            }
+        }
+    }
+    inline SharedTexture *acquire(Entry *entry);
+    void release(Entry *entry) {
+        if (--entry->nrefs == 0) {
+            entry->unused = true;
+            m_unused.push_front(entry);
+            entry->position = m_unused.begin();
+            evict();
+        }
+    }
+    void evict() {
+        while (m_totalBytes > m_budget && !m_unused.empty()) {
+            Entry *entry = m_unused.back();
+            m_unused.pop_back();
+            remove(entry);
+            m_nevictions++;
+        }
+    }
+    void remove(Entry *entry) {
+        for (std::vector<std::string>::const_iterator it = entry->paths.begin(); it != entry->paths.end(); ++it) {
+            m_paths.erase(PathKey(*it, entry->key.flags));
+        }
+        m_entries.erase(entry->key);
+        m_textures.erase(entry->texture);
+        m_totalBytes -= entry->bytes;
+        delete entry;
+    }
+
+    EntryMap m_entries;
+    PathMap m_paths;
+    TextureMap m_textures;
+    EntryList m_unused;
+    vsize m_budget;
+    vsize m_totalBytes;
+    int m_nhits;
+    int m_nmisses;
+    int m_nevictions;
+
+    VPVL2_DISABLE_COPY_AND_ASSIGN(TextureCache)
+};
+
+class TextureCache::SharedTexture : public ITexture {
+public:
+    ~SharedTexture() {
+        if (TextureCache *cacheRef = m_entryRef->cacheRef) {
+            cacheRef->release(m_entryRef);
+        }
+        else if (--m_entryRef->nrefs == 0) {
+            delete m_entryRef;
+        }
+        m_entryRef = 0;
+    }
+
+    void create() {}
+    void bind() { m_entryRef->texture->bind(); }
+    void resize(const Vector3 & /* size */) {}
+    void unbind() { m_entryRef->texture->unbind(); }
+    /* the shared texture is released by TextureCache */
+    void release() {}
+    Vector3 size() const { return m_entryRef->texture->size(); }
+    intptr_t data() const { return m_entryRef->texture->data(); }
+    intptr_t sampler() const { return m_entryRef->texture->sampler(); }
+    intptr_t format() const { return m_entryRef->texture->format(); }
+
+    const ITexture *textureRef() const { return m_entryRef->texture; }
+
+private:
+    explicit SharedTexture(Entry *entryRef)
+        : m_entryRef(entryRef)
+    {
+    }
+
+    Entry *m_entryRef;
+
+    friend class TextureCache;
+    VPVL2_DISABLE_COPY_AND_ASSIGN(SharedTexture)
+};
+
+inline TextureCache::SharedTexture *TextureCache::acquire(Entry *entry)
+{
+    if (entry->unused) {
+        m_unused.erase(entry->position);
+        entry->unused = false;
+    }
+    entry->nrefs++;
+    return new SharedTexture(entry);
+}
+
+} /* namespace extensions */
+} /* namespace vpvl2 */
+
+#endif
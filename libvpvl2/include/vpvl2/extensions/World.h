@@ -54,12 +54,35 @@ namespace extensions
 class VPVL2_API World {
 public:
     static const int kDefaultMaxSubSteps;
+    static const int kDefaultNumSolverIterations;
+
+    /**
+     * Parameters fixed at construction time.
+     *
+     * When enableModelIslands is true, each model registered by addModel gets its own
+     * dynamics world (island) and islands are stepped concurrently in stepSimulation.
+     * Rigid bodies in different islands never collide with each other unless their models
+     * are linked by linkModels.
+     *
+     * When enableSleeping is true, dynamic rigid bodies at rest are deactivated by Bullet
+     * and only AABBs of active bodies are updated.
+     */
+    struct Configuration {
+        Configuration();
+        int numSolverIterations;
+        bool enableRandomizeOrder;
+        bool enableModelIslands;
+        bool enableSleeping;
+    };
 
     World();
+    explicit World(const Configuration &configuration);
     ~World();
 
+    const Configuration &configuration() const;
     const Vector3 gravity() const;
     btDiscreteDynamicsWorld *dynamicWorldRef() const;
+    btDiscreteDynamicsWorld *findDynamicWorldRef(const IModel *model) const;
     void setGravity(const Vector3 &value);
     unsigned long randSeed() const;
     Scalar motionFPS() const;
@@ -70,6 +93,23 @@ public:
     void setMaxSubSteps(int value);
     void addRigidBody(btRigidBody *value);
     void removeRigidBody(btRigidBody *value);
+    void addModel(IModel *value);
+    void removeModel(IModel *value);
+    void linkModels(IModel *model1, IModel *model2);
+    void unlinkModel(IModel *value);
+    bool isLinked(const IModel *model1, const IModel *model2) const;
+    int countIslands() const;
+    /**
+     * Resets motion states of all models registered by addModel and broadphases of each
+     * world.
+     */
+    void resetMotionState();
+    /**
+     * Resets motion states of the given models only. Islands containing one of them are
+     * reset entirely and the others are kept as they are. Scene calls this on
+     * Scene::kResetDirtyMotionState with models seeked or added since the last reset.
+     */
+    void resetMotionState(const Array<IModel *> &models);
     void stepSimulation(const Scalar &delta);
 
 private:
@@ -96,6 +96,19 @@ public:
               target(g)
         {
         }
+        /* the format is known only after loading, so formats with alpha channel are treated as translucent */
+        bool isOpaque() const {
+            switch (internal) {
+            case GL_RGB:
+            case GL_RGB8:
+#ifdef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+            case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+#endif
+                return true;
+            default:
+                return false;
+            }
+        }
         GLenum external;
         GLenum internal;
         GLenum type;
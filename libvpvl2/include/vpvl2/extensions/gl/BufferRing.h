@@ -0,0 +1,152 @@
+/**
+
+ Copyright (c) 2010-2013  hkrn
+
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or
+ without modification, are permitted provided that the following
+ conditions are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+ - Redistributions in binary form must reproduce the above
+   copyright notice, this list of conditions and the following
+   disclaimer in the documentation and/or other materials provided
+   with the distribution.
+ - Neither the name of the MMDAI project team nor the names of
+   its contributors may be used to endorse or promote products
+   derived from this software without specific prior written
+   permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#pragma once
+#ifndef VPVL2_EXTENSIONS_GL_BUFFERRING_H_
+#define VPVL2_EXTENSIONS_GL_BUFFERRING_H_
+
+#include <vpvl2/Common.h>
+
+namespace vpvl2
+{
+namespace extensions
+{
+namespace gl
+{
+
+/**
+ * Bookkeeping of slots of a streamed buffer written by the CPU and read by the GPU.
+ *
+ * acquire() returns the slot to write next and waits the fence of the slot if the GPU
+ * may still read it. commit() makes the written slot current to draw. The fence of the
+ * current slot is placed at the next acquire(), after all draw calls of the frame are issued.
+ * Without a delegate no fence is used, which is for buffers synchronized by the driver.
+ *
+ * This class does not call the API directly, see StreamingVertexBuffer.
+ */
+class BufferRing {
+public:
+    typedef intptr_t Fence;
+    class Delegate {
+    public:
+        virtual ~Delegate() {}
+        virtual Fence createFence() = 0;
+        virtual bool isFenceSignaled(Fence fence) = 0;
+        virtual void waitFence(Fence fence) = 0;
+        virtual void deleteFence(Fence fence) = 0;
+    };
+    static const int kMaxSlots = 4;
+
+    BufferRing()
+        : m_delegateRef(0),
+          m_nslots(0),
+          m_writingSlot(-1),
+          m_currentSlot(-1),
+          m_nstalls(0)
+    {
+        for (int i = 0; i < kMaxSlots; i++) {
+            m_fences[i] = 0;
+        }
+    }
+    ~BufferRing() {
+        release();
+    }
+
+    void reset(int nslots, Delegate *delegate) {
+        release();
+        m_delegateRef = delegate;
+        m_nslots = btClamped(nslots, 1, int(kMaxSlots));
+    }
+    void release() {
+        for (int i = 0; i < kMaxSlots; i++) {
+            if (m_fences[i] && m_delegateRef) {
+                m_delegateRef->deleteFence(m_fences[i]);
+            }
+            m_fences[i] = 0;
+        }
+        m_delegateRef = 0;
+        m_nslots = 0;
+        m_writingSlot = m_currentSlot = -1;
+        m_nstalls = 0;
+    }
+    int acquire() {
+        if (m_nslots == 0) {
+            return -1;
+        }
+        if (m_delegateRef && m_currentSlot >= 0 && !m_fences[m_currentSlot]) {
+            m_fences[m_currentSlot] = m_delegateRef->createFence();
+        }
+        const int slot = (m_writingSlot + 1) % m_nslots;
+        if (Fence fence = m_fences[slot]) {
+            if (!m_delegateRef->isFenceSignaled(fence)) {
+                m_delegateRef->waitFence(fence);
+                m_nstalls++;
+            }
+            m_delegateRef->deleteFence(fence);
+            m_fences[slot] = 0;
+        }
+        m_writingSlot = slot;
+        return slot;
+    }
+    void commit() {
+        m_currentSlot = m_writingSlot;
+    }
+
+    int countSlots() const { return m_nslots; }
+    int countStalls() const { return m_nstalls; }
+    int writingSlot() const { return m_writingSlot; }
+    int currentSlot() const { return m_currentSlot; }
+    bool hasFence(int slot) const {
+        return slot >= 0 && slot < m_nslots && m_fences[slot] != 0;
+    }
+
+private:
+    Delegate *m_delegateRef;
+    Fence m_fences[kMaxSlots];
+    int m_nslots;
+    int m_writingSlot;
+    int m_currentSlot;
+    int m_nstalls;
+
+    VPVL2_DISABLE_COPY_AND_ASSIGN(BufferRing)
+};
+
+} /* namespace gl */
+} /* namespace extensions */
+} /* namespace vpvl2 */
+
+#endif
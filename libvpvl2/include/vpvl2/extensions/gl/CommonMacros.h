@@ -205,4 +205,9 @@
 
 #endif
 
+/* persistently mapped buffers need both of GL_ARB_buffer_storage and GL_ARB_sync */
+#if defined(GL_ARB_buffer_storage) && defined(GL_ARB_sync) && (defined(VPVL2_LINK_GLEW) || defined(GL_GLEXT_PROTOTYPES))
+#define VPVL2_GL_BUFFER_STORAGE_AVAILABLE
+#endif /* GL_ARB_buffer_storage */
+
 #endif
@@ -0,0 +1,311 @@
+/**
+
+ Copyright (c) 2010-2013  hkrn
+
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or
+ without modification, are permitted provided that the following
+ conditions are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+ - Redistributions in binary form must reproduce the above
+   copyright notice, this list of conditions and the following
+   disclaimer in the documentation and/or other materials provided
+   with the distribution.
+ - Neither the name of the MMDAI project team nor the names of
+   its contributors may be used to endorse or promote products
+   derived from this software without specific prior written
+   permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#pragma once
+#ifndef VPVL2_EXTENSIONS_GL_STREAMINGVERTEXBUFFER_H_
+#define VPVL2_EXTENSIONS_GL_STREAMINGVERTEXBUFFER_H_
+
+#include <vpvl2/Common.h>
+#include <vpvl2/extensions/gl/BufferRing.h>
+#include <vpvl2/extensions/gl/CommonMacros.h>
+
+#include <string.h> /* strstr */
+
+namespace vpvl2
+{
+namespace extensions
+{
+namespace gl
+{
+
+/**
+ * Vertex buffer rewritten by the CPU every frame.
+ *
+ * With GL_ARB_buffer_storage, all slots are placed in one buffer that is persistently and
+ * coherently mapped, and each slot is guarded by a fence. The address returned by map()
+ * is written directly without mapping the buffer again. Otherwise each slot is a separate
+ * buffer orphaned at map(), or written with glBufferSubData if mapping is not available.
+ *
+ * Draw calls must use slotName() and slotOffset() of currentSlot().
+ */
+class StreamingVertexBuffer : private BufferRing::Delegate {
+public:
+    enum Strategy {
+        kPersistentMapping,
+        kOrphaning,
+        kSubData,
+        kMaxStrategy
+    };
+    static const int kMaxSlots = BufferRing::kMaxSlots;
+
+    static bool isPersistentMappingSupported() {
+#if defined(VPVL2_GL_BUFFER_STORAGE_AVAILABLE)
+#if defined(VPVL2_LINK_GLEW)
+        return GLEW_ARB_buffer_storage && GLEW_ARB_sync;
+#else
+        const char *extensions = reinterpret_cast<const char *>(glGetString(GL_EXTENSIONS));
+        return extensions && strstr(extensions, "GL_ARB_buffer_storage") && strstr(extensions, "GL_ARB_sync");
+#endif
+#else
+        return false;
+#endif
+    }
+
+    StreamingVertexBuffer()
+        : m_strategy(kMaxStrategy),
+          m_address(0),
+          m_size(0)
+    {
+        for (int i = 0; i < kMaxSlots; i++) {
+            m_names[i] = 0;
+        }
+    }
+    ~StreamingVertexBuffer() {
+        release();
+    }
+
+    /**
+     * Creates slots of the buffer.
+     *
+     * The number of slots is 3 with persistent mapping (the GPU may read two previous
+     * frames while the CPU writes) and 2 otherwise unless nslots is positive.
+     * Persistent mapping is not used if allowPersistentMapping is false (e.g. the buffer
+     * is shared with OpenCL and must be a separate buffer for each slot).
+     *
+     * @brief create
+     * @param size
+     * @param nslots
+     * @param allowPersistentMapping
+     */
+    void create(vsize size, int nslots, bool allowPersistentMapping) {
+        release();
+        m_size = size;
+#if defined(VPVL2_GL_BUFFER_STORAGE_AVAILABLE)
+        if (allowPersistentMapping && isPersistentMappingSupported()) {
+            const int n = btClamped(nslots > 0 ? nslots : 3, 1, int(kMaxSlots));
+            const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            GLuint name = 0;
+            glGenBuffers(1, &name);
+            glBindBuffer(GL_ARRAY_BUFFER, name);
+            glBufferStorage(GL_ARRAY_BUFFER, size * n, 0, flags);
+            void *address = glMapBufferRange(GL_ARRAY_BUFFER, 0, size * n, flags);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            if (address) {
+                for (int i = 0; i < n; i++) {
+                    m_names[i] = name;
+                }
+                m_address = static_cast<uint8_t *>(address);
+                m_strategy = kPersistentMapping;
+                m_ring.reset(n, this);
+                return;
+            }
+            glDeleteBuffers(1, &name);
+        }
+#else
+        (void) allowPersistentMapping;
+#endif
+        const int n = btClamped(nslots > 0 ? nslots : 2, 1, int(kMaxSlots));
+        glGenBuffers(n, m_names);
+        for (int i = 0; i < n; i++) {
+            glBindBuffer(GL_ARRAY_BUFFER, m_names[i]);
+            glBufferData(GL_ARRAY_BUFFER, size, 0, GL_DYNAMIC_DRAW);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+#if defined(VPVL2_ENABLE_GLES2) && !defined(GL_CHROMIUM_map_sub)
+        m_strategy = kSubData;
+#else
+        m_strategy = kOrphaning;
+#endif
+        m_ring.reset(n, 0);
+    }
+    void release() {
+        const int nslots = m_ring.countSlots();
+        m_ring.release();
+        if (m_strategy == kPersistentMapping) {
+            glBindBuffer(GL_ARRAY_BUFFER, m_names[0]);
+            glUnmapBuffer(GL_ARRAY_BUFFER);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            glDeleteBuffers(1, &m_names[0]);
+        }
+        else if (nslots > 0) {
+            glDeleteBuffers(nslots, m_names);
+        }
+        for (int i = 0; i < kMaxSlots; i++) {
+            m_names[i] = 0;
+        }
+        m_strategy = kMaxStrategy;
+        m_address = 0;
+        m_size = 0;
+        m_bytes.clear();
+    }
+
+    /**
+     * Returns the address to write the next slot.
+     *
+     * This may block until the GPU finishes reading the slot. unmap() must be called
+     * with the returned address even if the buffer is persistently mapped.
+     *
+     * @brief map
+     * @return
+     */
+    void *map() {
+        const int slot = m_ring.acquire();
+        if (slot < 0) {
+            return 0;
+        }
+        switch (m_strategy) {
+        case kPersistentMapping:
+            return m_address + slot * m_size;
+        case kOrphaning:
+            glBindBuffer(GL_ARRAY_BUFFER, m_names[slot]);
+#if defined(GL_CHROMIUM_map_sub)
+            return glMapBufferSubDataCHROMIUM(GL_ARRAY_BUFFER, 0, m_size, GL_WRITE_ONLY);
+#elif defined(VPVL2_ENABLE_GLES2)
+            return 0;
+#else
+            if (GLEW_ARB_map_buffer_range) {
+                return glMapBufferRange(GL_ARRAY_BUFFER, 0, m_size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+            }
+            glBufferData(GL_ARRAY_BUFFER, m_size, 0, GL_DYNAMIC_DRAW);
+            return glMapBuffer(GL_ARRAY_BUFFER, GL_WRITE_ONLY);
+#endif
+        case kSubData:
+            m_bytes.resize(int(m_size));
+            return &m_bytes[0];
+        case kMaxStrategy:
+        default:
+            return 0;
+        }
+    }
+    void unmap(void *address) {
+        const int slot = m_ring.writingSlot();
+        switch (m_strategy) {
+        case kPersistentMapping:
+            /* coherent mapping makes writes visible without flushing */
+            (void) address;
+            break;
+        case kOrphaning:
+#if defined(GL_CHROMIUM_map_sub)
+            glUnmapBufferSubDataCHROMIUM(address);
+#else
+            (void) address;
+            glUnmapBuffer(GL_ARRAY_BUFFER);
+#endif
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            break;
+        case kSubData:
+            (void) address;
+            glBindBuffer(GL_ARRAY_BUFFER, m_names[slot]);
+            glBufferSubData(GL_ARRAY_BUFFER, 0, m_size, &m_bytes[0]);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            break;
+        case kMaxStrategy:
+        default:
+            break;
+        }
+        m_ring.commit();
+    }
+
+    void bind(int slot) const {
+        glBindBuffer(GL_ARRAY_BUFFER, slotName(slot));
+    }
+    void unbind() const {
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    Strategy strategy() const { return m_strategy; }
+    int countSlots() const { return m_ring.countSlots(); }
+    int countStalls() const { return m_ring.countStalls(); }
+    int currentSlot() const { return btMax(m_ring.currentSlot(), 0); }
+    int writingSlot() const { return m_ring.writingSlot(); }
+    GLuint slotName(int slot) const {
+        return slot >= 0 && slot < m_ring.countSlots() ? m_names[slot] : 0;
+    }
+    vsize slotOffset(int slot) const {
+        return m_strategy == kPersistentMapping ? slot * m_size : 0;
+    }
+
+private:
+    BufferRing::Fence createFence() {
+#if defined(VPVL2_GL_BUFFER_STORAGE_AVAILABLE)
+        return reinterpret_cast<BufferRing::Fence>(glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+#else
+        return 0;
+#endif
+    }
+    bool isFenceSignaled(BufferRing::Fence fence) {
+#if defined(VPVL2_GL_BUFFER_STORAGE_AVAILABLE)
+        return glClientWaitSync(reinterpret_cast<GLsync>(fence), 0, 0) != GL_TIMEOUT_EXPIRED;
+#else
+        (void) fence;
+        return true;
+#endif
+    }
+    void waitFence(BufferRing::Fence fence) {
+#if defined(VPVL2_GL_BUFFER_STORAGE_AVAILABLE)
+        static const GLuint64 kTimeoutNanoSeconds = 1000000;
+        GLenum result = GL_TIMEOUT_EXPIRED;
+        while (result == GL_TIMEOUT_EXPIRED) {
+            result = glClientWaitSync(reinterpret_cast<GLsync>(fence), GL_SYNC_FLUSH_COMMANDS_BIT, kTimeoutNanoSeconds);
+        }
+#else
+        (void) fence;
+#endif
+    }
+    void deleteFence(BufferRing::Fence fence) {
+#if defined(VPVL2_GL_BUFFER_STORAGE_AVAILABLE)
+        glDeleteSync(reinterpret_cast<GLsync>(fence));
+#else
+        (void) fence;
+#endif
+    }
+
+    BufferRing m_ring;
+    Strategy m_strategy;
+    GLuint m_names[kMaxSlots];
+    uint8_t *m_address;
+    vsize m_size;
+    Array<uint8_t> m_bytes;
+
+    VPVL2_DISABLE_COPY_AND_ASSIGN(StreamingVertexBuffer)
+};
+
+} /* namespace gl */
+} /* namespace extensions */
+} /* namespace vpvl2 */
+
+#endif
@@ -0,0 +1,180 @@
+/**
+
+ Copyright (c) 2010-2013  hkrn
+
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or
+ without modification, are permitted provided that the following
+ conditions are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+ - Redistributions in binary form must reproduce the above
+   copyright notice, this list of conditions and the following
+   disclaimer in the documentation and/or other materials provided
+   with the distribution.
+ - Neither the name of the MMDAI project team nor the names of
+   its contributors may be used to endorse or promote products
+   derived from this software without specific prior written
+   permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#pragma once
+#ifndef VPVL2_EXTENSIONS_HEADLESS_APPLICATIONCONTEXT_H_
+#define VPVL2_EXTENSIONS_HEADLESS_APPLICATIONCONTEXT_H_
+
+/* libvpvl2 */
+#include <vpvl2/extensions/BaseApplicationContext.h>
+#include <vpvl2/internal/Thread.h>
+
+#if defined(VPVL2_ENABLE_OSMESA)
+#include <GL/osmesa.h>
+#elif defined(VPVL2_LINK_EGL)
+#include <EGL/egl.h>
+#endif
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace vpvl2
+{
+namespace extensions
+{
+namespace headless
+{
+
+/**
+ * ApplicationContext for rendering without any window system.
+ *
+ * The OpenGL context itself is created by the caller (OSMesa or EGL pbuffer surface),
+ * this class only resolves procedures from the same runtime and measures time with
+ * a monotonic clock instead of the clock of the window system.
+ *
+ * Toon colors are read from toon textures with the image loader of BaseApplicationContext.
+ * Animated textures are not animated and keep their first frame.
+ */
+class ApplicationContext : public BaseApplicationContext {
+public:
+    static bool mapFileDescriptor(const UnicodeString &path, uint8 *&address, vsize &size, intptr_t &fd) {
+        fd = ::open(icu4c::String::toStdString(path).c_str(), O_RDONLY);
+        if (fd == -1) {
+            return false;
+        }
+        struct stat sb;
+        if (::fstat(fd, &sb) == -1) {
+            return false;
+        }
+        size = sb.st_size;
+        address = static_cast<uint8 *>(::mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0));
+        if (address == reinterpret_cast<uint8 *>(-1)) {
+            return false;
+        }
+        return true;
+    }
+    static bool unmapFileDescriptor(uint8 *address, vsize size, intptr_t fd) {
+        if (address && size > 0) {
+            ::munmap(address, size);
+        }
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        return true;
+    }
+
+    ApplicationContext(Scene *sceneRef, IEncoding *encodingRef, icu4c::StringMap *configRef)
+        : BaseApplicationContext(sceneRef, encodingRef, configRef),
+          m_elapsedTicks(0),
+          m_animatedTextureWarned(false)
+    {
+    }
+    ~ApplicationContext()
+    {
+        m_elapsedTicks = 0;
+        m_animatedTextureWarned = false;
+    }
+
+    void *findProcedureAddress(const void **candidatesPtr) const {
+        const char **candidates = reinterpret_cast<const char **>(candidatesPtr);
+        const char *candidate = candidates[0];
+        int i = 0;
+        while (candidate) {
+#if defined(VPVL2_ENABLE_OSMESA)
+            void *address = reinterpret_cast<void *>(OSMesaGetProcAddress(candidate));
+#elif defined(VPVL2_LINK_EGL)
+            void *address = reinterpret_cast<void *>(eglGetProcAddress(candidate));
+#else
+            void *address = 0;
+#endif
+            if (address) {
+                return address;
+            }
+            candidate = candidates[++i];
+        }
+        return 0;
+    }
+    bool mapFile(const UnicodeString &path, MapBuffer *buffer) const {
+        return mapFileDescriptor(path, buffer->address, buffer->size, buffer->opaque);
+    }
+    bool unmapFile(MapBuffer *buffer) const {
+        return unmapFileDescriptor(buffer->address, buffer->size, buffer->opaque);
+    }
+    bool existsFile(const UnicodeString &path) const {
+        return ::access(icu4c::String::toStdString(path).c_str(), R_OK) == 0;
+    }
+
+#if defined(VPVL2_ENABLE_NVIDIA_CG) || defined(VPVL2_LINK_NVFX)
+    void getToonColor(const IString *name, Color &value, void *userData) {
+        const ModelContext *modelContext = static_cast<const ModelContext *>(userData);
+        if (!loadToonColor(name, modelContext, value)) {
+            VPVL2_LOG(WARNING, "Cannot load the toon texture to get the toon color: " << (name ? icu4c::String::toStdString(static_cast<const icu4c::String *>(name)->value()) : std::string()));
+            value.setValue(1, 1, 1, 1);
+        }
+    }
+    void getTime(float32 &value, bool sync) const {
+        value = sync ? 0 : float32(m_timer.elapsed() / 1000000.0);
+    }
+    void getElapsed(float32 &value, bool sync) const {
+        int64 currentTicks = m_timer.elapsed();
+        value = sync ? 0 : (m_elapsedTicks > 0 ? float32((currentTicks - m_elapsedTicks) / 1000000.0) : 0);
+        m_elapsedTicks = currentTicks;
+    }
+    void uploadAnimatedTexture(float /* offset */, float /* speed */, float /* seek */, void * /* texture */) {
+        /* no animated image decoder is linked, so the first frame uploaded by the texture loader is kept */
+        if (!m_animatedTextureWarned) {
+            VPVL2_LOG(WARNING, "Animated textures are rendered with the first frame in the headless context");
+            m_animatedTextureWarned = true;
+        }
+    }
+#endif
+
+private:
+    internal::ElapsedTimer m_timer;
+    mutable int64 m_elapsedTicks;
+    bool m_animatedTextureWarned;
+
+    VPVL2_DISABLE_COPY_AND_ASSIGN(ApplicationContext)
+};
+
+} /* namespace headless */
+} /* namespace extensions */
+} /* namespace vpvl2 */
+
+#endif /* VPVL2_EXTENSIONS_HEADLESS_APPLICATIONCONTEXT_H_ */
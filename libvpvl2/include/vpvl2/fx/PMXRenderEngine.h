@@ -42,6 +42,7 @@
 #include "vpvl2/IModel.h"
 #include "vpvl2/IRenderEngine.h"
 #include "vpvl2/fx/EffectEngine.h"
+#include "vpvl2/extensions/gl/StreamingVertexBuffer.h"
 #include "vpvl2/extensions/gl/VertexBundle.h"
 #include "vpvl2/extensions/gl/VertexBundleLayout.h"
 
@@ -55,6 +56,9 @@ namespace vpvl2
 namespace cl {
 class PMXAccelerator;
 }
+namespace internal {
+class MaterialCuller;
+}
 
 class Scene;
 
@@ -96,19 +100,10 @@ public:
 private:
     class PrivateEffectEngine;
     enum VertexBufferObjectType {
-        kModelDynamicVertexBufferEven,
-        kModelDynamicVertexBufferOdd,
         kModelStaticVertexBuffer,
         kModelIndexBuffer,
         kMaxVertexBufferObjectType
     };
-    enum VertexArrayObjectType {
-        kVertexArrayObjectEven,
-        kVertexArrayObjectOdd,
-        kEdgeVertexArrayObjectEven,
-        kEdgeVertexArrayObjectOdd,
-        kMaxVertexArrayObjectType
-    };
     struct MaterialContext {
         MaterialContext()
             : mainTextureRef(0),
@@ -131,15 +126,14 @@ private:
     bool uploadMaterials(void *userData);
     bool releaseUserData0(void *userData);
     void release();
-    void createVertexBundle(GLuint dvbo);
-    void createEdgeBundle(GLuint dvbo);
+    void createVertexBundle(int slot);
+    void createEdgeBundle(int slot);
     void unbindVertexBundle();
-    void bindDynamicVertexAttributePointers(IModel::Buffer::StrideType type);
+    void bindDynamicVertexAttributePointers(IModel::Buffer::StrideType type, vsize baseOffset);
     void bindStaticVertexAttributePointers();
-    void getVertexBundleType(VertexArrayObjectType &vao, VertexBufferObjectType &vbo) const;
-    void getEdgeBundleType(VertexArrayObjectType &vao, VertexBufferObjectType &vbo) const;
     void getDrawPrimitivesCommand(EffectEngine::DrawPrimitiveCommand &command) const;
     void updateDrawPrimitivesCommand(const IMaterial *material, EffectEngine::DrawPrimitiveCommand &command) const;
+    void beginCullingPass(int type, int flags);
     void uploadToonTexture(const IMaterial *material, const IString *toonTexturePath, EffectEngine *engineRef, MaterialContext &context, bool shared, void *userData);
 
     PrivateEffectEngine *m_currentEffectEngineRef;
@@ -154,17 +148,20 @@ private:
     IModel::DynamicVertexBuffer *m_dynamicBuffer;
     IModel::IndexBuffer *m_indexBuffer;
     extensions::gl::VertexBundle m_bundle;
-    extensions::gl::VertexBundleLayout m_layouts[kMaxVertexArrayObjectType];
+    extensions::gl::StreamingVertexBuffer m_vertexStream;
+    extensions::gl::VertexBundleLayout m_layouts[extensions::gl::StreamingVertexBuffer::kMaxSlots];
+    extensions::gl::VertexBundleLayout m_edgeLayouts[extensions::gl::StreamingVertexBuffer::kMaxSlots];
     Array<MaterialContext> m_materialContexts;
     PointerHash<HashPtr, ITexture> m_allocatedTextures;
     PointerHash<HashInt, PrivateEffectEngine> m_effectEngines;
     PointerArray<PrivateEffectEngine> m_oseffects;
     IEffect *m_defaultEffect;
+    internal::MaterialCuller *m_culler;
+    Array<uint8> m_stagingVertices;
     GLenum m_indexType;
     Vector3 m_aabbMin;
     Vector3 m_aabbMax;
     bool m_cullFaceState;
-    bool m_updateEvenBuffer;
     bool m_isVertexShaderSkinning;
 
     VPVL2_DISABLE_COPY_AND_ASSIGN(PMXRenderEngine)
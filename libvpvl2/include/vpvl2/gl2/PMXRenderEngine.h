@@ -95,13 +95,13 @@ private:
                        IApplicationContext::ShaderType fragmentShaderType,
                        void *userData);
     bool uploadMaterials(void *userData);
-    void createVertexBundle(GLuint dvbo);
-    void createEdgeBundle(GLuint dvbo);
+    void createVertexBundle(int slot);
+    void createEdgeBundle(int slot);
     void bindVertexBundle();
     void bindEdgeBundle();
     void unbindVertexBundle();
-    void bindDynamicVertexAttributePointers();
-    void bindEdgeVertexAttributePointers();
+    void bindDynamicVertexAttributePointers(vsize baseOffset);
+    void bindEdgeVertexAttributePointers(vsize baseOffset);
     void bindStaticVertexAttributePointers();
 
     cl::PMXAccelerator *m_accelerator;
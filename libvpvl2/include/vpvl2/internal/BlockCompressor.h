@@ -0,0 +1,222 @@
+/**
+
+ Copyright (c) 2010-2013  hkrn
+
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or
+ without modification, are permitted provided that the following
+ conditions are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+ - Redistributions in binary form must reproduce the above
+   copyright notice, this list of conditions and the following
+   disclaimer in the documentation and/or other materials provided
+   with the distribution.
+ - Neither the name of the MMDAI project team nor the names of
+   its contributors may be used to endorse or promote products
+   derived from this software without specific prior written
+   permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#pragma once
+#ifndef VPVL2_INTERNAL_BLOCKCOMPRESSOR_H_
+#define VPVL2_INTERNAL_BLOCKCOMPRESSOR_H_
+
+#include "vpvl2/Common.h"
+
+#include <climits>
+
+namespace vpvl2
+{
+namespace internal
+{
+
+/**
+ * @file
+ * @author hkrn
+ *
+ * @section DESCRIPTION
+ *
+ * BlockCompressor class encodes 8bit RGBA (or BGRA) images into BC1 (DXT1) or BC3 (DXT5)
+ * on CPU. Endpoints are taken from a diagonal of the bounding box of each 4x4 block inset by
+ * 1/16 of the range and every pixel chooses the nearest palette entry, which is fast enough
+ * to run at load time at the cost of some quality compared with a cluster fit encoder.
+ */
+
+class BlockCompressor
+{
+public:
+    static const int kBlockSize = 4;
+    static const int kBC1BlockBytes = 8;
+    static const int kBC3BlockBytes = 16;
+
+    static vsize compressedSize(int width, int height, bool alpha) {
+        const vsize nblocks = vsize((btMax(width, 1) + kBlockSize - 1) / kBlockSize) * vsize((btMax(height, 1) + kBlockSize - 1) / kBlockSize);
+        return nblocks * (alpha ? kBC3BlockBytes : kBC1BlockBytes);
+    }
+    static bool hasTransparentPixels(const uint8 *pixels, int width, int height) {
+        const vsize npixels = vsize(width) * height;
+        for (vsize i = 0; i < npixels; i++) {
+            if (pixels[i * 4 + 3] != 0xff) {
+                return true;
+            }
+        }
+        return false;
+    }
+    static void compress(const uint8 *pixels, int width, int height, bool alpha, bool bgra, uint8 *output) {
+        uint8 block[kBlockSize * kBlockSize * 4];
+        for (int y = 0; y < height; y += kBlockSize) {
+            for (int x = 0; x < width; x += kBlockSize) {
+                /* pixels out of the image are clamped to the edge */
+                for (int by = 0; by < kBlockSize; by++) {
+                    const int sy = btMin(y + by, height - 1);
+                    for (int bx = 0; bx < kBlockSize; bx++) {
+                        const int sx = btMin(x + bx, width - 1);
+                        const uint8 *source = pixels + (vsize(sy) * width + sx) * 4;
+                        uint8 *dest = block + (by * kBlockSize + bx) * 4;
+                        dest[0] = source[bgra ? 2 : 0];
+                        dest[1] = source[1];
+                        dest[2] = source[bgra ? 0 : 2];
+                        dest[3] = source[3];
+                    }
+                }
+                if (alpha) {
+                    compressAlphaBlock(block, output);
+                    compressColorBlock(block, output + 8);
+                    output += kBC3BlockBytes;
+                }
+                else {
+                    compressColorBlock(block, output);
+                    output += kBC1BlockBytes;
+                }
+            }
+        }
+    }
+    static void compressColorBlock(const uint8 *block, uint8 *output) {
+        int minColor[3] = { 255, 255, 255 }, maxColor[3] = { 0, 0, 0 };
+        for (int i = 0; i < 16; i++) {
+            for (int c = 0; c < 3; c++) {
+                minColor[c] = btMin(minColor[c], int(block[i * 4 + c]));
+                maxColor[c] = btMax(maxColor[c], int(block[i * 4 + c]));
+            }
+        }
+        for (int c = 0; c < 3; c++) {
+            const int inset = (maxColor[c] - minColor[c]) >> 4;
+            minColor[c] = btMin(minColor[c] + inset, 255);
+            maxColor[c] = btMax(maxColor[c] - inset, 0);
+        }
+        /* pick the diagonal of the bounding box following the sign of covariance against the red channel */
+        int covariance[3] = { 0, 0, 0 };
+        for (int i = 0; i < 16; i++) {
+            const int r = int(block[i * 4]) * 2 - (minColor[0] + maxColor[0]);
+            for (int c = 1; c < 3; c++) {
+                covariance[c] += r * (int(block[i * 4 + c]) * 2 - (minColor[c] + maxColor[c]));
+            }
+        }
+        for (int c = 1; c < 3; c++) {
+            if (covariance[c] < 0) {
+                btSwap(minColor[c], maxColor[c]);
+            }
+        }
+        uint16 color0 = packRGB565(maxColor), color1 = packRGB565(minColor);
+        uint32 indices = 0;
+        if (color0 != color1) {
+            if (color0 < color1) {
+                btSwap(color0, color1);
+            }
+            int palette[4][3];
+            unpackRGB565(color0, palette[0]);
+            unpackRGB565(color1, palette[1]);
+            for (int c = 0; c < 3; c++) {
+                palette[2][c] = (palette[0][c] * 2 + palette[1][c]) / 3;
+                palette[3][c] = (palette[0][c] + palette[1][c] * 2) / 3;
+            }
+            for (int i = 0; i < 16; i++) {
+                int nearest = 0, minDistance = INT_MAX;
+                for (int j = 0; j < 4; j++) {
+                    int distance = 0;
+                    for (int c = 0; c < 3; c++) {
+                        const int d = int(block[i * 4 + c]) - palette[j][c];
+                        distance += d * d;
+                    }
+                    if (distance < minDistance) {
+                        minDistance = distance;
+                        nearest = j;
+                    }
+                }
+                indices |= uint32(nearest) << (i * 2);
+            }
+        }
+        output[0] = uint8(color0 & 0xff);
+        output[1] = uint8(color0 >> 8);
+        output[2] = uint8(color1 & 0xff);
+        output[3] = uint8(color1 >> 8);
+        for (int i = 0; i < 4; i++) {
+            output[4 + i] = uint8((indices >> (i * 8)) & 0xff);
+        }
+    }
+    static void compressAlphaBlock(const uint8 *block, uint8 *output) {
+        int minAlpha = 255, maxAlpha = 0;
+        for (int i = 0; i < 16; i++) {
+            minAlpha = btMin(minAlpha, int(block[i * 4 + 3]));
+            maxAlpha = btMax(maxAlpha, int(block[i * 4 + 3]));
+        }
+        uint64 indices = 0;
+        if (minAlpha != maxAlpha) {
+            /* eight alpha mode (alpha0 > alpha1) */
+            int palette[8] = { maxAlpha, minAlpha };
+            for (int j = 1; j < 7; j++) {
+                palette[j + 1] = ((7 - j) * maxAlpha + j * minAlpha) / 7;
+            }
+            for (int i = 0; i < 16; i++) {
+                int nearest = 0, minDistance = INT_MAX;
+                for (int j = 0; j < 8; j++) {
+                    const int d = int(block[i * 4 + 3]) - palette[j], distance = d < 0 ? -d : d;
+                    if (distance < minDistance) {
+                        minDistance = distance;
+                        nearest = j;
+                    }
+                }
+                indices |= uint64(nearest) << (i * 3);
+            }
+        }
+        output[0] = uint8(maxAlpha);
+        output[1] = uint8(minAlpha);
+        for (int i = 0; i < 6; i++) {
+            output[2 + i] = uint8((indices >> (i * 8)) & 0xff);
+        }
+    }
+
+private:
+    static uint16 packRGB565(const int *color) {
+        return uint16(((color[0] * 31 + 127) / 255) << 11 | ((color[1] * 63 + 127) / 255) << 5 | ((color[2] * 31 + 127) / 255));
+    }
+    static void unpackRGB565(uint16 value, int *color) {
+        const int r = (value >> 11) & 0x1f, g = (value >> 5) & 0x3f, b = value & 0x1f;
+        color[0] = (r << 3) | (r >> 2);
+        color[1] = (g << 2) | (g >> 4);
+        color[2] = (b << 3) | (b >> 2);
+    }
+};
+
+} /* namespace internal */
+} /* namespace vpvl2 */
+
+#endif
@@ -0,0 +1,399 @@
+/**
+
+ Copyright (c) 2010-2013  hkrn
+
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or
+ without modification, are permitted provided that the following
+ conditions are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+ - Redistributions in binary form must reproduce the above
+   copyright notice, this list of conditions and the following
+   disclaimer in the documentation and/or other materials provided
+   with the distribution.
+ - Neither the name of the MMDAI project team nor the names of
+   its contributors may be used to endorse or promote products
+   derived from this software without specific prior written
+   permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#pragma once
+#ifndef VPVL2_INTERNAL_CULLING_H_
+#define VPVL2_INTERNAL_CULLING_H_
+
+#include "vpvl2/Common.h"
+#include "vpvl2/IModel.h"
+
+namespace vpvl2
+{
+namespace internal
+{
+
+/**
+ * @file
+ * @author hkrn
+ *
+ * @section DESCRIPTION
+ *
+ * Classes for CPU side visibility tests of materials.
+ *
+ * MaterialAabbList reduces skinned positions into per-material AABBs while skinning through
+ * the vertices referenced by the index range of each material. ViewFrustum tests AABBs
+ * against a model-view-projection matrix and OcclusionBuffer keeps a coarse depth of large opaque materials already drawn. CullingContext
+ * is shared by all render engines of a scene and MaterialCuller is owned by each render engine.
+ *
+ * All tests are conservative: a material is culled only if it cannot affect any pixel.
+ */
+
+class VPVL2_API MaterialAabbList
+{
+public:
+    struct VertexRange {
+        VertexRange()
+            : begin(0),
+              end(0)
+        {
+        }
+        VertexRange(int b, int e)
+            : begin(b),
+              end(e)
+        {
+        }
+        int begin;
+        int end;
+    };
+
+    MaterialAabbList();
+    ~MaterialAabbList();
+
+    /**
+     * Collects vertices referenced by the index range of each material into sorted ranges
+     * and materials referencing each vertex.
+     *
+     * A vertex shared by several materials belongs to all of them, so the AABB of a material
+     * never depends on which material a vertex was assigned to. Call this again when indices
+     * or index ranges of materials are changed.
+     *
+     * @brief build
+     * @param materials
+     * @param indexBufferRef
+     * @param nvertices
+     */
+    void build(const Array<IMaterial *> &materials, const IModel::IndexBuffer *indexBufferRef, int nvertices);
+
+    /**
+     * Prepares nslots partial AABBs of each material for reduce.
+     *
+     * Skinning processors call this before skinning, reduce from each slot and endReduction after
+     * all slots are done, so AABBs are computed from values on CPU instead of reading back the
+     * mapped vertex buffer.
+     *
+     * @brief beginReduction
+     * @param nslots
+     */
+    void beginReduction(int nslots);
+
+    /**
+     * Expands partial AABBs of the slot of all materials referencing the vertex.
+     *
+     * Each slot must be reduced by only one thread at a time.
+     *
+     * @brief reduce
+     * @param slot
+     * @param vertexIndex
+     * @param position
+     * @param edge
+     */
+    void reduce(int slot, int vertexIndex, const Vector3 &position, const Vector3 &edge) {
+        if (vertexIndex < 0 || vertexIndex >= m_vertexMaterialOffsets.count() - 1) {
+            return;
+        }
+        const int base = slot * m_nmaterials, end = m_vertexMaterialOffsets[vertexIndex + 1];
+        for (int i = m_vertexMaterialOffsets[vertexIndex]; i < end; i++) {
+            const int offset = base + m_vertexMaterials[i];
+            Vector3 &aabbMin = m_aabbMinPartials[offset], &aabbMax = m_aabbMaxPartials[offset];
+            aabbMin.setMin(position);
+            aabbMax.setMax(position);
+            aabbMin.setMin(edge);
+            aabbMax.setMax(edge);
+        }
+    }
+
+    /**
+     * Merges partial AABBs of nslots into the AABB of each material.
+     *
+     * @brief endReduction
+     * @param nslots
+     */
+    void endReduction(int nslots);
+
+    /**
+     * Discards AABBs but keeps vertex ranges. getMaterialAabb returns false until next endReduction.
+     *
+     * @brief invalidate
+     */
+    void invalidate();
+    bool get(int materialIndex, Vector3 &aabbMin, Vector3 &aabbMax) const;
+    bool isBuilt() const { return m_rangeOffsets.count() > 0; }
+    int count() const { return m_aabbMins.count(); }
+
+private:
+    Array<VertexRange> m_vertexRanges;
+    Array<int> m_rangeOffsets;
+    Array<int> m_vertexMaterialOffsets;
+    Array<int> m_vertexMaterials;
+    Array<Vector3> m_aabbMinPartials;
+    Array<Vector3> m_aabbMaxPartials;
+    Array<Vector3> m_aabbMins;
+    Array<Vector3> m_aabbMaxs;
+    int m_nmaterials;
+
+    VPVL2_DISABLE_COPY_AND_ASSIGN(MaterialAabbList)
+};
+
+class VPVL2_API ViewFrustum
+{
+public:
+    ViewFrustum();
+    ~ViewFrustum();
+
+    /**
+     * Sets column-major model-view-projection matrix same as IApplicationContext#getMatrix.
+     *
+     * @brief setMatrix
+     * @param value
+     */
+    void setMatrix(const float32 *value);
+
+    /**
+     * Returns false if all corners of the AABB are outside of the same clip plane.
+     *
+     * @brief intersectsAabb
+     * @param aabbMin
+     * @param aabbMax
+     * @return
+     */
+    bool intersectsAabb(const Vector3 &aabbMin, const Vector3 &aabbMax) const;
+
+    /**
+     * Projects the AABB into normalized device coordinates.
+     *
+     * Returns false if any corner is behind the eye and the rectangle cannot be bounded.
+     *
+     * @brief projectAabb
+     * @param aabbMin
+     * @param aabbMax
+     * @param ndcMin
+     * @param ndcMax
+     * @return
+     */
+    bool projectAabb(const Vector3 &aabbMin, const Vector3 &aabbMax, Vector3 &ndcMin, Vector3 &ndcMax) const;
+    bool project(const Vector3 &position, Vector3 &ndc) const;
+
+private:
+    inline void transform(const Vector3 &position, Scalar *clip) const;
+
+    float32 m_matrix[16];
+};
+
+class VPVL2_API OcclusionBuffer
+{
+public:
+    static const int kDefaultWidth = 128;
+    static const int kDefaultHeight = 64;
+
+    OcclusionBuffer();
+    ~OcclusionBuffer();
+
+    void resize(int width, int height);
+    void clear();
+
+    /**
+     * Writes the farthest depth of the triangle into pixels whose centers are inside the triangle.
+     *
+     * Vertices are in normalized device coordinates. A pixel keeps the nearest of the written
+     * depths, so the stored depth is never in front of what has been drawn on the pixel.
+     * Triangles of both windings are accepted.
+     *
+     * @brief rasterizeTriangle
+     * @param v0
+     * @param v1
+     * @param v2
+     */
+    void rasterizeTriangle(const Vector3 &v0, const Vector3 &v1, const Vector3 &v2);
+
+    /**
+     * Returns true if all pixels overlapping the rectangle and their neighbors are covered by
+     * occluders in front of ndcMin.z.
+     *
+     * Neighbors are tested to absorb the error of sampling occluders at pixel centers.
+     *
+     * @brief isOccluded
+     * @param ndcMin
+     * @param ndcMax
+     * @return
+     */
+    bool isOccluded(const Vector3 &ndcMin, const Vector3 &ndcMax) const;
+    float32 depthAt(int x, int y) const;
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+    int countRasterizedTriangles() const { return m_nrasterizedTriangles; }
+
+private:
+    Array<float32> m_depths;
+    int m_width;
+    int m_height;
+    int m_nrasterizedTriangles;
+
+    VPVL2_DISABLE_COPY_AND_ASSIGN(OcclusionBuffer)
+};
+
+class VPVL2_API CullingContext
+{
+public:
+    CullingContext();
+    ~CullingContext();
+
+    /**
+     * Clears the occlusion buffer if value differs from the view-projection matrix of the previous call.
+     *
+     * @brief setViewProjection
+     * @param value
+     */
+    void setViewProjection(const float32 *value);
+
+    /**
+     * Discards occluders and draw call counters. Scene#update calls this when render engines
+     * are updated because skinned positions of the occluders are no longer valid.
+     *
+     * @brief invalidate
+     */
+    void invalidate();
+    void resetCounters();
+
+    int flags() const { return m_flags; }
+    void setFlags(int value) { m_flags = value; }
+    bool isFrustumCullingEnabled() const;
+    bool isOcclusionCullingEnabled() const;
+    OcclusionBuffer *occlusionBufferRef() { return &m_occlusionBuffer; }
+    const OcclusionBuffer *occlusionBufferRef() const { return &m_occlusionBuffer; }
+
+    int countDrawCalls() const { return m_ndrawCalls; }
+    int countFrustumCulledDrawCalls() const { return m_nfrustumCulledDrawCalls; }
+    int countOcclusionCulledDrawCalls() const { return m_nocclusionCulledDrawCalls; }
+    void addDrawCall() { m_ndrawCalls++; }
+    void addFrustumCulledDrawCall() { m_nfrustumCulledDrawCalls++; }
+    void addOcclusionCulledDrawCall() { m_nocclusionCulledDrawCalls++; }
+
+private:
+    OcclusionBuffer m_occlusionBuffer;
+    float32 m_viewProjection[16];
+    int m_flags;
+    int m_ndrawCalls;
+    int m_nfrustumCulledDrawCalls;
+    int m_nocclusionCulledDrawCalls;
+
+    VPVL2_DISABLE_COPY_AND_ASSIGN(CullingContext)
+};
+
+class VPVL2_API MaterialCuller
+{
+public:
+    enum PassType {
+        kModelPass,
+        kEdgePass,
+        kShadowPass,
+        kZPlotPass,
+        kMaxPassType
+    };
+    /* occluders with more triangles than this are skipped to bound the CPU cost */
+    static const int kMaxOccluderTriangles = 8192;
+    /* minimum screen area of an occluder in normalized device coordinates (whole screen is 4) */
+    static const float32 kMinOccluderArea;
+
+    explicit MaterialCuller(CullingContext *contextRef);
+    ~MaterialCuller();
+
+    /**
+     * Starts a pass with model-view-projection matrix of the pass.
+     *
+     * Pass viewProjection to the model pass to bind the occlusion buffer to the camera. The
+     * occlusion buffer is tested only in the model and edge passes.
+     *
+     * @brief begin
+     * @param type
+     * @param bufferRef
+     * @param modelViewProjection
+     * @param viewProjection
+     */
+    void begin(PassType type,
+               const IModel::DynamicVertexBuffer *bufferRef,
+               const float32 *modelViewProjection,
+               const float32 *viewProjection);
+
+    /**
+     * Returns false if the material of the current pass can be culled and counts the result.
+     *
+     * Materials without AABB (e.g. skinned by vertex shader or OpenCL) are always visible.
+     *
+     * @brief testMaterial
+     * @param materialIndex
+     * @return
+     */
+    bool testMaterial(int materialIndex);
+    bool testAabb(const float32 *modelViewProjection, const Vector3 &aabbMin, const Vector3 &aabbMax) const;
+
+    /**
+     * Rasterizes opaque, large and single sided materials visible in the last model pass into
+     * the occlusion buffer.
+     *
+     * Materials not marked in opaqueMaterials are skipped because alpha of their main texture
+     * may cut out pixels even if the material is single sided.
+     *
+     * @brief rasterizeOccluders
+     * @param modelRef
+     * @param vertices skinned vertices written by DynamicVertexBuffer#update
+     * @param indexBufferRef
+     * @param opaqueMaterials true if the material and its main texture have no alpha
+     */
+    void rasterizeOccluders(const IModel *modelRef,
+                            const uint8 *vertices,
+                            const IModel::IndexBuffer *indexBufferRef,
+                            const Array<bool> &opaqueMaterials);
+
+    bool isEnabled() const;
+    bool isOcclusionCullingEnabled() const;
+
+private:
+    CullingContext *m_contextRef;
+    const IModel::DynamicVertexBuffer *m_bufferRef;
+    ViewFrustum m_frustum;
+    float32 m_modelViewProjection[16];
+    PassType m_passType;
+    Array<bool> m_visibleMaterials;
+
+    VPVL2_DISABLE_COPY_AND_ASSIGN(MaterialCuller)
+};
+
+} /* namespace internal */
+} /* namespace vpvl2 */
+
+#endif
@@ -0,0 +1,120 @@
+/**
+
+ Copyright (c) 2010-2013  hkrn
+
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or
+ without modification, are permitted provided that the following
+ conditions are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+ - Redistributions in binary form must reproduce the above
+   copyright notice, this list of conditions and the following
+   disclaimer in the documentation and/or other materials provided
+   with the distribution.
+ - Neither the name of the MMDAI project team nor the names of
+   its contributors may be used to endorse or promote products
+   derived from this software without specific prior written
+   permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#pragma once
+#ifndef VPVL2_INTERNAL_INTERPOLATIONTABLECACHE_H_
+#define VPVL2_INTERNAL_INTERPOLATIONTABLECACHE_H_
+
+#include "vpvl2/Common.h"
+#include "vpvl2/IKeyframe.h"
+
+namespace vpvl2
+{
+namespace internal
+{
+
+/**
+ * @file
+ * @author hkrn
+ *
+ * @section DESCRIPTION
+ *
+ * InterpolationTableCache class shares interpolation tables built from the same bezier
+ * control points among all keyframes in the process.
+ *
+ * Control points are quantized to 8 bits (as stored in VMD/MVD) and tables are reference
+ * counted. A table is freed when the last keyframe referring it releases it.
+ */
+
+class VPVL2_API InterpolationTableCache
+{
+public:
+    struct Stats {
+        Stats()
+            : ntables(0),
+              nreferences(0),
+              allocatedBytes(0),
+              savedBytes(0)
+        {
+        }
+        /* number of distinct tables alive */
+        int ntables;
+        /* number of keyframe references to the tables */
+        int nreferences;
+        /* bytes of all distinct tables */
+        vsize allocatedBytes;
+        /* bytes that would be allocated additionally without sharing */
+        vsize savedBytes;
+    };
+
+    /**
+     * Returns the table of size + 1 elements built from parameter (x1, y1, x2, y2) and increments
+     * its reference count. Returned table must be released by #release.
+     *
+     * @brief acquire
+     * @param parameter
+     * @param size
+     * @return
+     */
+    static const IKeyframe::SmoothPrecision *acquire(const QuadWord &parameter, int size);
+
+    /**
+     * Decrements the reference count of table and sets table to NULL.
+     *
+     * Nothing is done if table is NULL.
+     *
+     * @brief release
+     * @param table
+     */
+    static void release(const IKeyframe::SmoothPrecision *&table);
+
+    /**
+     * Gets current memory usage of the cache.
+     *
+     * @brief getStats
+     * @param value
+     */
+    static void getStats(Stats &value);
+
+private:
+    VPVL2_MAKE_STATIC_CLASS(InterpolationTableCache)
+};
+
+} /* namespace internal */
+} /* namespace vpvl2 */
+
+#endif
@@ -41,6 +41,7 @@
 #define VPVL2_INTERNAL_KEYFRAME_H_
 
 #include "vpvl2/IKeyframe.h"
+#include "vpvl2/internal/InterpolationTableCache.h"
 
 namespace vpvl2
 {
@@ -62,18 +63,21 @@ struct InterpolationPair {
 #pragma pack(pop)
 
 struct InterpolationTable {
-    typedef Array<IKeyframe::SmoothPrecision> Value;
+    /* table is shared among keyframes by InterpolationTableCache */
+    typedef const IKeyframe::SmoothPrecision *Value;
     Value table;
     QuadWord parameter;
     bool linear;
     int size;
     InterpolationTable()
-        : parameter(defaultParameter()),
+        : table(0),
+          parameter(defaultParameter()),
           linear(true),
           size(0)
     {
     }
     ~InterpolationTable() {
+        InterpolationTableCache::release(table);
         parameter = defaultParameter();
         linear = true;
         size = 0;
@@ -85,23 +89,19 @@ struct InterpolationTable {
         pair.second.y = uint8(parameter.w());
     }
     void build(const QuadWord &value, int s) {
+        InterpolationTableCache::release(table);
         if (!btFuzzyZero(value.x() - value.y()) || !btFuzzyZero(value.z() - value.w())) {
-            table.resize(s + 1);
-            const IKeyframe::SmoothPrecision &x1 = value.x() / 127.0, &x2 = value.z() / 127.0;
-            const IKeyframe::SmoothPrecision &y1 = value.y() / 127.0, &y2 = value.w() / 127.0;
-            IKeyframe::SmoothPrecision *ptr = &table[0];
-            build(x1, x2, y1, y2, s, ptr);
+            table = InterpolationTableCache::acquire(value, s);
             linear = false;
         }
         else {
-            table.clear();
             linear = true;
         }
         parameter = value;
         size = s;
     }
     void reset() {
-        table.clear();
+        InterpolationTableCache::release(table);
         linear = true;
         parameter = defaultParameter();
     }
@@ -150,6 +150,9 @@ struct InterpolationTable {
         }
         table[size] = 1;
     }
+
+private:
+    VPVL2_DISABLE_COPY_AND_ASSIGN(InterpolationTable)
 };
 
 } /* namespace internal */
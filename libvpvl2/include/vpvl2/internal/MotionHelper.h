@@ -63,6 +63,13 @@ public:
         }
     };
 
+    /**
+     * Finds the pair of keyframes surrounding seekIndex.
+     *
+     * lastIndex is used as a cursor hint and updated: seeking forward gallops from the cursor and
+     * seeking backward gallops back to it, so sequential playback costs O(1) and random scrubbing
+     * costs O(log n) instead of a linear scan from the beginning.
+     */
     template<typename T>
     static void findKeyframeIndices(const IKeyframe::TimeIndex &seekIndex,
                                     IKeyframe::TimeIndex &currentKeyframe,
@@ -74,23 +81,18 @@ public:
         const int nframes = keyframes.count();
         IKeyframe *lastKeyFrame = keyframes[nframes - 1];
         currentKeyframe = btMin(seekIndex, lastKeyFrame->timeIndex());
+        lastIndex = btClamped(lastIndex, 0, nframes - 1);
         // Find the next frame index bigger than the frame index of last key frame
         fromIndex = toIndex = 0;
-        if (currentKeyframe >= keyframes[lastIndex]->timeIndex()) {
-            for (int i = lastIndex; i < nframes; i++) {
-                if (currentKeyframe <= keyframes[i]->timeIndex()) {
-                    toIndex = i;
-                    break;
-                }
-            }
+        if (keyframes[0]->layerIndex() != lastKeyFrame->layerIndex()) {
+            /* keyframes are not ordered by time index across layers so binary search cannot be applied */
+            findKeyframeIndicesLinear(currentKeyframe, lastIndex, toIndex, keyframes);
+        }
+        else if (currentKeyframe >= keyframes[lastIndex]->timeIndex()) {
+            toIndex = gallopForward(currentKeyframe, lastIndex, nframes, keyframes);
         }
         else {
-            for (int i = 0; i <= lastIndex && i < nframes; i++) {
-                if (currentKeyframe <= keyframes[i]->timeIndex()) {
-                    toIndex = i;
-                    break;
-                }
-            }
+            toIndex = gallopBackward(currentKeyframe, lastIndex, keyframes);
         }
         if (toIndex >= nframes) {
             toIndex = nframes - 1;
@@ -98,6 +100,23 @@ public:
         fromIndex = toIndex <= 1 ? 0 : toIndex - 1;
         lastIndex = fromIndex;
     }
+    /**
+     * Returns the first index in [begin, end) whose time index is equal or greater than timeIndex, or end.
+     */
+    template<typename T>
+    static int lowerBoundKeyframeIndex(const IKeyframe::TimeIndex &timeIndex, int begin, int end, const Array<T *> &keyframes)
+    {
+        while (begin < end) {
+            const int middle = begin + ((end - begin) >> 1);
+            if (keyframes[middle]->timeIndex() < timeIndex) {
+                begin = middle + 1;
+            }
+            else {
+                end = middle;
+            }
+        }
+        return begin;
+    }
     template<typename TMotion>
     static inline bool isReachedToDuration(const TMotion &motion, const IKeyframe::TimeIndex &atEnd)
     {
@@ -143,6 +162,55 @@ public:
     }
 
 private:
+    template<typename T>
+    static void findKeyframeIndicesLinear(const IKeyframe::TimeIndex &currentKeyframe,
+                                          int lastIndex,
+                                          int &toIndex,
+                                          const Array<T *> &keyframes)
+    {
+        const int nframes = keyframes.count();
+        if (currentKeyframe >= keyframes[lastIndex]->timeIndex()) {
+            for (int i = lastIndex; i < nframes; i++) {
+                if (currentKeyframe <= keyframes[i]->timeIndex()) {
+                    toIndex = i;
+                    break;
+                }
+            }
+        }
+        else {
+            for (int i = 0; i <= lastIndex && i < nframes; i++) {
+                if (currentKeyframe <= keyframes[i]->timeIndex()) {
+                    toIndex = i;
+                    break;
+                }
+            }
+        }
+    }
+    /* timeIndex >= keyframes[hint] is assumed */
+    template<typename T>
+    static int gallopForward(const IKeyframe::TimeIndex &timeIndex, int hint, int end, const Array<T *> &keyframes)
+    {
+        int low = hint, high = hint, step = 1;
+        while (high < end && keyframes[high]->timeIndex() < timeIndex) {
+            low = high + 1;
+            high = hint + step;
+            step <<= 1;
+        }
+        return lowerBoundKeyframeIndex(timeIndex, low, btMin(high + 1, end), keyframes);
+    }
+    /* timeIndex < keyframes[hint] is assumed */
+    template<typename T>
+    static int gallopBackward(const IKeyframe::TimeIndex &timeIndex, int hint, const Array<T *> &keyframes)
+    {
+        int low = hint - 1, high = hint, step = 1;
+        while (low > 0 && keyframes[low]->timeIndex() >= timeIndex) {
+            high = low;
+            step <<= 1;
+            low = hint - step;
+        }
+        return lowerBoundKeyframeIndex(timeIndex, btMax(low, 0), high, keyframes);
+    }
+
     MotionHelper();
     ~MotionHelper();
 };
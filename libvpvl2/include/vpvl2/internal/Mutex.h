@@ -0,0 +1,101 @@
+/**
+
+ Copyright (c) 2010-2013  hkrn
+
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or
+ without modification, are permitted provided that the following
+ conditions are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+ - Redistributions in binary form must reproduce the above
+   copyright notice, this list of conditions and the following
+   disclaimer in the documentation and/or other materials provided
+   with the distribution.
+ - Neither the name of the MMDAI project team nor the names of
+   its contributors may be used to endorse or promote products
+   derived from this software without specific prior written
+   permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#pragma once
+#ifndef VPVL2_INTERNAL_MUTEX_H_
+#define VPVL2_INTERNAL_MUTEX_H_
+
+#include "vpvl2/Common.h"
+
+namespace vpvl2
+{
+namespace internal
+{
+
+/**
+ * @file
+ * @author hkrn
+ *
+ * @section DESCRIPTION
+ *
+ * Mutex class is a minimal non-recursive mutex used to guard process-wide caches.
+ * It wraps tbb::mutex when linked with Intel TBB, otherwise CRITICAL_SECTION (Windows)
+ * or pthread_mutex_t.
+ */
+
+class VPVL2_API Mutex
+{
+public:
+    Mutex();
+    ~Mutex();
+
+    void lock();
+    void unlock();
+
+private:
+    /* pthread_mutex_t or CRITICAL_SECTION for Condition#wait */
+    void *nativeHandle() const;
+
+    struct PrivateContext;
+    PrivateContext *m_context;
+
+    friend class Condition;
+    VPVL2_DISABLE_COPY_AND_ASSIGN(Mutex)
+};
+
+class ScopedLock
+{
+public:
+    explicit ScopedLock(Mutex &mutex)
+        : m_mutexRef(mutex)
+    {
+        m_mutexRef.lock();
+    }
+    ~ScopedLock() {
+        m_mutexRef.unlock();
+    }
+
+private:
+    Mutex &m_mutexRef;
+
+    VPVL2_DISABLE_COPY_AND_ASSIGN(ScopedLock)
+};
+
+} /* namespace internal */
+} /* namespace vpvl2 */
+
+#endif
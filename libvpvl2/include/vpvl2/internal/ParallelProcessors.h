@@ -41,6 +41,9 @@
 
 #include <vpvl2/Common.h>
 #include <vpvl2/IMaterial.h>
+#include <vpvl2/internal/Culling.h>
+#include <vpvl2/internal/VertexStore.h>
+#include <vpvl2/internal/WorkerPool.h>
 
 #ifdef VPVL2_LINK_INTEL_TBB
 #include <tbb/tbb.h>
@@ -52,32 +55,58 @@ namespace vpvl2
 namespace internal
 {
 
-static inline bool GreaterOMP(const Vector3 &left, const Vector3 &right)
-{
-    return left.x() < right.x() ||  left.y() < right.y() || left.z() < right.z();
-}
+static const int kCacheLineSize = 64;
 
-static inline bool LessOMP(const Vector3 &left, const Vector3 &right)
+/**
+ * Returns the number of units per chunk that is at least minimum and spans whole cache lines
+ * so that adjacent chunks written by different threads never share a cache line.
+ */
+template<typename TUnit>
+static inline int CacheAlignedChunkSize(int minimum)
 {
-    return left.x() > right.x() ||  left.y() > right.y() || left.z() > right.z();
+    int a = int(sizeof(TUnit)), b = kCacheLineSize;
+    while (b != 0) {
+        const int r = a % b;
+        a = b;
+        b = r;
+    }
+    const int nunitsPerLines = kCacheLineSize / a;
+    return ((btMax(minimum, 1) + nunitsPerLines - 1) / nunitsPerLines) * nunitsPerLines;
 }
 
+/*
+ * chunks are distributed to a fixed number of slots in round robin and each slot keeps its own partial AABB
+ * on the stack, so the reduction never allocates, no lock is required and the result does not depend on
+ * the thread count or scheduling
+ */
+static const int kMaxReductionSlots = 32;
+
 template<typename TModel, typename TVertex, typename TUnit>
 class ParallelSkinningVertexProcessor {
 public:
     ParallelSkinningVertexProcessor(const TModel *modelRef,
                                     const Array<TVertex *> *verticesRef,
                                     const Vector3 &cameraPosition,
-                                    void *address)
+                                    void *address,
+                                    MaterialAabbList *materialAabbsRef = 0)
         : m_verticesRef(verticesRef),
+          m_materialAabbsRef(materialAabbsRef),
           m_edgeScaleFactor(modelRef->edgeScaleFactor(cameraPosition)),
           m_aabbMin(SIMD_INFINITY, SIMD_INFINITY, SIMD_INFINITY),
           m_aabbMax(-SIMD_INFINITY, -SIMD_INFINITY, -SIMD_INFINITY),
-          m_bufferPtr(static_cast<TUnit *>(address))
+          m_aabbMinPartialsRef(0),
+          m_aabbMaxPartialsRef(0),
+          m_bufferPtr(static_cast<TUnit *>(address)),
+          m_chunkSize(CacheAlignedChunkSize<TUnit>(kMinimumChunkSize)),
+          m_nchunks(0),
+          m_nslots(0)
     {
     }
     ~ParallelSkinningVertexProcessor() {
         m_verticesRef = 0;
+        m_materialAabbsRef = 0;
+        m_aabbMinPartialsRef = 0;
+        m_aabbMaxPartialsRef = 0;
         m_bufferPtr = 0;
     }
 
@@ -85,78 +114,193 @@ public:
     Vector3 aabbMax() const { return m_aabbMax; }
 
 #ifdef VPVL2_LINK_INTEL_TBB
-    ParallelSkinningVertexProcessor(const ParallelSkinningVertexProcessor &self, tbb::split /* split */)
-        : m_verticesRef(self.m_verticesRef),
-          m_edgeScaleFactor(self.m_edgeScaleFactor),
-          m_aabbMin(SIMD_INFINITY, SIMD_INFINITY, SIMD_INFINITY),
-          m_aabbMax(-SIMD_INFINITY, -SIMD_INFINITY, -SIMD_INFINITY),
-          m_bufferPtr(self.m_bufferPtr)
-    {
-    }
-    void join(const ParallelSkinningVertexProcessor &self) {
-        m_aabbMin.setMin(self.m_aabbMin);
-        m_aabbMax.setMax(self.m_aabbMax);
-    }
     void operator()(const tbb::blocked_range<int> &range) const {
-        Vector3 aabbMin(m_aabbMin), aabbMax(m_aabbMax), position;
         for (int i = range.begin(); i != range.end(); ++i) {
-            const TVertex *vertex = m_verticesRef->at(i);
-            const IMaterial *material = vertex->materialRef();
-            const float materialEdgeSize = material->edgeSize() * m_edgeScaleFactor;
-            TUnit &v = m_bufferPtr[i];
-            v.update(vertex, materialEdgeSize, i, position);
-            aabbMin.setMin(position);
-            aabbMax.setMax(position);
+            updateSlot(i);
         }
-        m_aabbMin = aabbMin;
-        m_aabbMax = aabbMax;
     }
 #endif /* VPVL2_LINK_INTEL_TBB */
 
     void execute(bool enableParallel) {
         const int nvertices = m_verticesRef->count();
+        m_nchunks = (nvertices + m_chunkSize - 1) / m_chunkSize;
+        m_nslots = btMin(m_nchunks, kMaxReductionSlots);
+        /* the body is copied by TBB, so partials are referred from the stack of the caller */
+        Vector3 aabbMinPartials[kMaxReductionSlots], aabbMaxPartials[kMaxReductionSlots];
+        m_aabbMinPartialsRef = aabbMinPartials;
+        m_aabbMaxPartialsRef = aabbMaxPartials;
+        if (m_materialAabbsRef) {
+            m_materialAabbsRef->beginReduction(m_nslots);
+        }
 #if defined(VPVL2_LINK_INTEL_TBB)
         if (enableParallel) {
-            tbb::parallel_reduce(tbb::blocked_range<int>(0, nvertices), *this);
+            tbb::parallel_for(tbb::blocked_range<int>(0, m_nslots, 1), *this);
         }
         else {
 #else
         {
             (void) enableParallel;
 #endif
-            Vector3 position, aabbMin(SIMD_INFINITY, SIMD_INFINITY, SIMD_INFINITY),
-                    aabbMax(-SIMD_INFINITY, -SIMD_INFINITY, -SIMD_INFINITY);
-#pragma omp parallel for
-            for (int i = 0; i < nvertices; ++i) {
-                const TVertex *vertex = m_verticesRef->at(i);
-                const IMaterial *material = vertex->materialRef();
-                const IVertex::EdgeSizePrecision &materialEdgeSize = material->edgeSize() * m_edgeScaleFactor;
-                TUnit &v = m_bufferPtr[i];
-                v.update(vertex, materialEdgeSize, i, position);
-#pragma omp flush(aabbMin)
-                if (LessOMP(aabbMin, position)) {
-#pragma omp critical
-                    {
-                        aabbMin.setMin(position);
-                    }
-                }
-#pragma omp flush(aabbMax)
-                if (GreaterOMP(aabbMax, position)) {
-#pragma omp critical
-                    {
-                        aabbMax.setMax(position);
-                    }
-                }
+#pragma omp parallel for schedule(dynamic)
+            for (int i = 0; i < m_nslots; ++i) {
+                updateSlot(i);
             }
         }
+        for (int i = 0; i < m_nslots; ++i) {
+            m_aabbMin.setMin(aabbMinPartials[i]);
+            m_aabbMax.setMax(aabbMaxPartials[i]);
+        }
+        if (m_materialAabbsRef) {
+            m_materialAabbsRef->endReduction(m_nslots);
+        }
+        m_aabbMinPartialsRef = m_aabbMaxPartialsRef = 0;
     }
 
 private:
+    static const int kMinimumChunkSize = 256;
+
+    void updateSlot(int slot) const {
+        const int nvertices = m_verticesRef->count();
+        Vector3 aabbMin(SIMD_INFINITY, SIMD_INFINITY, SIMD_INFINITY),
+                aabbMax(-SIMD_INFINITY, -SIMD_INFINITY, -SIMD_INFINITY);
+        for (int i = slot; i < m_nchunks; i += m_nslots) {
+            const int begin = i * m_chunkSize;
+            updateRange(slot, begin, btMin(begin + m_chunkSize, nvertices), aabbMin, aabbMax);
+        }
+        m_aabbMinPartialsRef[slot] = aabbMin;
+        m_aabbMaxPartialsRef[slot] = aabbMax;
+    }
+    void updateRange(int slot, int begin, int end, Vector3 &aabbMin, Vector3 &aabbMax) const {
+        Vector3 position, edge;
+        for (int i = begin; i < end; ++i) {
+            const TVertex *vertex = m_verticesRef->at(i);
+            const IMaterial *material = vertex->materialRef();
+            const IVertex::EdgeSizePrecision &materialEdgeSize = material->edgeSize() * m_edgeScaleFactor;
+            TUnit &v = m_bufferPtr[i];
+            v.update(vertex, materialEdgeSize, i, position, edge);
+            aabbMin.setMin(position);
+            aabbMax.setMax(position);
+            if (m_materialAabbsRef) {
+                m_materialAabbsRef->reduce(slot, i, position, edge);
+            }
+        }
+    }
+
     const Array<TVertex *> *m_verticesRef;
+    MaterialAabbList *m_materialAabbsRef;
     const IVertex::EdgeSizePrecision m_edgeScaleFactor;
-    mutable Vector3 m_aabbMin;
-    mutable Vector3 m_aabbMax;
+    Vector3 m_aabbMin;
+    Vector3 m_aabbMax;
+    Vector3 *m_aabbMinPartialsRef;
+    Vector3 *m_aabbMaxPartialsRef;
     TUnit *m_bufferPtr;
+    const int m_chunkSize;
+    int m_nchunks;
+    int m_nslots;
+};
+
+class ParallelVertexStoreSkinningProcessor {
+public:
+    static const int kChunkSize = 1024;
+
+    ParallelVertexStoreSkinningProcessor(const VertexStore *storeRef, const VertexStore::Output &output)
+        : m_storeRef(storeRef),
+          m_output(output),
+          m_type(VertexStore::kBdef1Group),
+          m_aabbMin(SIMD_INFINITY, SIMD_INFINITY, SIMD_INFINITY),
+          m_aabbMax(-SIMD_INFINITY, -SIMD_INFINITY, -SIMD_INFINITY),
+          m_aabbMinPartialsRef(0),
+          m_aabbMaxPartialsRef(0),
+          m_nvertices(0),
+          m_nchunks(0),
+          m_nslots(0)
+    {
+    }
+    ~ParallelVertexStoreSkinningProcessor() {
+        m_storeRef = 0;
+        m_aabbMinPartialsRef = 0;
+        m_aabbMaxPartialsRef = 0;
+    }
+
+    Vector3 aabbMin() const { return m_aabbMin; }
+    Vector3 aabbMax() const { return m_aabbMax; }
+
+#ifdef VPVL2_LINK_INTEL_TBB
+    void operator()(const tbb::blocked_range<int> &range) const {
+        for (int i = range.begin(); i != range.end(); ++i) {
+            updateSlot(i);
+        }
+    }
+#endif /* VPVL2_LINK_INTEL_TBB */
+
+    void execute(bool enableParallel) {
+        /* the body is copied by TBB, so partials are referred from the stack of the caller */
+        Vector3 aabbMinPartials[kMaxReductionSlots], aabbMaxPartials[kMaxReductionSlots];
+        m_aabbMinPartialsRef = aabbMinPartials;
+        m_aabbMaxPartialsRef = aabbMaxPartials;
+        /* slots of per-material AABBs are shared by all groups as groups are skinned one by one */
+        int nmaterialSlots = 0;
+        for (int i = 0; i < VertexStore::kMaxGroupType; i++) {
+            const int nchunks = (m_storeRef->countVertices(static_cast<VertexStore::GroupType>(i)) + kChunkSize - 1) / kChunkSize;
+            nmaterialSlots = btMax(nmaterialSlots, btMin(nchunks, kMaxReductionSlots));
+        }
+        MaterialAabbList *materialAabbsRef = m_output.materialAabbsRef;
+        if (materialAabbsRef) {
+            materialAabbsRef->beginReduction(nmaterialSlots);
+        }
+        for (int i = 0; i < VertexStore::kMaxGroupType; i++) {
+            m_type = static_cast<VertexStore::GroupType>(i);
+            m_nvertices = m_storeRef->countVertices(m_type);
+            /* chunks are aligned to the lane size of the kernel */
+            m_nchunks = (m_nvertices + kChunkSize - 1) / kChunkSize;
+            m_nslots = btMin(m_nchunks, kMaxReductionSlots);
+#if defined(VPVL2_LINK_INTEL_TBB)
+            if (enableParallel) {
+                tbb::parallel_for(tbb::blocked_range<int>(0, m_nslots, 1), *this);
+            }
+            else {
+#else
+            {
+                (void) enableParallel;
+#endif
+#pragma omp parallel for schedule(dynamic)
+                for (int j = 0; j < m_nslots; j++) {
+                    updateSlot(j);
+                }
+            }
+            for (int j = 0; j < m_nslots; j++) {
+                m_aabbMin.setMin(aabbMinPartials[j]);
+                m_aabbMax.setMax(aabbMaxPartials[j]);
+            }
+        }
+        if (materialAabbsRef) {
+            materialAabbsRef->endReduction(nmaterialSlots);
+        }
+        m_aabbMinPartialsRef = m_aabbMaxPartialsRef = 0;
+    }
+
+private:
+    void updateSlot(int slot) const {
+        Vector3 aabbMin(SIMD_INFINITY, SIMD_INFINITY, SIMD_INFINITY),
+                aabbMax(-SIMD_INFINITY, -SIMD_INFINITY, -SIMD_INFINITY);
+        for (int i = slot; i < m_nchunks; i += m_nslots) {
+            const int begin = i * kChunkSize;
+            m_storeRef->perform(m_type, begin, btMin(begin + kChunkSize, m_nvertices), m_output, aabbMin, aabbMax, slot);
+        }
+        m_aabbMinPartialsRef[slot] = aabbMin;
+        m_aabbMaxPartialsRef[slot] = aabbMax;
+    }
+
+    const VertexStore *m_storeRef;
+    const VertexStore::Output m_output;
+    VertexStore::GroupType m_type;
+    Vector3 m_aabbMin;
+    Vector3 m_aabbMax;
+    Vector3 *m_aabbMinPartialsRef;
+    Vector3 *m_aabbMaxPartialsRef;
+    int m_nvertices;
+    int m_nchunks;
+    int m_nslots;
 };
 
 template<typename TModel, typename TVertex, typename TUnit>
@@ -322,6 +466,81 @@ private:
     mutable Array<TRigidBody *> *m_rigidBodyRefs;
 };
 
+/**
+ * Runs independent tasks (TTask#execute) concurrently and returns after all of them are finished.
+ * Tasks are scheduled one by one because costs of each task (typically a model) differ widely.
+ */
+template<typename TTask>
+class ParallelTaskProcessor {
+public:
+    /* workerPoolRef is used only if neither TBB nor OpenMP is available, tasks run serially if it's null */
+    ParallelTaskProcessor(const Array<TTask *> *taskRefs, WorkerPool *workerPoolRef = 0)
+        : m_taskRefs(taskRefs),
+          m_workerPoolRef(workerPoolRef)
+    {
+    }
+    ~ParallelTaskProcessor() {
+        m_taskRefs = 0;
+        m_workerPoolRef = 0;
+    }
+
+#ifdef VPVL2_LINK_INTEL_TBB
+    void operator()(const tbb::blocked_range<int> &range) const {
+        for (int i = range.begin(); i != range.end(); ++i) {
+            TTask *task = m_taskRefs->at(i);
+            task->execute();
+        }
+    }
+#endif
+
+    void execute() const {
+        const int ntasks = m_taskRefs->count();
+#if defined(VPVL2_LINK_INTEL_TBB)
+        tbb::parallel_for(tbb::blocked_range<int>(0, ntasks, 1), *this);
+#elif defined(_OPENMP)
+#pragma omp parallel for schedule(dynamic, 1)
+        for (int i = 0; i < ntasks; i++) {
+            TTask *task = m_taskRefs->at(i);
+            task->execute();
+        }
+#else
+        if (m_workerPoolRef && ntasks > 1) {
+            /* idle workers take the next task from the shared queue, so uneven tasks are balanced as a dynamic schedule */
+            for (int i = 0; i < ntasks; i++) {
+                m_workerPoolRef->enqueue(new Runner(m_taskRefs->at(i)));
+            }
+            m_workerPoolRef->waitForCompletion();
+        }
+        else {
+            for (int i = 0; i < ntasks; i++) {
+                TTask *task = m_taskRefs->at(i);
+                task->execute();
+            }
+        }
+#endif
+    }
+
+private:
+    class Runner : public WorkerPool::ITask {
+    public:
+        Runner(TTask *taskRef)
+            : m_taskRef(taskRef)
+        {
+        }
+        ~Runner() {
+            m_taskRef = 0;
+        }
+        void execute() {
+            m_taskRef->execute();
+        }
+    private:
+        TTask *m_taskRef;
+    };
+
+    const Array<TTask *> *m_taskRefs;
+    WorkerPool *m_workerPoolRef;
+};
+
 } /* namespace internal */
 } /* namespace vpvl2 */
 
@@ -0,0 +1,260 @@
+/**
+
+ Copyright (c) 2010-2013  hkrn
+
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or
+ without modification, are permitted provided that the following
+ conditions are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+ - Redistributions in binary form must reproduce the above
+   copyright notice, this list of conditions and the following
+   disclaimer in the documentation and/or other materials provided
+   with the distribution.
+ - Neither the name of the MMDAI project team nor the names of
+   its contributors may be used to endorse or promote products
+   derived from this software without specific prior written
+   permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#pragma once
+#ifndef VPVL2_INTERNAL_PHYSICSCACHE_H_
+#define VPVL2_INTERNAL_PHYSICSCACHE_H_
+
+#include "vpvl2/Common.h"
+
+namespace vpvl2
+{
+namespace internal
+{
+
+/**
+ * @file
+ * @author hkrn
+ *
+ * @section DESCRIPTION
+ *
+ * PhysicsCache class records world transforms of rigid bodies per frame to replay simulated
+ * results without stepping the physics world. Positions and rotations are quantized to integers
+ * and each frame is stored as zigzag varint deltas from the previous frame. An absolute frame
+ * is stored every kKeyframeInterval frames (or after a gap) to bound the cost of restoring.
+ */
+
+class PhysicsCache
+{
+public:
+    static const int kKeyframeInterval = 30;
+    static const int kPositionPrecision = 8192;
+    static const int kRotationPrecision = 32767;
+    static const int kNumComponents = 7;
+
+    PhysicsCache()
+        : m_lastFrameIndex(-1)
+    {
+    }
+    ~PhysicsCache() {
+        clear();
+    }
+
+    void record(int frameIndex, const Array<Transform> &transforms) {
+        if (Frame *const *framePtr = m_frames.find(frameIndex)) {
+            /* keep the cached frame but follow it to encode the next frame as delta */
+            const Frame *frame = *framePtr;
+            if (frameIndex == m_lastFrameIndex + 1 && !frame->absolute && m_lastValues.count() == frame->nbodies * kNumComponents) {
+                decode(frame, m_lastValues);
+            }
+            else {
+                restoreValues(frameIndex, m_lastValues);
+            }
+            m_lastFrameIndex = frameIndex;
+            return;
+        }
+        const int nbodies = transforms.count();
+        Array<int32> values;
+        values.resize(nbodies * kNumComponents);
+        const bool absolute = frameIndex != m_lastFrameIndex + 1 || frameIndex % kKeyframeInterval == 0
+                || m_lastValues.count() != values.count() || !m_frames.find(frameIndex - 1);
+        for (int i = 0; i < nbodies; i++) {
+            quantize(transforms[i], absolute ? 0 : &m_lastValues[i * kNumComponents], &values[i * kNumComponents]);
+        }
+        Frame *frame = m_frames.insert(frameIndex, new Frame(frameIndex, nbodies, absolute));
+        Array<uint8> &bytes = frame->bytes;
+        bytes.reserve(nbodies * kNumComponents * (absolute ? 4 : 2));
+        for (int i = 0, nvalues = values.count(); i < nvalues; i++) {
+            writeVarint(values[i] - (absolute ? 0 : m_lastValues[i]), bytes);
+        }
+        m_lastValues.copy(values);
+        m_lastFrameIndex = frameIndex;
+    }
+    bool restore(int frameIndex, Array<Transform> &transforms) const {
+        Array<int32> values;
+        if (!restoreValues(frameIndex, values)) {
+            return false;
+        }
+        const int nbodies = values.count() / kNumComponents;
+        transforms.resize(nbodies);
+        for (int i = 0; i < nbodies; i++) {
+            transforms[i] = dequantize(&values[i * kNumComponents]);
+        }
+        return true;
+    }
+    void invalidate(int fromFrameIndex) {
+        /* simulation depends on preceding frames so every frame after the edited one is stale */
+        Array<int> frameIndices;
+        const int nframes = m_frames.count();
+        for (int i = 0; i < nframes; i++) {
+            const Frame *frame = *m_frames.value(i);
+            if (frame->index >= fromFrameIndex) {
+                frameIndices.append(frame->index);
+            }
+        }
+        const int nremoves = frameIndices.count();
+        for (int i = 0; i < nremoves; i++) {
+            const int frameIndex = frameIndices[i];
+            delete *m_frames.find(frameIndex);
+            m_frames.remove(frameIndex);
+        }
+        if (m_lastFrameIndex >= fromFrameIndex) {
+            m_lastFrameIndex = -1;
+            m_lastValues.clear();
+        }
+    }
+    void clear() {
+        m_frames.releaseAll();
+        m_lastFrameIndex = -1;
+        m_lastValues.clear();
+    }
+    bool contains(int frameIndex) const {
+        return m_frames.find(frameIndex) != 0;
+    }
+    int countFrames() const {
+        return m_frames.count();
+    }
+    vsize estimateSize() const {
+        vsize size = 0;
+        const int nframes = m_frames.count();
+        for (int i = 0; i < nframes; i++) {
+            size += sizeof(Frame) + (*m_frames.value(i))->bytes.count();
+        }
+        return size;
+    }
+
+private:
+    struct Frame {
+        Frame(int i, int n, bool a)
+            : index(i),
+              nbodies(n),
+              absolute(a)
+        {
+        }
+        Array<uint8> bytes;
+        int index;
+        int nbodies;
+        bool absolute;
+    };
+
+    static void quantize(const Transform &transform, const int32 *previous, int32 *values) {
+        const Vector3 &origin = transform.getOrigin();
+        Quaternion rotation = transform.getRotation();
+        /* q and -q are the same rotation, so choose the one nearest to the previous frame */
+        const Scalar sign = previous ? Scalar(previous[3]) * rotation.x() + Scalar(previous[4]) * rotation.y()
+                                       + Scalar(previous[5]) * rotation.z() + Scalar(previous[6]) * rotation.w()
+                                     : rotation.w();
+        if (sign < 0) {
+            rotation = -rotation;
+        }
+        for (int i = 0; i < 3; i++) {
+            values[i] = int32(btFloor(origin[i] * kPositionPrecision + 0.5f));
+        }
+        values[3] = int32(btFloor(rotation.x() * kRotationPrecision + 0.5f));
+        values[4] = int32(btFloor(rotation.y() * kRotationPrecision + 0.5f));
+        values[5] = int32(btFloor(rotation.z() * kRotationPrecision + 0.5f));
+        values[6] = int32(btFloor(rotation.w() * kRotationPrecision + 0.5f));
+    }
+    static Transform dequantize(const int32 *values) {
+        const Vector3 origin(Scalar(values[0]) / kPositionPrecision,
+                             Scalar(values[1]) / kPositionPrecision,
+                             Scalar(values[2]) / kPositionPrecision);
+        Quaternion rotation(Scalar(values[3]), Scalar(values[4]), Scalar(values[5]), Scalar(values[6]));
+        if (rotation.length2() > 0) {
+            rotation.normalize();
+        }
+        else {
+            rotation = Quaternion::getIdentity();
+        }
+        return Transform(rotation, origin);
+    }
+    static void writeVarint(int32 value, Array<uint8> &bytes) {
+        uint32 v = (uint32(value) << 1) ^ uint32(value >> 31);
+        while (v >= 0x80) {
+            bytes.append(uint8(v | 0x80));
+            v >>= 7;
+        }
+        bytes.append(uint8(v));
+    }
+    static int32 readVarint(const Array<uint8> &bytes, int &offset) {
+        uint32 v = 0;
+        int shift = 0;
+        uint8 byte = 0;
+        do {
+            byte = bytes[offset++];
+            v |= uint32(byte & 0x7f) << shift;
+            shift += 7;
+        } while ((byte & 0x80) != 0);
+        return int32(v >> 1) ^ -int32(v & 1);
+    }
+    static void decode(const Frame *frame, Array<int32> &values) {
+        const int nvalues = frame->nbodies * kNumComponents;
+        if (frame->absolute) {
+            values.resize(nvalues);
+        }
+        int offset = 0;
+        for (int i = 0; i < nvalues; i++) {
+            const int32 value = readVarint(frame->bytes, offset);
+            values[i] = frame->absolute ? value : values[i] + value;
+        }
+    }
+    bool restoreValues(int frameIndex, Array<int32> &values) const {
+        if (!m_frames.find(frameIndex)) {
+            return false;
+        }
+        /* walk back to the nearest absolute frame and apply deltas forward */
+        int startIndex = frameIndex;
+        while (!(*m_frames.find(startIndex))->absolute) {
+            startIndex--;
+        }
+        for (int i = startIndex; i <= frameIndex; i++) {
+            decode(*m_frames.find(i), values);
+        }
+        return true;
+    }
+
+    PointerHash<HashInt, Frame> m_frames;
+    Array<int32> m_lastValues;
+    int m_lastFrameIndex;
+
+    VPVL2_DISABLE_COPY_AND_ASSIGN(PhysicsCache)
+};
+
+} /* namespace internal */
+} /* namespace vpvl2 */
+
+#endif
@@ -0,0 +1,215 @@
+/**
+
+ Copyright (c) 2010-2013  hkrn
+
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or
+ without modification, are permitted provided that the following
+ conditions are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+ - Redistributions in binary form must reproduce the above
+   copyright notice, this list of conditions and the following
+   disclaimer in the documentation and/or other materials provided
+   with the distribution.
+ - Neither the name of the MMDAI project team nor the names of
+   its contributors may be used to endorse or promote products
+   derived from this software without specific prior written
+   permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#pragma once
+#ifndef VPVL2_INTERNAL_PROFILER_H_
+#define VPVL2_INTERNAL_PROFILER_H_
+
+#include "vpvl2/Common.h"
+
+namespace vpvl2
+{
+namespace internal
+{
+
+/**
+ * @file
+ * @author hkrn
+ *
+ * @section DESCRIPTION
+ *
+ * Profiler class records nested begin/end pairs of hot paths into per-thread ring buffers.
+ *
+ * Each thread owns its ring buffer, so recording takes no locks. An end call closes the
+ * latest open begin call of the same thread and stores a span with both timestamps. When
+ * the ring buffer is full, the oldest spans are overwritten. #begin does nothing while the
+ * profiler is disabled.
+ *
+ * #collect, #reset and #setCapacity read or rewrite buffers owned by other threads. Call them
+ * only while no thread is recording, e.g. between frames after Scene#update returns.
+ */
+
+class VPVL2_API Profiler
+{
+public:
+    struct Span {
+        Span()
+            : start(0),
+              end(0),
+              argRef(0),
+              parentArgRef(0),
+              type(0),
+              track(0),
+              depth(0)
+        {
+        }
+        /* wall clock time in microseconds (ElapsedTimer#currentMicroseconds) */
+        int64 start;
+        int64 end;
+        const void *argRef;
+        /* argument of the enclosing span (e.g. the model of a material draw call) */
+        const void *parentArgRef;
+        int type;
+        /* thread ID assigned by the profiler or an external track such as GPU timers */
+        int track;
+        int depth;
+    };
+    struct Stats {
+        Stats()
+            : argRef(0),
+              parentArgRef(0),
+              type(0),
+              count(0),
+              total(0),
+              min(0),
+              max(0)
+        {
+        }
+        const void *argRef;
+        const void *parentArgRef;
+        int type;
+        int count;
+        int64 total;
+        int64 min;
+        int64 max;
+    };
+    static const int kDefaultCapacity = 16384;
+    static const int kMaxDepth = 64;
+
+    /**
+     * Returns true if the platform provides thread local storage that the profiler requires.
+     *
+     * @brief isAvailable
+     * @return
+     */
+    static bool isAvailable();
+    static bool isEnabled();
+    static void setEnabled(bool value);
+    static int capacity();
+    static void setCapacity(int value);
+
+    /**
+     * Opens a span of type with arg on the calling thread.
+     *
+     * @brief begin
+     * @param type
+     * @param arg
+     * @sa end
+     */
+    static void begin(int type, const void *arg);
+
+    /**
+     * Closes the latest open span of the calling thread.
+     *
+     * This closes the span even after the profiler is disabled so that begin/end pairs
+     * are kept balanced.
+     *
+     * @brief end
+     * @sa begin
+     */
+    static void end();
+
+    /**
+     * Stores a span measured externally (e.g. by GPU timer queries) into the calling thread's
+     * ring buffer with track instead of the thread ID.
+     *
+     * @brief record
+     * @param type
+     * @param arg
+     * @param start
+     * @param end
+     * @param track
+     */
+    static void record(int type, const void *arg, int64 start, int64 end, int track);
+
+    /**
+     * Copies spans of all threads sorted by start time into spans.
+     *
+     * @brief collect
+     * @param spans
+     */
+    static void collect(Array<Span> &spans);
+
+    /**
+     * Aggregates spans into per type and argument statistics sorted by total time descending.
+     *
+     * As render engines pass models to process sessions and materials to draw call sessions,
+     * this yields per-model and per-material statistics.
+     *
+     * @brief aggregate
+     * @param spans
+     * @param stats
+     */
+    static void aggregate(const Array<Span> &spans, Array<Stats> &stats);
+
+    /**
+     * Discards all spans and open begin calls of all threads.
+     *
+     * @brief reset
+     */
+    static void reset();
+
+private:
+    VPVL2_MAKE_STATIC_CLASS(Profiler)
+};
+
+class ScopedProfile
+{
+public:
+    ScopedProfile(int type, const void *arg)
+        : m_enabled(Profiler::isEnabled())
+    {
+        if (m_enabled) {
+            Profiler::begin(type, arg);
+        }
+    }
+    ~ScopedProfile() {
+        if (m_enabled) {
+            Profiler::end();
+        }
+    }
+
+private:
+    const bool m_enabled;
+
+    VPVL2_DISABLE_COPY_AND_ASSIGN(ScopedProfile)
+};
+
+} /* namespace internal */
+} /* namespace vpvl2 */
+
+#endif
@@ -0,0 +1,238 @@
+/**
+
+ Copyright (c) 2010-2013  hkrn
+
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or
+ without modification, are permitted provided that the following
+ conditions are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+ - Redistributions in binary form must reproduce the above
+   copyright notice, this list of conditions and the following
+   disclaimer in the documentation and/or other materials provided
+   with the distribution.
+ - Neither the name of the MMDAI project team nor the names of
+   its contributors may be used to endorse or promote products
+   derived from this software without specific prior written
+   permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#pragma once
+#ifndef VPVL2_INTERNAL_RENDERSTATECACHE_H_
+#define VPVL2_INTERNAL_RENDERSTATECACHE_H_
+
+#include "vpvl2/Common.h"
+#include "vpvl2/IMaterial.h"
+
+namespace vpvl2
+{
+
+class ITexture;
+
+namespace internal
+{
+
+/**
+ * @file
+ * @author hkrn
+ *
+ * @section DESCRIPTION
+ *
+ * Shadow copies of the render state to skip redundant state changes.
+ *
+ * Each update* method stores the value and returns true only if the value differs from
+ * the stored one, so the caller issues the actual API call only when it returns true.
+ * UniformStateCache belongs to a shader program because uniforms are a part of the program
+ * object. RenderStateCache is for texture units and capabilities that are shared with other
+ * render engines, so it must be invalidated at the beginning of each pass.
+ */
+
+class VPVL2_API UniformStateCache
+{
+public:
+    static const int kMaxLocations = 256;
+    static const int kMaxComponents = 4;
+
+    UniformStateCache();
+    ~UniformStateCache();
+
+    bool update1i(int location, int value);
+    bool update1f(int location, float32 value);
+    bool updatefv(int location, const float32 *values, int ncomponents);
+    void invalidate();
+
+private:
+    struct Value {
+        Value()
+            : integer(0),
+              ncomponents(0)
+        {
+            for (int i = 0; i < kMaxComponents; i++) {
+                components[i] = 0;
+            }
+        }
+        float32 components[kMaxComponents];
+        int integer;
+        int ncomponents;
+    };
+    Value *resolveValue(int location);
+
+    Array<Value> m_values;
+
+    VPVL2_DISABLE_COPY_AND_ASSIGN(UniformStateCache)
+};
+
+class VPVL2_API RenderStateCache
+{
+public:
+    enum CapabilityType {
+        kCullFace,
+        kMaxCapabilityType
+    };
+    static const int kMaxTextureUnits = 8;
+
+    RenderStateCache();
+    ~RenderStateCache();
+
+    bool updateActiveTexture(int unit);
+    bool updateTexture(int unit, uint32 name);
+    bool updateCapability(CapabilityType type, bool value);
+
+    /**
+     * Stores the state of the capability known by the caller without issuing the API call.
+     *
+     * @brief setCapability
+     * @param type
+     * @param value
+     */
+    void setCapability(CapabilityType type, bool value);
+    void invalidate();
+
+private:
+    enum StateType {
+        kUnknownState = -1,
+        kDisabledState,
+        kEnabledState
+    };
+    uint32 m_textures[kMaxTextureUnits];
+    bool m_hasTextures[kMaxTextureUnits];
+    int m_activeTexture;
+    int m_capabilities[kMaxCapabilityType];
+
+    VPVL2_DISABLE_COPY_AND_ASSIGN(RenderStateCache)
+};
+
+/**
+ * Material dependent values of the model program computed once per update
+ * instead of once per draw call.
+ *
+ * Values depending on the light are not stored because the light may change
+ * between update and render, see bindMaterialUniformBlock.
+ */
+struct VPVL2_API MaterialUniformBlock
+{
+    MaterialUniformBlock();
+    ~MaterialUniformBlock();
+
+    void update(const IMaterial *material, bool isMainTextureOpaque);
+
+    Color ambient;
+    Color diffuse;
+    Color specular;
+    Color mainTextureBlend;
+    Color sphereTextureBlend;
+    Color toonTextureBlend;
+    Scalar shininess;
+    ITexture *mainTextureRef;
+    ITexture *sphereTextureRef;
+    ITexture *toonTextureRef;
+    IMaterial::SphereTextureRenderMode sphereTextureRenderMode;
+    vsize indexOffset;
+    int nindices;
+    bool isCullingDisabled;
+    bool isSelfShadowEnabled;
+    bool isOpaque;
+};
+
+/**
+ * Sets uniforms and textures of the block lit by lightColor through the program.
+ *
+ * TProgram skips unchanged values by itself, see UniformStateCache and RenderStateCache.
+ *
+ * @brief bindMaterialUniformBlock
+ * @param program
+ * @param block
+ * @param lightColor
+ * @param depthTexture
+ */
+template<typename TProgram>
+inline void bindMaterialUniformBlock(TProgram *program, const MaterialUniformBlock &block, const Vector3 &lightColor, uint32 depthTexture)
+{
+    const Color &ma = block.ambient, &md = block.diffuse, &ms = block.specular;
+    program->setMaterialColor(Color(ma.x() + md.x() * lightColor.x(),
+                                    ma.y() + md.y() * lightColor.y(),
+                                    ma.z() + md.z() * lightColor.z(),
+                                    md.w()));
+    program->setMaterialSpecular(Color(ms.x() * lightColor.x(), ms.y() * lightColor.y(), ms.z() * lightColor.z(), 1.0));
+    program->setMaterialShininess(block.shininess);
+    program->setMainTextureBlend(block.mainTextureBlend);
+    program->setSphereTextureBlend(block.sphereTextureBlend);
+    program->setToonTextureBlend(block.toonTextureBlend);
+    program->setMainTexture(block.mainTextureRef);
+    program->setSphereTexture(block.sphereTextureRef, block.sphereTextureRenderMode);
+    program->setToonTexture(block.toonTextureRef);
+    program->setDepthTexture(block.isSelfShadowEnabled ? depthTexture : 0);
+}
+
+class VPVL2_API MaterialDrawOrder
+{
+public:
+    MaterialDrawOrder();
+    ~MaterialDrawOrder();
+
+    /**
+     * Builds the order to draw materials.
+     *
+     * The order is the one of the model unless sort is true. Even if sort is true,
+     * only contiguous runs of opaque materials are sorted by state (culling, textures
+     * and self shadow) because translucent materials depend on the order of the model.
+     * Sorting is skipped if opacities of materials are same as the previous call.
+     *
+     * @brief build
+     * @param blocks
+     * @param sort
+     */
+    void build(const Array<MaterialUniformBlock> &blocks, bool sort);
+    int count() const { return m_order.count(); }
+    int at(int index) const { return m_order[index]; }
+
+private:
+    Array<int> m_order;
+    Array<bool> m_opaques;
+    bool m_sorted;
+
+    VPVL2_DISABLE_COPY_AND_ASSIGN(MaterialDrawOrder)
+};
+
+} /* namespace internal */
+} /* namespace vpvl2 */
+
+#endif
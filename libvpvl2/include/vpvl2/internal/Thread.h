@@ -0,0 +1,131 @@
+/**
+
+ Copyright (c) 2010-2013  hkrn
+
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or
+ without modification, are permitted provided that the following
+ conditions are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+ - Redistributions in binary form must reproduce the above
+   copyright notice, this list of conditions and the following
+   disclaimer in the documentation and/or other materials provided
+   with the distribution.
+ - Neither the name of the MMDAI project team nor the names of
+   its contributors may be used to endorse or promote products
+   derived from this software without specific prior written
+   permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#pragma once
+#ifndef VPVL2_INTERNAL_THREAD_H_
+#define VPVL2_INTERNAL_THREAD_H_
+
+#include "vpvl2/Common.h"
+#include "vpvl2/internal/Mutex.h"
+
+namespace vpvl2
+{
+namespace internal
+{
+
+/**
+ * @file
+ * @author hkrn
+ *
+ * @section DESCRIPTION
+ *
+ * Thread runs IRunnable#run on a native thread (Win32 or pthread) and Condition is a
+ * condition variable waiting with a locked Mutex to make workers wait for tasks.
+ * ElapsedTimer measures wall clock time in microseconds with a monotonic clock.
+ */
+
+class VPVL2_API Thread
+{
+public:
+    class IRunnable {
+    public:
+        virtual ~IRunnable() {}
+        virtual void run() = 0;
+    };
+
+    static int countProcessors();
+
+    explicit Thread(IRunnable *runnableRef);
+    ~Thread();
+
+    bool start();
+    void join();
+    bool isRunning() const;
+
+private:
+    struct PrivateContext;
+    PrivateContext *m_context;
+
+    VPVL2_DISABLE_COPY_AND_ASSIGN(Thread)
+};
+
+class VPVL2_API Condition
+{
+public:
+    Condition();
+    ~Condition();
+
+    /* must be called with the mutex locked by the caller */
+    void wait(Mutex &mutex);
+    void notify();
+    void notifyAll();
+
+private:
+    struct PrivateContext;
+    PrivateContext *m_context;
+
+    VPVL2_DISABLE_COPY_AND_ASSIGN(Condition)
+};
+
+class VPVL2_API ElapsedTimer
+{
+public:
+    static int64 currentMicroseconds();
+
+    ElapsedTimer()
+        : m_started(currentMicroseconds())
+    {
+    }
+    ~ElapsedTimer() {
+        m_started = 0;
+    }
+
+    void restart() {
+        m_started = currentMicroseconds();
+    }
+    int64 elapsed() const {
+        return currentMicroseconds() - m_started;
+    }
+
+private:
+    int64 m_started;
+};
+
+} /* namespace internal */
+} /* namespace vpvl2 */
+
+#endif
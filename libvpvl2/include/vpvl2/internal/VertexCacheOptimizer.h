@@ -0,0 +1,281 @@
+/**
+
+ Copyright (c) 2010-2013  hkrn
+
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or
+ without modification, are permitted provided that the following
+ conditions are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+ - Redistributions in binary form must reproduce the above
+   copyright notice, this list of conditions and the following
+   disclaimer in the documentation and/or other materials provided
+   with the distribution.
+ - Neither the name of the MMDAI project team nor the names of
+   its contributors may be used to endorse or promote products
+   derived from this software without specific prior written
+   permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#pragma once
+#ifndef VPVL2_INTERNAL_VERTEXCACHEOPTIMIZER_H_
+#define VPVL2_INTERNAL_VERTEXCACHEOPTIMIZER_H_
+
+#include "vpvl2/Common.h"
+
+namespace vpvl2
+{
+namespace internal
+{
+
+/**
+ * @file
+ * @author hkrn
+ *
+ * @section DESCRIPTION
+ *
+ * VertexCacheOptimizer class reorders triangles for the post-transform vertex cache with
+ * Tipsify (Sander et al. 2007) and vertices for fetch locality. It also simulates a FIFO
+ * vertex cache to compute ACMR (cache misses per triangle) and ATVR (cache misses per
+ * referenced vertex) without GPU.
+ */
+
+class VertexCacheOptimizer
+{
+public:
+    static const int kDefaultCacheSize = 16;
+
+    struct Statistics {
+        Statistics()
+            : nmisses(0),
+              ntriangles(0),
+              nvertices(0)
+        {
+        }
+        void add(const Statistics &value) {
+            nmisses += value.nmisses;
+            ntriangles += value.ntriangles;
+            nvertices += value.nvertices;
+        }
+        Scalar acmr() const {
+            return ntriangles > 0 ? Scalar(nmisses) / ntriangles : 0;
+        }
+        Scalar atvr() const {
+            return nvertices > 0 ? Scalar(nmisses) / nvertices : 0;
+        }
+        int nmisses;
+        int ntriangles;
+        int nvertices;
+    };
+
+    /**
+     * Maps vertex indices referenced by a range of indices to a dense local range. Entries of
+     * the table are stamped by each call, so one instance is reused for all materials of a
+     * model instead of allocating tables sized by the vertex count for each material.
+     */
+    class LocalIndexMap {
+    public:
+        LocalIndexMap()
+            : m_stamp(0)
+        {
+        }
+        ~LocalIndexMap() {
+            m_stamp = 0;
+        }
+
+        int build(const int *indices, int nindices, Array<int> &localIndices) {
+            m_stamp++;
+            m_globalIndices.clear();
+            localIndices.resize(nindices);
+            for (int i = 0; i < nindices; i++) {
+                const int index = indices[i];
+                if (index >= m_stamps.count()) {
+                    const int size = btMax(index + 1, m_stamps.count() * 2);
+                    m_stamps.resize(size);
+                    m_localIndices.resize(size);
+                }
+                if (m_stamps[index] != m_stamp) {
+                    m_stamps[index] = m_stamp;
+                    m_localIndices[index] = m_globalIndices.count();
+                    m_globalIndices.append(index);
+                }
+                localIndices[i] = m_localIndices[index];
+            }
+            return m_globalIndices.count();
+        }
+        int globalIndex(int value) const {
+            return m_globalIndices[value];
+        }
+
+    private:
+        Array<int> m_stamps;
+        Array<int> m_localIndices;
+        Array<int> m_globalIndices;
+        int m_stamp;
+    };
+
+    static void optimizeTriangles(int *indices, int nindices, int cacheSize, LocalIndexMap &map) {
+        const int ntriangles = nindices / 3, ntriangleIndices = ntriangles * 3;
+        if (ntriangles <= 1) {
+            return;
+        }
+        Array<int> localIndices;
+        const int nvertices = map.build(indices, ntriangleIndices, localIndices);
+        Array<int> offsets, adjacency, live, cacheTime, deadEnd, candidates, output;
+        Array<uint8> emitted;
+        offsets.resize(nvertices + 1);
+        for (int i = 0; i < ntriangleIndices; i++) {
+            offsets[localIndices[i] + 1]++;
+        }
+        live.resize(nvertices);
+        for (int i = 0; i < nvertices; i++) {
+            live[i] = offsets[i + 1];
+            offsets[i + 1] += offsets[i];
+        }
+        Array<int> cursors;
+        cursors.copy(offsets);
+        adjacency.resize(ntriangleIndices);
+        for (int i = 0; i < ntriangleIndices; i++) {
+            adjacency[cursors[localIndices[i]]++] = i / 3;
+        }
+        cacheTime.resize(nvertices);
+        emitted.resize(ntriangles);
+        output.reserve(ntriangleIndices);
+        int fanning = localIndices[0], cursor = 0, time = cacheSize + 1;
+        while (fanning >= 0) {
+            candidates.clear();
+            for (int i = offsets[fanning], end = offsets[fanning + 1]; i < end; i++) {
+                const int triangle = adjacency[i];
+                if (!emitted[triangle]) {
+                    for (int j = 0; j < 3; j++) {
+                        const int vertex = localIndices[triangle * 3 + j];
+                        output.append(vertex);
+                        deadEnd.append(vertex);
+                        candidates.append(vertex);
+                        live[vertex]--;
+                        if (time - cacheTime[vertex] > cacheSize) {
+                            cacheTime[vertex] = time++;
+                        }
+                    }
+                    emitted[triangle] = 1;
+                }
+            }
+            fanning = nextVertex(candidates, live, cacheTime, deadEnd, time, cacheSize, cursor);
+        }
+        for (int i = 0; i < ntriangleIndices; i++) {
+            indices[i] = map.globalIndex(output[i]);
+        }
+    }
+    static int remapVertices(int *indices, int nindices, int nvertices, Array<int> &newIndices) {
+        int nextIndex = 0;
+        newIndices.resize(nvertices);
+        for (int i = 0; i < nvertices; i++) {
+            newIndices[i] = -1;
+        }
+        for (int i = 0; i < nindices; i++) {
+            int &newIndex = newIndices[indices[i]];
+            if (newIndex < 0) {
+                newIndex = nextIndex++;
+            }
+            indices[i] = newIndex;
+        }
+        /* unreferenced vertices are kept at the tail in the same order */
+        const int nreferenced = nextIndex;
+        for (int i = 0; i < nvertices; i++) {
+            int &newIndex = newIndices[i];
+            if (newIndex < 0) {
+                newIndex = nextIndex++;
+            }
+        }
+        return nreferenced;
+    }
+    static void simulate(const int *indices, int nindices, int cacheSize, LocalIndexMap &map, Statistics &value) {
+        Array<int> localIndices;
+        const int nvertices = map.build(indices, nindices, localIndices);
+        Array<int> insertedAt;
+        insertedAt.resize(nvertices);
+        for (int i = 0; i < nvertices; i++) {
+            insertedAt[i] = -1;
+        }
+        value.nmisses = value.nvertices = 0;
+        value.ntriangles = nindices / 3;
+        for (int i = 0; i < nindices; i++) {
+            int &at = insertedAt[localIndices[i]];
+            if (at < 0) {
+                value.nvertices++;
+            }
+            /* a FIFO cache evicts the entry inserted cacheSize misses before */
+            if (at < 0 || value.nmisses - at >= cacheSize) {
+                at = value.nmisses++;
+            }
+        }
+    }
+
+private:
+    static int nextVertex(const Array<int> &candidates,
+                          const Array<int> &live,
+                          const Array<int> &cacheTime,
+                          Array<int> &deadEnd,
+                          int time,
+                          int cacheSize,
+                          int &cursor) {
+        const int ncandidates = candidates.count();
+        int vertex = -1, priority = -1;
+        for (int i = 0; i < ncandidates; i++) {
+            const int candidate = candidates[i];
+            if (live[candidate] > 0) {
+                int value = 0;
+                /* prefers vertices that will still be in the cache after fanning them */
+                if (time - cacheTime[candidate] + 2 * live[candidate] <= cacheSize) {
+                    value = time - cacheTime[candidate];
+                }
+                if (value > priority) {
+                    priority = value;
+                    vertex = candidate;
+                }
+            }
+        }
+        if (vertex < 0) {
+            while (deadEnd.count() > 0) {
+                const int last = deadEnd.count() - 1, candidate = deadEnd[last];
+                deadEnd.resize(last);
+                if (live[candidate] > 0) {
+                    return candidate;
+                }
+            }
+            const int nvertices = live.count();
+            while (cursor < nvertices) {
+                if (live[cursor] > 0) {
+                    return cursor;
+                }
+                cursor++;
+            }
+        }
+        return vertex;
+    }
+
+    VPVL2_MAKE_STATIC_CLASS(VertexCacheOptimizer)
+};
+
+} /* namespace internal */
+} /* namespace vpvl2 */
+
+#endif
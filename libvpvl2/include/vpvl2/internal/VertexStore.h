@@ -0,0 +1,317 @@
+/**
+
+ Copyright (c) 2010-2013  hkrn
+
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or
+ without modification, are permitted provided that the following
+ conditions are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+ - Redistributions in binary form must reproduce the above
+   copyright notice, this list of conditions and the following
+   disclaimer in the documentation and/or other materials provided
+   with the distribution.
+ - Neither the name of the MMDAI project team nor the names of
+   its contributors may be used to endorse or promote products
+   derived from this software without specific prior written
+   permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#pragma once
+#ifndef VPVL2_INTERNAL_VERTEXSTORE_H_
+#define VPVL2_INTERNAL_VERTEXSTORE_H_
+
+#include "vpvl2/Common.h"
+#include "vpvl2/Factory.h"
+#include "vpvl2/IBone.h"
+#include "vpvl2/IMaterial.h"
+#include "vpvl2/IVertex.h"
+#include "vpvl2/internal/util.h"
+
+namespace vpvl2
+{
+namespace internal
+{
+
+class MaterialAabbList;
+
+/**
+ * @file
+ * @author hkrn
+ *
+ * @section DESCRIPTION
+ *
+ * VertexStore class holds skinning attributes of vertices as structure of arrays.
+ *
+ * Vertices are grouped by deform type (BDEF1/BDEF2/BDEF4/SDEF) and each group
+ * is processed by a vectorized kernel (4 vertices per iteration on SSE2 and
+ * 8 vertices per iteration on AVX). The kernel writes skinned position, normal
+ * and edge vertex into the mapped dynamic vertex buffer directly.
+ *
+ * Results are bit-exact with IVertex#performSkinning because the kernel performs
+ * the same floating point operations in the same order.
+ */
+
+class VPVL2_API VertexStore
+{
+public:
+    enum GroupType {
+        kBdef1Group,
+        kBdef2Group,
+        kBdef4Group,
+        kSdefGroup,
+        kMaxGroupType
+    };
+    enum KernelType {
+        kScalarKernel,
+        kSSE2Kernel,
+        kAVXKernel,
+        kMaxKernelType
+    };
+    struct Output {
+        Output()
+            : address(0),
+              stride(0),
+              positionOffset(0),
+              normalOffset(0),
+              edgeOffset(0),
+              materialAabbsRef(0)
+        {
+        }
+        uint8 *address;
+        vsize stride;
+        vsize positionOffset;
+        vsize normalOffset;
+        vsize edgeOffset;
+        /* per-material AABBs reduced with skinned positions and edges if not null */
+        MaterialAabbList *materialAabbsRef;
+    };
+    typedef btAlignedObjectArray<float32> FloatArray;
+    typedef btAlignedObjectArray<int32> IntArray;
+    struct Group {
+        Group()
+            : count(0)
+        {
+        }
+        void clear() {
+            for (int i = 0; i < 3; i++) {
+                positions[i].clear();
+                normals[i].clear();
+                deltas[i].clear();
+            }
+            for (int i = 0; i < 4; i++) {
+                bones[i].clear();
+                weights[i].clear();
+            }
+            vertexIndices.clear();
+            materialIndices.clear();
+            edgeSizes.clear();
+            count = 0;
+        }
+        IntArray vertexIndices;
+        IntArray materialIndices;
+        IntArray bones[4];
+        FloatArray weights[4];
+        FloatArray positions[3];
+        FloatArray normals[3];
+        FloatArray deltas[3];
+        FloatArray edgeSizes;
+        int count;
+    };
+    static const int kPaletteStride = 12;
+    static const int kMaxLaneSize = 8;
+
+    /**
+     * Returns the fastest kernel type supported by the compiled binary.
+     *
+     * @return KernelType
+     */
+    static KernelType defaultKernelType();
+
+    VertexStore();
+    ~VertexStore();
+
+    /**
+     * Rebuild all groups from vertices.
+     *
+     * BDEF2/SDEF vertices whose weight is 0 or 1 are stored to BDEF1 group
+     * with the effective bone as IVertex#performSkinning does.
+     *
+     * @param vertices
+     * @param nbones
+     * @param nmaterials
+     */
+    template<typename TVertex>
+    void build(const Array<TVertex *> &vertices, int nbones, int nmaterials) {
+        for (int i = 0; i < kMaxGroupType; i++) {
+            m_groups[i].clear();
+        }
+        m_vertexGroups.clear();
+        m_vertexSlots.clear();
+        m_nbones = nbones;
+        m_nmaterials = nmaterials;
+        const int nvertices = vertices.count();
+        m_vertexGroups.resize(nvertices);
+        m_vertexSlots.resize(nvertices);
+        for (int i = 0; i < nvertices; i++) {
+            const IVertex *vertex = vertices[i];
+            const IVertex::WeightPrecision &weight = vertex->weight(0);
+            switch (vertex->type()) {
+            case IVertex::kBdef1:
+                appendVertex(kBdef1Group, i, vertex, boneIndex(vertex, 0), -1, -1, -1, 0, 0, 0, 0);
+                break;
+            case IVertex::kBdef2:
+            case IVertex::kSdef: {
+                if (btFuzzyZero(Scalar(1 - weight))) {
+                    appendVertex(kBdef1Group, i, vertex, boneIndex(vertex, 0), -1, -1, -1, 0, 0, 0, 0);
+                }
+                else if (btFuzzyZero(Scalar(weight))) {
+                    appendVertex(kBdef1Group, i, vertex, boneIndex(vertex, 1), -1, -1, -1, 0, 0, 0, 0);
+                }
+                else {
+                    /* SDEF is skinned as linear blend same as IVertex#performSkinning */
+                    GroupType type = vertex->type() == IVertex::kSdef ? kSdefGroup : kBdef2Group;
+                    const float32 rest = 1.0f - weight;
+                    appendVertex(type, i, vertex, boneIndex(vertex, 0), boneIndex(vertex, 1), -1, -1, weight, rest, 0, 0);
+                }
+                break;
+            }
+            case IVertex::kBdef4:
+            case IVertex::kQdef: {
+                /* QDEF is approximated as BDEF4 */
+                const IVertex::WeightPrecision &w1 = vertex->weight(0), &w2 = vertex->weight(1), &w3 = vertex->weight(2), &w4 = vertex->weight(3);
+                const IVertex::WeightPrecision &s = w1 + w2 + w3 + w4, &w1s = w1 / s, &w2s = w2 / s, &w3s = w3 / s, &w4s = w4 / s;
+                appendVertex(kBdef4Group, i, vertex,
+                             boneIndex(vertex, 0), boneIndex(vertex, 1), boneIndex(vertex, 2), boneIndex(vertex, 3),
+                             w1s, w2s, w3s, w4s);
+                break;
+            }
+            case IVertex::kMaxType:
+            default:
+                m_vertexGroups[i] = kMaxGroupType;
+                m_vertexSlots[i] = -1;
+                break;
+            }
+        }
+        for (int i = 0; i < kMaxGroupType; i++) {
+            padGroup(m_groups[i]);
+        }
+        m_palette.resize((nbones + 1) * kPaletteStride);
+        setPaletteAt(nbones, Transform::getIdentity());
+        m_materialEdgeSizes.resize(nmaterials + 1);
+        m_materialEdgeSizes[nmaterials] = 1;
+    }
+
+    /**
+     * Copy local transforms of bones to the palette.
+     *
+     * @param bones
+     */
+    template<typename TBone>
+    void updateBonePalette(const Array<TBone *> &bones) {
+        const int nbones = btMin(bones.count(), m_nbones);
+        for (int i = 0; i < nbones; i++) {
+            const IBone *bone = bones[i];
+            setPaletteAt(i, bone->localTransform());
+        }
+    }
+
+    /**
+     * Compute edge size of each material scaled with edgeScaleFactor.
+     *
+     * @param materials
+     * @param edgeScaleFactor
+     */
+    template<typename TMaterial>
+    void updateMaterialEdgeSizes(const Array<TMaterial *> &materials, const IVertex::EdgeSizePrecision &edgeScaleFactor) {
+        const int nmaterials = btMin(materials.count(), m_nmaterials);
+        for (int i = 0; i < nmaterials; i++) {
+            const IMaterial *material = materials[i];
+            m_materialEdgeSizes[i] = float32(material->edgeSize() * edgeScaleFactor);
+        }
+        m_materialEdgeSizes[m_nmaterials] = float32(Factory::sharedNullMaterialRef()->edgeSize() * edgeScaleFactor);
+    }
+
+    void setMorphDelta(int vertexIndex, const Vector3 &value) {
+        if (internal::checkBound(vertexIndex, 0, m_vertexSlots.size())) {
+            const int groupIndex = m_vertexGroups[vertexIndex];
+            if (groupIndex != kMaxGroupType) {
+                Group &group = m_groups[groupIndex];
+                const int slot = m_vertexSlots[vertexIndex];
+                group.deltas[0][slot] = value.x();
+                group.deltas[1][slot] = value.y();
+                group.deltas[2][slot] = value.z();
+            }
+        }
+    }
+
+    /**
+     * Skin vertices of the group in range [begin, end) and writes them to output.
+     *
+     * aabbMin and aabbMax are expanded with skinned positions. Partial AABBs of the slot in
+     * Output#materialAabbsRef are also expanded, see MaterialAabbList#reduce.
+     *
+     * @param type
+     * @param begin
+     * @param end
+     * @param output
+     * @param aabbMin
+     * @param aabbMax
+     * @param slot
+     */
+    void perform(GroupType type, int begin, int end, const Output &output, Vector3 &aabbMin, Vector3 &aabbMax, int slot) const;
+    void performAll(const Output &output, Vector3 &aabbMin, Vector3 &aabbMax) const;
+
+    const Group &group(GroupType type) const { return m_groups[type]; }
+    int countVertices(GroupType type) const { return m_groups[type].count; }
+    KernelType kernelType() const { return m_kernelType; }
+    void setKernelType(KernelType value);
+
+private:
+    static inline int32 boneIndexOf(const IBone *bone, int nbones) {
+        const int index = bone ? bone->index() : -1;
+        return internal::checkBound(index, 0, nbones) ? index : nbones;
+    }
+    inline int32 boneIndex(const IVertex *vertex, int offset) const {
+        return boneIndexOf(vertex->boneRef(offset), m_nbones);
+    }
+    void appendVertex(GroupType type, int vertexIndex, const IVertex *vertex,
+                      int32 bone1, int32 bone2, int32 bone3, int32 bone4,
+                      float32 weight1, float32 weight2, float32 weight3, float32 weight4);
+    void padGroup(Group &group);
+    void setPaletteAt(int index, const Transform &transform);
+
+    Group m_groups[kMaxGroupType];
+    IntArray m_vertexGroups;
+    IntArray m_vertexSlots;
+    FloatArray m_palette;
+    FloatArray m_materialEdgeSizes;
+    KernelType m_kernelType;
+    int m_nbones;
+    int m_nmaterials;
+
+    VPVL2_DISABLE_COPY_AND_ASSIGN(VertexStore)
+};
+
+} /* namespace internal */
+} /* namespace vpvl2 */
+
+#endif
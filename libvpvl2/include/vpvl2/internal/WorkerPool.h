@@ -0,0 +1,163 @@
+/**
+
+ Copyright (c) 2010-2013  hkrn
+
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or
+ without modification, are permitted provided that the following
+ conditions are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+ - Redistributions in binary form must reproduce the above
+   copyright notice, this list of conditions and the following
+   disclaimer in the documentation and/or other materials provided
+   with the distribution.
+ - Neither the name of the MMDAI project team nor the names of
+   its contributors may be used to endorse or promote products
+   derived from this software without specific prior written
+   permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#pragma once
+#ifndef VPVL2_INTERNAL_WORKERPOOL_H_
+#define VPVL2_INTERNAL_WORKERPOOL_H_
+
+#include "vpvl2/Common.h"
+#include "vpvl2/internal/Thread.h"
+
+namespace vpvl2
+{
+namespace internal
+{
+
+/**
+ * @file
+ * @author hkrn
+ *
+ * @section DESCRIPTION
+ *
+ * WorkerPool executes enqueued tasks in FIFO order on a fixed number of threads.
+ * BoundedQueue passes results from workers to a consumer thread; producers wait while
+ * the queue is full so that finished but not yet consumed results never pile up.
+ */
+
+class VPVL2_API WorkerPool
+{
+public:
+    class ITask {
+    public:
+        virtual ~ITask() {}
+        virtual void execute() = 0;
+    };
+
+    explicit WorkerPool(int nthreads);
+    ~WorkerPool();
+
+    /* takes ownership of the task, it's deleted after execution */
+    void enqueue(ITask *task);
+    void waitForCompletion();
+    int countThreads() const;
+    int countPendingTasks() const;
+
+private:
+    struct PrivateContext;
+    PrivateContext *m_context;
+
+    VPVL2_DISABLE_COPY_AND_ASSIGN(WorkerPool)
+};
+
+template<typename T>
+class BoundedQueue
+{
+public:
+    explicit BoundedQueue(int capacity)
+        : m_head(0),
+          m_count(0),
+          m_closed(false)
+    {
+        m_values.resize(btMax(capacity, 1));
+    }
+    ~BoundedQueue() {
+        m_head = m_count = 0;
+    }
+
+    bool push(const T &value) {
+        ScopedLock locker(m_mutex);
+        while (!m_closed && m_count == m_values.count()) {
+            m_condition.wait(m_mutex);
+        }
+        if (m_closed) {
+            return false;
+        }
+        m_values[(m_head + m_count) % m_values.count()] = value;
+        m_count++;
+        m_condition.notifyAll();
+        return true;
+    }
+    bool pop(T &value) {
+        ScopedLock locker(m_mutex);
+        while (!m_closed && m_count == 0) {
+            m_condition.wait(m_mutex);
+        }
+        return take(value);
+    }
+    bool tryPop(T &value) {
+        ScopedLock locker(m_mutex);
+        return take(value);
+    }
+    void close() {
+        ScopedLock locker(m_mutex);
+        m_closed = true;
+        m_condition.notifyAll();
+    }
+    int count() const {
+        ScopedLock locker(m_mutex);
+        return m_count;
+    }
+    int capacity() const {
+        return m_values.count();
+    }
+
+private:
+    bool take(T &value) {
+        if (m_count == 0) {
+            return false;
+        }
+        value = m_values[m_head];
+        m_head = (m_head + 1) % m_values.count();
+        m_count--;
+        m_condition.notifyAll();
+        return true;
+    }
+
+    mutable Mutex m_mutex;
+    Condition m_condition;
+    Array<T> m_values;
+    int m_head;
+    int m_count;
+    bool m_closed;
+
+    VPVL2_DISABLE_COPY_AND_ASSIGN(BoundedQueue)
+};
+
+} /* namespace internal */
+} /* namespace vpvl2 */
+
+#endif
@@ -99,8 +99,34 @@ public:
     void getLocalTransform(const Transform &worldTransform, Transform &output) const;
     void performTransform();
     void solveInverseKinematics();
+
+    /**
+     * Solves IK of the bone and stops iterations when the distance between the effector and
+     * the bone gets equal to or less than threshold.
+     *
+     * @param threshold
+     * @param residual the distance between the effector and the bone after solving
+     * @return count of iterations performed
+     */
+    int solveInverseKinematics(const Scalar &threshold, Scalar &residual);
     void updateLocalTransform();
     void resetIKLink();
+
+    /**
+     * Returns true if the transform of the bone must be recomputed in the next update.
+     *
+     * The flag is set when local translation/orientation/transform, bone morph or hierarchy of the bone
+     * is changed and cleared by pmx::Model after the bone is updated.
+     */
+    bool isDirty() const;
+    void setDirty(bool value);
+
+    /**
+     * Marks the bone dirty when a bone it depends on (parent, parent of inherence or IK chain) is dirty.
+     *
+     * @return true if any dirty flag is changed
+     */
+    bool propagateDirty();
     Vector3 offset() const;
     Transform worldTransform() const;
     Transform localTransform() const;
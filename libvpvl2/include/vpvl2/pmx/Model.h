@@ -48,6 +48,11 @@
 
 namespace vpvl2
 {
+namespace internal
+{
+class VertexStore;
+}
+
 namespace pmx
 {
 
@@ -88,6 +93,8 @@ public:
         kIndexStride
     };
 
+    static const int kMaxVertexChunks = 64;
+
     struct DataInfo
     {
         IEncoding *encoding;
@@ -112,6 +119,8 @@ public:
         int englishCommentSize;
         uint8 *verticesPtr;
         vsize verticesCount;
+        uint8 *vertexChunkPtrs[kMaxVertexChunks];
+        vsize vertexChunkSize;
         uint8 *indicesPtr;
         vsize indicesCount;
         uint8 *texturesPtr;
@@ -131,6 +140,28 @@ public:
         uint8 *endPtr;
     };
 
+    struct InverseKinematicsStatistics
+    {
+        InverseKinematicsStatistics()
+            : nchains(0),
+              niterations(0),
+              nconverged(0),
+              maxResidual(0),
+              totalResidual(0)
+        {
+        }
+        /* count of IK chains solved */
+        int nchains;
+        /* total count of iterations performed by the chains */
+        int niterations;
+        /* count of chains terminated by the threshold */
+        int nconverged;
+        /* max distance between the effector and the IK bone */
+        Scalar maxResidual;
+        /* sum of distances between the effector and the IK bone */
+        Scalar totalResidual;
+    };
+
     /**
      * Constructor
      */
@@ -207,7 +238,7 @@ public:
     void setParentBoneRef(IBone *value);
     void setPhysicsEnable(bool value);
 
-    static void updateLocalTransform(Array<Bone *> &bones);
+    void updateLocalTransform(Array<Bone *> &bones);
     void getIndexBuffer(IndexBuffer *&indexBuffer) const;
     void getStaticVertexBuffer(StaticVertexBuffer *&staticBuffer) const;
     void getDynamicVertexBuffer(DynamicVertexBuffer *&dynamicBuffer,
@@ -218,6 +249,126 @@ public:
     void setAabb(const Vector3 &min, const Vector3 &max);
     void getAabb(Vector3 &min, Vector3 &max) const;
 
+    /**
+     * Enable skinning with structure of arrays vertex store and vectorized kernel.
+     *
+     * The dynamic vertex buffer skins vertices with internal::VertexStore instead of
+     * calling Vertex#performSkinning for each vertex if enabled.
+     *
+     * @param value
+     */
+    void setVectorizedSkinningEnable(bool value);
+    bool isVectorizedSkinningEnabled() const;
+    internal::VertexStore *vertexStoreRef() const;
+    void invalidateVertexStore();
+
+    /**
+     * Enable lazy loading.
+     *
+     * #load parses only names, textures and bones if enabled and keeps pointers to the given data
+     * without copying, so the data (typically memory mapped) must be alive until #isMaterialized
+     * returns true. Vertices, indices and materials, rigid bodies and joints, morphs and labels
+     * are parsed per section on first access. #count returns values from the preparsed data
+     * without parsing.
+     *
+     * Materialization is not thread safe and should be done by #materializeAll before sharing
+     * the model among threads.
+     *
+     * @param value
+     */
+    void setLazyLoadEnable(bool value);
+    bool isLazyLoadEnabled() const;
+    bool isMaterialized() const;
+    bool materializeAll();
+
+    /**
+     * Enable parsing sections concurrently in #load.
+     *
+     * Vertices are split into chunks indexed by #preparse and each chunk, indices and the other
+     * sections are parsed as independent tasks. Materials and linking among sections are done
+     * after all tasks are finished.
+     *
+     * @param value
+     */
+    void setParallelLoadEnable(bool value);
+    bool isParallelLoadEnabled() const;
+
+    /**
+     * Enable updating only dirty bones and bones depending on them in #performUpdate (enabled by default).
+     *
+     * Disabling this forces all bones to be transformed in every update as before.
+     *
+     * @param value
+     */
+    void setIncrementalBoneUpdateEnable(bool value);
+    bool isIncrementalBoneUpdateEnabled() const;
+
+    /**
+     * Enable resetting only vertices merged by morphs in the previous update (enabled by default).
+     *
+     * Disabling this resets morph deltas and UVs of all vertices in every #performUpdate as before.
+     *
+     * @param value
+     */
+    void setSparseMorphUpdateEnable(bool value);
+    bool isSparseMorphUpdateEnabled() const;
+
+    /**
+     * Set the maximum count of bone matrices per sub-mesh used by #getMatrixBuffer (128 by default).
+     *
+     * This should be equal to the length of the bone matrix uniform array of the skinning shader.
+     *
+     * @param value
+     */
+    void setMaxBonePaletteSize(int value);
+    int maxBonePaletteSize() const;
+
+    /**
+     * Enable reordering triangles and vertices for the post-transform vertex cache in #load (disabled by default).
+     *
+     * Lazily loaded models are not optimized until #optimizeVertexCache is called.
+     *
+     * @param value
+     */
+    void setVertexCacheOptimizationEnable(bool value);
+    bool isVertexCacheOptimizationEnabled() const;
+
+    /**
+     * Reorder triangles of each material with Tipsify and vertices in order of the first reference.
+     *
+     * Index ranges of materials are kept and vertex indices of vertex and UV morphs are updated.
+     *
+     * @param cacheSize
+     */
+    void optimizeVertexCache(int cacheSize);
+
+    /**
+     * Compute ACMR (cache misses per triangle) and ATVR (cache misses per vertex) of all materials
+     * by simulating a FIFO post-transform vertex cache.
+     *
+     * @param cacheSize
+     * @param acmr
+     * @param atvr
+     */
+    void getVertexCacheStatistics(int cacheSize, Scalar &acmr, Scalar &atvr) const;
+
+    /**
+     * Set the distance between the effector and the IK bone to stop iterations of IK (1.0e-4 by default).
+     *
+     * Setting zero performs all iterations specified by the model as before.
+     *
+     * @param value
+     */
+    void setInverseKinematicsThreshold(const Scalar &value);
+    Scalar inverseKinematicsThreshold() const;
+
+    /**
+     * Get statistics of IK chains solved in the last #performUpdate.
+     *
+     * @param value
+     */
+    void getInverseKinematicsStatistics(InverseKinematicsStatistics &value) const;
+
     float32 version() const;
     void setVersion(float32 value);
     IBone *createBone();
@@ -181,6 +181,15 @@ public:
     void update();
     void markDirty();
     void syncWeight();
+
+    /**
+     * Appends vertices merged by vertex or UV morphs of this morph since the last call.
+     *
+     * pmx::Model uses this to reset only vertices morphed in the previous update.
+     *
+     * @param value
+     */
+    void getMergedVertexRefs(Array<pmx::Vertex *> &value);
     void updateVertexMorphs(const WeightPrecision &value);
     void updateBoneMorphs(const WeightPrecision &value);
     void updateUVMorphs(const WeightPrecision &value);
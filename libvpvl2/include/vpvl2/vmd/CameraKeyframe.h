@@ -99,7 +99,7 @@ private:
     Vector3 m_angle;
     bool m_noPerspective;
     bool m_linear[6];
-    IKeyframe::SmoothPrecision *m_interpolationTable[6];
+    const IKeyframe::SmoothPrecision *m_interpolationTable[6];
     int8 m_rawInterpolationTable[kTableSize];
     InterpolationParameter m_parameter;
 
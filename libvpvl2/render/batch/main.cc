@@ -0,0 +1,656 @@
+/**
+
+ Copyright (c) 2010-2013  hkrn
+
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or
+ without modification, are permitted provided that the following
+ conditions are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+ - Redistributions in binary form must reproduce the above
+   copyright notice, this list of conditions and the following
+   disclaimer in the documentation and/or other materials provided
+   with the distribution.
+ - Neither the name of the MMDAI project team nor the names of
+   its contributors may be used to endorse or promote products
+   derived from this software without specific prior written
+   permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "../helper.h"
+#include <vpvl2/vpvl2.h>
+#include <vpvl2/extensions/headless/ApplicationContext.h>
+#include <vpvl2/internal/Thread.h>
+
+#ifdef VPVL2_ENABLE_EXTENSIONS_PROJECT
+#include <vpvl2/extensions/XMLProject.h>
+#endif
+
+#ifdef VPVL2_LINK_FREEIMAGE
+#include <FreeImage.h>
+#endif
+
+#if !defined(VPVL2_ENABLE_OSMESA) && !defined(VPVL2_LINK_EGL)
+#error "Batch renderer requires either VPVL2_ENABLE_OSMESA or VPVL2_LINK_EGL"
+#endif
+
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+using namespace vpvl2;
+using namespace vpvl2::extensions;
+using namespace vpvl2::extensions::icu4c;
+using namespace vpvl2::extensions::headless;
+
+namespace {
+
+enum StageType {
+    kSeekStage,
+    kUpdateStage,
+    kPhysicsStage,
+    kSkinningStage,
+    kRenderStage,
+    kReadbackStage,
+    kMaxStages
+};
+
+static const char *const kStageNames[kMaxStages] = {
+    "seek",
+    "update",
+    "physics",
+    "skinning",
+    "render",
+    "readback"
+};
+
+struct StageStatistics {
+    StageStatistics()
+        : total(0),
+          min(std::numeric_limits<int64>::max()),
+          max(0),
+          count(0)
+    {
+    }
+    void add(int64 value) {
+        total += value;
+        min = btMin(min, value);
+        max = btMax(max, value);
+        count++;
+    }
+    int64 total;
+    int64 min;
+    int64 max;
+    int count;
+};
+
+class OffscreenSurface {
+public:
+    OffscreenSurface()
+#if defined(VPVL2_ENABLE_OSMESA)
+        : m_context(0)
+#else
+        : m_display(EGL_NO_DISPLAY),
+          m_surface(EGL_NO_SURFACE),
+          m_context(EGL_NO_CONTEXT)
+#endif
+    {
+    }
+    ~OffscreenSurface() {
+        release();
+    }
+
+    bool create(const StringMap &config, int width, int height) {
+        int redSize = config.value("opengl.size.red", 8),
+                greenSize = config.value("opengl.size.green", 8),
+                blueSize = config.value("opengl.size.blue", 8),
+                alphaSize = config.value("opengl.size.alpha", 8),
+                depthSize = config.value("opengl.size.depth", 24),
+                stencilSize = config.value("opengl.size.stencil", 8);
+#if defined(VPVL2_ENABLE_OSMESA)
+        /* OSMesa always renders into RGBA8 buffer owned by the caller */
+        (void) redSize; (void) greenSize; (void) blueSize; (void) alphaSize;
+        m_context = OSMesaCreateContextExt(OSMESA_RGBA, depthSize, stencilSize, 0, 0);
+        if (!m_context) {
+            std::cerr << "OSMesaCreateContextExt() failed" << std::endl;
+            return false;
+        }
+        m_buffer.resize(vsize(width) * height * 4);
+        if (!OSMesaMakeCurrent(m_context, &m_buffer[0], GL_UNSIGNED_BYTE, width, height)) {
+            std::cerr << "OSMesaMakeCurrent() failed" << std::endl;
+            return false;
+        }
+#else
+        m_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        EGLint major = 0, minor = 0;
+        if (m_display == EGL_NO_DISPLAY || !eglInitialize(m_display, &major, &minor)) {
+            std::cerr << "eglInitialize() failed: " << eglGetError() << std::endl;
+            return false;
+        }
+#if defined(VPVL2_ENABLE_GLES2)
+        static const EGLint kRenderableType = EGL_OPENGL_ES2_BIT;
+        static const EGLint kContextAttributes[] = { EGL_CONTEXT_CLIENT_VERSION, 2, EGL_NONE };
+        eglBindAPI(EGL_OPENGL_ES_API);
+#else
+        static const EGLint kRenderableType = EGL_OPENGL_BIT;
+        static const EGLint kContextAttributes[] = { EGL_NONE };
+        eglBindAPI(EGL_OPENGL_API);
+#endif
+        const EGLint configAttributes[] = {
+            EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+            EGL_RENDERABLE_TYPE, kRenderableType,
+            EGL_RED_SIZE, redSize,
+            EGL_GREEN_SIZE, greenSize,
+            EGL_BLUE_SIZE, blueSize,
+            EGL_ALPHA_SIZE, alphaSize,
+            EGL_DEPTH_SIZE, depthSize,
+            EGL_STENCIL_SIZE, stencilSize,
+            EGL_NONE
+        };
+        EGLConfig surfaceConfig = 0;
+        EGLint nconfigs = 0;
+        if (!eglChooseConfig(m_display, configAttributes, &surfaceConfig, 1, &nconfigs) || nconfigs == 0) {
+            std::cerr << "eglChooseConfig() failed: " << eglGetError() << std::endl;
+            return false;
+        }
+        const EGLint surfaceAttributes[] = { EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE };
+        m_surface = eglCreatePbufferSurface(m_display, surfaceConfig, surfaceAttributes);
+        if (m_surface == EGL_NO_SURFACE) {
+            std::cerr << "eglCreatePbufferSurface() failed: " << eglGetError() << std::endl;
+            return false;
+        }
+        m_context = eglCreateContext(m_display, surfaceConfig, EGL_NO_CONTEXT, kContextAttributes);
+        if (m_context == EGL_NO_CONTEXT) {
+            std::cerr << "eglCreateContext() failed: " << eglGetError() << std::endl;
+            return false;
+        }
+        if (!eglMakeCurrent(m_display, m_surface, m_surface, m_context)) {
+            std::cerr << "eglMakeCurrent() failed: " << eglGetError() << std::endl;
+            return false;
+        }
+#endif
+        return true;
+    }
+    void release() {
+#if defined(VPVL2_ENABLE_OSMESA)
+        if (m_context) {
+            OSMesaDestroyContext(m_context);
+            m_context = 0;
+        }
+#else
+        if (m_display != EGL_NO_DISPLAY) {
+            eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+            if (m_context != EGL_NO_CONTEXT) {
+                eglDestroyContext(m_display, m_context);
+                m_context = EGL_NO_CONTEXT;
+            }
+            if (m_surface != EGL_NO_SURFACE) {
+                eglDestroySurface(m_display, m_surface);
+                m_surface = EGL_NO_SURFACE;
+            }
+            eglTerminate(m_display);
+            m_display = EGL_NO_DISPLAY;
+        }
+#endif
+    }
+
+private:
+#if defined(VPVL2_ENABLE_OSMESA)
+    OSMesaContext m_context;
+    std::vector<uint8> m_buffer;
+#else
+    EGLDisplay m_display;
+    EGLSurface m_surface;
+    EGLContext m_context;
+#endif
+
+    VPVL2_DISABLE_COPY_AND_ASSIGN(OffscreenSurface)
+};
+
+#ifdef VPVL2_ENABLE_EXTENSIONS_PROJECT
+class ProjectDelegate : public XMLProject::IDelegate {
+public:
+    ProjectDelegate(const StringMap *configRef, Factory *factoryRef, IEncoding *encodingRef)
+        : m_configRef(configRef),
+          m_factoryRef(factoryRef),
+          m_encodingRef(encodingRef),
+          m_applicationContextRef(0),
+          m_projectRef(0)
+    {
+    }
+    ~ProjectDelegate() {
+        m_configRef = 0;
+        m_factoryRef = 0;
+        m_encodingRef = 0;
+        m_applicationContextRef = 0;
+        m_projectRef = 0;
+    }
+
+    void setReferences(BaseApplicationContext *applicationContextRef, XMLProject *projectRef) {
+        m_applicationContextRef = applicationContextRef;
+        m_projectRef = projectRef;
+    }
+    const std::string toStdFromString(const IString *value) const {
+        return value ? String::toStdString(static_cast<const String *>(value)->value()) : std::string();
+    }
+    const IString *toStringFromStd(const std::string &value) const {
+        return new String(UnicodeString::fromUTF8(value));
+    }
+    bool loadModel(const XMLProject::UUID & /* uuid */, const XMLProject::StringMap &settings, IModel::Type /* type */, IModel *&model, IRenderEngine *&engine, int &priority) {
+        const UnicodeString &modelPath = UnicodeString::fromUTF8(settings.value(XMLProject::kSettingURIKey));
+        ArchiveSmartPtr archive;
+        IModelSmartPtr modelPtr;
+        model = 0;
+        engine = 0;
+        if (!::ui::loadModel(modelPath, m_applicationContextRef, m_factoryRef, m_encodingRef, archive, modelPtr)) {
+            std::cerr << "Cannot load model: " << String::toStdString(modelPath) << std::endl;
+            return false;
+        }
+        int indexOf = modelPath.lastIndexOf("/");
+        String dir(modelPath.tempSubString(0, indexOf));
+        BaseApplicationContext::ModelContext modelContext(m_applicationContextRef, archive.get(), &dir);
+        bool enableEffects = m_configRef->value("enable.effects", true);
+        IRenderEngineSmartPtr enginePtr(m_projectRef->createRenderEngine(m_applicationContextRef, modelPtr.get(),
+                                                                         enableEffects ? Scene::kEffectCapable : 0));
+        IEffect *effectRef = 0;
+        m_applicationContextRef->addModelPath(modelPtr.get(), modelPath);
+        if (enableEffects) {
+            effectRef = m_applicationContextRef->createEffectRef(modelPtr.get(), &dir);
+            if (effectRef) {
+                effectRef->createFrameBufferObject();
+                enginePtr->setEffect(effectRef, IEffect::kAutoDetection, &modelContext);
+            }
+        }
+        if (!enginePtr->upload(&modelContext)) {
+            std::cerr << "Cannot upload model: " << String::toStdString(modelPath) << std::endl;
+            return false;
+        }
+        m_applicationContextRef->parseOffscreenSemantic(effectRef, &dir);
+        int options = m_configRef->value("enable.parallel", true) ? IRenderEngine::kParallelUpdate : IRenderEngine::kNone;
+        if (m_configRef->value("material.sort.enabled", false)) {
+            options |= IRenderEngine::kSortOpaqueMaterials;
+        }
+        enginePtr->setUpdateOptions(options);
+        priority = XMLProject::toIntFromString(settings.value(XMLProject::kSettingOrderKey));
+        model = modelPtr.release();
+        engine = enginePtr.release();
+        return true;
+    }
+
+private:
+    const StringMap *m_configRef;
+    Factory *m_factoryRef;
+    IEncoding *m_encodingRef;
+    BaseApplicationContext *m_applicationContextRef;
+    XMLProject *m_projectRef;
+
+    VPVL2_DISABLE_COPY_AND_ASSIGN(ProjectDelegate)
+};
+
+VPVL2_MAKE_SMARTPTR(ProjectDelegate);
+#endif
+
+VPVL2_MAKE_SMARTPTR(ApplicationContext);
+
+class Application {
+public:
+    Application()
+        : m_width(0),
+          m_height(0),
+          m_frameFrom(0),
+          m_frameTo(0),
+          m_nwarmups(0),
+          m_updateFlags(Scene::kUpdateAll & ~Scene::kUpdateRenderEngines),
+          m_wallTime(0),
+          m_enableReadback(true),
+          m_timingsFile(0)
+    {
+    }
+    ~Application() {
+        if (m_timingsFile) {
+            std::fclose(m_timingsFile);
+            m_timingsFile = 0;
+        }
+        m_dictionary.releaseAll();
+        if (m_scene.get()) {
+            m_scene->setPhysicsWorldRef(0);
+        }
+        /* explicitly release Scene instance to invalidation of Effect correctly before destorying RenderContext */
+        m_scene.reset();
+        /* explicitly release World instance first to ensure release btRigidBody */
+        m_world.reset();
+        m_applicationContext.reset();
+        m_surface.release();
+    }
+
+    bool initialize(int argc, char *argv[]) {
+        std::string configPath("config.ini");
+        for (int i = 1; i < argc; i++) {
+            const std::string argument(argv[i]);
+            if (argument.find('=') == std::string::npos) {
+                configPath = argument;
+            }
+        }
+        ::ui::loadSettings(configPath, m_config);
+        /* key=value arguments override values of the configuration file */
+        for (int i = 1; i < argc; i++) {
+            const std::string argument(argv[i]);
+            std::string::size_type offset = argument.find('=');
+            if (offset != std::string::npos) {
+                UnicodeString key(UnicodeString::fromUTF8(argument.substr(0, offset))),
+                        value(UnicodeString::fromUTF8(argument.substr(offset + 1)));
+                m_config[key.trim()] = value.trim();
+            }
+        }
+        m_width = m_config.value("window.width", 640);
+        m_height = m_config.value("window.height", 480);
+        if (!m_surface.create(m_config, int(m_width), int(m_height))) {
+            return false;
+        }
+        if (!Scene::initialize(0)) {
+            std::cerr << "Scene::initialize() failed" << std::endl;
+            return false;
+        }
+        std::cerr << "GL_VERSION:  " << glGetString(GL_VERSION) << std::endl;
+        std::cerr << "GL_VENDOR:   " << glGetString(GL_VENDOR) << std::endl;
+        std::cerr << "GL_RENDERER: " << glGetString(GL_RENDERER) << std::endl;
+        ::ui::initializeDictionary(m_config, m_dictionary);
+        m_encoding.reset(new Encoding(&m_dictionary));
+        m_factory.reset(new Factory(m_encoding.get()));
+        m_world.reset(new World());
+        const UnicodeString &projectPath = m_config.value("file.project", UnicodeString());
+        if (!projectPath.isEmpty()) {
+#ifdef VPVL2_ENABLE_EXTENSIONS_PROJECT
+            m_delegate.reset(new ProjectDelegate(&m_config, m_factory.get(), m_encoding.get()));
+            m_scene.reset(new XMLProject(m_delegate.get(), m_factory.get(), true));
+#else
+            std::cerr << "Loading project requires VPVL2_ENABLE_EXTENSIONS_PROJECT" << std::endl;
+            return false;
+#endif
+        }
+        else {
+            m_scene.reset(new Scene(true));
+        }
+        m_applicationContext.reset(new ApplicationContext(m_scene.get(), m_encoding.get(), &m_config));
+        m_applicationContext->initialize(false);
+        m_outputPath = String::toStdString(m_config.value("batch.output.path", UnicodeString()));
+        m_enableReadback = !m_outputPath.empty() || m_config.value("batch.readback.enabled", true);
+        m_pixels.resize(m_width * m_height * 4);
+        m_row.resize(m_width * 4);
+        const std::string &timingsPath = String::toStdString(m_config.value("batch.timings.path", UnicodeString()));
+        if (!timingsPath.empty()) {
+            m_timingsFile = std::fopen(timingsPath.c_str(), "w");
+            if (!m_timingsFile) {
+                std::cerr << "Cannot open " << timingsPath << std::endl;
+                return false;
+            }
+            std::fprintf(m_timingsFile, "frame");
+            for (int i = 0; i < kMaxStages; i++) {
+                std::fprintf(m_timingsFile, ",%s", kStageNames[i]);
+            }
+            std::fprintf(m_timingsFile, "\n");
+        }
+        return true;
+    }
+    bool load() {
+        if (m_config.value("enable.opencl", false)) {
+            m_scene->setAccelerationType(Scene::kOpenCLAccelerationType1);
+        }
+        m_scene->lightRef()->setToonEnable(m_config.value("enable.toon", true));
+        if (m_config.value("enable.sm", false)) {
+            int sw = m_config.value("sm.width", 2048);
+            int sh = m_config.value("sm.height", 2048);
+            m_applicationContext->createShadowMap(Vector3(sw, sh, 0));
+        }
+        if (m_config.value("enable.parallel", true)) {
+            m_updateFlags |= Scene::kParallelUpdateModels;
+        }
+        m_applicationContext->updateCameraMatrices(glm::vec2(m_width, m_height));
+        const UnicodeString &projectPath = m_config.value("file.project", UnicodeString());
+        if (!projectPath.isEmpty()) {
+#ifdef VPVL2_ENABLE_EXTENSIONS_PROJECT
+            XMLProject *project = static_cast<XMLProject *>(m_scene.get());
+            m_delegate->setReferences(m_applicationContext.get(), project);
+            if (!project->load(String::toStdString(projectPath).c_str())) {
+                std::cerr << "Cannot load project: " << String::toStdString(projectPath) << std::endl;
+                return false;
+            }
+#endif
+        }
+        else {
+            ::ui::loadAllModels(m_config, m_applicationContext.get(), m_scene.get(), m_factory.get(), m_encoding.get());
+        }
+        Array<IModel *> models;
+        m_scene->getModelRefs(models);
+        if (models.count() == 0) {
+            std::cerr << "No models are loaded" << std::endl;
+            return false;
+        }
+        bool enablePhysics = m_config.value("enable.physics", true);
+        for (int i = 0, nmodels = models.count(); i < nmodels; i++) {
+            models[i]->setPhysicsEnable(enablePhysics);
+        }
+        if (enablePhysics) {
+            m_scene->setPhysicsWorldRef(m_world.get());
+        }
+        /* decoding textures asynchronously makes timings of the first frames unstable */
+        m_applicationContext->waitForDecodedTextures();
+        m_frameFrom = btMax(m_config.value("batch.frame.from", 0), 0);
+        m_frameTo = m_config.value("batch.frame.to", int(m_scene->duration()));
+        m_nwarmups = btMax(m_config.value("batch.frame.warmup", 0), 0);
+        if (m_frameTo < m_frameFrom) {
+            std::cerr << "batch.frame.to (" << m_frameTo << ") is less than batch.frame.from (" << m_frameFrom << ")" << std::endl;
+            return false;
+        }
+        return true;
+    }
+    bool execute() {
+        const IKeyframe::TimeIndex timeIndexFrom(m_frameFrom);
+        for (int i = 0; i < m_nwarmups; i++) {
+            resetMotionState(timeIndexFrom);
+            if (!renderFrame(timeIndexFrom, -1)) {
+                return false;
+            }
+        }
+        resetMotionState(timeIndexFrom);
+        if (m_outputPath == "-") {
+            std::cerr << "Writing raw RGBA frames (" << m_width << "x" << m_height << ") to stdout" << std::endl;
+        }
+        internal::ElapsedTimer timer;
+        for (int frameIndex = m_frameFrom; frameIndex <= m_frameTo; frameIndex++) {
+            if (!renderFrame(IKeyframe::TimeIndex(frameIndex), frameIndex)) {
+                return false;
+            }
+        }
+        m_wallTime = timer.elapsed();
+        return true;
+    }
+    void printStatistics() const {
+        int nframes = m_statistics[kSeekStage].count;
+        if (nframes == 0) {
+            return;
+        }
+        char line[128];
+        std::cerr << "frames: " << m_frameFrom << "-" << m_frameTo << " (" << nframes << " frames, "
+                  << m_nwarmups << " warmup, " << m_width << "x" << m_height << ")" << std::endl;
+        std::snprintf(line, sizeof(line), "%-10s %12s %10s %10s %10s", "stage", "total(ms)", "avg(ms)", "min(ms)", "max(ms)");
+        std::cerr << line << std::endl;
+        int64 total = 0;
+        for (int i = 0; i < kMaxStages; i++) {
+            const StageStatistics &s = m_statistics[i];
+            std::snprintf(line, sizeof(line), "%-10s %12.3f %10.3f %10.3f %10.3f", kStageNames[i],
+                          s.total / 1000.0, s.total / (1000.0 * s.count), s.min / 1000.0, s.max / 1000.0);
+            std::cerr << line << std::endl;
+            total += s.total;
+        }
+        std::snprintf(line, sizeof(line), "%-10s %12.3f %10.3f", "all", total / 1000.0, total / (1000.0 * nframes));
+        std::cerr << line << std::endl;
+        std::snprintf(line, sizeof(line), "wall: %.3f ms (%.2f fps)", m_wallTime / 1000.0,
+                      m_wallTime > 0 ? nframes * 1000000.0 / m_wallTime : 0.0);
+        std::cerr << line << std::endl;
+    }
+
+private:
+    void resetMotionState(const IKeyframe::TimeIndex &timeIndex) {
+        m_scene->seek(timeIndex, Scene::kUpdateAll);
+        m_scene->update(Scene::kUpdateAll | Scene::kResetMotionState);
+    }
+    bool renderFrame(const IKeyframe::TimeIndex &timeIndex, int frameIndex) {
+        int64 elapsed[kMaxStages] = { 0 };
+        internal::ElapsedTimer timer;
+        m_scene->seek(timeIndex, Scene::kUpdateAll);
+        elapsed[kSeekStage] = timer.elapsed();
+        timer.restart();
+        m_world->stepSimulation(1.0 / Scene::defaultFPS());
+        elapsed[kPhysicsStage] = timer.elapsed();
+        timer.restart();
+        m_scene->update(m_updateFlags);
+        elapsed[kUpdateStage] = timer.elapsed();
+        timer.restart();
+        /* render engines transform vertices by the bones updated above */
+        m_scene->update(Scene::kUpdateRenderEngines);
+        elapsed[kSkinningStage] = timer.elapsed();
+        timer.restart();
+        m_applicationContext->renderShadowMap();
+        m_applicationContext->renderOffscreen();
+        m_applicationContext->updateCameraMatrices(glm::vec2(m_width, m_height));
+        ::ui::drawScreen(*m_scene.get(), m_width, m_height);
+        /* wait for GPU to measure the render stage instead of command submission */
+        glFinish();
+        elapsed[kRenderStage] = timer.elapsed();
+        timer.restart();
+        if (m_enableReadback) {
+            glPixelStorei(GL_PACK_ALIGNMENT, 1);
+            glReadPixels(0, 0, GLsizei(m_width), GLsizei(m_height), GL_RGBA, GL_UNSIGNED_BYTE, &m_pixels[0]);
+        }
+        elapsed[kReadbackStage] = timer.elapsed();
+        if (frameIndex < 0) {
+            return true;
+        }
+        if (m_timingsFile) {
+            std::fprintf(m_timingsFile, "%d", frameIndex);
+        }
+        for (int i = 0; i < kMaxStages; i++) {
+            m_statistics[i].add(elapsed[i]);
+            if (m_timingsFile) {
+                std::fprintf(m_timingsFile, ",%.3f", elapsed[i] / 1000.0);
+            }
+        }
+        if (m_timingsFile) {
+            std::fprintf(m_timingsFile, "\n");
+        }
+        return writeFrame(frameIndex);
+    }
+    void flipRows() {
+        const vsize stride = m_width * 4;
+        for (vsize top = 0, bottom = m_height - 1; top < bottom; top++, bottom--) {
+            uint8 *topRow = &m_pixels[top * stride], *bottomRow = &m_pixels[bottom * stride];
+            std::memcpy(&m_row[0], topRow, stride);
+            std::memcpy(topRow, bottomRow, stride);
+            std::memcpy(bottomRow, &m_row[0], stride);
+        }
+    }
+    bool writeFrame(int frameIndex) {
+        if (m_outputPath.empty()) {
+            return true;
+        }
+        else if (m_outputPath == "-") {
+            /* glReadPixels returns rows bottom-up but the raw stream is top-down */
+            flipRows();
+            if (std::fwrite(&m_pixels[0], 1, m_pixels.size(), stdout) != m_pixels.size()) {
+                std::cerr << "Cannot write frame " << frameIndex << " to stdout" << std::endl;
+                return false;
+            }
+            return true;
+        }
+        char path[1024];
+#ifdef VPVL2_LINK_FREEIMAGE
+        std::snprintf(path, sizeof(path), "%s/%06d.png", m_outputPath.c_str(), frameIndex);
+        /* FreeImage stores rows bottom-up same as OpenGL, only swap red and blue channels */
+        for (vsize i = 0, size = m_pixels.size(); i < size; i += 4) {
+            btSwap(m_pixels[i], m_pixels[i + 2]);
+        }
+        FIBITMAP *bitmap = FreeImage_ConvertFromRawBits(&m_pixels[0], int(m_width), int(m_height), int(m_width * 4), 32,
+                                                        FI_RGBA_RED_MASK, FI_RGBA_GREEN_MASK, FI_RGBA_BLUE_MASK, FALSE);
+        bool ok = bitmap && FreeImage_Save(FIF_PNG, bitmap, path, PNG_DEFAULT);
+        FreeImage_Unload(bitmap);
+#else
+        std::snprintf(path, sizeof(path), "%s/%06d.ppm", m_outputPath.c_str(), frameIndex);
+        flipRows();
+        bool ok = false;
+        if (FILE *fp = std::fopen(path, "wb")) {
+            std::fprintf(fp, "P6\n%d %d\n255\n", int(m_width), int(m_height));
+            ok = true;
+            for (vsize i = 0, size = m_pixels.size(); ok && i < size; i += 4) {
+                ok = std::fwrite(&m_pixels[i], 1, 3, fp) == 3;
+            }
+            ok = std::fclose(fp) == 0 && ok;
+        }
+#endif
+        if (!ok) {
+            std::cerr << "Cannot write frame " << frameIndex << " to " << path << std::endl;
+        }
+        return ok;
+    }
+
+    OffscreenSurface m_surface;
+    StringMap m_config;
+    Encoding::Dictionary m_dictionary;
+    WorldSmartPtr m_world;
+    EncodingSmartPtr m_encoding;
+    FactorySmartPtr m_factory;
+#ifdef VPVL2_ENABLE_EXTENSIONS_PROJECT
+    ProjectDelegateSmartPtr m_delegate;
+#endif
+    SceneSmartPtr m_scene;
+    ApplicationContextSmartPtr m_applicationContext;
+    StageStatistics m_statistics[kMaxStages];
+    std::vector<uint8> m_pixels;
+    std::vector<uint8> m_row;
+    std::string m_outputPath;
+    vsize m_width;
+    vsize m_height;
+    int m_frameFrom;
+    int m_frameTo;
+    int m_nwarmups;
+    int m_updateFlags;
+    int64 m_wallTime;
+    bool m_enableReadback;
+    FILE *m_timingsFile;
+};
+
+} /* namespace anonymous */
+
+int main(int argc, char *argv[])
+{
+    Application application;
+    tbb::task_scheduler_init initializer; (void) initializer;
+    BaseApplicationContext::initializeOnce(argv[0]);
+    if (!application.initialize(argc, argv) || !application.load()) {
+        BaseApplicationContext::terminate();
+        return EXIT_FAILURE;
+    }
+    bool ok = application.execute();
+    application.printStatistics();
+    BaseApplicationContext::terminate();
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -137,13 +137,13 @@ static bool loadModel(const UnicodeString &path,
     bool ok = false;
     if (path.endsWith(".zip")) {
         archive.reset(new Archive(encodingRef));
-        vpvl2::extensions::Archive::EntryNames entries;
         icu4c::String s(path);
-        if (archive->open(&s, entries)) {
-            for (Archive::EntryNames::const_iterator it = entries.begin(); it != entries.end(); it++) {
-                const UnicodeString &filename = *it;
-                if (filename.endsWith(kPMDExtension) || filename.endsWith(kPMXExtension)) {
-                    archive->uncompressEntry(filename);
+        if (archive->open(&s)) {
+            const int nentries = archive->countEntries();
+            for (int i = 0; i < nentries; i++) {
+                if (archive->entryEndsWith(i, kPMDExtension) || archive->entryEndsWith(i, kPMXExtension)) {
+                    archive->uncompressEntry(i);
+                    const UnicodeString &filename = archive->entryName(i);
                     int offset = filename.lastIndexOf('/');
                     const std::string *bytes = archive->dataRef(filename);
                     const uint8 *data = reinterpret_cast<const uint8 *>(bytes->data());
@@ -169,6 +169,10 @@ static void loadAllModels(const icu4c::StringMap &settings,
     const UnicodeString &motionPath = settings.value("file.motion", UnicodeString());
     int nmodels = settings.value("models/size", 0);
     bool parallel = settings.value("enable.parallel", true), ok = false;
+    int options = parallel ? IRenderEngine::kParallelUpdate : IRenderEngine::kNone;
+    if (settings.value("material.sort.enabled", false)) {
+        options |= IRenderEngine::kSortOpaqueMaterials;
+    }
     ArchiveSmartPtr archive;
     IModelSmartPtr model;
     std::ostringstream stream;
@@ -201,7 +205,7 @@ static void loadAllModels(const icu4c::StringMap &settings,
             }
             if (engine->upload(&modelContext)) {
                 applicationContextRef->parseOffscreenSemantic(effectRef, &dir);
-                engine->setUpdateOptions(parallel ? IRenderEngine::kParallelUpdate : IRenderEngine::kNone);
+                engine->setUpdateOptions(options);
                 model->setEdgeWidth(settings.value(prefix + "/edge.width", 1.0f));
                 sceneRef->addModel(model.get(), engine.release(), i);
                 BaseApplicationContext::MapBuffer motionBuffer(applicationContextRef);
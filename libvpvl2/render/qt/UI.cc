@@ -725,6 +725,8 @@ void UI::paintGL()
     glClearColor(0, 0, 0.75, 1);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
     if (m_applicationContext) {
+        /* uploads textures decoded asynchronously within 4ms */
+        m_applicationContext->uploadDecodedTextures(4000);
         m_applicationContext->renderShadowMap();
         m_applicationContext->renderOffscreen();
         m_applicationContext->updateCameraMatrices(glm::vec2(width(), height()));
@@ -818,7 +820,7 @@ bool UI::loadScene()
     btRigidBody::btRigidBodyConstructionInfo info(0, 0, ground.take(), kZeroV3);
     QScopedPointer<btRigidBody> body(new btRigidBody(info));
     m_world->dynamicWorldRef()->addRigidBody(body.take(), 0x10, 0);
-    m_scene->setWorldRef(m_world->dynamicWorldRef());
+    m_scene->setPhysicsWorldRef(m_world.data());
     const QString &modelMotionPath = QDir(m_settings->value("dir.motion").toString())
             .absoluteFilePath(m_settings->value("file.motion").toString());
     const QString &cameraMotionPath = QDir(m_settings->value("dir.camera").toString())
@@ -864,14 +866,14 @@ UI::ModelSet UI::createModelAsync(const QString &path)
     bool ok = true;
     if (path.endsWith(".zip")) {
         ArchiveSharedPtr archive(new Archive(m_encoding.data()));
-        Archive::EntryNames entries;
         String archivePath(Util::fromQString(path));
-        if (archive->open(&archivePath, entries)) {
+        if (archive->open(&archivePath)) {
             const UnicodeString targetExtension(".pmx");
-            for (Archive::EntryNames::const_iterator it = entries.begin(); it != entries.end(); it++) {
-                const UnicodeString &filename = *it;
-                if (filename.endsWith(targetExtension)) {
-                    archive->uncompressEntry(filename);
+            const int nentries = archive->countEntries();
+            for (int i = 0; i < nentries; i++) {
+                if (archive->entryEndsWith(i, targetExtension)) {
+                    archive->uncompressEntry(i);
+                    const UnicodeString &filename = archive->entryName(i);
                     const std::string *bytes = archive->dataRef(filename);
                     const uint8 *data = reinterpret_cast<const uint8 *>(bytes->data());
                     const QFileInfo finfo(Util::toQString(filename));
@@ -966,7 +968,12 @@ IModelSharedPtr UI::addModel(const QString &path, QProgressDialog &dialog, int i
             modelPtr->setName(&s, IEncoding::kDefaultLanguage);
         }
         bool parallel = m_settings->value("enable.parallel", true).toBool();
-        enginePtr->setUpdateOptions(parallel ? IRenderEngine::kParallelUpdate : IRenderEngine::kNone);
+        bool sortMaterials = m_settings->value("material.sort.enabled", false).toBool();
+        int options = parallel ? IRenderEngine::kParallelUpdate : IRenderEngine::kNone;
+        if (sortMaterials) {
+            options |= IRenderEngine::kSortOpaqueMaterials;
+        }
+        enginePtr->setUpdateOptions(options);
         m_scene->addModel(modelPtr.data(), enginePtr.take(), index);
     }
     else {
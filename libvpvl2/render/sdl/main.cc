@@ -179,6 +179,8 @@ public:
                 break;
             }
         }
+        /* uploads textures decoded asynchronously within 4ms */
+        m_applicationContext->uploadDecodedTextures(4000);
         m_applicationContext->renderShadowMap();
         m_applicationContext->renderOffscreen();
         m_applicationContext->updateCameraMatrices(glm::vec2(m_width, m_height));
@@ -38,6 +38,10 @@
 #include "vpvl2/vpvl2.h"
 #include "vpvl2/IApplicationContext.h"
 #include "vpvl2/internal/util.h"
+#include "vpvl2/internal/Culling.h"
+#include "vpvl2/internal/ParallelProcessors.h"
+#include "vpvl2/internal/PhysicsCache.h"
+#include "vpvl2/internal/Profiler.h"
 
 #ifdef VPVL2_LINK_GLEW
 #include <GL/glew.h>
@@ -54,6 +58,7 @@
 #include "vpvl2/pmd2/Model.h"
 #endif /* VPVL2_LINK_VPVL */
 #include "vpvl2/pmx/Model.h"
+#include "vpvl2/pmx/RigidBody.h"
 #include "vpvl2/vmd/Motion.h"
 #ifdef VPVL2_ENABLE_EXTENSIONS_APPLICATIONCONTEXT
 #include "vpvl2/gl2/AssetRenderEngine.h"
@@ -61,6 +66,9 @@
 #include "vpvl2/fx/AssetRenderEngine.h"
 #include "vpvl2/fx/PMXRenderEngine.h"
 #endif /* VPVL2_ENABLE_EXTENSIONS_APPLICATIONCONTEXT */
+#ifdef VPVL2_ENABLE_EXTENSIONS_WORLD
+#include "vpvl2/extensions/World.h"
+#endif /* VPVL2_ENABLE_EXTENSIONS_WORLD */
 
 #ifdef VPVL2_ENABLE_NVIDIA_CG
 #include "vpvl2/cg/Effect.h"
@@ -112,6 +120,17 @@ using namespace vpvl2;
 
 VPVL2_STATIC_TLS(static bool g_initialized = false);
 
+static void VPVL2SceneUpdateMotion(IMotion *motion, const IKeyframe::TimeIndex &timeIndex, bool seek)
+{
+    internal::ScopedProfile profile(IApplicationContext::kProfileSeekMotionProcess, motion);
+    if (seek) {
+        motion->seek(timeIndex);
+    }
+    else {
+        motion->advance(timeIndex);
+    }
+}
+
 static void VPVL2SceneSetParentSceneRef(IModel *model, Scene *scene)
 {
     if (model) {
@@ -379,6 +398,33 @@ struct Scene::PrivateContext
         int priority;
         bool ownMemory;
     };
+    struct ModelUpdateTask {
+        ModelUpdateTask(IModel *m)
+            : modelRef(m)
+        {
+        }
+        void execute() {
+            modelRef->performUpdate();
+        }
+        IModel *modelRef;
+    };
+    struct MotionUpdateTask {
+        MotionUpdateTask(const IKeyframe::TimeIndex &t, bool s)
+            : timeIndex(t),
+              seek(s)
+        {
+        }
+        void execute() {
+            /* motions of the same model must be applied sequentially in order of addition */
+            const int nmotions = motionRefs.count();
+            for (int i = 0; i < nmotions; i++) {
+                VPVL2SceneUpdateMotion(motionRefs[i], timeIndex, seek);
+            }
+        }
+        Array<IMotion *> motionRefs;
+        const IKeyframe::TimeIndex timeIndex;
+        const bool seek;
+    };
     template<typename T>
     struct Predication {
         bool operator()(const T *left, const T *right) const {
@@ -389,21 +435,29 @@ struct Scene::PrivateContext
     PrivateContext(Scene *sceneRef, bool ownMemory)
         : shadowMapRef(0),
           worldRef(0),
+          physicsWorldRef(0),
           accelerationType(Scene::kSoftwareFallback),
           light(sceneRef),
           camera(sceneRef),
           currentTimeIndex(0),
           preferredFPS(Scene::defaultFPS()),
-          ownMemory(ownMemory)
+          workerPool(0),
+          ownMemory(ownMemory),
+          enablePhysicsCache(false)
     {
     }
     ~PrivateContext() {
+        delete workerPool;
+        workerPool = 0;
+        physicsCaches.releaseAll();
         destroyWorld();
+        destroyPhysicsWorld();
         motions.releaseAll();
         engines.releaseAll();
         models.releaseAll();
         shadowMapRef = 0;
         worldRef = 0;
+        physicsWorldRef = 0;
     }
 
     static void handleRegalErrorCallback(GLenum error) {
@@ -415,6 +469,11 @@ struct Scene::PrivateContext
         engines.append(new RenderEnginePtr(engine, priority, ownMemory));
         model2engineRef.insert(model, engine);
         model->joinWorld(worldRef);
+#ifdef VPVL2_ENABLE_EXTENSIONS_WORLD
+        if (physicsWorldRef) {
+            physicsWorldRef->addModel(model);
+        }
+#endif /* VPVL2_ENABLE_EXTENSIONS_WORLD */
     }
     void addMotionPtr(IMotion *motion) {
         motions.append(new MotionPtr(motion, 0, ownMemory));
@@ -457,7 +516,14 @@ struct Scene::PrivateContext
             ModelPtr *v = models[i];
             IModel *m = v->value;
             if (m == model) {
+                removePhysicsCache(model);
                 model->leaveWorld(worldRef);
+#ifdef VPVL2_ENABLE_EXTENSIONS_WORLD
+                if (physicsWorldRef) {
+                    physicsWorldRef->removeModel(model);
+                }
+#endif /* VPVL2_ENABLE_EXTENSIONS_WORLD */
+                motionStateSyncedModels.remove(model);
                 v->ownMemory = false;
                 models.removeAt(i);
                 break;
@@ -497,8 +563,23 @@ struct Scene::PrivateContext
         return 0;
     }
 
-    void updateMotionState() {
+    void markMotionStateDirty(const IModel *model) {
+        if (model) {
+            motionStateSyncedModels.remove(model);
+        }
+    }
+    void resetMotionState() {
         const int nmodels = models.count();
+        for (int i = 0; i < nmodels; i++) {
+            IModel *model = models[i]->value;
+            motionStateSyncedModels.insert(model, model->isPhysicsEnabled());
+        }
+#ifdef VPVL2_ENABLE_EXTENSIONS_WORLD
+        if (physicsWorldRef) {
+            physicsWorldRef->resetMotionState();
+            return;
+        }
+#endif /* VPVL2_ENABLE_EXTENSIONS_WORLD */
         for (int i = 0; i < nmodels; i++) {
             IModel *model = models[i]->value;
             model->resetMotionState(worldRef);
@@ -509,13 +590,206 @@ struct Scene::PrivateContext
             worldRef->getForceUpdateAllAabbs();
         }
     }
-    void updateModels() {
+    void resetDirtyMotionState() {
+        /*
+         * only models added, seeked or toggled physics since the last reset are reset so that
+         * rigid bodies of the others keep simulating without rebuilding the whole broadphase
+         */
+        Array<IModel *> dirtyModelRefs;
         const int nmodels = models.count();
         for (int i = 0; i < nmodels; i++) {
             IModel *model = models[i]->value;
+            const HashPtr key(model);
+            const bool enabled = model->isPhysicsEnabled();
+            const bool *syncedPtr = motionStateSyncedModels.find(key);
+            if (!syncedPtr || *syncedPtr != enabled) {
+                dirtyModelRefs.append(model);
+                motionStateSyncedModels.insert(key, enabled);
+            }
+        }
+        const int ndirtyModels = dirtyModelRefs.count();
+        if (ndirtyModels == 0) {
+            return;
+        }
+#ifdef VPVL2_ENABLE_EXTENSIONS_WORLD
+        if (physicsWorldRef) {
+            physicsWorldRef->resetMotionState(dirtyModelRefs);
+            return;
+        }
+#endif /* VPVL2_ENABLE_EXTENSIONS_WORLD */
+        for (int i = 0; i < ndirtyModels; i++) {
+            IModel *model = dirtyModelRefs[i];
+            model->resetMotionState(worldRef);
+        }
+        if (worldRef) {
+            worldRef->getConstraintSolver()->reset();
+        }
+    }
+    void updateMotionState(int flags) {
+        if (flags & Scene::kResetMotionState) {
+            resetMotionState();
+        }
+        else if (flags & Scene::kResetDirtyMotionState) {
+            resetDirtyMotionState();
+        }
+    }
+    static bool isPhysicsCacheable(const IModel *model) {
+        return model->type() == IModel::kPMXModel && model->isPhysicsEnabled();
+    }
+    static bool getFrameIndex(const IKeyframe::TimeIndex &timeIndex, int &frameIndex) {
+        /* only frames on the timeline are cached (intermediate steps of playback are not) */
+        frameIndex = int(btFloor(timeIndex));
+        return timeIndex >= 0 && IKeyframe::TimeIndex(frameIndex) == timeIndex;
+    }
+    void recordPhysicsCache() {
+        int frameIndex;
+        if (!getFrameIndex(currentTimeIndex, frameIndex)) {
+            return;
+        }
+        Array<IRigidBody *> rigidBodies;
+        Array<Transform> transforms;
+        const int nmodels = models.count();
+        for (int i = 0; i < nmodels; i++) {
+            IModel *model = models[i]->value;
+            if (!isPhysicsCacheable(model)) {
+                continue;
+            }
+            rigidBodies.clear();
+            model->getRigidBodyRefs(rigidBodies);
+            const int nbodies = rigidBodies.count();
+            transforms.resize(nbodies);
+            for (int j = 0; j < nbodies; j++) {
+                const pmx::RigidBody *body = static_cast<const pmx::RigidBody *>(rigidBodies[j]);
+                transforms[j] = body->body()->getCenterOfMassTransform();
+            }
+            const HashPtr key(model);
+            internal::PhysicsCache *const *cachePtr = physicsCaches.find(key);
+            internal::PhysicsCache *cache = cachePtr ? *cachePtr : physicsCaches.insert(key, new internal::PhysicsCache());
+            cache->record(frameIndex, transforms);
+        }
+    }
+    void restorePhysicsCache() {
+        int frameIndex;
+        if (!getFrameIndex(currentTimeIndex, frameIndex)) {
+            return;
+        }
+        Array<IRigidBody *> rigidBodies;
+        Array<Transform> transforms;
+        const int nmodels = models.count();
+        for (int i = 0; i < nmodels; i++) {
+            IModel *model = models[i]->value;
+            internal::PhysicsCache *const *cachePtr = physicsCaches.find(HashPtr(model));
+            if (!cachePtr || !isPhysicsCacheable(model) || !(*cachePtr)->restore(frameIndex, transforms)) {
+                continue;
+            }
+            rigidBodies.clear();
+            model->getRigidBodyRefs(rigidBodies);
+            const int nbodies = rigidBodies.count();
+            if (nbodies != transforms.count()) {
+                continue;
+            }
+            for (int j = 0; j < nbodies; j++) {
+                pmx::RigidBody *rigidBody = static_cast<pmx::RigidBody *>(rigidBodies[j]);
+                btRigidBody *body = rigidBody->body();
+                const Transform &transform = transforms[j];
+                body->setCenterOfMassTransform(transform);
+                body->setInterpolationWorldTransform(transform);
+                body->setLinearVelocity(kZeroV3);
+                body->setAngularVelocity(kZeroV3);
+            }
+            /* applies restored transforms to the bones after physics simulation */
             model->performUpdate();
         }
     }
+    void invalidatePhysicsCache(const IModel *model, const IKeyframe::TimeIndex &timeIndex) {
+        const int frameIndex = int(btFloor(btMax(timeIndex, IKeyframe::TimeIndex(0))));
+        if (model) {
+            if (internal::PhysicsCache *const *cachePtr = physicsCaches.find(HashPtr(model))) {
+                (*cachePtr)->invalidate(frameIndex);
+            }
+        }
+        else {
+            const int ncaches = physicsCaches.count();
+            for (int i = 0; i < ncaches; i++) {
+                (*physicsCaches.value(i))->invalidate(frameIndex);
+            }
+        }
+    }
+    void removePhysicsCache(const IModel *model) {
+        const HashPtr key(model);
+        if (internal::PhysicsCache *const *cachePtr = physicsCaches.find(key)) {
+            delete *cachePtr;
+            physicsCaches.remove(key);
+        }
+    }
+    internal::WorkerPool *workerPoolRef() {
+#if !defined(VPVL2_LINK_INTEL_TBB) && !defined(_OPENMP)
+        /* threads are started on the first parallel update, not when the scene is created */
+        if (!workerPool) {
+            workerPool = new internal::WorkerPool(0);
+        }
+#endif
+        return workerPool;
+    }
+    void updateModels(bool enableParallel) {
+        const int nmodels = models.count();
+        if (enableParallel) {
+            PointerArray<ModelUpdateTask> tasks;
+            for (int i = 0; i < nmodels; i++) {
+                IModel *model = models[i]->value;
+                tasks.append(new ModelUpdateTask(model));
+            }
+            internal::ParallelTaskProcessor<ModelUpdateTask> processor(&tasks, workerPoolRef());
+            processor.execute();
+            tasks.releaseAll();
+        }
+        else {
+            for (int i = 0; i < nmodels; i++) {
+                IModel *model = models[i]->value;
+                model->performUpdate();
+            }
+        }
+    }
+    void updateMotions(const IKeyframe::TimeIndex &timeIndex, bool seek, bool enableParallel) {
+        const int nmotions = motions.count();
+        if (seek) {
+            /* seeking teleports bones so rigid bodies of the models must be reset */
+            for (int i = 0; i < nmotions; i++) {
+                markMotionStateDirty(motions[i]->value->parentModelRef());
+            }
+        }
+        if (enableParallel) {
+            /* motions without the parent model are applied first and others are grouped by the model */
+            PointerArray<MotionUpdateTask> tasks;
+            Hash<HashPtr, MotionUpdateTask *> model2tasks;
+            MotionUpdateTask orphanTask(timeIndex, seek);
+            for (int i = 0; i < nmotions; i++) {
+                IMotion *motion = motions[i]->value;
+                if (IModel *model = motion->parentModelRef()) {
+                    const HashPtr key(model);
+                    MotionUpdateTask *const *taskPtr = model2tasks.find(key);
+                    MotionUpdateTask *task = taskPtr ? *taskPtr : 0;
+                    if (!task) {
+                        task = tasks.append(new MotionUpdateTask(timeIndex, seek));
+                        model2tasks.insert(key, task);
+                    }
+                    task->motionRefs.append(motion);
+                }
+                else {
+                    orphanTask.motionRefs.append(motion);
+                }
+            }
+            orphanTask.execute();
+            internal::ParallelTaskProcessor<MotionUpdateTask> processor(&tasks, workerPoolRef());
+            processor.execute();
+            tasks.releaseAll();
+        }
+        else {
+            for (int i = 0; i < nmotions; i++) {
+                VPVL2SceneUpdateMotion(motions[i]->value, timeIndex, seek);
+            }
+        }
+    }
     void markAllMorphsDirty() {
         Array<IMorph *> morphs;
         const int nmodels = models.count();
@@ -586,7 +860,9 @@ struct Scene::PrivateContext
     void setWorldRef(btDiscreteDynamicsWorld *world) {
         if (worldRef != world) {
             destroyWorld();
+            motionStateSyncedModels.clear();
         }
+        destroyPhysicsWorld();
         if (world) {
             int nmodels = models.count();
             for (int i = 0; i < nmodels; i++) {
@@ -610,8 +886,48 @@ struct Scene::PrivateContext
         }
     }
 
+    void setPhysicsWorldRef(extensions::World *world) {
+        if (physicsWorldRef == world) {
+            return;
+        }
+        destroyPhysicsWorld();
+        setWorldRef(0);
+#ifdef VPVL2_ENABLE_EXTENSIONS_WORLD
+        if (world) {
+            int nmodels = models.count();
+            for (int i = 0; i < nmodels; i++) {
+                ModelPtr *model = models[i];
+                if (IModel *m = model->value) {
+                    world->addModel(m);
+                }
+            }
+        }
+        physicsWorldRef = world;
+#else
+        (void) world;
+        VPVL2_LOG(WARNING, "Scene#setPhysicsWorldRef requires VPVL2_ENABLE_EXTENSIONS_WORLD");
+#endif /* VPVL2_ENABLE_EXTENSIONS_WORLD */
+    }
+    void destroyPhysicsWorld() {
+#ifdef VPVL2_ENABLE_EXTENSIONS_WORLD
+        if (physicsWorldRef) {
+            int nmodels = models.count();
+            for (int i = 0; i < nmodels; i++) {
+                ModelPtr *model = models[i];
+                if (IModel *m = model->value) {
+                    physicsWorldRef->removeModel(m);
+                }
+            }
+            motionStateSyncedModels.clear();
+        }
+#endif /* VPVL2_ENABLE_EXTENSIONS_WORLD */
+        physicsWorldRef = 0;
+    }
+
     IShadowMap *shadowMapRef;
     btDiscreteDynamicsWorld *worldRef;
+    extensions::World *physicsWorldRef;
+    Hash<HashPtr, bool> motionStateSyncedModels;
     Scene::AccelerationType accelerationType;
 #ifdef VPVL2_ENABLE_NVIDIA_CG
     cg::EffectContext effectContextCgFX;
@@ -628,7 +944,11 @@ struct Scene::PrivateContext
     Camera camera;
     IKeyframe::TimeIndex currentTimeIndex;
     Scalar preferredFPS;
+    PointerHash<HashPtr, internal::PhysicsCache> physicsCaches;
+    mutable internal::CullingContext cullingContext;
+    internal::WorkerPool *workerPool;
     bool ownMemory;
+    bool enablePhysicsCache;
 };
 
 bool Scene::initialize(void *opaque)
@@ -826,6 +1146,7 @@ void Scene::addModel(IModel *model, IRenderEngine *engine, int priority)
 void Scene::addMotion(IMotion *motion)
 {
     if (motion) {
+        m_context->removePhysicsCache(motion->parentModelRef());
         m_context->addMotionPtr(motion);
         VPVL2SceneSetParentSceneRef(motion, this);
     }
@@ -899,6 +1220,7 @@ void Scene::deleteModel(IModel *&model)
 void Scene::removeMotion(IMotion *motion)
 {
     if (motion) {
+        m_context->removePhysicsCache(motion->parentModelRef());
         m_context->removeMotionPtr(motion);
         VPVL2SceneSetParentSceneRef(motion, 0);
     }
@@ -929,19 +1251,14 @@ void Scene::advance(const IKeyframe::TimeIndex &delta, int flags)
             lightMotion->advanceScene(delta, this);
         }
     }
-    if (flags & kResetMotionState) {
-        m_context->updateMotionState();
+    if (flags & (kResetMotionState | kResetDirtyMotionState)) {
+        m_context->updateMotionState(flags);
     }
     if (flags & kForceUpdateAllMorphs) {
         m_context->markAllMorphsDirty();
     }
     if (flags & kUpdateModels) {
-        const Array<PrivateContext::MotionPtr *> &motions = m_context->motions;
-        const int nmotions = motions.count();
-        for (int i = 0; i < nmotions; i++) {
-            IMotion *motion = motions[i]->value;
-            motion->advance(delta);
-        }
+        m_context->updateMotions(delta, false, (flags & kParallelUpdateModels) != 0);
     }
     m_context->currentTimeIndex += delta;
 }
@@ -963,12 +1280,7 @@ void Scene::seek(const IKeyframe::TimeIndex &timeIndex, int flags)
         }
     }
     if (flags & kUpdateModels) {
-        const Array<PrivateContext::MotionPtr *> &motions = m_context->motions;
-        const int nmotions = motions.count();
-        for (int i = 0; i < nmotions; i++) {
-            IMotion *motion = motions[i]->value;
-            motion->seek(timeIndex);
-        }
+        m_context->updateMotions(timeIndex, true, (flags & kParallelUpdateModels) != 0);
     }
     m_context->currentTimeIndex = timeIndex;
 }
@@ -992,20 +1304,33 @@ void Scene::update(int flags)
         m_context->markAllMorphsDirty();
     }
     if (flags & kUpdateModels) {
-        m_context->updateModels();
+        m_context->updateModels((flags & kParallelUpdateModels) != 0);
     }
     /*
      * Call updateMotionAfter after #updateModels() to resolve dependency
      * (get position from motion state) of Bone's world transform.
      */
-    if (flags & kResetMotionState) {
-        m_context->updateMotionState();
+    if (flags & (kResetMotionState | kResetDirtyMotionState)) {
+        m_context->updateMotionState(flags);
+    }
+    /*
+     * Record rigid bodies after the physics world is stepped at playback and restore them
+     * after seeking instead of simulating again from the kinematic pose.
+     */
+    if (m_context->enablePhysicsCache && (flags & kUpdateModels)) {
+        if (flags & (kResetMotionState | kResetDirtyMotionState)) {
+            m_context->restorePhysicsCache();
+        }
+        else {
+            m_context->recordPhysicsCache();
+        }
     }
     /*
      * Call updateRenderEngines after #update(Models|MotionState) to get skinned position.
      * #updateModels() performs transforming position to skinned position by the model's bones.
      */
     if (flags & kUpdateRenderEngines) {
+        m_context->cullingContext.invalidate();
         m_context->updateRenderEngines();
     }
 }
@@ -1153,4 +1478,51 @@ void Scene::setWorldRef(btDiscreteDynamicsWorld *worldRef)
     m_context->setWorldRef(worldRef);
 }
 
+void Scene::setPhysicsWorldRef(extensions::World *worldRef)
+{
+    m_context->setPhysicsWorldRef(worldRef);
+}
+
+bool Scene::isPhysicsCacheEnabled() const
+{
+    return m_context->enablePhysicsCache;
+}
+
+void Scene::setPhysicsCacheEnable(bool value)
+{
+    if (!value) {
+        m_context->physicsCaches.releaseAll();
+    }
+    m_context->enablePhysicsCache = value;
+}
+
+void Scene::invalidatePhysicsCache(const IModel *model, const IKeyframe::TimeIndex &timeIndex)
+{
+    m_context->invalidatePhysicsCache(model, timeIndex);
+}
+
+int Scene::cullingFlags() const
+{
+    return m_context->cullingContext.flags();
+}
+
+void Scene::setCullingFlags(int value)
+{
+    m_context->cullingContext.setFlags(value);
+    m_context->cullingContext.invalidate();
+}
+
+void Scene::getDrawCallCounts(int &ndrawCalls, int &nfrustumCulled, int &nocclusionCulled) const
+{
+    const internal::CullingContext &context = m_context->cullingContext;
+    ndrawCalls = context.countDrawCalls();
+    nfrustumCulled = context.countFrustumCulledDrawCalls();
+    nocclusionCulled = context.countOcclusionCulledDrawCalls();
+}
+
+internal::CullingContext *Scene::cullingContextRef() const
+{
+    return &m_context->cullingContext;
+}
+
 } /* namespace vpvl2 */
@@ -0,0 +1,582 @@
+/**
+
+ Copyright (c) 2010-2013  hkrn
+
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or
+ without modification, are permitted provided that the following
+ conditions are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+ - Redistributions in binary form must reproduce the above
+   copyright notice, this list of conditions and the following
+   disclaimer in the documentation and/or other materials provided
+   with the distribution.
+ - Neither the name of the MMDAI project team nor the names of
+   its contributors may be used to endorse or promote products
+   derived from this software without specific prior written
+   permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "vpvl2/vpvl2.h"
+#include "vpvl2/internal/Culling.h"
+#include "vpvl2/internal/util.h"
+
+#include <string.h>
+
+namespace
+{
+
+using namespace vpvl2;
+
+static const Scalar kMinimumW = 1e-5f;
+
+/* edge function of the 2D triangle; positive if (x, y) is on the left of a -> b */
+static inline Scalar EdgeFunction(const Vector3 &a, const Vector3 &b, Scalar x, Scalar y)
+{
+    return (b.x() - a.x()) * (y - a.y()) - (b.y() - a.y()) * (x - a.x());
+}
+
+static inline bool IsInsideTriangle(const Vector3 &v0, const Vector3 &v1, const Vector3 &v2, Scalar x, Scalar y)
+{
+    return EdgeFunction(v0, v1, x, y) >= 0 && EdgeFunction(v1, v2, x, y) >= 0 && EdgeFunction(v2, v0, x, y) >= 0;
+}
+
+struct IndexPredication {
+    bool operator()(int left, int right) const {
+        return left < right;
+    }
+};
+
+}
+
+namespace vpvl2
+{
+namespace internal
+{
+
+MaterialAabbList::MaterialAabbList()
+    : m_nmaterials(0)
+{
+}
+
+MaterialAabbList::~MaterialAabbList()
+{
+    m_nmaterials = 0;
+}
+
+void MaterialAabbList::build(const Array<IMaterial *> &materials, const IModel::IndexBuffer *indexBufferRef, int nvertices)
+{
+    const int nmaterials = materials.count();
+    const int nindices = indexBufferRef ? int(indexBufferRef->size() / btMax(indexBufferRef->strideSize(), vsize(1))) : 0;
+    Array<int> indices;
+    m_vertexRanges.clear();
+    m_rangeOffsets.resize(nmaterials + 1);
+    int indexOffset = 0;
+    for (int i = 0; i < nmaterials; i++) {
+        const int start = indexOffset, end = btMin(indexOffset + materials[i]->indexRange().count, nindices);
+        indexOffset = end;
+        indices.clear();
+        for (int j = start; j < end; j++) {
+            const int index = indexBufferRef->indexAt(j);
+            if (internal::checkBound(index, 0, nvertices)) {
+                indices.append(index);
+            }
+        }
+        indices.sort(IndexPredication());
+        m_rangeOffsets[i] = m_vertexRanges.count();
+        const int nmaterialIndices = indices.count();
+        for (int j = 0; j < nmaterialIndices; j++) {
+            const int index = indices[j];
+            const int nranges = m_vertexRanges.count();
+            if (nranges > m_rangeOffsets[i] && index <= m_vertexRanges[nranges - 1].end) {
+                VertexRange &range = m_vertexRanges[nranges - 1];
+                range.end = btMax(range.end, index + 1);
+            }
+            else {
+                m_vertexRanges.append(VertexRange(index, index + 1));
+            }
+        }
+    }
+    m_rangeOffsets[nmaterials] = m_vertexRanges.count();
+    /* inverts vertex ranges of materials to look up materials from the vertex while skinning */
+    m_vertexMaterialOffsets.resize(nvertices + 1);
+    for (int i = 0; i <= nvertices; i++) {
+        m_vertexMaterialOffsets[i] = 0;
+    }
+    for (int i = 0; i < nmaterials; i++) {
+        const int end = m_rangeOffsets[i + 1];
+        for (int j = m_rangeOffsets[i]; j < end; j++) {
+            const VertexRange &range = m_vertexRanges[j];
+            for (int k = range.begin; k < range.end; k++) {
+                m_vertexMaterialOffsets[k + 1]++;
+            }
+        }
+    }
+    for (int i = 0; i < nvertices; i++) {
+        m_vertexMaterialOffsets[i + 1] += m_vertexMaterialOffsets[i];
+    }
+    Array<int> positions;
+    positions.resize(nvertices);
+    for (int i = 0; i < nvertices; i++) {
+        positions[i] = m_vertexMaterialOffsets[i];
+    }
+    m_vertexMaterials.resize(m_vertexMaterialOffsets[nvertices]);
+    for (int i = 0; i < nmaterials; i++) {
+        const int end = m_rangeOffsets[i + 1];
+        for (int j = m_rangeOffsets[i]; j < end; j++) {
+            const VertexRange &range = m_vertexRanges[j];
+            for (int k = range.begin; k < range.end; k++) {
+                m_vertexMaterials[positions[k]++] = i;
+            }
+        }
+    }
+    m_nmaterials = nmaterials;
+    invalidate();
+}
+
+void MaterialAabbList::beginReduction(int nslots)
+{
+    const int npartials = btMax(nslots, 0) * m_nmaterials;
+    m_aabbMinPartials.resize(npartials);
+    m_aabbMaxPartials.resize(npartials);
+    for (int i = 0; i < npartials; i++) {
+        m_aabbMinPartials[i].setValue(SIMD_INFINITY, SIMD_INFINITY, SIMD_INFINITY);
+        m_aabbMaxPartials[i].setValue(-SIMD_INFINITY, -SIMD_INFINITY, -SIMD_INFINITY);
+    }
+}
+
+void MaterialAabbList::endReduction(int nslots)
+{
+    if (!isBuilt() || m_aabbMinPartials.count() < nslots * m_nmaterials) {
+        invalidate();
+        return;
+    }
+    m_aabbMins.resize(m_nmaterials);
+    m_aabbMaxs.resize(m_nmaterials);
+    for (int i = 0; i < m_nmaterials; i++) {
+        Vector3 aabbMin(SIMD_INFINITY, SIMD_INFINITY, SIMD_INFINITY),
+                aabbMax(-SIMD_INFINITY, -SIMD_INFINITY, -SIMD_INFINITY);
+        for (int j = 0; j < nslots; j++) {
+            const int offset = j * m_nmaterials + i;
+            aabbMin.setMin(m_aabbMinPartials[offset]);
+            aabbMax.setMax(m_aabbMaxPartials[offset]);
+        }
+        m_aabbMins[i] = aabbMin;
+        m_aabbMaxs[i] = aabbMax;
+    }
+}
+
+void MaterialAabbList::invalidate()
+{
+    m_aabbMins.clear();
+    m_aabbMaxs.clear();
+}
+
+bool MaterialAabbList::get(int materialIndex, Vector3 &aabbMin, Vector3 &aabbMax) const
+{
+    if (internal::checkBound(materialIndex, 0, m_aabbMins.count())) {
+        const Vector3 &min = m_aabbMins[materialIndex], &max = m_aabbMaxs[materialIndex];
+        /* a material without any vertices has an inverted AABB */
+        if (min.x() <= max.x() && min.y() <= max.y() && min.z() <= max.z()) {
+            aabbMin = min;
+            aabbMax = max;
+            return true;
+        }
+    }
+    return false;
+}
+
+ViewFrustum::ViewFrustum()
+{
+    for (int i = 0; i < 16; i++) {
+        m_matrix[i] = (i % 5) == 0 ? 1.0f : 0.0f;
+    }
+}
+
+ViewFrustum::~ViewFrustum()
+{
+}
+
+void ViewFrustum::setMatrix(const float32 *value)
+{
+    memcpy(m_matrix, value, sizeof(m_matrix));
+}
+
+bool ViewFrustum::intersectsAabb(const Vector3 &aabbMin, const Vector3 &aabbMax) const
+{
+    /* counts corners outside of each clip plane in order of -x, +x, -y, +y, -z, +z */
+    int outside[6] = { 0, 0, 0, 0, 0, 0 };
+    Scalar clip[4];
+    for (int i = 0; i < 8; i++) {
+        const Vector3 corner((i & 1) ? aabbMax.x() : aabbMin.x(),
+                             (i & 2) ? aabbMax.y() : aabbMin.y(),
+                             (i & 4) ? aabbMax.z() : aabbMin.z());
+        transform(corner, clip);
+        const Scalar &w = clip[3];
+        for (int j = 0; j < 3; j++) {
+            outside[j * 2 + 0] += clip[j] < -w ? 1 : 0;
+            outside[j * 2 + 1] += clip[j] > w ? 1 : 0;
+        }
+    }
+    for (int i = 0; i < 6; i++) {
+        if (outside[i] == 8) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ViewFrustum::projectAabb(const Vector3 &aabbMin, const Vector3 &aabbMax, Vector3 &ndcMin, Vector3 &ndcMax) const
+{
+    Vector3 ndc;
+    ndcMin.setValue(SIMD_INFINITY, SIMD_INFINITY, SIMD_INFINITY);
+    ndcMax.setValue(-SIMD_INFINITY, -SIMD_INFINITY, -SIMD_INFINITY);
+    for (int i = 0; i < 8; i++) {
+        const Vector3 corner((i & 1) ? aabbMax.x() : aabbMin.x(),
+                             (i & 2) ? aabbMax.y() : aabbMin.y(),
+                             (i & 4) ? aabbMax.z() : aabbMin.z());
+        if (!project(corner, ndc)) {
+            return false;
+        }
+        ndcMin.setMin(ndc);
+        ndcMax.setMax(ndc);
+    }
+    return true;
+}
+
+bool ViewFrustum::project(const Vector3 &position, Vector3 &ndc) const
+{
+    Scalar clip[4];
+    transform(position, clip);
+    const Scalar &w = clip[3];
+    if (w > kMinimumW) {
+        ndc.setValue(clip[0] / w, clip[1] / w, clip[2] / w);
+        return true;
+    }
+    return false;
+}
+
+void ViewFrustum::transform(const Vector3 &position, Scalar *clip) const
+{
+    const Scalar &x = position.x(), &y = position.y(), &z = position.z();
+    for (int i = 0; i < 4; i++) {
+        clip[i] = m_matrix[i] * x + m_matrix[i + 4] * y + m_matrix[i + 8] * z + m_matrix[i + 12];
+    }
+}
+
+const int OcclusionBuffer::kDefaultWidth;
+const int OcclusionBuffer::kDefaultHeight;
+
+OcclusionBuffer::OcclusionBuffer()
+    : m_width(0),
+      m_height(0),
+      m_nrasterizedTriangles(0)
+{
+    resize(kDefaultWidth, kDefaultHeight);
+}
+
+OcclusionBuffer::~OcclusionBuffer()
+{
+    m_width = 0;
+    m_height = 0;
+    m_nrasterizedTriangles = 0;
+}
+
+void OcclusionBuffer::resize(int width, int height)
+{
+    m_width = btMax(width, 1);
+    m_height = btMax(height, 1);
+    m_depths.resize(m_width * m_height);
+    clear();
+}
+
+void OcclusionBuffer::clear()
+{
+    const int ndepths = m_depths.count();
+    for (int i = 0; i < ndepths; i++) {
+        m_depths[i] = SIMD_INFINITY;
+    }
+    m_nrasterizedTriangles = 0;
+}
+
+void OcclusionBuffer::rasterizeTriangle(const Vector3 &v0, const Vector3 &v1, const Vector3 &v2)
+{
+    const Scalar &area = EdgeFunction(v0, v1, v2.x(), v2.y());
+    if (btFuzzyZero(area)) {
+        return;
+    }
+    /* both windings are accepted as the material is drawn in both directions of the camera */
+    const Vector3 &a = v0, &b = area > 0 ? v1 : v2, &c = area > 0 ? v2 : v1;
+    const Scalar &depth = btMax(btMax(v0.z(), v1.z()), v2.z());
+    const Scalar &width = Scalar(m_width), &height = Scalar(m_height);
+    const Scalar &minX = btMin(btMin(v0.x(), v1.x()), v2.x()), &maxX = btMax(btMax(v0.x(), v1.x()), v2.x());
+    const Scalar &minY = btMin(btMin(v0.y(), v1.y()), v2.y()), &maxY = btMax(btMax(v0.y(), v1.y()), v2.y());
+    const int x0 = btMax(int(btFloor((minX + 1) * 0.5f * width)), 0);
+    const int x1 = btMin(int(btCeil((maxX + 1) * 0.5f * width)), m_width);
+    const int y0 = btMax(int(btFloor((minY + 1) * 0.5f * height)), 0);
+    const int y1 = btMin(int(btCeil((maxY + 1) * 0.5f * height)), m_height);
+    const Scalar &stepX = 2.0f / width, &stepY = 2.0f / height;
+    bool rasterized = false;
+    /* points on a shared edge are inside of both triangles so that meshes have no gaps between triangles */
+    for (int y = y0; y < y1; y++) {
+        const Scalar &centerY = (y + 0.5f) * stepY - 1;
+        for (int x = x0; x < x1; x++) {
+            const Scalar &centerX = (x + 0.5f) * stepX - 1;
+            if (IsInsideTriangle(a, b, c, centerX, centerY)) {
+                float32 &value = m_depths[y * m_width + x];
+                btSetMin(value, float32(depth));
+                rasterized = true;
+            }
+        }
+    }
+    if (rasterized) {
+        m_nrasterizedTriangles++;
+    }
+}
+
+bool OcclusionBuffer::isOccluded(const Vector3 &ndcMin, const Vector3 &ndcMax) const
+{
+    if (m_nrasterizedTriangles == 0) {
+        return false;
+    }
+    const Scalar &width = Scalar(m_width), &height = Scalar(m_height);
+    const int x0 = btMax(int(btFloor((ndcMin.x() + 1) * 0.5f * width)) - 1, 0);
+    const int x1 = btMin(int(btCeil((ndcMax.x() + 1) * 0.5f * width)) + 1, m_width);
+    const int y0 = btMax(int(btFloor((ndcMin.y() + 1) * 0.5f * height)) - 1, 0);
+    const int y1 = btMin(int(btCeil((ndcMax.y() + 1) * 0.5f * height)) + 1, m_height);
+    if (x0 >= x1 || y0 >= y1) {
+        return false;
+    }
+    const float32 nearest = float32(ndcMin.z());
+    for (int y = y0; y < y1; y++) {
+        for (int x = x0; x < x1; x++) {
+            if (!(m_depths[y * m_width + x] < nearest)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+float32 OcclusionBuffer::depthAt(int x, int y) const
+{
+    if (internal::checkBound(x, 0, m_width) && internal::checkBound(y, 0, m_height)) {
+        return m_depths[y * m_width + x];
+    }
+    return SIMD_INFINITY;
+}
+
+CullingContext::CullingContext()
+    : m_flags(Scene::kFrustumCulling),
+      m_ndrawCalls(0),
+      m_nfrustumCulledDrawCalls(0),
+      m_nocclusionCulledDrawCalls(0)
+{
+    memset(m_viewProjection, 0, sizeof(m_viewProjection));
+}
+
+CullingContext::~CullingContext()
+{
+    m_flags = 0;
+    resetCounters();
+}
+
+void CullingContext::setViewProjection(const float32 *value)
+{
+    if (memcmp(m_viewProjection, value, sizeof(m_viewProjection)) != 0) {
+        memcpy(m_viewProjection, value, sizeof(m_viewProjection));
+        m_occlusionBuffer.clear();
+    }
+}
+
+void CullingContext::invalidate()
+{
+    m_occlusionBuffer.clear();
+    resetCounters();
+}
+
+void CullingContext::resetCounters()
+{
+    m_ndrawCalls = 0;
+    m_nfrustumCulledDrawCalls = 0;
+    m_nocclusionCulledDrawCalls = 0;
+}
+
+bool CullingContext::isFrustumCullingEnabled() const
+{
+    return internal::hasFlagBits(m_flags, Scene::kFrustumCulling);
+}
+
+bool CullingContext::isOcclusionCullingEnabled() const
+{
+    return internal::hasFlagBits(m_flags, Scene::kOcclusionCulling);
+}
+
+const int MaterialCuller::kMaxOccluderTriangles;
+const float32 MaterialCuller::kMinOccluderArea = 0.05f;
+
+MaterialCuller::MaterialCuller(CullingContext *contextRef)
+    : m_contextRef(contextRef),
+      m_bufferRef(0),
+      m_passType(kModelPass)
+{
+    memset(m_modelViewProjection, 0, sizeof(m_modelViewProjection));
+}
+
+MaterialCuller::~MaterialCuller()
+{
+    m_contextRef = 0;
+    m_bufferRef = 0;
+}
+
+void MaterialCuller::begin(PassType type,
+                           const IModel::DynamicVertexBuffer *bufferRef,
+                           const float32 *modelViewProjection,
+                           const float32 *viewProjection)
+{
+    m_passType = type;
+    m_bufferRef = bufferRef;
+    m_frustum.setMatrix(modelViewProjection);
+    if (type == kModelPass) {
+        memcpy(m_modelViewProjection, modelViewProjection, sizeof(m_modelViewProjection));
+        m_visibleMaterials.clear();
+        if (viewProjection && isOcclusionCullingEnabled()) {
+            m_contextRef->setViewProjection(viewProjection);
+        }
+    }
+}
+
+bool MaterialCuller::testMaterial(int materialIndex)
+{
+    if (!m_contextRef) {
+        return true;
+    }
+    Vector3 aabbMin, aabbMax;
+    bool visible = true;
+    if (m_bufferRef && m_bufferRef->getMaterialAabb(materialIndex, aabbMin, aabbMax)) {
+        if (m_contextRef->isFrustumCullingEnabled() && !m_frustum.intersectsAabb(aabbMin, aabbMax)) {
+            m_contextRef->addFrustumCulledDrawCall();
+            visible = false;
+        }
+        else if ((m_passType == kModelPass || m_passType == kEdgePass) && isOcclusionCullingEnabled()) {
+            Vector3 ndcMin, ndcMax;
+            if (m_frustum.projectAabb(aabbMin, aabbMax, ndcMin, ndcMax) &&
+                    m_contextRef->occlusionBufferRef()->isOccluded(ndcMin, ndcMax)) {
+                m_contextRef->addOcclusionCulledDrawCall();
+                visible = false;
+            }
+        }
+    }
+    if (visible) {
+        m_contextRef->addDrawCall();
+    }
+    if (m_passType == kModelPass && materialIndex >= 0) {
+        if (materialIndex >= m_visibleMaterials.count()) {
+            const int nvisibles = m_visibleMaterials.count();
+            m_visibleMaterials.resize(materialIndex + 1);
+            for (int i = nvisibles; i < materialIndex; i++) {
+                m_visibleMaterials[i] = false;
+            }
+        }
+        m_visibleMaterials[materialIndex] = visible;
+    }
+    return visible;
+}
+
+bool MaterialCuller::testAabb(const float32 *modelViewProjection, const Vector3 &aabbMin, const Vector3 &aabbMax) const
+{
+    if (!m_contextRef || aabbMin.x() > aabbMax.x() || aabbMin.y() > aabbMax.y() || aabbMin.z() > aabbMax.z()) {
+        return true;
+    }
+    ViewFrustum frustum;
+    frustum.setMatrix(modelViewProjection);
+    if (m_contextRef->isFrustumCullingEnabled() && !frustum.intersectsAabb(aabbMin, aabbMax)) {
+        return false;
+    }
+    Vector3 ndcMin, ndcMax;
+    if (isOcclusionCullingEnabled() && frustum.projectAabb(aabbMin, aabbMax, ndcMin, ndcMax) &&
+            m_contextRef->occlusionBufferRef()->isOccluded(ndcMin, ndcMax)) {
+        return false;
+    }
+    return true;
+}
+
+void MaterialCuller::rasterizeOccluders(const IModel *modelRef,
+                                        const uint8 *vertices,
+                                        const IModel::IndexBuffer *indexBufferRef,
+                                        const Array<bool> &opaqueMaterials)
+{
+    if (!isOcclusionCullingEnabled() || !modelRef || !vertices || !indexBufferRef || !m_bufferRef ||
+            modelRef->opacity() < 1.0f) {
+        return;
+    }
+    Array<IMaterial *> materials;
+    modelRef->getMaterialRefs(materials);
+    OcclusionBuffer *buffer = m_contextRef->occlusionBufferRef();
+    ViewFrustum frustum;
+    frustum.setMatrix(m_modelViewProjection);
+    const vsize stride = m_bufferRef->strideSize(), offset = m_bufferRef->strideOffset(IModel::DynamicVertexBuffer::kVertexStride);
+    const int nmaterials = materials.count();
+    int indexOffset = 0;
+    Vector3 aabbMin, aabbMax, ndcMin, ndcMax, v[3];
+    for (int i = 0; i < nmaterials; i++) {
+        const IMaterial *material = materials[i];
+        const int nindices = material->indexRange().count, start = indexOffset;
+        indexOffset += nindices;
+        /* double sided materials are often cut out by alpha textures (e.g. hair or lace) */
+        if ((i < m_visibleMaterials.count() && !m_visibleMaterials[i]) || material->isCullingDisabled() ||
+                i >= opaqueMaterials.count() || !opaqueMaterials[i] ||
+                material->diffuse().w() < 1.0f || nindices / 3 > kMaxOccluderTriangles ||
+                !m_bufferRef->getMaterialAabb(i, aabbMin, aabbMax) ||
+                !frustum.projectAabb(aabbMin, aabbMax, ndcMin, ndcMax)) {
+            continue;
+        }
+        ndcMin.setMax(Vector3(-1, -1, -1));
+        ndcMax.setMin(Vector3(1, 1, 1));
+        if ((ndcMax.x() - ndcMin.x()) * (ndcMax.y() - ndcMin.y()) < kMinOccluderArea) {
+            continue;
+        }
+        for (int j = 0; j + 2 < nindices; j += 3) {
+            bool projected = true;
+            for (int k = 0; k < 3 && projected; k++) {
+                const int index = indexBufferRef->indexAt(start + j + k);
+                const float32 *position = reinterpret_cast<const float32 *>(vertices + stride * index + offset);
+                projected = frustum.project(Vector3(position[0], position[1], position[2]), v[k]);
+            }
+            if (projected) {
+                buffer->rasterizeTriangle(v[0], v[1], v[2]);
+            }
+        }
+    }
+}
+
+bool MaterialCuller::isEnabled() const
+{
+    return m_contextRef && (m_contextRef->isFrustumCullingEnabled() || m_contextRef->isOcclusionCullingEnabled());
+}
+
+bool MaterialCuller::isOcclusionCullingEnabled() const
+{
+    return m_contextRef && m_contextRef->isOcclusionCullingEnabled();
+}
+
+} /* namespace internal */
+} /* namespace vpvl2 */
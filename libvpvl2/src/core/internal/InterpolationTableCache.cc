@@ -0,0 +1,159 @@
+/**
+
+ Copyright (c) 2010-2013  hkrn
+
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or
+ without modification, are permitted provided that the following
+ conditions are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+ - Redistributions in binary form must reproduce the above
+   copyright notice, this list of conditions and the following
+   disclaimer in the documentation and/or other materials provided
+   with the distribution.
+ - Neither the name of the MMDAI project team nor the names of
+   its contributors may be used to endorse or promote products
+   derived from this software without specific prior written
+   permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "vpvl2/vpvl2.h"
+#include "vpvl2/internal/InterpolationTableCache.h"
+#include "vpvl2/internal/Keyframe.h"
+#include "vpvl2/internal/Mutex.h"
+
+namespace
+{
+
+using namespace vpvl2;
+
+struct InterpolationTableKey {
+    InterpolationTableKey(const QuadWord &parameter, int s)
+        : size(s)
+    {
+        for (int i = 0; i < 4; i++) {
+            points[i] = uint8(btClamped(btScalar(parameter[i]) + btScalar(0.5), btScalar(0), btScalar(255)));
+        }
+    }
+    unsigned int getHash() const {
+        unsigned int hash = unsigned(points[0]) | (unsigned(points[1]) << 8) | (unsigned(points[2]) << 16) | (unsigned(points[3]) << 24);
+        hash ^= unsigned(size) * 2654435761u;
+        return hash;
+    }
+    bool equals(const InterpolationTableKey &other) const {
+        return size == other.size && points[0] == other.points[0] && points[1] == other.points[1]
+                && points[2] == other.points[2] && points[3] == other.points[3];
+    }
+    uint8 points[4];
+    int size;
+};
+
+struct InterpolationTableEntry {
+    InterpolationTableEntry(const InterpolationTableKey &k)
+        : key(k),
+          nreferences(0)
+    {
+        const int size = key.size;
+        values.resize(size + 1);
+        IKeyframe::SmoothPrecision *ptr = &values[0];
+        internal::InterpolationTable::build(key.points[0] / 127.0, // x1
+                                            key.points[2] / 127.0, // x2
+                                            key.points[1] / 127.0, // y1
+                                            key.points[3] / 127.0, // y2
+                                            size,
+                                            ptr);
+    }
+    vsize bytes() const {
+        return values.count() * sizeof(IKeyframe::SmoothPrecision);
+    }
+    const InterpolationTableKey key;
+    Array<IKeyframe::SmoothPrecision> values;
+    int nreferences;
+};
+
+static internal::Mutex g_mutex;
+static Hash<InterpolationTableKey, InterpolationTableEntry *> g_key2entries;
+static Hash<HashPtr, InterpolationTableEntry *> g_table2entries;
+static internal::InterpolationTableCache::Stats g_stats;
+
+}
+
+namespace vpvl2
+{
+namespace internal
+{
+
+const IKeyframe::SmoothPrecision *InterpolationTableCache::acquire(const QuadWord &parameter, int size)
+{
+    VPVL2_DCHECK_GT(size, 0);
+    const InterpolationTableKey key(parameter, size);
+    ScopedLock lock(g_mutex);
+    InterpolationTableEntry *const *entryPtr = g_key2entries.find(key);
+    InterpolationTableEntry *entry = entryPtr ? *entryPtr : 0;
+    if (entry) {
+        g_stats.savedBytes += entry->bytes();
+    }
+    else {
+        entry = new InterpolationTableEntry(key);
+        g_key2entries.insert(key, entry);
+        g_table2entries.insert(HashPtr(&entry->values[0]), entry);
+        g_stats.ntables++;
+        g_stats.allocatedBytes += entry->bytes();
+    }
+    entry->nreferences++;
+    g_stats.nreferences++;
+    return &entry->values[0];
+}
+
+void InterpolationTableCache::release(const IKeyframe::SmoothPrecision *&table)
+{
+    if (table) {
+        const HashPtr tableKey(table);
+        ScopedLock lock(g_mutex);
+        InterpolationTableEntry *const *entryPtr = g_table2entries.find(tableKey);
+        if (InterpolationTableEntry *entry = entryPtr ? *entryPtr : 0) {
+            g_stats.nreferences--;
+            if (--entry->nreferences > 0) {
+                g_stats.savedBytes -= entry->bytes();
+            }
+            else {
+                g_stats.ntables--;
+                g_stats.allocatedBytes -= entry->bytes();
+                g_key2entries.remove(entry->key);
+                g_table2entries.remove(tableKey);
+                delete entry;
+            }
+        }
+        else {
+            VPVL2_LOG(WARNING, "Releasing an interpolation table not owned by the cache: " << table);
+        }
+        table = 0;
+    }
+}
+
+void InterpolationTableCache::getStats(Stats &value)
+{
+    ScopedLock lock(g_mutex);
+    value = g_stats;
+}
+
+} /* namespace internal */
+} /* namespace vpvl2 */
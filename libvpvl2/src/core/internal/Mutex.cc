@@ -0,0 +1,111 @@
+/**
+
+ Copyright (c) 2010-2013  hkrn
+
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or
+ without modification, are permitted provided that the following
+ conditions are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+ - Redistributions in binary form must reproduce the above
+   copyright notice, this list of conditions and the following
+   disclaimer in the documentation and/or other materials provided
+   with the distribution.
+ - Neither the name of the MMDAI project team nor the names of
+   its contributors may be used to endorse or promote products
+   derived from this software without specific prior written
+   permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "vpvl2/vpvl2.h"
+#include "vpvl2/internal/Mutex.h"
+
+#if defined(VPVL2_LINK_INTEL_TBB)
+#include <tbb/mutex.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+namespace vpvl2
+{
+namespace internal
+{
+
+struct Mutex::PrivateContext {
+#if defined(VPVL2_LINK_INTEL_TBB)
+    tbb::mutex value;
+#elif defined(_WIN32)
+    PrivateContext() { InitializeCriticalSection(&value); }
+    ~PrivateContext() { DeleteCriticalSection(&value); }
+    CRITICAL_SECTION value;
+#else
+    PrivateContext() { pthread_mutex_init(&value, 0); }
+    ~PrivateContext() { pthread_mutex_destroy(&value); }
+    pthread_mutex_t value;
+#endif
+};
+
+Mutex::Mutex()
+    : m_context(new PrivateContext())
+{
+}
+
+Mutex::~Mutex()
+{
+    delete m_context;
+    m_context = 0;
+}
+
+void Mutex::lock()
+{
+#if defined(VPVL2_LINK_INTEL_TBB)
+    m_context->value.lock();
+#elif defined(_WIN32)
+    EnterCriticalSection(&m_context->value);
+#else
+    pthread_mutex_lock(&m_context->value);
+#endif
+}
+
+void Mutex::unlock()
+{
+#if defined(VPVL2_LINK_INTEL_TBB)
+    m_context->value.unlock();
+#elif defined(_WIN32)
+    LeaveCriticalSection(&m_context->value);
+#else
+    pthread_mutex_unlock(&m_context->value);
+#endif
+}
+
+void *Mutex::nativeHandle() const
+{
+#if defined(VPVL2_LINK_INTEL_TBB)
+    return m_context->value.native_handle();
+#else
+    return &m_context->value;
+#endif
+}
+
+} /* namespace internal */
+} /* namespace vpvl2 */
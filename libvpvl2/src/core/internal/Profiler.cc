@@ -0,0 +1,295 @@
+/**
+
+ Copyright (c) 2010-2013  hkrn
+
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or
+ without modification, are permitted provided that the following
+ conditions are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+ - Redistributions in binary form must reproduce the above
+   copyright notice, this list of conditions and the following
+   disclaimer in the documentation and/or other materials provided
+   with the distribution.
+ - Neither the name of the MMDAI project team nor the names of
+   its contributors may be used to endorse or promote products
+   derived from this software without specific prior written
+   permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "vpvl2/vpvl2.h"
+#include "vpvl2/internal/Mutex.h"
+#include "vpvl2/internal/Profiler.h"
+#include "vpvl2/internal/Thread.h"
+
+namespace
+{
+
+using namespace vpvl2;
+using namespace vpvl2::internal;
+
+struct ThreadBuffer {
+    struct Frame {
+        int64 start;
+        const void *argRef;
+        int type;
+    };
+    ThreadBuffer(int t, int capacity)
+        : track(t),
+          cursor(0),
+          depth(0)
+    {
+        spans.resize(capacity);
+    }
+    void push(const Profiler::Span &span) {
+        if (const int capacity = spans.count()) {
+            spans[int(cursor % capacity)] = span;
+            cursor++;
+        }
+    }
+    void copy(Array<Profiler::Span> &value) const {
+        const int capacity = spans.count();
+        if (capacity > 0) {
+            /* oldest span is at the cursor once the ring buffer is wrapped around */
+            const bool wrapped = cursor > uint64(capacity);
+            const int nspans = wrapped ? capacity : int(cursor);
+            const int offset = wrapped ? int(cursor % capacity) : 0;
+            for (int i = 0; i < nspans; i++) {
+                value.append(spans[(offset + i) % capacity]);
+            }
+        }
+    }
+    void reset(int capacity) {
+        spans.clear();
+        spans.resize(capacity);
+        cursor = 0;
+        depth = 0;
+    }
+    Array<Profiler::Span> spans;
+    Frame frames[Profiler::kMaxDepth];
+    const int track;
+    uint64 cursor;
+    int depth;
+};
+
+struct ThreadBufferList {
+    ~ThreadBufferList() {
+        buffers.releaseAll();
+    }
+    PointerArray<ThreadBuffer> buffers;
+};
+
+struct SpanStartPredication {
+    bool operator()(const Profiler::Span &left, const Profiler::Span &right) const {
+        if (left.start == right.start) {
+            return left.depth < right.depth;
+        }
+        return left.start < right.start;
+    }
+};
+
+struct SpanKeyPredication {
+    bool operator()(const Profiler::Span &left, const Profiler::Span &right) const {
+        if (left.type == right.type) {
+            return left.argRef < right.argRef;
+        }
+        return left.type < right.type;
+    }
+};
+
+struct StatsTotalPredication {
+    bool operator()(const Profiler::Stats &left, const Profiler::Stats &right) const {
+        return left.total > right.total;
+    }
+};
+
+static internal::Mutex g_mutex;
+static ThreadBufferList g_bufferList;
+static int g_capacity = Profiler::kDefaultCapacity;
+static volatile bool g_enabled = false;
+static VPVL2_STATIC_TLS(ThreadBuffer *g_threadBufferRef = 0);
+
+static ThreadBuffer *VPVL2ProfilerGetThreadBuffer()
+{
+    ThreadBuffer *buffer = g_threadBufferRef;
+    if (!buffer) {
+        ScopedLock lock(g_mutex);
+        PointerArray<ThreadBuffer> &buffers = g_bufferList.buffers;
+        /* buffers are kept after the thread exits to collect its spans */
+        buffer = buffers.append(new ThreadBuffer(buffers.count() + 1, g_capacity));
+        g_threadBufferRef = buffer;
+    }
+    return buffer;
+}
+
+}
+
+namespace vpvl2
+{
+namespace internal
+{
+
+bool Profiler::isAvailable()
+{
+#if defined(VPVL2_HAS_STATIC_TLS_GNU) || defined(VPVL2_HAS_STATIC_TLS_MSVC)
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool Profiler::isEnabled()
+{
+    return g_enabled;
+}
+
+void Profiler::setEnabled(bool value)
+{
+    /* a ring buffer shared among threads is not safe without thread local storage */
+    g_enabled = value && isAvailable();
+}
+
+int Profiler::capacity()
+{
+    ScopedLock lock(g_mutex);
+    return g_capacity;
+}
+
+void Profiler::setCapacity(int value)
+{
+    ScopedLock lock(g_mutex);
+    g_capacity = btMax(value, 0);
+    PointerArray<ThreadBuffer> &buffers = g_bufferList.buffers;
+    const int nbuffers = buffers.count();
+    for (int i = 0; i < nbuffers; i++) {
+        buffers[i]->reset(g_capacity);
+    }
+}
+
+void Profiler::begin(int type, const void *arg)
+{
+    if (!g_enabled) {
+        return;
+    }
+    ThreadBuffer *buffer = VPVL2ProfilerGetThreadBuffer();
+    /* depth is counted beyond kMaxDepth to keep begin/end pairs balanced */
+    if (buffer->depth < kMaxDepth) {
+        ThreadBuffer::Frame &frame = buffer->frames[buffer->depth];
+        frame.argRef = arg;
+        frame.type = type;
+        frame.start = ElapsedTimer::currentMicroseconds();
+    }
+    buffer->depth++;
+}
+
+void Profiler::end()
+{
+    ThreadBuffer *buffer = g_threadBufferRef;
+    if (!buffer || buffer->depth <= 0) {
+        return;
+    }
+    const int depth = --buffer->depth;
+    if (depth < kMaxDepth) {
+        const ThreadBuffer::Frame &frame = buffer->frames[depth];
+        Span span;
+        span.end = ElapsedTimer::currentMicroseconds();
+        span.start = frame.start;
+        span.argRef = frame.argRef;
+        span.parentArgRef = depth > 0 ? buffer->frames[depth - 1].argRef : 0;
+        span.type = frame.type;
+        span.track = buffer->track;
+        span.depth = depth;
+        buffer->push(span);
+    }
+}
+
+void Profiler::record(int type, const void *arg, int64 start, int64 end, int track)
+{
+    if (!g_enabled) {
+        return;
+    }
+    ThreadBuffer *buffer = VPVL2ProfilerGetThreadBuffer();
+    Span span;
+    span.start = start;
+    span.end = end;
+    span.argRef = arg;
+    span.type = type;
+    span.track = track;
+    buffer->push(span);
+}
+
+void Profiler::collect(Array<Span> &spans)
+{
+    spans.clear();
+    {
+        ScopedLock lock(g_mutex);
+        const PointerArray<ThreadBuffer> &buffers = g_bufferList.buffers;
+        const int nbuffers = buffers.count();
+        for (int i = 0; i < nbuffers; i++) {
+            buffers[i]->copy(spans);
+        }
+    }
+    spans.sort(SpanStartPredication());
+}
+
+void Profiler::aggregate(const Array<Span> &spans, Array<Stats> &stats)
+{
+    stats.clear();
+    Array<Span> sortedSpans;
+    const int nspans = spans.count();
+    sortedSpans.reserve(nspans);
+    for (int i = 0; i < nspans; i++) {
+        sortedSpans.append(spans[i]);
+    }
+    sortedSpans.sort(SpanKeyPredication());
+    Stats *current = 0;
+    for (int i = 0; i < nspans; i++) {
+        const Span &span = sortedSpans[i];
+        const int64 elapsed = span.end - span.start;
+        if (!current || current->type != span.type || current->argRef != span.argRef) {
+            Stats value;
+            value.argRef = span.argRef;
+            value.parentArgRef = span.parentArgRef;
+            value.type = span.type;
+            value.min = value.max = elapsed;
+            stats.append(value);
+            current = &stats[stats.count() - 1];
+        }
+        current->count++;
+        current->total += elapsed;
+        current->min = btMin(current->min, elapsed);
+        current->max = btMax(current->max, elapsed);
+    }
+    stats.sort(StatsTotalPredication());
+}
+
+void Profiler::reset()
+{
+    ScopedLock lock(g_mutex);
+    PointerArray<ThreadBuffer> &buffers = g_bufferList.buffers;
+    const int nbuffers = buffers.count();
+    for (int i = 0; i < nbuffers; i++) {
+        buffers[i]->reset(g_capacity);
+    }
+}
+
+} /* namespace internal */
+} /* namespace vpvl2 */
@@ -0,0 +1,310 @@
+/**
+
+ Copyright (c) 2010-2013  hkrn
+
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or
+ without modification, are permitted provided that the following
+ conditions are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+ - Redistributions in binary form must reproduce the above
+   copyright notice, this list of conditions and the following
+   disclaimer in the documentation and/or other materials provided
+   with the distribution.
+ - Neither the name of the MMDAI project team nor the names of
+   its contributors may be used to endorse or promote products
+   derived from this software without specific prior written
+   permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "vpvl2/vpvl2.h"
+#include "vpvl2/internal/RenderStateCache.h"
+
+namespace
+{
+
+using namespace vpvl2;
+using namespace vpvl2::internal;
+
+/* returns negative if lvalue should be drawn before rvalue */
+static int CompareMaterialState(const MaterialUniformBlock &lvalue, int lindex, const MaterialUniformBlock &rvalue, int rindex)
+{
+    if (lvalue.isCullingDisabled != rvalue.isCullingDisabled) {
+        return lvalue.isCullingDisabled ? 1 : -1;
+    }
+    if (lvalue.mainTextureRef != rvalue.mainTextureRef) {
+        return lvalue.mainTextureRef < rvalue.mainTextureRef ? -1 : 1;
+    }
+    if (lvalue.sphereTextureRef != rvalue.sphereTextureRef) {
+        return lvalue.sphereTextureRef < rvalue.sphereTextureRef ? -1 : 1;
+    }
+    if (lvalue.sphereTextureRenderMode != rvalue.sphereTextureRenderMode) {
+        return lvalue.sphereTextureRenderMode < rvalue.sphereTextureRenderMode ? -1 : 1;
+    }
+    if (lvalue.toonTextureRef != rvalue.toonTextureRef) {
+        return lvalue.toonTextureRef < rvalue.toonTextureRef ? -1 : 1;
+    }
+    if (lvalue.isSelfShadowEnabled != rvalue.isSelfShadowEnabled) {
+        return lvalue.isSelfShadowEnabled ? 1 : -1;
+    }
+    return lindex - rindex;
+}
+
+}
+
+namespace vpvl2
+{
+namespace internal
+{
+
+UniformStateCache::UniformStateCache()
+{
+}
+
+UniformStateCache::~UniformStateCache()
+{
+}
+
+bool UniformStateCache::update1i(int location, int value)
+{
+    if (Value *v = resolveValue(location)) {
+        if (v->ncomponents == -1 && v->integer == value) {
+            return false;
+        }
+        v->ncomponents = -1;
+        v->integer = value;
+    }
+    return location >= 0;
+}
+
+bool UniformStateCache::update1f(int location, float32 value)
+{
+    return updatefv(location, &value, 1);
+}
+
+bool UniformStateCache::updatefv(int location, const float32 *values, int ncomponents)
+{
+    if (Value *v = resolveValue(location)) {
+        if (ncomponents > kMaxComponents) {
+            v->ncomponents = 0;
+            return true;
+        }
+        if (v->ncomponents == ncomponents) {
+            bool changed = false;
+            for (int i = 0; i < ncomponents; i++) {
+                if (v->components[i] != values[i]) {
+                    changed = true;
+                    break;
+                }
+            }
+            if (!changed) {
+                return false;
+            }
+        }
+        v->ncomponents = ncomponents;
+        for (int i = 0; i < ncomponents; i++) {
+            v->components[i] = values[i];
+        }
+    }
+    return location >= 0;
+}
+
+void UniformStateCache::invalidate()
+{
+    m_values.clear();
+}
+
+UniformStateCache::Value *UniformStateCache::resolveValue(int location)
+{
+    /* locations out of range are not cached and always issued */
+    if (location < 0 || location >= kMaxLocations) {
+        return 0;
+    }
+    if (location >= m_values.count()) {
+        m_values.resize(location + 1);
+    }
+    return &m_values[location];
+}
+
+RenderStateCache::RenderStateCache()
+    : m_activeTexture(kUnknownState)
+{
+    invalidate();
+}
+
+RenderStateCache::~RenderStateCache()
+{
+    invalidate();
+}
+
+bool RenderStateCache::updateActiveTexture(int unit)
+{
+    if (unit == m_activeTexture) {
+        return false;
+    }
+    m_activeTexture = unit;
+    return true;
+}
+
+bool RenderStateCache::updateTexture(int unit, uint32 name)
+{
+    if (unit < 0 || unit >= kMaxTextureUnits) {
+        return true;
+    }
+    if (m_hasTextures[unit] && m_textures[unit] == name) {
+        return false;
+    }
+    m_textures[unit] = name;
+    m_hasTextures[unit] = true;
+    return true;
+}
+
+bool RenderStateCache::updateCapability(CapabilityType type, bool value)
+{
+    const int state = value ? kEnabledState : kDisabledState;
+    if (m_capabilities[type] == state) {
+        return false;
+    }
+    m_capabilities[type] = state;
+    return true;
+}
+
+void RenderStateCache::setCapability(CapabilityType type, bool value)
+{
+    m_capabilities[type] = value ? kEnabledState : kDisabledState;
+}
+
+void RenderStateCache::invalidate()
+{
+    for (int i = 0; i < kMaxTextureUnits; i++) {
+        m_textures[i] = 0;
+        m_hasTextures[i] = false;
+    }
+    for (int i = 0; i < kMaxCapabilityType; i++) {
+        m_capabilities[i] = kUnknownState;
+    }
+    m_activeTexture = kUnknownState;
+}
+
+MaterialUniformBlock::MaterialUniformBlock()
+    : ambient(kZeroC),
+      diffuse(kZeroC),
+      specular(kZeroC),
+      mainTextureBlend(kZeroC),
+      sphereTextureBlend(kZeroC),
+      toonTextureBlend(kZeroC),
+      shininess(0),
+      mainTextureRef(0),
+      sphereTextureRef(0),
+      toonTextureRef(0),
+      sphereTextureRenderMode(IMaterial::kNone),
+      indexOffset(0),
+      nindices(0),
+      isCullingDisabled(false),
+      isSelfShadowEnabled(false),
+      isOpaque(false)
+{
+}
+
+MaterialUniformBlock::~MaterialUniformBlock()
+{
+    mainTextureRef = 0;
+    sphereTextureRef = 0;
+    toonTextureRef = 0;
+}
+
+void MaterialUniformBlock::update(const IMaterial *material, bool isMainTextureOpaque)
+{
+    ambient = material->ambient();
+    diffuse = material->diffuse();
+    specular = material->specular();
+    shininess = material->shininess();
+    mainTextureBlend = material->mainTextureBlend();
+    sphereTextureBlend = material->sphereTextureBlend();
+    toonTextureBlend = material->toonTextureBlend();
+    sphereTextureRenderMode = material->sphereTextureRenderMode();
+    nindices = material->indexRange().count;
+    isCullingDisabled = material->isCullingDisabled();
+    isSelfShadowEnabled = material->isSelfShadowEnabled();
+    isOpaque = diffuse.w() >= 1.0f && (!mainTextureRef || isMainTextureOpaque);
+}
+
+MaterialDrawOrder::MaterialDrawOrder()
+    : m_sorted(false)
+{
+}
+
+MaterialDrawOrder::~MaterialDrawOrder()
+{
+    m_sorted = false;
+}
+
+void MaterialDrawOrder::build(const Array<MaterialUniformBlock> &blocks, bool sort)
+{
+    const int nblocks = blocks.count();
+    bool changed = nblocks != m_order.count() || sort != m_sorted;
+    if (!changed && sort) {
+        for (int i = 0; i < nblocks; i++) {
+            if (blocks[i].isOpaque != m_opaques[i]) {
+                changed = true;
+                break;
+            }
+        }
+    }
+    if (!changed) {
+        return;
+    }
+    m_order.resize(nblocks);
+    m_opaques.resize(nblocks);
+    for (int i = 0; i < nblocks; i++) {
+        m_order[i] = i;
+        m_opaques[i] = blocks[i].isOpaque;
+    }
+    m_sorted = sort;
+    if (!sort) {
+        return;
+    }
+    int start = 0;
+    while (start < nblocks) {
+        if (!m_opaques[start]) {
+            start++;
+            continue;
+        }
+        int end = start + 1;
+        while (end < nblocks && m_opaques[end]) {
+            end++;
+        }
+        /* stable insertion sort because a run of opaque materials is usually short */
+        for (int i = start + 1; i < end; i++) {
+            const int index = m_order[i];
+            int j = i - 1;
+            while (j >= start && CompareMaterialState(blocks[m_order[j]], m_order[j], blocks[index], index) > 0) {
+                m_order[j + 1] = m_order[j];
+                j--;
+            }
+            m_order[j + 1] = index;
+        }
+        start = end;
+    }
+}
+
+} /* namespace internal */
+} /* namespace vpvl2 */
@@ -0,0 +1,212 @@
+/**
+
+ Copyright (c) 2010-2013  hkrn
+
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or
+ without modification, are permitted provided that the following
+ conditions are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+ - Redistributions in binary form must reproduce the above
+   copyright notice, this list of conditions and the following
+   disclaimer in the documentation and/or other materials provided
+   with the distribution.
+ - Neither the name of the MMDAI project team nor the names of
+   its contributors may be used to endorse or promote products
+   derived from this software without specific prior written
+   permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "vpvl2/vpvl2.h"
+#include "vpvl2/internal/Thread.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#if defined(__APPLE__)
+#include <mach/mach_time.h>
+#else
+#include <time.h>
+#endif
+#endif
+
+namespace vpvl2
+{
+namespace internal
+{
+
+struct Thread::PrivateContext {
+    PrivateContext(IRunnable *runnableRef)
+        : runnableRef(runnableRef),
+          running(false)
+    {
+    }
+    ~PrivateContext() {
+        runnableRef = 0;
+        running = false;
+    }
+#if defined(_WIN32)
+    static DWORD WINAPI start(LPVOID opaque) {
+        static_cast<PrivateContext *>(opaque)->runnableRef->run();
+        return 0;
+    }
+    HANDLE value;
+#else
+    static void *start(void *opaque) {
+        static_cast<PrivateContext *>(opaque)->runnableRef->run();
+        return 0;
+    }
+    pthread_t value;
+#endif
+    IRunnable *runnableRef;
+    bool running;
+};
+
+int Thread::countProcessors()
+{
+#if defined(_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return btMax(int(info.dwNumberOfProcessors), 1);
+#else
+    return btMax(int(sysconf(_SC_NPROCESSORS_ONLN)), 1);
+#endif
+}
+
+Thread::Thread(IRunnable *runnableRef)
+    : m_context(new PrivateContext(runnableRef))
+{
+}
+
+Thread::~Thread()
+{
+    join();
+    delete m_context;
+    m_context = 0;
+}
+
+bool Thread::start()
+{
+    if (!m_context->running) {
+#if defined(_WIN32)
+        m_context->value = CreateThread(0, 0, &PrivateContext::start, m_context, 0, 0);
+        m_context->running = m_context->value != 0;
+#else
+        m_context->running = pthread_create(&m_context->value, 0, &PrivateContext::start, m_context) == 0;
+#endif
+        if (!m_context->running) {
+            VPVL2_LOG(WARNING, "Cannot start a thread");
+        }
+    }
+    return m_context->running;
+}
+
+void Thread::join()
+{
+    if (m_context->running) {
+#if defined(_WIN32)
+        WaitForSingleObject(m_context->value, INFINITE);
+        CloseHandle(m_context->value);
+#else
+        pthread_join(m_context->value, 0);
+#endif
+        m_context->running = false;
+    }
+}
+
+bool Thread::isRunning() const
+{
+    return m_context->running;
+}
+
+struct Condition::PrivateContext {
+#if defined(_WIN32)
+    PrivateContext() { InitializeConditionVariable(&value); }
+    CONDITION_VARIABLE value;
+#else
+    PrivateContext() { pthread_cond_init(&value, 0); }
+    ~PrivateContext() { pthread_cond_destroy(&value); }
+    pthread_cond_t value;
+#endif
+};
+
+Condition::Condition()
+    : m_context(new PrivateContext())
+{
+}
+
+Condition::~Condition()
+{
+    delete m_context;
+    m_context = 0;
+}
+
+void Condition::wait(Mutex &mutex)
+{
+#if defined(_WIN32)
+    SleepConditionVariableCS(&m_context->value, static_cast<CRITICAL_SECTION *>(mutex.nativeHandle()), INFINITE);
+#else
+    pthread_cond_wait(&m_context->value, static_cast<pthread_mutex_t *>(mutex.nativeHandle()));
+#endif
+}
+
+void Condition::notify()
+{
+#if defined(_WIN32)
+    WakeConditionVariable(&m_context->value);
+#else
+    pthread_cond_signal(&m_context->value);
+#endif
+}
+
+void Condition::notifyAll()
+{
+#if defined(_WIN32)
+    WakeAllConditionVariable(&m_context->value);
+#else
+    pthread_cond_broadcast(&m_context->value);
+#endif
+}
+
+int64 ElapsedTimer::currentMicroseconds()
+{
+#if defined(_WIN32)
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return int64(counter.QuadPart / frequency.QuadPart) * 1000000 + int64(counter.QuadPart % frequency.QuadPart) * 1000000 / frequency.QuadPart;
+#elif defined(__APPLE__)
+    static mach_timebase_info_data_t info;
+    if (info.denom == 0) {
+        mach_timebase_info(&info);
+    }
+    return int64(mach_absolute_time() * info.numer / info.denom / 1000);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return int64(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+} /* namespace internal */
+} /* namespace vpvl2 */
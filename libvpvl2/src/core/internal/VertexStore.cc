@@ -0,0 +1,438 @@
+/**
+
+ Copyright (c) 2010-2013  hkrn
+
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or
+ without modification, are permitted provided that the following
+ conditions are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+ - Redistributions in binary form must reproduce the above
+   copyright notice, this list of conditions and the following
+   disclaimer in the documentation and/or other materials provided
+   with the distribution.
+ - Neither the name of the MMDAI project team nor the names of
+   its contributors may be used to endorse or promote products
+   derived from this software without specific prior written
+   permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "vpvl2/vpvl2.h"
+#include "vpvl2/internal/Culling.h"
+#include "vpvl2/internal/VertexStore.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define VPVL2_VERTEXSTORE_ENABLE_AVX
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define VPVL2_VERTEXSTORE_ENABLE_SSE2
+#endif
+
+namespace
+{
+
+using namespace vpvl2;
+using namespace vpvl2::internal;
+
+struct ScalarPack {
+    typedef float32 Type;
+    static const int kWidth = 1;
+    static inline Type load(const float32 *ptr) {
+        return *ptr;
+    }
+    static inline Type gather(const float32 *base, const int32 *indices, int stride, int offset) {
+        return base[indices[0] * stride + offset];
+    }
+    static inline Type add(const Type &left, const Type &right) {
+        return left + right;
+    }
+    static inline Type mul(const Type &left, const Type &right) {
+        return left * right;
+    }
+    static inline void store(float32 *ptr, const Type &value) {
+        *ptr = value;
+    }
+};
+
+#ifdef VPVL2_VERTEXSTORE_ENABLE_SSE2
+struct SSE2Pack {
+    typedef __m128 Type;
+    static const int kWidth = 4;
+    static inline Type load(const float32 *ptr) {
+        return _mm_loadu_ps(ptr);
+    }
+    static inline Type gather(const float32 *base, const int32 *indices, int stride, int offset) {
+        return _mm_setr_ps(base[indices[0] * stride + offset],
+                           base[indices[1] * stride + offset],
+                           base[indices[2] * stride + offset],
+                           base[indices[3] * stride + offset]);
+    }
+    static inline Type add(const Type &left, const Type &right) {
+        return _mm_add_ps(left, right);
+    }
+    static inline Type mul(const Type &left, const Type &right) {
+        return _mm_mul_ps(left, right);
+    }
+    static inline void store(float32 *ptr, const Type &value) {
+        _mm_storeu_ps(ptr, value);
+    }
+};
+#endif /* VPVL2_VERTEXSTORE_ENABLE_SSE2 */
+
+#ifdef VPVL2_VERTEXSTORE_ENABLE_AVX
+struct AVXPack {
+    typedef __m256 Type;
+    static const int kWidth = 8;
+    static inline Type load(const float32 *ptr) {
+        return _mm256_loadu_ps(ptr);
+    }
+    static inline Type gather(const float32 *base, const int32 *indices, int stride, int offset) {
+        return _mm256_setr_ps(base[indices[0] * stride + offset],
+                              base[indices[1] * stride + offset],
+                              base[indices[2] * stride + offset],
+                              base[indices[3] * stride + offset],
+                              base[indices[4] * stride + offset],
+                              base[indices[5] * stride + offset],
+                              base[indices[6] * stride + offset],
+                              base[indices[7] * stride + offset]);
+    }
+    static inline Type add(const Type &left, const Type &right) {
+        return _mm256_add_ps(left, right);
+    }
+    static inline Type mul(const Type &left, const Type &right) {
+        return _mm256_mul_ps(left, right);
+    }
+    static inline void store(float32 *ptr, const Type &value) {
+        _mm256_storeu_ps(ptr, value);
+    }
+};
+#endif /* VPVL2_VERTEXSTORE_ENABLE_AVX */
+
+template<typename Pack>
+class SkinningKernel {
+public:
+    typedef typename Pack::Type Type;
+
+    SkinningKernel(const VertexStore::Group &group,
+                   const float32 *palette,
+                   const float32 *materialEdgeSizes,
+                   const VertexStore::Output &output)
+        : m_group(group),
+          m_palette(palette),
+          m_materialEdgeSizes(materialEdgeSizes),
+          m_output(output)
+    {
+    }
+
+    void execute(VertexStore::GroupType type, int begin, int end, Vector3 &aabbMin, Vector3 &aabbMax, int slot) const {
+        MaterialAabbList *materialAabbsRef = m_output.materialAabbsRef;
+        for (int i = begin; i < end; i += Pack::kWidth) {
+            const Type &px = Pack::add(Pack::load(&m_group.positions[0][i]), Pack::load(&m_group.deltas[0][i]));
+            const Type &py = Pack::add(Pack::load(&m_group.positions[1][i]), Pack::load(&m_group.deltas[1][i]));
+            const Type &pz = Pack::add(Pack::load(&m_group.positions[2][i]), Pack::load(&m_group.deltas[2][i]));
+            const Type &nx = Pack::load(&m_group.normals[0][i]);
+            const Type &ny = Pack::load(&m_group.normals[1][i]);
+            const Type &nz = Pack::load(&m_group.normals[2][i]);
+            Type ox, oy, oz, onx, ony, onz;
+            switch (type) {
+            case VertexStore::kBdef1Group: {
+                transform(&m_group.bones[0][i], px, py, pz, nx, ny, nz, ox, oy, oz, onx, ony, onz);
+                break;
+            }
+            case VertexStore::kBdef2Group:
+            case VertexStore::kSdefGroup: {
+                Type x1, y1, z1, nx1, ny1, nz1, x2, y2, z2, nx2, ny2, nz2;
+                transform(&m_group.bones[0][i], px, py, pz, nx, ny, nz, x1, y1, z1, nx1, ny1, nz1);
+                transform(&m_group.bones[1][i], px, py, pz, nx, ny, nz, x2, y2, z2, nx2, ny2, nz2);
+                /* same as Vector3#setInterpolate3(v2, v1, w) = v2 * (1 - w) + v1 * w */
+                const Type &w = Pack::load(&m_group.weights[0][i]), &s = Pack::load(&m_group.weights[1][i]);
+                ox = Pack::add(Pack::mul(s, x2), Pack::mul(w, x1));
+                oy = Pack::add(Pack::mul(s, y2), Pack::mul(w, y1));
+                oz = Pack::add(Pack::mul(s, z2), Pack::mul(w, z1));
+                onx = Pack::add(Pack::mul(s, nx2), Pack::mul(w, nx1));
+                ony = Pack::add(Pack::mul(s, ny2), Pack::mul(w, ny1));
+                onz = Pack::add(Pack::mul(s, nz2), Pack::mul(w, nz1));
+                break;
+            }
+            case VertexStore::kBdef4Group: {
+                Type x, y, z, tnx, tny, tnz;
+                transform(&m_group.bones[0][i], px, py, pz, nx, ny, nz, x, y, z, tnx, tny, tnz);
+                Type w = Pack::load(&m_group.weights[0][i]);
+                ox = Pack::mul(x, w); oy = Pack::mul(y, w); oz = Pack::mul(z, w);
+                onx = Pack::mul(tnx, w); ony = Pack::mul(tny, w); onz = Pack::mul(tnz, w);
+                for (int j = 1; j < 4; j++) {
+                    transform(&m_group.bones[j][i], px, py, pz, nx, ny, nz, x, y, z, tnx, tny, tnz);
+                    w = Pack::load(&m_group.weights[j][i]);
+                    ox = Pack::add(ox, Pack::mul(x, w));
+                    oy = Pack::add(oy, Pack::mul(y, w));
+                    oz = Pack::add(oz, Pack::mul(z, w));
+                    onx = Pack::add(onx, Pack::mul(tnx, w));
+                    ony = Pack::add(ony, Pack::mul(tny, w));
+                    onz = Pack::add(onz, Pack::mul(tnz, w));
+                }
+                break;
+            }
+            case VertexStore::kMaxGroupType:
+            default:
+                return;
+            }
+            const Type &edgeSize = Pack::mul(Pack::load(&m_group.edgeSizes[i]),
+                                             Pack::gather(m_materialEdgeSizes, &m_group.materialIndices[i], 1, 0));
+            const Type &ex = Pack::add(ox, Pack::mul(onx, edgeSize));
+            const Type &ey = Pack::add(oy, Pack::mul(ony, edgeSize));
+            const Type &ez = Pack::add(oz, Pack::mul(onz, edgeSize));
+            float32 lanes[10][Pack::kWidth];
+            Pack::store(lanes[0], ox);
+            Pack::store(lanes[1], oy);
+            Pack::store(lanes[2], oz);
+            Pack::store(lanes[3], onx);
+            Pack::store(lanes[4], ony);
+            Pack::store(lanes[5], onz);
+            Pack::store(lanes[6], edgeSize);
+            Pack::store(lanes[7], ex);
+            Pack::store(lanes[8], ey);
+            Pack::store(lanes[9], ez);
+            const int nlanes = btMin(int(Pack::kWidth), end - i);
+            for (int j = 0; j < nlanes; j++) {
+                const int vertexIndex = m_group.vertexIndices[i + j];
+                uint8 *base = m_output.address + m_output.stride * vertexIndex;
+                float32 *position = reinterpret_cast<float32 *>(base + m_output.positionOffset);
+                float32 *normal = reinterpret_cast<float32 *>(base + m_output.normalOffset);
+                float32 *edge = reinterpret_cast<float32 *>(base + m_output.edgeOffset);
+                const float32 x = lanes[0][j], y = lanes[1][j], z = lanes[2][j];
+                position[0] = x;
+                position[1] = y;
+                position[2] = z;
+                position[3] = 0;
+                normal[0] = lanes[3][j];
+                normal[1] = lanes[4][j];
+                normal[2] = lanes[5][j];
+                normal[3] = lanes[6][j];
+                edge[0] = lanes[7][j];
+                edge[1] = lanes[8][j];
+                edge[2] = lanes[9][j];
+                edge[3] = float32(vertexIndex);
+                btSetMin(aabbMin[0], x);
+                btSetMin(aabbMin[1], y);
+                btSetMin(aabbMin[2], z);
+                btSetMax(aabbMax[0], x);
+                btSetMax(aabbMax[1], y);
+                btSetMax(aabbMax[2], z);
+                if (materialAabbsRef) {
+                    materialAabbsRef->reduce(slot, vertexIndex, Vector3(x, y, z), Vector3(lanes[7][j], lanes[8][j], lanes[9][j]));
+                }
+            }
+        }
+    }
+
+private:
+    /* same order of operations as Transform#operator*(Vector3) and Matrix3x3#operator*(Vector3) */
+    inline void transform(const int32 *bones,
+                          const Type &px, const Type &py, const Type &pz,
+                          const Type &nx, const Type &ny, const Type &nz,
+                          Type &ox, Type &oy, Type &oz,
+                          Type &onx, Type &ony, Type &onz) const {
+        static const int kStride = VertexStore::kPaletteStride;
+        const Type &m00 = Pack::gather(m_palette, bones, kStride, 0);
+        const Type &m01 = Pack::gather(m_palette, bones, kStride, 1);
+        const Type &m02 = Pack::gather(m_palette, bones, kStride, 2);
+        const Type &m10 = Pack::gather(m_palette, bones, kStride, 3);
+        const Type &m11 = Pack::gather(m_palette, bones, kStride, 4);
+        const Type &m12 = Pack::gather(m_palette, bones, kStride, 5);
+        const Type &m20 = Pack::gather(m_palette, bones, kStride, 6);
+        const Type &m21 = Pack::gather(m_palette, bones, kStride, 7);
+        const Type &m22 = Pack::gather(m_palette, bones, kStride, 8);
+        const Type &tx = Pack::gather(m_palette, bones, kStride, 9);
+        const Type &ty = Pack::gather(m_palette, bones, kStride, 10);
+        const Type &tz = Pack::gather(m_palette, bones, kStride, 11);
+        ox = Pack::add(dot(m00, m01, m02, px, py, pz), tx);
+        oy = Pack::add(dot(m10, m11, m12, px, py, pz), ty);
+        oz = Pack::add(dot(m20, m21, m22, px, py, pz), tz);
+        onx = dot(m00, m01, m02, nx, ny, nz);
+        ony = dot(m10, m11, m12, nx, ny, nz);
+        onz = dot(m20, m21, m22, nx, ny, nz);
+    }
+    static inline Type dot(const Type &a0, const Type &a1, const Type &a2,
+                           const Type &b0, const Type &b1, const Type &b2) {
+        return Pack::add(Pack::add(Pack::mul(a0, b0), Pack::mul(a1, b1)), Pack::mul(a2, b2));
+    }
+
+    const VertexStore::Group &m_group;
+    const float32 *m_palette;
+    const float32 *m_materialEdgeSizes;
+    const VertexStore::Output &m_output;
+};
+
+template<typename Pack>
+static inline void PerformSkinning(const VertexStore::Group &group,
+                                   VertexStore::GroupType type,
+                                   const float32 *palette,
+                                   const float32 *materialEdgeSizes,
+                                   int begin,
+                                   int end,
+                                   const VertexStore::Output &output,
+                                   Vector3 &aabbMin,
+                                   Vector3 &aabbMax,
+                                   int slot)
+{
+    SkinningKernel<Pack> kernel(group, palette, materialEdgeSizes, output);
+    kernel.execute(type, begin, end, aabbMin, aabbMax, slot);
+}
+
+}
+
+namespace vpvl2
+{
+namespace internal
+{
+
+const int VertexStore::kPaletteStride;
+const int VertexStore::kMaxLaneSize;
+
+VertexStore::KernelType VertexStore::defaultKernelType()
+{
+#if defined(VPVL2_VERTEXSTORE_ENABLE_AVX)
+    return kAVXKernel;
+#elif defined(VPVL2_VERTEXSTORE_ENABLE_SSE2)
+    return kSSE2Kernel;
+#else
+    return kScalarKernel;
+#endif
+}
+
+VertexStore::VertexStore()
+    : m_kernelType(defaultKernelType()),
+      m_nbones(0),
+      m_nmaterials(0)
+{
+}
+
+VertexStore::~VertexStore()
+{
+    m_nbones = 0;
+    m_nmaterials = 0;
+}
+
+void VertexStore::perform(GroupType type, int begin, int end, const Output &output, Vector3 &aabbMin, Vector3 &aabbMax, int slot) const
+{
+    const Group &group = m_groups[type];
+    const int count = btMin(end, group.count);
+    if (!output.address || begin >= count) {
+        return;
+    }
+    const float32 *palette = &m_palette[0], *materialEdgeSizes = &m_materialEdgeSizes[0];
+    switch (m_kernelType) {
+    case kAVXKernel:
+#if defined(VPVL2_VERTEXSTORE_ENABLE_AVX)
+        PerformSkinning<AVXPack>(group, type, palette, materialEdgeSizes, begin, count, output, aabbMin, aabbMax, slot);
+        break;
+#endif
+    case kSSE2Kernel:
+#if defined(VPVL2_VERTEXSTORE_ENABLE_SSE2)
+        PerformSkinning<SSE2Pack>(group, type, palette, materialEdgeSizes, begin, count, output, aabbMin, aabbMax, slot);
+        break;
+#endif
+    case kScalarKernel:
+    case kMaxKernelType:
+    default:
+        PerformSkinning<ScalarPack>(group, type, palette, materialEdgeSizes, begin, count, output, aabbMin, aabbMax, slot);
+        break;
+    }
+}
+
+void VertexStore::performAll(const Output &output, Vector3 &aabbMin, Vector3 &aabbMax) const
+{
+    for (int i = 0; i < kMaxGroupType; i++) {
+        const GroupType type = static_cast<GroupType>(i);
+        perform(type, 0, countVertices(type), output, aabbMin, aabbMax, 0);
+    }
+}
+
+void VertexStore::setKernelType(KernelType value)
+{
+    m_kernelType = value;
+}
+
+void VertexStore::appendVertex(GroupType type, int vertexIndex, const IVertex *vertex,
+                               int32 bone1, int32 bone2, int32 bone3, int32 bone4,
+                               float32 weight1, float32 weight2, float32 weight3, float32 weight4)
+{
+    Group &group = m_groups[type];
+    const Vector3 &origin = vertex->origin(), &normal = vertex->normal();
+    const int32 bones[] = { bone1, bone2, bone3, bone4 };
+    const float32 weights[] = { weight1, weight2, weight3, weight4 };
+    const IMaterial *material = vertex->materialRef();
+    const int materialIndex = material ? material->index() : -1;
+    m_vertexGroups[vertexIndex] = type;
+    m_vertexSlots[vertexIndex] = group.count;
+    group.vertexIndices.push_back(vertexIndex);
+    group.materialIndices.push_back(internal::checkBound(materialIndex, 0, m_nmaterials) ? materialIndex : m_nmaterials);
+    for (int i = 0; i < 4; i++) {
+        group.bones[i].push_back(bones[i] >= 0 ? bones[i] : m_nbones);
+        group.weights[i].push_back(weights[i]);
+    }
+    for (int i = 0; i < 3; i++) {
+        group.positions[i].push_back(origin[i]);
+        group.normals[i].push_back(normal[i]);
+        group.deltas[i].push_back(0);
+    }
+    group.edgeSizes.push_back(float32(vertex->edgeSize()));
+    group.count++;
+}
+
+void VertexStore::padGroup(Group &group)
+{
+    /* pad lane size so that loads of the last iteration never overrun even if the range is not aligned */
+    const int npadded = group.count + kMaxLaneSize;
+    for (int i = group.count; i < npadded; i++) {
+        group.vertexIndices.push_back(-1);
+        group.materialIndices.push_back(m_nmaterials);
+        for (int j = 0; j < 4; j++) {
+            group.bones[j].push_back(m_nbones);
+            group.weights[j].push_back(0);
+        }
+        for (int j = 0; j < 3; j++) {
+            group.positions[j].push_back(0);
+            group.normals[j].push_back(0);
+            group.deltas[j].push_back(0);
+        }
+        group.edgeSizes.push_back(0);
+    }
+}
+
+void VertexStore::setPaletteAt(int index, const Transform &transform)
+{
+    float32 *palette = &m_palette[index * kPaletteStride];
+    const Matrix3x3 &basis = transform.getBasis();
+    const Vector3 &origin = transform.getOrigin();
+    for (int i = 0; i < 3; i++) {
+        const Vector3 &row = basis.getRow(i);
+        palette[i * 3 + 0] = row.x();
+        palette[i * 3 + 1] = row.y();
+        palette[i * 3 + 2] = row.z();
+        palette[9 + i] = origin[i];
+    }
+}
+
+} /* namespace internal */
+} /* namespace vpvl2 */
@@ -0,0 +1,161 @@
+/**
+
+ Copyright (c) 2010-2013  hkrn
+
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or
+ without modification, are permitted provided that the following
+ conditions are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+ - Redistributions in binary form must reproduce the above
+   copyright notice, this list of conditions and the following
+   disclaimer in the documentation and/or other materials provided
+   with the distribution.
+ - Neither the name of the MMDAI project team nor the names of
+   its contributors may be used to endorse or promote products
+   derived from this software without specific prior written
+   permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "vpvl2/vpvl2.h"
+#include "vpvl2/internal/WorkerPool.h"
+
+namespace vpvl2
+{
+namespace internal
+{
+
+struct WorkerPool::PrivateContext : Thread::IRunnable {
+    PrivateContext()
+        : head(0),
+          nrunning(0),
+          stopped(false)
+    {
+    }
+    ~PrivateContext() {
+        head = 0;
+        nrunning = 0;
+    }
+
+    void run() {
+        ITask *task = 0;
+        while (dequeue(task)) {
+            task->execute();
+            delete task;
+            ScopedLock locker(mutex);
+            nrunning--;
+            condition.notifyAll();
+        }
+    }
+    bool dequeue(ITask *&task) {
+        ScopedLock locker(mutex);
+        while (!stopped && head == tasks.count()) {
+            condition.wait(mutex);
+        }
+        if (stopped) {
+            return false;
+        }
+        task = tasks[head++];
+        if (head == tasks.count()) {
+            tasks.clear();
+            head = 0;
+        }
+        nrunning++;
+        return true;
+    }
+
+    Mutex mutex;
+    Condition condition;
+    PointerArray<Thread> threads;
+    Array<ITask *> tasks;
+    int head;
+    int nrunning;
+    bool stopped;
+};
+
+WorkerPool::WorkerPool(int nthreads)
+    : m_context(new PrivateContext())
+{
+    const int n = nthreads > 0 ? nthreads : Thread::countProcessors();
+    for (int i = 0; i < n; i++) {
+        Thread *thread = new Thread(m_context);
+        if (thread->start()) {
+            m_context->threads.append(thread);
+        }
+        else {
+            delete thread;
+        }
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        ScopedLock locker(m_context->mutex);
+        m_context->stopped = true;
+        m_context->condition.notifyAll();
+    }
+    /* Thread#~Thread joins the thread */
+    m_context->threads.releaseAll();
+    const int ntasks = m_context->tasks.count();
+    for (int i = m_context->head; i < ntasks; i++) {
+        delete m_context->tasks[i];
+    }
+    m_context->tasks.clear();
+    delete m_context;
+    m_context = 0;
+}
+
+void WorkerPool::enqueue(ITask *task)
+{
+    if (task && m_context->threads.count() == 0) {
+        /* no worker is available, execute the task in the caller thread */
+        task->execute();
+        delete task;
+    }
+    else if (task) {
+        ScopedLock locker(m_context->mutex);
+        m_context->tasks.append(task);
+        m_context->condition.notifyAll();
+    }
+}
+
+void WorkerPool::waitForCompletion()
+{
+    ScopedLock locker(m_context->mutex);
+    while (m_context->head < m_context->tasks.count() || m_context->nrunning > 0) {
+        m_context->condition.wait(m_context->mutex);
+    }
+}
+
+int WorkerPool::countThreads() const
+{
+    return m_context->threads.count();
+}
+
+int WorkerPool::countPendingTasks() const
+{
+    ScopedLock locker(m_context->mutex);
+    return m_context->tasks.count() - m_context->head + m_context->nrunning;
+}
+
+} /* namespace internal */
+} /* namespace vpvl2 */
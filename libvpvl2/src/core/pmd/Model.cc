@@ -36,6 +36,7 @@
 */
 
 #include "vpvl2/vpvl2.h"
+#include "vpvl2/internal/Culling.h"
 #include "vpvl2/internal/ModelHelper.h"
 
 #include "vpvl2/pmd/Bone.h"
@@ -135,14 +136,16 @@ struct DefaultDynamicVertexBuffer : public IModel::DynamicVertexBuffer {
             edge[3] = Scalar(index);
             uva0.setValue(0, 0, 0, 1);
         }
-        void update(const IVertex *vertex, const IVertex::EdgeSizePrecision &materialEdgeSize, int index, Vector3 &p) {
+        void update(const IVertex *vertex, const IVertex::EdgeSizePrecision &materialEdgeSize, int index, Vector3 &p, Vector3 &e) {
             Vector3 n;
             const IVertex::EdgeSizePrecision &edgeSize = vertex->edgeSize() * materialEdgeSize;
             vertex->performSkinning(p, n);
+            /* computed from locals not to read back the mapped buffer */
+            e = p + n * Scalar(edgeSize);
             position = p;
             normal = n;
             normal[3] = Scalar(vertex->edgeSize());
-            edge = position + normal * Scalar(edgeSize);
+            edge = e;
             edge[3] = Scalar(index);
             uva0.setValue(0, 0, 0, 1);
         }
@@ -160,6 +163,9 @@ struct DefaultDynamicVertexBuffer : public IModel::DynamicVertexBuffer {
           enableSkinning(true),
           enableParallelUpdate(false)
     {
+        Array<IMaterial *> materials;
+        model->getMaterialRefs(materials);
+        materialAabbs.build(materials, indexBuffer, model->vertices().count());
     }
     ~DefaultDynamicVertexBuffer() {
         modelRef = 0;
@@ -207,7 +213,7 @@ struct DefaultDynamicVertexBuffer : public IModel::DynamicVertexBuffer {
         const Array<IVertex *> &vertices = modelRef->vertices();
         Unit *bufferPtr = static_cast<Unit *>(address);
         if (enableSkinning) {
-            internal::ParallelSkinningVertexProcessor<pmd::Model, IVertex, Unit> processor(modelRef, &vertices, cameraPosition, bufferPtr);
+            internal::ParallelSkinningVertexProcessor<pmd::Model, IVertex, Unit> processor(modelRef, &vertices, cameraPosition, bufferPtr, &materialAabbs);
             processor.execute(enableParallelUpdate);
             aabbMin = processor.aabbMin();
             aabbMax = processor.aabbMax();
@@ -215,6 +221,7 @@ struct DefaultDynamicVertexBuffer : public IModel::DynamicVertexBuffer {
         else {
             internal::ParallelInitializeVertexProcessor<pmd::Model, IVertex, Unit> processor(&vertices, address);
             processor.execute(enableParallelUpdate);
+            materialAabbs.invalidate();
         }
     }
     void setSkinningEnable(bool value) {
@@ -223,12 +230,16 @@ struct DefaultDynamicVertexBuffer : public IModel::DynamicVertexBuffer {
     void setParallelUpdateEnable(bool value) {
         enableParallelUpdate = value;
     }
+    bool getMaterialAabb(int materialIndex, Vector3 &aabbMin, Vector3 &aabbMax) const {
+        return materialAabbs.get(materialIndex, aabbMin, aabbMax);
+    }
     const void *ident() const {
         return &kIdent;
     }
 
     const Model *modelRef;
     const IModel::IndexBuffer *indexBufferRef;
+    mutable internal::MaterialAabbList materialAabbs;
     bool enableSkinning;
     bool enableParallelUpdate;
 };
@@ -353,6 +364,22 @@ struct DefaultMatrixBuffer : public IModel::MatrixBuffer {
         int nbones = meshes.bones.size();
         return internal::checkBound(materialIndex, 0, nbones) ? meshes.bones[materialIndex].size() : 0;
     }
+    int countSubMeshes(int materialIndex) const {
+        /* materials are not split and palettes are indexed by bone indices */
+        return internal::checkBound(materialIndex, 0, materials.count()) ? 1 : 0;
+    }
+    void getSubMeshRange(int materialIndex, int /* subMeshIndex */, int &offset, int &count) const {
+        offset = 0;
+        count = internal::checkBound(materialIndex, 0, materials.count()) ? materials[materialIndex]->indexRange().count : 0;
+    }
+    const float *subMeshBytes(int materialIndex, int /* subMeshIndex */) const {
+        return bytes(materialIndex);
+    }
+    vsize subMeshSize(int materialIndex, int /* subMeshIndex */) const {
+        return size(materialIndex);
+    }
+    void mapBoneIndices(void * /* address */, const IModel::StaticVertexBuffer * /* staticBuffer */) const {
+    }
 
     void initialize() {
         const int nmaterials = materials.count();
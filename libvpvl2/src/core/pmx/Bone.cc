@@ -123,7 +123,8 @@ struct Bone::PrivateContext {
           parentInherentBoneIndex(-1),
           globalID(0),
           flags(0),
-          enableInverseKinematics(true)
+          enableInverseKinematics(true),
+          dirty(true)
     {
     }
     ~PrivateContext() {
@@ -277,6 +278,7 @@ struct Bone::PrivateContext {
     int globalID;
     uint16 flags;
     bool enableInverseKinematics;
+    bool dirty;
 };
 
 Bone::Bone(IModel *modelRef)
@@ -698,8 +700,13 @@ vsize Bone::estimateSize(const Model::DataInfo &info) const
 void Bone::mergeMorph(const Morph::Bone *morph, const IMorph::WeightPrecision &weight)
 {
     const Scalar &w = Scalar(weight);
-    m_context->localMorphTranslation = morph->position * w;
-    m_context->localMorphRotation = Quaternion::getIdentity().slerp(morph->rotation, w);
+    const Vector3 &translation = morph->position * w;
+    const Quaternion &rotation = Quaternion::getIdentity().slerp(morph->rotation, w);
+    if (m_context->localMorphTranslation != translation || m_context->localMorphRotation != rotation) {
+        m_context->localMorphTranslation = translation;
+        m_context->localMorphRotation = rotation;
+        m_context->dirty = true;
+    }
 }
 
 void Bone::getLocalTransform(Transform &output) const
@@ -758,8 +765,15 @@ void Bone::performTransform()
 
 void Bone::solveInverseKinematics()
 {
+    Scalar residual;
+    solveInverseKinematics(0, residual);
+}
+
+int Bone::solveInverseKinematics(const Scalar &threshold, Scalar &residual)
+{
+    residual = 0;
     if (!hasInverseKinematics() || !m_context->enableInverseKinematics) {
-        return;
+        return 0;
     }
     const Array<IKConstraint *> &constraints = m_context->constraints;
     const Vector3 &rootBonePosition = m_context->worldTransform.getOrigin();
@@ -771,17 +785,24 @@ void Bone::solveInverseKinematics()
     const Quaternion originalTargetRotation = effectorBoneRef->localOrientation();
     Quaternion jointRotation(Quaternion::getIdentity()), newJointLocalRotation;
     Matrix3x3 matrix, mx, my, mz, result;
-    Vector3 localEffectorPosition(kZeroV3), localRootBonePosition(kZeroV3), localAxis(kZeroV3);
-    for (int i = 0; i < niteration; i++) {
+    Vector3 localEffectorPosition(kZeroV3), localRootBonePosition(kZeroV3), localAxis(kZeroV3), localEffectorOffset(kZeroV3);
+    Vector3 effectorPosition = effectorBoneRef->worldTransform().getOrigin();
+    Scalar distance = effectorPosition.distance(rootBonePosition);
+    if (threshold > 0 && distance <= threshold) {
+        residual = distance;
+        return 0;
+    }
+    int i = 0;
+    while (i < niteration) {
         const bool performConstraint = i < numHalfOfIteration;
         for (int j = 0; j < nconstraints; j++) {
             const IKConstraint *constraint = constraints[j];
             Bone *jointBoneRef = constraint->jointBoneRef;
-            const Vector3 &currentEffectorPosition = effectorBoneRef->worldTransform().getOrigin();
+            /* links before the joint are children of it, so the world transform of the joint is not changed by them */
             const Transform &jointBoneTransform = jointBoneRef->worldTransform();
-            const Transform &inversedJointBoneTransform = jointBoneTransform.inverse();
-            localRootBonePosition = inversedJointBoneTransform * rootBonePosition;
-            localEffectorPosition = inversedJointBoneTransform * currentEffectorPosition;
+            localRootBonePosition = jointBoneTransform.invXform(rootBonePosition);
+            localEffectorOffset = jointBoneTransform.invXform(effectorPosition);
+            localEffectorPosition = localEffectorOffset;
             localRootBonePosition.normalize();
             localEffectorPosition.normalize();
             const Scalar &dot = localRootBonePosition.dot(localEffectorPosition);
@@ -873,15 +894,26 @@ void Bone::solveInverseKinematics()
             }
             jointBoneRef->setLocalOrientation(newJointLocalRotation);
             jointBoneRef->m_context->jointRotation = jointRotation;
-            for (int k = j; k >= 0; k--) {
-                IKConstraint *constraint = constraints[k];
-                Bone *jointBoneRef = constraint->jointBoneRef;
-                jointBoneRef->m_context->updateWorldTransform();
-            }
-            effectorBoneRef->m_context->updateWorldTransform();
+            jointBoneRef->m_context->updateWorldTransform();
+            /* the effector moves rigidly with the joint, so it is tracked without walking all links */
+            effectorPosition = jointBoneRef->worldTransform() * localEffectorOffset;
+        }
+        /* world transforms of links are refreshed once per iteration instead of per joint */
+        for (int k = nconstraints - 1; k >= 0; k--) {
+            IKConstraint *constraint = constraints[k];
+            constraint->jointBoneRef->m_context->updateWorldTransform();
+        }
+        effectorBoneRef->m_context->updateWorldTransform();
+        effectorPosition = effectorBoneRef->worldTransform().getOrigin();
+        distance = effectorPosition.distance(rootBonePosition);
+        i++;
+        if (distance <= threshold) {
+            break;
         }
     }
     effectorBoneRef->setLocalOrientation(originalTargetRotation);
+    residual = distance;
+    return i;
 }
 
 void Bone::updateLocalTransform()
@@ -894,6 +926,51 @@ void Bone::resetIKLink()
     m_context->jointRotation = Quaternion::getIdentity();
 }
 
+bool Bone::isDirty() const
+{
+    return m_context->dirty;
+}
+
+void Bone::setDirty(bool value)
+{
+    m_context->dirty = value;
+}
+
+bool Bone::propagateDirty()
+{
+    bool changed = false;
+    if (!m_context->dirty) {
+        const Bone *parentBoneRef = m_context->parentBoneRef;
+        const Bone *parentInherentBoneRef = m_context->parentInherentBoneRef;
+        if ((parentBoneRef && parentBoneRef->m_context->dirty)
+                || (parentInherentBoneRef && parentInherentBoneRef->m_context->dirty
+                    && (hasInherentRotation() || hasInherentTranslation()))) {
+            m_context->dirty = true;
+            changed = true;
+        }
+    }
+    Bone *effectorBoneRef = m_context->effectorBoneRef;
+    if (hasInverseKinematics() && m_context->enableInverseKinematics && effectorBoneRef) {
+        /* solving IK reads and writes all bones of the chain, so these are updated together */
+        const Array<IKConstraint *> &constraints = m_context->constraints;
+        const int nconstraints = constraints.count();
+        bool dirty = m_context->dirty || effectorBoneRef->m_context->dirty;
+        for (int i = 0; i < nconstraints && !dirty; i++) {
+            dirty = constraints[i]->jointBoneRef->m_context->dirty;
+        }
+        if (dirty) {
+            changed |= !m_context->dirty || !effectorBoneRef->m_context->dirty;
+            m_context->dirty = effectorBoneRef->m_context->dirty = true;
+            for (int i = 0; i < nconstraints; i++) {
+                Bone *jointBoneRef = constraints[i]->jointBoneRef;
+                changed |= !jointBoneRef->m_context->dirty;
+                jointBoneRef->m_context->dirty = true;
+            }
+        }
+    }
+    return changed;
+}
+
 void Bone::addEventListenerRef(PropertyEventListener *value)
 {
     if (value) {
@@ -945,6 +1022,7 @@ void Bone::setLocalTranslation(const Vector3 &value)
     if (m_context->localTranslation != value) {
         VPVL2_TRIGGER_PROPERTY_EVENTS(m_context->eventRefs, localTranslationWillChange(value, this));
         m_context->localTranslation = value;
+        m_context->dirty = true;
     }
 }
 
@@ -953,6 +1031,7 @@ void Bone::setLocalOrientation(const Quaternion &value)
     if (m_context->localRotation != value) {
         VPVL2_TRIGGER_PROPERTY_EVENTS(m_context->eventRefs, localOrientationWillChange(value, this));
         m_context->localRotation = value;
+        m_context->dirty = true;
     }
 }
 
@@ -1141,12 +1220,14 @@ bool Bone::isInverseKinematicsEnabled() const
 void Bone::setLocalTransform(const Transform &value)
 {
     m_context->localTransform = value;
+    m_context->dirty = true;
 }
 
 void Bone::setParentBoneRef(Bone *value)
 {
     m_context->parentBoneRef = value;
     m_context->parentBoneIndex = value ? value->index() : -1;
+    m_context->dirty = true;
 }
 
 void Bone::setParentInherentBoneRef(Bone *value, float weight)
@@ -1154,6 +1235,7 @@ void Bone::setParentInherentBoneRef(Bone *value, float weight)
     m_context->parentInherentBoneRef = value;
     m_context->parentInherentBoneIndex = value ? value->index() : -1;
     m_context->coefficient = weight;
+    m_context->dirty = true;
 }
 
 void Bone::setEffectorBoneRef(Bone *effector, int numIteration, float angleLimit)
@@ -1162,6 +1244,7 @@ void Bone::setEffectorBoneRef(Bone *effector, int numIteration, float angleLimit
     m_context->effectorBoneIndex = effector ? effector->index() : -1;
     m_context->numIteration = numIteration;
     m_context->angleLimit = angleLimit;
+    m_context->dirty = true;
 }
 
 void Bone::setDestinationOriginBoneRef(Bone *value)
@@ -1195,6 +1278,7 @@ void Bone::setName(const IString *value, IEncoding::LanguageType type)
 void Bone::setOrigin(const Vector3 &value)
 {
     m_context->origin = value;
+    m_context->dirty = true;
 }
 
 void Bone::setDestinationOrigin(const Vector3 &value)
@@ -1256,16 +1340,19 @@ void Bone::setInteractive(bool value)
 void Bone::setIKEnable(bool value)
 {
     internal::toggleFlag(kHasInverseKinematics, value, m_context->flags);
+    m_context->dirty = true;
 }
 
 void Bone::setInherentRotationEnable(bool value)
 {
     internal::toggleFlag(kHasInherentTranslation, value, m_context->flags);
+    m_context->dirty = true;
 }
 
 void Bone::setInherentTranslationEnable(bool value)
 {
     internal::toggleFlag(kHasInherentRotation, value, m_context->flags);
+    m_context->dirty = true;
 }
 
 void Bone::setAxisFixedEnable(bool value)
@@ -1293,6 +1380,7 @@ void Bone::setInverseKinematicsEnable(bool value)
     if (m_context->enableInverseKinematics != value) {
         VPVL2_TRIGGER_PROPERTY_EVENTS(m_context->eventRefs, inverseKinematicsEnableWillChange(value, this));
         m_context->enableInverseKinematics = value;
+        m_context->dirty = true;
     }
 }
 
@@ -36,6 +36,8 @@
 */
 
 #include "vpvl2/vpvl2.h"
+#include "vpvl2/IApplicationContext.h"
+#include "vpvl2/internal/Culling.h"
 #include "vpvl2/internal/ModelHelper.h"
 
 #include "vpvl2/pmx/Bone.h"
@@ -46,7 +48,11 @@
 #include "vpvl2/pmx/Morph.h"
 #include "vpvl2/pmx/RigidBody.h"
 #include "vpvl2/pmx/Vertex.h"
+#include "vpvl2/internal/Mutex.h"
 #include "vpvl2/internal/ParallelProcessors.h"
+#include "vpvl2/internal/Profiler.h"
+#include "vpvl2/internal/VertexCacheOptimizer.h"
+#include "vpvl2/internal/VertexStore.h"
 
 #include <BulletDynamics/Dynamics/btDiscreteDynamicsWorld.h>
 #include <BulletDynamics/Dynamics/btRigidBody.h>
@@ -55,6 +61,9 @@ namespace {
 
 using namespace vpvl2;
 
+static const int kDefaultMaxBonePaletteSize = 128;
+static const Scalar kDefaultInverseKinematicsThreshold = 1.0e-4f;
+
 #pragma pack(push, 1)
 
 struct Header
@@ -187,14 +196,16 @@ struct DefaultDynamicVertexBuffer : public IModel::DynamicVertexBuffer {
             edge[3] = Scalar(index);
             updateMorph(vertex);
         }
-        void update(const IVertex *vertex, const IVertex::EdgeSizePrecision &materialEdgeSize, int index, Vector3 &p) {
+        void update(const IVertex *vertex, const IVertex::EdgeSizePrecision &materialEdgeSize, int index, Vector3 &p, Vector3 &e) {
             Vector3 n;
             const IVertex::EdgeSizePrecision &edgeSize = vertex->edgeSize() * materialEdgeSize;
             vertex->performSkinning(p, n);
+            /* computed from locals not to read back the mapped buffer */
+            e = p + n * Scalar(edgeSize);
             position = p;
             normal = n;
             normal[3] = Scalar(edgeSize);
-            edge = position + normal * Scalar(edgeSize);
+            edge = e;
             edge[3] = Scalar(index);
             updateMorph(vertex);
         }
@@ -224,6 +235,9 @@ struct DefaultDynamicVertexBuffer : public IModel::DynamicVertexBuffer {
           enableSkinning(true),
           enableParallelUpdate(false)
     {
+        Array<IMaterial *> materials;
+        model->getMaterialRefs(materials);
+        materialAabbs.build(materials, indexBuffer, model->vertices().count());
     }
     ~DefaultDynamicVertexBuffer() {
         modelRef = 0;
@@ -277,8 +291,31 @@ struct DefaultDynamicVertexBuffer : public IModel::DynamicVertexBuffer {
     void update(void *address, const Vector3 &cameraPosition, Vector3 &aabbMin, Vector3 &aabbMax) const {
         const Array<pmx::Vertex *> &vertices = modelRef->vertices();
         Unit *bufferPtr = static_cast<Unit *>(address);
-        if (enableSkinning) {
-            internal::ParallelSkinningVertexProcessor<pmx::Model, pmx::Vertex, Unit> processor(modelRef, &vertices, cameraPosition, bufferPtr);
+        internal::ScopedProfile profile(IApplicationContext::kProfileSkinningModelProcess, modelRef);
+        if (enableSkinning && modelRef->isVectorizedSkinningEnabled()) {
+            internal::VertexStore *store = modelRef->vertexStoreRef();
+            store->updateBonePalette(modelRef->bones());
+            store->updateMaterialEdgeSizes(modelRef->materials(), modelRef->edgeScaleFactor(cameraPosition));
+            const int nvertices = vertices.count();
+            for (int i = 0; i < nvertices; i++) {
+                const pmx::Vertex *vertex = vertices[i];
+                bufferPtr[i].updateMorph(vertex);
+                store->setMorphDelta(i, vertex->delta());
+            }
+            internal::VertexStore::Output output;
+            output.address = static_cast<uint8 *>(address);
+            output.stride = strideSize();
+            output.positionOffset = strideOffset(kVertexStride);
+            output.normalOffset = strideOffset(kNormalStride);
+            output.edgeOffset = strideOffset(kEdgeVertexStride);
+            output.materialAabbsRef = &materialAabbs;
+            internal::ParallelVertexStoreSkinningProcessor processor(store, output);
+            processor.execute(enableParallelUpdate);
+            aabbMin = processor.aabbMin();
+            aabbMax = processor.aabbMax();
+        }
+        else if (enableSkinning) {
+            internal::ParallelSkinningVertexProcessor<pmx::Model, pmx::Vertex, Unit> processor(modelRef, &vertices, cameraPosition, bufferPtr, &materialAabbs);
             processor.execute(enableParallelUpdate);
             aabbMin = processor.aabbMin();
             aabbMax = processor.aabbMax();
@@ -286,6 +323,7 @@ struct DefaultDynamicVertexBuffer : public IModel::DynamicVertexBuffer {
         else {
             internal::ParallelInitializeVertexProcessor<pmx::Model, pmx::Vertex, Unit> processor(&vertices, address);
             processor.execute(enableParallelUpdate);
+            materialAabbs.invalidate();
         }
     }
     void setSkinningEnable(bool value) {
@@ -294,9 +332,13 @@ struct DefaultDynamicVertexBuffer : public IModel::DynamicVertexBuffer {
     void setParallelUpdateEnable(bool value) {
         enableParallelUpdate = value;
     }
+    bool getMaterialAabb(int materialIndex, Vector3 &aabbMin, Vector3 &aabbMax) const {
+        return materialAabbs.get(materialIndex, aabbMin, aabbMax);
+    }
 
     const pmx::Model *modelRef;
     const IModel::IndexBuffer *indexBufferRef;
+    mutable internal::MaterialAabbList materialAabbs;
     bool enableSkinning;
     bool enableParallelUpdate;
 };
@@ -309,14 +351,15 @@ struct DefaultIndexBuffer : public IModel::IndexBuffer {
           indices32Ptr(0),
           nindices(indices.count())
     {
-        if (nindices < 65536) {
-            indexType = kIndex16;
-            indices16Ptr = new uint16[nindices];
-        }
-        else if (nindices < 256) {
+        /* width of indices depends on the count of vertices to be referred, not the count of indices */
+        if (nvertices <= 256) {
             indexType = kIndex8;
             indices8Ptr = new uint8[nindices];
         }
+        else if (nvertices <= 65536) {
+            indexType = kIndex16;
+            indices16Ptr = new uint16[nindices];
+        }
         else {
             indices32Ptr = new int[nindices];
         }
@@ -445,53 +488,44 @@ struct DefaultIndexBuffer : public IModel::IndexBuffer {
 const int DefaultIndexBuffer::kIdent;
 
 struct DefaultMatrixBuffer : public IModel::MatrixBuffer {
-    typedef btAlignedObjectArray<int32> BoneIndices;
-    typedef btAlignedObjectArray<BoneIndices> MeshBoneIndices;
-    typedef btAlignedObjectArray<Transform> MeshLocalTransforms;
-    typedef Array<float32 *> MeshMatrices;
-    struct SkinningMeshes {
-        MeshBoneIndices bones;
-        MeshLocalTransforms transforms;
-        MeshMatrices matrices;
-        BoneIndices bdef1;
-        BoneIndices bdef2;
-        BoneIndices bdef4;
-        BoneIndices sdef;
-        ~SkinningMeshes() { matrices.releaseArrayAll(); }
+    static const int kMaxBonesPerTriangle = 12;
+    struct SubMesh {
+        int offset;
+        int count;
+        int paletteOffset;
+        int paletteSize;
     };
 
-    DefaultMatrixBuffer(const IModel *model, const DefaultIndexBuffer *indexBuffer, DefaultDynamicVertexBuffer *dynamicBuffer)
+    DefaultMatrixBuffer(const pmx::Model *model, const DefaultIndexBuffer *indexBuffer, DefaultDynamicVertexBuffer *dynamicBuffer)
         : modelRef(model),
           indexBufferRef(indexBuffer),
-          dynamicBufferRef(dynamicBuffer)
+          dynamicBufferRef(dynamicBuffer),
+          initialized(false)
     {
         model->getBoneRefs(bones);
         model->getMaterialRefs(materials);
         model->getVertexRefs(vertices);
-        initialize();
+        initialized = initialize(model->maxBonePaletteSize());
     }
     ~DefaultMatrixBuffer() {
         modelRef = 0;
         indexBufferRef = 0;
         dynamicBufferRef = 0;
+        initialized = false;
     }
 
     void update(void *address) {
         const int nbones = bones.count();
-        MeshLocalTransforms &transforms = meshes.transforms;
         for (int i = 0; i < nbones; i++) {
             const IBone *bone = bones[i];
-            transforms[i] = bone->localTransform();
+            bone->localTransform().getOpenGLMatrix(&boneMatrices[i * 16]);
         }
-        const int nmaterials = materials.count();
-        for (int i = 0; i < nmaterials; i++) {
-            const BoneIndices &boneIndices = meshes.bones[i];
-            const int nBoneIndices = boneIndices.size();
-            Scalar *matrices = meshes.matrices[i];
-            for (int j = 0; j < nBoneIndices; j++) {
-                const int boneIndex = boneIndices[j];
-                const Transform &transform = transforms[boneIndex];
-                transform.getOpenGLMatrix(&matrices[j * 16]);
+        /* empty slots keep identity matrices written at initialize */
+        const int npaletteBones = paletteBones.count();
+        for (int i = 0; i < npaletteBones; i++) {
+            const int boneIndex = paletteBones[i];
+            if (boneIndex >= 0) {
+                memcpy(&matrices[i * 16], &boneMatrices[boneIndex * 16], sizeof(Scalar) * 16);
             }
         }
         const int nvertices = vertices.count();
@@ -499,64 +533,247 @@ struct DefaultMatrixBuffer : public IModel::MatrixBuffer {
         for (int i = 0; i < nvertices; i++) {
             const IVertex *vertex = vertices[i];
             DefaultDynamicVertexBuffer::Unit &buffer = units[i];
-            buffer.position = vertex->origin();
+            buffer.update(vertex, i);
             buffer.position.setW(Scalar(vertex->type()));
-            buffer.delta = vertex->delta();
         }
     }
     const float *bytes(int materialIndex) const {
-        int nmatrices = meshes.matrices.count();
-        return internal::checkBound(materialIndex, 0, nmatrices) ? meshes.matrices[materialIndex] : 0;
+        return subMeshBytes(materialIndex, 0);
     }
     vsize size(int materialIndex) const {
-        int nbones = meshes.bones.size();
-        return internal::checkBound(materialIndex, 0, nbones) ? meshes.bones[materialIndex].size() : 0;
+        return subMeshSize(materialIndex, 0);
+    }
+    int countSubMeshes(int materialIndex) const {
+        if (internal::checkBound(materialIndex, 0, materials.count())) {
+            return materialSubMeshOffsets[materialIndex + 1] - materialSubMeshOffsets[materialIndex];
+        }
+        return 0;
+    }
+    void getSubMeshRange(int materialIndex, int subMeshIndex, int &offset, int &count) const {
+        if (const SubMesh *subMesh = findSubMesh(materialIndex, subMeshIndex)) {
+            offset = subMesh->offset;
+            count = subMesh->count;
+        }
+        else {
+            offset = count = 0;
+        }
+    }
+    const float *subMeshBytes(int materialIndex, int subMeshIndex) const {
+        const SubMesh *subMesh = findSubMesh(materialIndex, subMeshIndex);
+        return subMesh && subMesh->paletteSize > 0 ? &matrices[subMesh->paletteOffset * 16] : 0;
+    }
+    vsize subMeshSize(int materialIndex, int subMeshIndex) const {
+        const SubMesh *subMesh = findSubMesh(materialIndex, subMeshIndex);
+        return subMesh ? subMesh->paletteSize : 0;
+    }
+    void mapBoneIndices(void *address, const IModel::StaticVertexBuffer *staticBuffer) const {
+        const int nvertices = vertices.count(), nbones = boneSlots.count();
+        const vsize offset = staticBuffer->strideOffset(IModel::StaticVertexBuffer::kBoneIndexStride);
+        const vsize stride = staticBuffer->strideSize();
+        uint8 *base = static_cast<uint8 *>(address) + offset;
+        for (int i = 0; i < nvertices; i++) {
+            float32 *boneIndices = reinterpret_cast<float32 *>(base + stride * i);
+            for (int j = 0; j < 4; j++) {
+                int boneIndex = int(boneIndices[j]), slot = 0;
+                if (internal::checkBound(boneIndex, 0, nbones) && boneSlots[boneIndex] >= 0) {
+                    slot = boneSlots[boneIndex];
+                }
+                boneIndices[j] = float32(slot);
+            }
+        }
     }
 
-    void initialize() {
-        const int nmaterials = materials.count();
-        BoneIndices boneIndices;
-        meshes.transforms.resize(bones.count());
-        int offset = 0;
+    bool isInitialized() const {
+        return initialized;
+    }
+    const SubMesh *findSubMesh(int materialIndex, int subMeshIndex) const {
+        if (internal::checkBound(subMeshIndex, 0, countSubMeshes(materialIndex))) {
+            return &subMeshes[materialSubMeshOffsets[materialIndex] + subMeshIndex];
+        }
+        return 0;
+    }
+    int collectTriangleBones(int offset, int *boneIndices) const {
+        int nboneIndices = 0;
+        for (int i = 0; i < 3; i++) {
+            const IVertex *vertex = vertices[indexBufferRef->indexAt(offset + i)];
+            for (int j = 0; j < 4; j++) {
+                const IBone *bone = vertex->boneRef(j);
+                const int boneIndex = bone ? bone->index() : -1;
+                if (boneIndex >= 0) {
+                    bool found = false;
+                    for (int k = 0; k < nboneIndices && !found; k++) {
+                        found = boneIndices[k] == boneIndex;
+                    }
+                    if (!found) {
+                        boneIndices[nboneIndices++] = boneIndex;
+                    }
+                }
+            }
+        }
+        return nboneIndices;
+    }
+    void buildBoneGraph(Array<int> &neighborOffsets, Array<int> &neighbors) const {
+        const int nbones = bones.count(), nindices = indexBufferRef->nindices;
+        int boneIndices[kMaxBonesPerTriangle];
+        neighborOffsets.resize(nbones + 1);
+        for (int i = 0; i <= nbones; i++) {
+            neighborOffsets[i] = 0;
+        }
+        /* bones sharing a triangle must be placed to different slots */
+        for (int i = 0; i + 2 < nindices; i += 3) {
+            const int nboneIndices = collectTriangleBones(i, boneIndices);
+            for (int j = 0; j < nboneIndices; j++) {
+                neighborOffsets[boneIndices[j] + 1] += nboneIndices - 1;
+            }
+        }
+        for (int i = 0; i < nbones; i++) {
+            neighborOffsets[i + 1] += neighborOffsets[i];
+        }
+        Array<int> cursors;
+        cursors.copy(neighborOffsets);
+        neighbors.resize(neighborOffsets[nbones]);
+        for (int i = 0; i + 2 < nindices; i += 3) {
+            const int nboneIndices = collectTriangleBones(i, boneIndices);
+            for (int j = 0; j < nboneIndices; j++) {
+                for (int k = 0; k < nboneIndices; k++) {
+                    if (j != k) {
+                        neighbors[cursors[boneIndices[j]]++] = boneIndices[k];
+                    }
+                }
+            }
+        }
+    }
+    bool assignBoneSlots(int maxPaletteSize) {
+        const int nbones = bones.count(), nmaterials = materials.count();
+        Array<int> neighborOffsets, neighbors, forbiddenSlots, usedSlots;
+        buildBoneGraph(neighborOffsets, neighbors);
+        boneSlots.resize(nbones);
+        for (int i = 0; i < nbones; i++) {
+            boneSlots[i] = -1;
+        }
+        forbiddenSlots.resize(maxPaletteSize);
+        usedSlots.resize(maxPaletteSize);
+        for (int i = 0; i < maxPaletteSize; i++) {
+            forbiddenSlots[i] = usedSlots[i] = -1;
+        }
+        /*
+         * Slots are assigned model-wide so each vertex has the same palette-local index in all sub-meshes.
+         * Slots unused in the current material are preferred to reduce splitting it.
+         */
+        int boneIndices[kMaxBonesPerTriangle], offset = 0;
+        for (int i = 0; i < nmaterials; i++) {
+            const int nindices = materials[i]->indexRange().count;
+            for (int j = 0; j + 2 < nindices; j += 3) {
+                const int nboneIndices = collectTriangleBones(offset + j, boneIndices);
+                for (int k = 0; k < nboneIndices; k++) {
+                    const int boneIndex = boneIndices[k];
+                    int slot = boneSlots[boneIndex];
+                    if (slot < 0) {
+                        for (int l = neighborOffsets[boneIndex], end = neighborOffsets[boneIndex + 1]; l < end; l++) {
+                            const int neighborSlot = boneSlots[neighbors[l]];
+                            if (neighborSlot >= 0) {
+                                forbiddenSlots[neighborSlot] = boneIndex;
+                            }
+                        }
+                        for (int l = 0; l < maxPaletteSize && slot < 0; l++) {
+                            if (forbiddenSlots[l] != boneIndex && usedSlots[l] != i) {
+                                slot = l;
+                            }
+                        }
+                        for (int l = 0; l < maxPaletteSize && slot < 0; l++) {
+                            if (forbiddenSlots[l] != boneIndex) {
+                                slot = l;
+                            }
+                        }
+                        if (slot < 0) {
+                            return false;
+                        }
+                        boneSlots[boneIndex] = slot;
+                    }
+                    usedSlots[slot] = i;
+                }
+            }
+            offset += nindices;
+        }
+        return true;
+    }
+    bool initialize(int maxPaletteSize) {
+        const int nmaterials = materials.count(), nbones = bones.count();
+        if (!assignBoneSlots(maxPaletteSize)) {
+            return false;
+        }
+        Array<int> slots;
+        slots.resize(maxPaletteSize);
+        int boneIndices[kMaxBonesPerTriangle], offset = 0;
+        materialSubMeshOffsets.resize(nmaterials + 1);
         for (int i = 0; i < nmaterials; i++) {
-            const IMaterial *material = materials[i];
-            const int nindices = material->indexRange().count;
-            for (int j = 0; j < nindices; j++) {
-                int vertexIndex = indexBufferRef->indexAt(offset + j);
-                IVertex *vertex = vertices[vertexIndex];
-                switch (vertex->type()) {
-                case IVertex::kBdef1:
-                    meshes.bdef1.push_back(vertexIndex);
-                    break;
-                case IVertex::kBdef2:
-                    meshes.bdef2.push_back(vertexIndex);
-                    break;
-                case IVertex::kBdef4:
-                    meshes.bdef4.push_back(vertexIndex);
-                    break;
-                case IVertex::kSdef:
-                    meshes.sdef.push_back(vertexIndex);
-                    break;
-                case IVertex::kMaxType:
-                default:
-                    break;
+            const int nindices = materials[i]->indexRange().count;
+            materialSubMeshOffsets[i] = subMeshes.count();
+            /* triangles are packed sequentially so each sub-mesh is a contiguous range of the index buffer */
+            int subMeshStart = 0, paletteSize = 0;
+            for (int j = 0; j < maxPaletteSize; j++) {
+                slots[j] = -1;
+            }
+            for (int j = 0; j + 2 < nindices; j += 3) {
+                const int nboneIndices = collectTriangleBones(offset + j, boneIndices);
+                bool fit = true;
+                for (int k = 0; k < nboneIndices && fit; k++) {
+                    const int slot = boneSlots[boneIndices[k]];
+                    fit = slots[slot] < 0 || slots[slot] == boneIndices[k];
+                }
+                if (!fit) {
+                    appendSubMesh(slots, subMeshStart, j - subMeshStart, paletteSize);
+                    subMeshStart = j;
+                    paletteSize = 0;
+                    for (int k = 0; k < maxPaletteSize; k++) {
+                        slots[k] = -1;
+                    }
+                }
+                for (int k = 0; k < nboneIndices; k++) {
+                    const int slot = boneSlots[boneIndices[k]];
+                    slots[slot] = boneIndices[k];
+                    paletteSize = btMax(paletteSize, slot + 1);
                 }
             }
-            meshes.matrices.append(new Scalar[boneIndices.size() * 16]);
-            meshes.bones.push_back(boneIndices);
-            boneIndices.clear();
+            appendSubMesh(slots, subMeshStart, nindices - subMeshStart, paletteSize);
             offset += nindices;
         }
+        materialSubMeshOffsets[nmaterials] = subMeshes.count();
+        const int npaletteBones = paletteBones.count();
+        boneMatrices.resize(nbones * 16);
+        matrices.resize(npaletteBones * 16);
+        for (int i = 0; i < npaletteBones; i++) {
+            Transform::getIdentity().getOpenGLMatrix(&matrices[i * 16]);
+        }
+        return true;
+    }
+    void appendSubMesh(const Array<int> &slots, int offset, int count, int paletteSize) {
+        SubMesh subMesh;
+        subMesh.offset = offset;
+        subMesh.count = count;
+        subMesh.paletteOffset = paletteBones.count();
+        subMesh.paletteSize = paletteSize;
+        subMeshes.append(subMesh);
+        for (int i = 0; i < paletteSize; i++) {
+            paletteBones.append(slots[i]);
+        }
     }
 
-    const IModel *modelRef;
+    const pmx::Model *modelRef;
     const DefaultIndexBuffer *indexBufferRef;
     DefaultDynamicVertexBuffer *dynamicBufferRef;
     Array<IBone *> bones;
     Array<IMaterial *> materials;
     Array<IVertex *> vertices;
-    SkinningMeshes meshes;
+    Array<SubMesh> subMeshes;
+    Array<int> materialSubMeshOffsets;
+    Array<int> boneSlots;
+    Array<int> paletteBones;
+    Array<Scalar> boneMatrices;
+    Array<Scalar> matrices;
+    bool initialized;
 };
+const int DefaultMatrixBuffer::kMaxBonesPerTriangle;
 
 static inline bool VPVL2PMXGetBonePosition(const IModel *modelRef,
                                            const IEncoding *encodingRef,
@@ -578,12 +795,100 @@ namespace pmx
 {
 
 struct Model::PrivateContext {
+    struct ParseTask {
+        virtual ~ParseTask() {}
+        virtual void execute() = 0;
+    };
+    struct VertexChunkParseTask : ParseTask {
+        VertexChunkParseTask(Model *modelRef, const Model::DataInfo &info, uint8 *ptr, int begin, int end, Array<Vertex *> &values)
+            : modelRef(modelRef),
+              info(info),
+              ptr(ptr),
+              begin(begin),
+              end(end),
+              valuesRef(values)
+        {
+        }
+        void execute() {
+            vsize size;
+            for (int i = begin; i < end; i++) {
+                Vertex *vertex = new Vertex(modelRef);
+                vertex->read(ptr, info, size);
+                ptr += size;
+                valuesRef[i] = vertex;
+            }
+        }
+        Model *modelRef;
+        const Model::DataInfo &info;
+        uint8 *ptr;
+        const int begin;
+        const int end;
+        Array<Vertex *> &valuesRef;
+    };
+    typedef void (PrivateContext::*ParseMethod)(const Model::DataInfo &info);
+    struct SectionParseTask : ParseTask {
+        SectionParseTask(PrivateContext *context, ParseMethod method, const Model::DataInfo &info)
+            : contextRef(context),
+              method(method),
+              info(info)
+        {
+        }
+        void execute() {
+            (contextRef->*method)(info);
+        }
+        PrivateContext *contextRef;
+        ParseMethod method;
+        const Model::DataInfo &info;
+    };
+    class SynchronizedEncoding : public IEncoding {
+    public:
+        SynchronizedEncoding(IEncoding *encoding)
+            : m_encodingRef(encoding)
+        {
+        }
+        ~SynchronizedEncoding() {
+            m_encodingRef = 0;
+        }
+
+        IString *toString(const uint8 *value, vsize size, IString::Codec codec) const {
+            internal::ScopedLock lock(m_mutex);
+            return m_encodingRef->toString(value, size, codec);
+        }
+        IString *toString(const uint8 *value, IString::Codec codec, vsize maxlen) const {
+            internal::ScopedLock lock(m_mutex);
+            return m_encodingRef->toString(value, codec, maxlen);
+        }
+        uint8 *toByteArray(const IString *value, IString::Codec codec) const {
+            internal::ScopedLock lock(m_mutex);
+            return m_encodingRef->toByteArray(value, codec);
+        }
+        void disposeByteArray(uint8 *value) const {
+            internal::ScopedLock lock(m_mutex);
+            m_encodingRef->disposeByteArray(value);
+        }
+        const IString *stringConstant(ConstantType value) const {
+            return m_encodingRef->stringConstant(value);
+        }
+
+    private:
+        IEncoding *m_encodingRef;
+        mutable internal::Mutex m_mutex;
+    };
+
+    enum SectionFlags {
+        kGeometrySection = 0x1, /* vertices, indices and materials */
+        kPhysicsSection  = 0x2, /* rigid bodies and joints */
+        kMorphSection    = 0x4, /* morphs and labels */
+        kAllSections     = kGeometrySection | kPhysicsSection | kMorphSection
+    };
+
     PrivateContext(IEncoding *encoding, Model *self)
         : encodingRef(encoding),
           selfRef(self),
           parentSceneRef(0),
           parentModelRef(0),
           parentBoneRef(0),
+          vertexStore(0),
           namePtr(0),
           englishNamePtr(0),
           commentPtr(0),
@@ -596,17 +901,31 @@ struct Model::PrivateContext {
           opacity(1),
           scaleFactor(1),
           edgeWidth(0),
+          pendingSections(0),
+          boneUpdateSerial(0),
           visible(false),
-          enablePhysics(false)
+          enablePhysics(false),
+          enableVectorizedSkinning(false),
+          vertexStoreDirty(true),
+          enableLazyLoad(false),
+          enableParallelLoad(false),
+          enableIncrementalBoneUpdate(true),
+          maxBonePaletteSize(kDefaultMaxBonePaletteSize),
+          enableSparseMorphUpdate(true),
+          enableVertexCacheOptimization(false),
+          inverseKinematicsThreshold(kDefaultInverseKinematicsThreshold)
     {
         internal::zerofill(&dataInfo, sizeof(dataInfo));
     }
     ~PrivateContext() {
+        delete vertexStore;
+        vertexStore = 0;
     }
 
     void release() {
         textures.releaseAll();
         vertices.releaseAll();
+        morphedVertices.clear();
         materials.releaseAll();
         bones.releaseAll();
         morphs.releaseAll();
@@ -633,6 +952,337 @@ struct Model::PrivateContext {
         rotation.setValue(0, 0, 0, 1);
         opacity = 1;
         scaleFactor = 1;
+        pendingSections = 0;
+        vertexStoreDirty = true;
+    }
+    void optimizeVertexCache(int cacheSize) {
+        const int nmaterials = materials.count(), nindices = indices.count(), nvertices = vertices.count();
+        if (nindices == 0) {
+            return;
+        }
+        internal::VertexCacheOptimizer::LocalIndexMap map;
+        int offset = 0;
+        for (int i = 0; i < nmaterials; i++) {
+            const int count = btMin(materials[i]->indexRange().count, nindices - offset);
+            internal::VertexCacheOptimizer::optimizeTriangles(&indices[offset], count, cacheSize, map);
+            offset += count;
+        }
+        /* vertices are stored in order of the first reference from the reordered triangles */
+        Array<int> newIndices;
+        Array<Vertex *> newVertices;
+        internal::VertexCacheOptimizer::remapVertices(&indices[0], nindices, nvertices, newIndices);
+        newVertices.resize(nvertices);
+        for (int i = 0; i < nvertices; i++) {
+            newVertices[newIndices[i]] = vertices[i];
+        }
+        for (int i = 0; i < nvertices; i++) {
+            Vertex *vertex = newVertices[i];
+            vertex->setIndex(i);
+            vertices[i] = vertex;
+        }
+        const int nmorphs = morphs.count();
+        for (int i = 0; i < nmorphs; i++) {
+            const Morph *morph = morphs[i];
+            const Array<Morph::Vertex *> &morphVertices = morph->vertices();
+            const int nMorphVertices = morphVertices.count();
+            for (int j = 0; j < nMorphVertices; j++) {
+                Morph::Vertex *v = morphVertices[j];
+                if (v->vertex) {
+                    v->index = v->vertex->index();
+                }
+            }
+            const Array<Morph::UV *> &morphUVs = morph->uvs();
+            const int nMorphUVs = morphUVs.count();
+            for (int j = 0; j < nMorphUVs; j++) {
+                Morph::UV *v = morphUVs[j];
+                if (v->vertex) {
+                    v->index = v->vertex->index();
+                }
+            }
+        }
+        vertexStoreDirty = true;
+    }
+    void getVertexCacheStatistics(int cacheSize, internal::VertexCacheOptimizer::Statistics &value) const {
+        const int nmaterials = materials.count(), nindices = indices.count();
+        internal::VertexCacheOptimizer::Statistics statistics;
+        internal::VertexCacheOptimizer::LocalIndexMap map;
+        int offset = 0;
+        /* the cache is assumed to be flushed at each draw call of materials */
+        for (int i = 0; i < nmaterials; i++) {
+            const int count = btMin(materials[i]->indexRange().count, nindices - offset);
+            if (count > 0) {
+                internal::VertexCacheOptimizer::simulate(&indices[offset], count, cacheSize, map, statistics);
+                value.add(statistics);
+            }
+            offset += count;
+        }
+    }
+    bool materialize(int sections) {
+        if (!(sections & pendingSections)) {
+            return true;
+        }
+        /* morphs refer vertices, materials and rigid bodies by index */
+        if (sections & pendingSections & kMorphSection) {
+            sections |= kGeometrySection | kPhysicsSection;
+        }
+        const int targets = sections & pendingSections;
+        const Model::DataInfo &info = dataInfo;
+        bool ok = true;
+        pendingSections &= ~targets;
+        if (targets & kGeometrySection) {
+            parseVertices(info);
+            parseIndices(info);
+            parseMaterials(info);
+            ok = Material::loadMaterials(materials, textures, indices.count()) && Vertex::loadVertices(vertices, bones);
+            vertexStoreDirty = true;
+        }
+        if (ok && (targets & kPhysicsSection)) {
+            parseRigidBodies(info);
+            parseJoints(info);
+            ok = RigidBody::loadRigidBodies(rigidBodies, bones) && Joint::loadJoints(joints, rigidBodies);
+        }
+        if (ok && (targets & kMorphSection)) {
+            parseMorphs(info);
+            parseLabels(info);
+            ok = Morph::loadMorphs(morphs, bones, materials, rigidBodies, vertices) && Label::loadLabels(labels, bones, morphs);
+        }
+        if (!ok) {
+            VPVL2_LOG(WARNING, "Failed materializing lazily loaded sections: " << targets);
+            /* keep the sections pending instead of leaving partially parsed (or empty) objects */
+            releaseSections(targets);
+            pendingSections |= targets;
+            return false;
+        }
+        if (pendingSections == 0) {
+            /* same as the end of eager loading */
+            selfRef->performUpdate();
+        }
+        return true;
+    }
+    void releaseSections(int sections) {
+        if (sections & kGeometrySection) {
+            vertices.releaseAll();
+            morphedVertices.clear();
+            indices.clear();
+            materials.releaseAll();
+            vertexStoreDirty = true;
+        }
+        if (sections & kPhysicsSection) {
+            joints.releaseAll();
+            rigidBodies.releaseAll();
+        }
+        if (sections & kMorphSection) {
+            labels.releaseAll();
+            morphs.releaseAll();
+            name2morphRefs.clear();
+        }
+    }
+    void resetMorphedVertices() {
+        if (enableSparseMorphUpdate) {
+            const int nvertices = morphedVertices.count();
+            for (int i = 0; i < nvertices; i++) {
+                Vertex *vertex = morphedVertices[i];
+                vertex->reset();
+            }
+        }
+        else {
+            internal::ParallelResetVertexProcessor<pmx::Vertex> processor(&vertices);
+            processor.execute();
+        }
+        morphedVertices.clear();
+    }
+    void collectMorphedVertices() {
+        const int nmorphs = morphs.count(), nvertices = vertices.count();
+        for (int i = 0; i < nmorphs; i++) {
+            Morph *morph = morphs[i];
+            morph->getMergedVertexRefs(mergedVertices);
+        }
+        /* vertex marks are all zero except while removing duplicated vertices shared among morphs */
+        vertexMarks.resize(nvertices);
+        const int nmergedVertices = mergedVertices.count();
+        for (int i = 0; i < nmergedVertices; i++) {
+            Vertex *vertex = mergedVertices[i];
+            const int index = vertex->index();
+            if (!internal::checkBound(index, 0, nvertices) || vertices[index] != vertex) {
+                morphedVertices.append(vertex);
+            }
+            else if (!vertexMarks[index]) {
+                vertexMarks[index] = 1;
+                morphedVertices.append(vertex);
+            }
+        }
+        const int nmorphedVertices = morphedVertices.count();
+        for (int i = 0; i < nmorphedVertices; i++) {
+            const int index = morphedVertices[i]->index();
+            if (internal::checkBound(index, 0, nvertices)) {
+                vertexMarks[index] = 0;
+            }
+        }
+        mergedVertices.clear();
+    }
+    void setBonesDirty(bool value) {
+        const int nbones = bones.count();
+        for (int i = 0; i < nbones; i++) {
+            Bone *bone = bones[i];
+            bone->setDirty(value);
+        }
+    }
+    void collectDirtyBones(const Array<Bone *> &orderedBones, Array<Bone *> &dirtyBones) {
+        const int nbones = orderedBones.count();
+        dirtyBones.clear();
+        for (int i = 0; i < nbones; i++) {
+            Bone *bone = orderedBones[i];
+            if (bone->isDirty()) {
+                bone->resetIKLink();
+                dirtyBones.append(bone);
+            }
+        }
+    }
+    Bone *orderedBoneAt(int position) const {
+        const int nBPSBones = BPSOrderedBones.count();
+        return position < nBPSBones ? BPSOrderedBones[position] : APSOrderedBones[position - nBPSBones];
+    }
+    int positionOf(const IBone *value) const {
+        const int index = value ? value->index() : -1;
+        return internal::checkBound(index, 0, bonePositions.count()) ? bonePositions[index] : -1;
+    }
+    bool isUpdatedInPreviousFrame(int position, const IBone *dependencyRef) const {
+        const int index = dependencyRef ? dependencyRef->index() : -1;
+        return positionOf(dependencyRef) > position && internal::checkBound(index, 0, boneUpdateSerials.count())
+                && boneUpdateSerials[index] == boneUpdateSerial - 1;
+    }
+    int findFirstCleanChainPosition(const Bone *bone) {
+        int position = BPSOrderedBones.count() + APSOrderedBones.count();
+        chainBoneRefs.clear();
+        chainBoneRefs.append(bone->effectorBoneRef());
+        bone->getEffectorBones(chainBoneRefs);
+        const int nchainBones = chainBoneRefs.count();
+        for (int i = 0; i < nchainBones; i++) {
+            const Bone *chainBone = static_cast<const Bone *>(chainBoneRefs[i]);
+            const int chainPosition = positionOf(chainBone);
+            if (chainPosition >= 0 && !chainBone->isDirty()) {
+                position = btMin(position, chainPosition);
+            }
+        }
+        return position;
+    }
+    void propagateDirtyBones(int begin) {
+        const int nbones = BPSOrderedBones.count() + APSOrderedBones.count();
+        for (int i = begin; i < nbones; i++) {
+            Bone *bone = orderedBoneAt(i);
+            const bool hasInverseKinematics = bone->hasInverseKinematics();
+            const int firstCleanChainPosition = hasInverseKinematics ? findFirstCleanChainPosition(bone) : nbones;
+            bone->propagateDirty();
+            /*
+             * a dependency placed after the bone is read as the previous frame like the full update does,
+             * so the bone is updated again one frame after the dependency is updated
+             */
+            if (!bone->isDirty() && (isUpdatedInPreviousFrame(i, bone->parentBoneRef())
+                                     || ((bone->hasInherentRotation() || bone->hasInherentTranslation())
+                                         && isUpdatedInPreviousFrame(i, bone->parentInherentBoneRef())))) {
+                bone->setDirty(true);
+            }
+            /* solving IK marks the whole chain and bones depending on the chain are already visited */
+            if (hasInverseKinematics && firstCleanChainPosition < i && bone->isDirty()) {
+                i = firstCleanChainPosition - 1;
+            }
+        }
+    }
+    void collectDirtyBones() {
+        /* bones are ordered mostly from parents to children so dirty flags are propagated in a single pass */
+        const int nBPSBones = BPSOrderedBones.count(), nAPSBones = APSOrderedBones.count();
+        bonePositions.resize(bones.count());
+        boneUpdateSerials.resize(bones.count());
+        for (int i = 0; i < nBPSBones + nAPSBones; i++) {
+            const int index = orderedBoneAt(i)->index();
+            if (internal::checkBound(index, 0, bonePositions.count())) {
+                bonePositions[index] = i;
+            }
+        }
+        boneUpdateSerial++;
+        propagateDirtyBones(0);
+        collectDirtyBones(BPSOrderedBones, dirtyBPSBones);
+        collectDirtyBones(APSOrderedBones, dirtyAPSBones);
+    }
+    bool isUpdatedLater(const Bone *bone, const IBone *dependencyRef) const {
+        const Bone *dependency = static_cast<const Bone *>(dependencyRef);
+        if (dependency && dependency->isDirty()) {
+            const int npositions = bonePositions.count(), index = bone->index(), dependencyIndex = dependency->index();
+            return internal::checkBound(index, 0, npositions) && internal::checkBound(dependencyIndex, 0, npositions)
+                    && bonePositions[index] < bonePositions[dependencyIndex];
+        }
+        return false;
+    }
+    void collectStaleBones(const Array<Bone *> &dirtyBones) {
+        const int nbones = dirtyBones.count();
+        for (int i = 0; i < nbones; i++) {
+            Bone *bone = dirtyBones[i];
+            if (isUpdatedLater(bone, bone->parentBoneRef()) || isUpdatedLater(bone, bone->parentInherentBoneRef())) {
+                staleBones.append(bone);
+            }
+        }
+    }
+    void markBoneUpdated(Bone *bone) {
+        const int index = bone->index();
+        if (internal::checkBound(index, 0, boneUpdateSerials.count())) {
+            boneUpdateSerials[index] = boneUpdateSerial;
+        }
+        bone->setDirty(false);
+    }
+    void cleanDirtyBones() {
+        /* bones placed before their dependencies are computed from stale transforms, so keep them dirty */
+        staleBones.clear();
+        collectStaleBones(dirtyBPSBones);
+        collectStaleBones(dirtyAPSBones);
+        const int nBPSBones = dirtyBPSBones.count(), nAPSBones = dirtyAPSBones.count(), nstaleBones = staleBones.count();
+        for (int i = 0; i < nBPSBones; i++) {
+            markBoneUpdated(dirtyBPSBones[i]);
+        }
+        for (int i = 0; i < nAPSBones; i++) {
+            markBoneUpdated(dirtyAPSBones[i]);
+        }
+        for (int i = 0; i < nstaleBones; i++) {
+            staleBones[i]->setDirty(true);
+        }
+    }
+    void solveInverseKinematics(Bone *bone) {
+        if (bone->hasInverseKinematics() && bone->isInverseKinematicsEnabled()) {
+            internal::ScopedProfile profile(IApplicationContext::kProfileSolveInverseKinematicsProcess, bone);
+            Model::InverseKinematicsStatistics &statistics = inverseKinematicsStatistics;
+            Scalar residual;
+            const int niterations = bone->solveInverseKinematics(inverseKinematicsThreshold, residual);
+            statistics.nchains++;
+            statistics.niterations += niterations;
+            statistics.maxResidual = btMax(statistics.maxResidual, residual);
+            statistics.totalResidual += residual;
+            if (residual <= inverseKinematicsThreshold) {
+                statistics.nconverged++;
+            }
+        }
+    }
+    void transformBones(Array<Bone *> &bones) {
+        const int nbones = bones.count();
+        for (int i = 0; i < nbones; i++) {
+            Bone *bone = bones[i];
+            bone->performTransform();
+            solveInverseKinematics(bone);
+        }
+    }
+    void updateBones(Array<Bone *> &bones) {
+        transformBones(bones);
+        internal::ParallelUpdateLocalTransformProcessor<pmx::Bone> processor(&bones);
+        processor.execute();
+    }
+    void updateDirtyBones(Array<Bone *> &dirtyBones, Array<Bone *> &orderedBones) {
+        transformBones(dirtyBones);
+        /* local transforms of bones may be overwritten by rigid bodies on physics simulation */
+        internal::ParallelUpdateLocalTransformProcessor<pmx::Bone> processor(enablePhysics ? &orderedBones : &dirtyBones);
+        processor.execute();
+    }
+    template<typename T>
+    int countOf(int section, const Array<T> &values, vsize countInData) const {
+        /* counts of sections not materialized yet are taken from the preparsed data */
+        return (pendingSections & section) ? int(countInData) : values.count();
     }
     void parseNamesAndComments(const Model::DataInfo &info) {
         IEncoding *encoding = info.encoding;
@@ -674,10 +1324,48 @@ struct Model::PrivateContext {
         int size;
         for (int i = 0; i < ntextures; i++) {
             internal::getText(ptr, rest, texturePtr, size);
-            IString *value = encodingRef->toString(texturePtr, size, info.codec);
+            IString *value = info.encoding->toString(texturePtr, size, info.codec);
             textures.insert(value->toHashString(), value);
         }
     }
+    void parseSectionsInParallel(const Model::DataInfo &info) {
+        /* string conversions of IEncoding are not reentrant, so these are serialized */
+        SynchronizedEncoding encoding(info.encoding);
+        Model::DataInfo sharedInfo(info);
+        sharedInfo.encoding = &encoding;
+        /* initialize shared null references referred from constructors before running tasks */
+        Factory::sharedNullBoneRef();
+        Factory::sharedNullMaterialRef();
+        PointerArray<ParseTask> tasks;
+        Array<Vertex *> newVertices;
+        const int nvertices = int(info.verticesCount), chunkSize = int(info.vertexChunkSize);
+        if (chunkSize > 0) {
+            newVertices.resize(nvertices);
+            for (int i = 0; i < nvertices; i += chunkSize) {
+                uint8 *ptr = info.vertexChunkPtrs[i / chunkSize];
+                tasks.append(new VertexChunkParseTask(selfRef, sharedInfo, ptr, i, btMin(i + chunkSize, nvertices), newVertices));
+            }
+        }
+        else {
+            tasks.append(new SectionParseTask(this, &PrivateContext::parseVertices, sharedInfo));
+        }
+        tasks.append(new SectionParseTask(this, &PrivateContext::parseIndices, sharedInfo));
+        tasks.append(new SectionParseTask(this, &PrivateContext::parseTextures, sharedInfo));
+        tasks.append(new SectionParseTask(this, &PrivateContext::parseBones, sharedInfo));
+        tasks.append(new SectionParseTask(this, &PrivateContext::parseMorphs, sharedInfo));
+        tasks.append(new SectionParseTask(this, &PrivateContext::parseLabels, sharedInfo));
+        tasks.append(new SectionParseTask(this, &PrivateContext::parseRigidBodies, sharedInfo));
+        tasks.append(new SectionParseTask(this, &PrivateContext::parseJoints, sharedInfo));
+        internal::ParallelTaskProcessor<ParseTask> processor(&tasks);
+        processor.execute();
+        tasks.releaseAll();
+        const int nnewVertices = newVertices.count();
+        for (int i = 0; i < nnewVertices; i++) {
+            vertices.append(newVertices[i]);
+        }
+        /* materials link vertices through indices so they are parsed after the others */
+        parseMaterials(info);
+    }
     void parseMaterials(const Model::DataInfo &info) {
         const int nmaterials = info.materialsCount, nindices = indices.count();
         uint8 *ptr = info.materialsPtr;
@@ -768,6 +1456,15 @@ struct Model::PrivateContext {
     PointerArray<Bone> bones;
     Array<Bone *> BPSOrderedBones;
     Array<Bone *> APSOrderedBones;
+    Array<Bone *> dirtyBPSBones;
+    Array<Bone *> dirtyAPSBones;
+    Array<Bone *> staleBones;
+    Array<int> bonePositions;
+    Array<int> boneUpdateSerials;
+    Array<IBone *> chainBoneRefs;
+    Array<Vertex *> morphedVertices;
+    Array<Vertex *> mergedVertices;
+    Array<uint8> vertexMarks;
     PointerArray<Morph> morphs;
     PointerArray<Label> labels;
     PointerArray<RigidBody> rigidBodies;
@@ -775,6 +1472,7 @@ struct Model::PrivateContext {
     Hash<HashString, IBone *> name2boneRefs;
     Hash<HashString, IMorph *> name2morphRefs;
     Array<PropertyEventListener *> eventRefs;
+    internal::VertexStore *vertexStore;
     IString *namePtr;
     IString *englishNamePtr;
     IString *commentPtr;
@@ -788,8 +1486,20 @@ struct Model::PrivateContext {
     Scalar scaleFactor;
     IVertex::EdgeSizePrecision edgeWidth;
     DataInfo dataInfo;
+    int pendingSections;
+    int boneUpdateSerial;
     bool visible;
     bool enablePhysics;
+    bool enableVectorizedSkinning;
+    bool vertexStoreDirty;
+    bool enableLazyLoad;
+    bool enableParallelLoad;
+    bool enableIncrementalBoneUpdate;
+    int maxBonePaletteSize;
+    bool enableSparseMorphUpdate;
+    bool enableVertexCacheOptimization;
+    Scalar inverseKinematicsThreshold;
+    Model::InverseKinematicsStatistics inverseKinematicsStatistics;
 };
 
 Model::Model(IEncoding *encoding)
@@ -812,15 +1522,33 @@ bool Model::load(const uint8 *data, vsize size)
     if (preparse(data, size, info)) {
         m_context->release();
         m_context->parseNamesAndComments(info);
-        m_context->parseVertices(info);
-        m_context->parseIndices(info);
-        m_context->parseTextures(info);
-        m_context->parseMaterials(info);
-        m_context->parseBones(info);
-        m_context->parseMorphs(info);
-        m_context->parseLabels(info);
-        m_context->parseRigidBodies(info);
-        m_context->parseJoints(info);
+        if (m_context->enableLazyLoad) {
+            /* data must be kept alive until the rest of sections are materialized */
+            m_context->parseTextures(info);
+            m_context->parseBones(info);
+            if (!Bone::loadBones(m_context->bones)) {
+                m_context->dataInfo.error = info.error;
+                return false;
+            }
+            Bone::sortBones(m_context->bones, m_context->BPSOrderedBones, m_context->APSOrderedBones);
+            m_context->dataInfo = info;
+            m_context->pendingSections = PrivateContext::kAllSections;
+            return true;
+        }
+        if (m_context->enableParallelLoad) {
+            m_context->parseSectionsInParallel(info);
+        }
+        else {
+            m_context->parseVertices(info);
+            m_context->parseIndices(info);
+            m_context->parseTextures(info);
+            m_context->parseMaterials(info);
+            m_context->parseBones(info);
+            m_context->parseMorphs(info);
+            m_context->parseLabels(info);
+            m_context->parseRigidBodies(info);
+            m_context->parseJoints(info);
+        }
         if (!Bone::loadBones(m_context->bones)
                 || !Material::loadMaterials(m_context->materials, m_context->textures, m_context->indices.count())
                 || !Vertex::loadVertices(m_context->vertices, m_context->bones)
@@ -832,6 +1560,14 @@ bool Model::load(const uint8 *data, vsize size)
             return false;
         }
         Bone::sortBones(m_context->bones, m_context->BPSOrderedBones, m_context->APSOrderedBones);
+        if (m_context->enableVertexCacheOptimization) {
+            const int cacheSize = internal::VertexCacheOptimizer::kDefaultCacheSize;
+            internal::VertexCacheOptimizer::Statistics before, after;
+            m_context->getVertexCacheStatistics(cacheSize, before);
+            m_context->optimizeVertexCache(cacheSize);
+            m_context->getVertexCacheStatistics(cacheSize, after);
+            VPVL2_VLOG(1, "PMXVertexCache: ACMR=" << before.acmr() << "=>" << after.acmr() << " ATVR=" << before.atvr() << "=>" << after.atvr());
+        }
         performUpdate();
         m_context->dataInfo = info;
         return true;
@@ -844,6 +1580,7 @@ bool Model::load(const uint8 *data, vsize size)
 
 void Model::save(uint8 *data, vsize &written) const
 {
+    m_context->materialize(PrivateContext::kAllSections);
     Header header;
     uint8 *base = data;
     uint8 *signature = reinterpret_cast<uint8 *>(header.signature);
@@ -894,6 +1631,7 @@ void Model::save(uint8 *data, vsize &written) const
 
 vsize Model::estimateSize() const
 {
+    m_context->materialize(PrivateContext::kAllSections);
     vsize size = 0;
     IString::Codec codec = IString::kUTF8; // TODO: UTF-16 support
     DataInfo info = m_context->dataInfo;
@@ -925,6 +1663,7 @@ vsize Model::estimateSize() const
 
 void Model::joinWorld(btDiscreteDynamicsWorld *worldRef)
 {
+    m_context->materialize(PrivateContext::kPhysicsSection);
     if (worldRef && m_context->enablePhysics) {
         const int nRigidBodies = m_context->rigidBodies.count();
         for (int i = 0; i < nRigidBodies; i++) {
@@ -941,6 +1680,7 @@ void Model::joinWorld(btDiscreteDynamicsWorld *worldRef)
 
 void Model::leaveWorld(btDiscreteDynamicsWorld *worldRef)
 {
+    m_context->materialize(PrivateContext::kPhysicsSection);
     if (worldRef) {
         const int nRigidBodies = m_context->rigidBodies.count();
         for (int i = nRigidBodies - 1; i >= 0; i--) {
@@ -957,6 +1697,7 @@ void Model::leaveWorld(btDiscreteDynamicsWorld *worldRef)
 
 void Model::resetMotionState(btDiscreteDynamicsWorld *worldRef)
 {
+    m_context->materialize(PrivateContext::kPhysicsSection);
     if (!worldRef || !m_context->enablePhysics) {
         return;
     }
@@ -993,22 +1734,48 @@ void Model::resetMotionState(btDiscreteDynamicsWorld *worldRef)
 
 void Model::performUpdate()
 {
+    m_context->materialize(PrivateContext::kAllSections);
+    const bool enableIncrementalUpdate = m_context->enableIncrementalBoneUpdate;
     // update local transform matrix
-    const int nbones = m_context->bones.count();
-    for (int i = 0; i < nbones; i++) {
-        Bone *bone = m_context->bones[i];
-        bone->resetIKLink();
-    }
-    internal::ParallelResetVertexProcessor<pmx::Vertex> processor(&m_context->vertices);
-    processor.execute();
-    const int nmorphs = m_context->morphs.count();
-    for (int i = 0; i < nmorphs; i++) {
-        Morph *morph = m_context->morphs[i];
-        morph->syncWeight();
+    if (!enableIncrementalUpdate) {
+        const int nbones = m_context->bones.count();
+        for (int i = 0; i < nbones; i++) {
+            Bone *bone = m_context->bones[i];
+            bone->resetIKLink();
+        }
     }
-    for (int i = 0; i < nmorphs; i++) {
-        Morph *morph = m_context->morphs[i];
-        morph->update();
+    m_context->inverseKinematicsStatistics = InverseKinematicsStatistics();
+    {
+        internal::ScopedProfile profile(IApplicationContext::kProfileUpdateMorphProcess, this);
+        m_context->resetMorphedVertices();
+        const int nmorphs = m_context->morphs.count();
+        for (int i = 0; i < nmorphs; i++) {
+            Morph *morph = m_context->morphs[i];
+            morph->syncWeight();
+        }
+        for (int i = 0; i < nmorphs; i++) {
+            Morph *morph = m_context->morphs[i];
+            morph->update();
+        }
+        m_context->collectMorphedVertices();
+    }
+    if (enableIncrementalUpdate) {
+        /* bone morphs are merged above, so dirty bones are collected after that */
+        m_context->collectDirtyBones();
+        // before physics simulation
+        m_context->updateDirtyBones(m_context->dirtyBPSBones, m_context->BPSOrderedBones);
+        if (m_context->enablePhysics) {
+            // physics simulation
+            internal::ParallelUpdateRigidBodyProcessor<pmx::RigidBody> processor(&m_context->rigidBodies);
+            processor.execute();
+            /* bones following rigid bodies are marked dirty by the simulation */
+            m_context->propagateDirtyBones(m_context->BPSOrderedBones.count());
+            m_context->collectDirtyBones(m_context->APSOrderedBones, m_context->dirtyAPSBones);
+        }
+        // after physics simulation
+        m_context->updateDirtyBones(m_context->dirtyAPSBones, m_context->APSOrderedBones);
+        m_context->cleanDirtyBones();
+        return;
     }
     // before physics simulation
     updateLocalTransform(m_context->BPSOrderedBones);
@@ -1019,6 +1786,7 @@ void Model::performUpdate()
     }
     // after physics simulation
     updateLocalTransform(m_context->APSOrderedBones);
+    m_context->setBonesDirty(false);
 }
 
 IBone *Model::findBoneRef(const IString *value) const
@@ -1033,6 +1801,7 @@ IBone *Model::findBoneRef(const IString *value) const
 
 IMorph *Model::findMorphRef(const IString *value) const
 {
+    m_context->materialize(PrivateContext::kMorphSection);
     if (value) {
         const HashString &key = value->toHashString();
         IMorph *const *morph = m_context->name2morphRefs.find(key);
@@ -1059,19 +1828,19 @@ int Model::count(ObjectType value) const
         return nIK;
     }
     case kIndex: {
-        return m_context->indices.count();
+        return m_context->countOf(PrivateContext::kGeometrySection, m_context->indices, m_context->dataInfo.indicesCount);
     }
     case kJoint: {
-        return m_context->joints.count();
+        return m_context->countOf(PrivateContext::kPhysicsSection, m_context->joints, m_context->dataInfo.jointsCount);
     }
     case kMaterial: {
-        return m_context->materials.count();
+        return m_context->countOf(PrivateContext::kGeometrySection, m_context->materials, m_context->dataInfo.materialsCount);
     }
     case kMorph: {
-        return m_context->morphs.count();
+        return m_context->countOf(PrivateContext::kMorphSection, m_context->morphs, m_context->dataInfo.morphsCount);
     }
     case kRigidBody: {
-        return m_context->rigidBodies.count();
+        return m_context->countOf(PrivateContext::kPhysicsSection, m_context->rigidBodies, m_context->dataInfo.rigidBodiesCount);
     }
     case kSoftBody: {
         return 0;
@@ -1080,7 +1849,7 @@ int Model::count(ObjectType value) const
         return m_context->textures.count();
     }
     case kVertex: {
-        return m_context->vertices.count();
+        return m_context->countOf(PrivateContext::kGeometrySection, m_context->vertices, m_context->dataInfo.verticesCount);
     }
     default:
         return 0;
@@ -1094,25 +1863,30 @@ void Model::getBoneRefs(Array<IBone *> &value) const
 
 void Model::getJointRefs(Array<IJoint *> &value) const
 {
+    m_context->materialize(PrivateContext::kPhysicsSection);
     internal::ModelHelper::getObjectRefs(m_context->joints, value);
 }
 void Model::getLabelRefs(Array<ILabel *> &value) const
 {
+    m_context->materialize(PrivateContext::kMorphSection);
     internal::ModelHelper::getObjectRefs(m_context->labels, value);
 }
 
 void Model::getMaterialRefs(Array<IMaterial *> &value) const
 {
+    m_context->materialize(PrivateContext::kGeometrySection);
     internal::ModelHelper::getObjectRefs(m_context->materials, value);
 }
 
 void Model::getMorphRefs(Array<IMorph *> &value) const
 {
+    m_context->materialize(PrivateContext::kMorphSection);
     internal::ModelHelper::getObjectRefs(m_context->morphs, value);
 }
 
 void Model::getRigidBodyRefs(Array<IRigidBody *> &value) const
 {
+    m_context->materialize(PrivateContext::kPhysicsSection);
     internal::ModelHelper::getObjectRefs(m_context->rigidBodies, value);
 }
 
@@ -1123,11 +1897,13 @@ void Model::getTextureRefs(Array<const IString *> &value) const
 
 void Model::getVertexRefs(Array<IVertex *> &value) const
 {
+    m_context->materialize(PrivateContext::kGeometrySection);
     internal::ModelHelper::getObjectRefs(m_context->vertices, value);
 }
 
 void Model::getIndices(Array<int> &value) const
 {
+    m_context->materialize(PrivateContext::kGeometrySection);
     value.copy(m_context->indices);
 }
 
@@ -1348,11 +2124,13 @@ IModel::Type Model::type() const
 
 const Array<Vertex *> &Model::vertices() const
 {
+    m_context->materialize(PrivateContext::kGeometrySection);
     return m_context->vertices;
 }
 
 const Array<int> &Model::indices() const
 {
+    m_context->materialize(PrivateContext::kGeometrySection);
     return m_context->indices;
 }
 
@@ -1363,6 +2141,7 @@ const Hash<HashString, IString *> &Model::textures() const
 
 const Array<Material *> &Model::materials() const
 {
+    m_context->materialize(PrivateContext::kGeometrySection);
     return m_context->materials;
 }
 
@@ -1373,21 +2152,25 @@ const Array<Bone *> &Model::bones() const
 
 const Array<Morph *> &Model::morphs() const
 {
+    m_context->materialize(PrivateContext::kMorphSection);
     return m_context->morphs;
 }
 
 const Array<Label *> &Model::labels() const
 {
+    m_context->materialize(PrivateContext::kMorphSection);
     return m_context->labels;
 }
 
 const Array<RigidBody *> &Model::rigidBodies() const
 {
+    m_context->materialize(PrivateContext::kPhysicsSection);
     return m_context->rigidBodies;
 }
 
 const Array<Joint *> &Model::joints() const
 {
+    m_context->materialize(PrivateContext::kPhysicsSection);
     return m_context->joints;
 }
 
@@ -1593,29 +2376,26 @@ void Model::setPhysicsEnable(bool value)
     if (m_context->enablePhysics != value) {
         VPVL2_TRIGGER_PROPERTY_EVENTS(m_context->eventRefs, physicsEnableWillChange(value, this));
         m_context->enablePhysics = value;
+        /* local transforms left by physics simulation must be recomputed */
+        m_context->setBonesDirty(true);
     }
 }
 
 void Model::updateLocalTransform(Array<Bone *> &bones)
 {
-    const int nbones = bones.count();
-    for (int i = 0; i < nbones; i++) {
-        Bone *bone = bones[i];
-        bone->performTransform();
-        bone->solveInverseKinematics();
-    }
-    internal::ParallelUpdateLocalTransformProcessor<pmx::Bone> processor(&bones);
-    processor.execute();
+    m_context->updateBones(bones);
 }
 
 void Model::getIndexBuffer(IndexBuffer *&indexBuffer) const
 {
+    m_context->materialize(PrivateContext::kGeometrySection);
     delete indexBuffer;
     indexBuffer = new DefaultIndexBuffer(m_context->indices, m_context->vertices.count());
 }
 
 void Model::getStaticVertexBuffer(StaticVertexBuffer *&staticBuffer) const
 {
+    m_context->materialize(PrivateContext::kGeometrySection);
     delete staticBuffer;
     staticBuffer = new DefaultStaticVertexBuffer(this);
 }
@@ -1623,6 +2403,7 @@ void Model::getStaticVertexBuffer(StaticVertexBuffer *&staticBuffer) const
 void Model::getDynamicVertexBuffer(DynamicVertexBuffer *&dynamicBuffer,
                                    const IndexBuffer *indexBuffer) const
 {
+    m_context->materialize(PrivateContext::kGeometrySection);
     delete dynamicBuffer;
     if (indexBuffer && indexBuffer->ident() == &DefaultIndexBuffer::kIdent) {
         dynamicBuffer = new DefaultDynamicVertexBuffer(this, indexBuffer);
@@ -1636,12 +2417,21 @@ void Model::getMatrixBuffer(MatrixBuffer *&matrixBuffer,
                             DynamicVertexBuffer *dynamicBuffer,
                             const IndexBuffer *indexBuffer) const
 {
+    m_context->materialize(PrivateContext::kGeometrySection);
     delete matrixBuffer;
     if (indexBuffer && indexBuffer->ident() == &DefaultIndexBuffer::kIdent &&
             dynamicBuffer && dynamicBuffer->ident() == &DefaultDynamicVertexBuffer::kIdent) {
-        matrixBuffer = new DefaultMatrixBuffer(this,
-                                               static_cast<const DefaultIndexBuffer *>(indexBuffer),
-                                               static_cast<DefaultDynamicVertexBuffer *>(dynamicBuffer));
+        DefaultMatrixBuffer *buffer = new DefaultMatrixBuffer(this,
+                                                              static_cast<const DefaultIndexBuffer *>(indexBuffer),
+                                                              static_cast<DefaultDynamicVertexBuffer *>(dynamicBuffer));
+        if (buffer->isInitialized()) {
+            matrixBuffer = buffer;
+        }
+        else {
+            VPVL2_LOG(WARNING, "Bones of a triangle cannot be placed into the bone palette: max=" << maxBonePaletteSize());
+            delete buffer;
+            matrixBuffer = 0;
+        }
     }
     else {
         matrixBuffer = 0;
@@ -1663,6 +2453,134 @@ void Model::getAabb(Vector3 &min, Vector3 &max) const
     max = m_context->aabbMax;
 }
 
+void Model::setVectorizedSkinningEnable(bool value)
+{
+    m_context->enableVectorizedSkinning = value;
+}
+
+bool Model::isVectorizedSkinningEnabled() const
+{
+    return m_context->enableVectorizedSkinning;
+}
+
+internal::VertexStore *Model::vertexStoreRef() const
+{
+    m_context->materialize(PrivateContext::kGeometrySection);
+    if (!m_context->vertexStore) {
+        m_context->vertexStore = new internal::VertexStore();
+    }
+    if (m_context->vertexStoreDirty) {
+        m_context->vertexStore->build(m_context->vertices, m_context->bones.count(), m_context->materials.count());
+        m_context->vertexStoreDirty = false;
+    }
+    return m_context->vertexStore;
+}
+
+void Model::invalidateVertexStore()
+{
+    m_context->vertexStoreDirty = true;
+}
+
+void Model::setLazyLoadEnable(bool value)
+{
+    m_context->enableLazyLoad = value;
+}
+
+bool Model::isLazyLoadEnabled() const
+{
+    return m_context->enableLazyLoad;
+}
+
+void Model::setParallelLoadEnable(bool value)
+{
+    m_context->enableParallelLoad = value;
+}
+
+bool Model::isParallelLoadEnabled() const
+{
+    return m_context->enableParallelLoad;
+}
+
+void Model::setIncrementalBoneUpdateEnable(bool value)
+{
+    m_context->enableIncrementalBoneUpdate = value;
+}
+
+bool Model::isIncrementalBoneUpdateEnabled() const
+{
+    return m_context->enableIncrementalBoneUpdate;
+}
+
+void Model::setSparseMorphUpdateEnable(bool value)
+{
+    m_context->enableSparseMorphUpdate = value;
+}
+
+bool Model::isSparseMorphUpdateEnabled() const
+{
+    return m_context->enableSparseMorphUpdate;
+}
+
+void Model::setMaxBonePaletteSize(int value)
+{
+    m_context->maxBonePaletteSize = btMax(value, 1);
+}
+
+int Model::maxBonePaletteSize() const
+{
+    return m_context->maxBonePaletteSize;
+}
+
+void Model::setVertexCacheOptimizationEnable(bool value)
+{
+    m_context->enableVertexCacheOptimization = value;
+}
+
+bool Model::isVertexCacheOptimizationEnabled() const
+{
+    return m_context->enableVertexCacheOptimization;
+}
+
+void Model::optimizeVertexCache(int cacheSize)
+{
+    m_context->materialize(PrivateContext::kAllSections);
+    m_context->optimizeVertexCache(cacheSize);
+}
+
+void Model::getVertexCacheStatistics(int cacheSize, Scalar &acmr, Scalar &atvr) const
+{
+    internal::VertexCacheOptimizer::Statistics statistics;
+    m_context->materialize(PrivateContext::kGeometrySection);
+    m_context->getVertexCacheStatistics(cacheSize, statistics);
+    acmr = statistics.acmr();
+    atvr = statistics.atvr();
+}
+
+void Model::setInverseKinematicsThreshold(const Scalar &value)
+{
+    m_context->inverseKinematicsThreshold = btMax(value, Scalar(0));
+}
+
+Scalar Model::inverseKinematicsThreshold() const
+{
+    return m_context->inverseKinematicsThreshold;
+}
+
+void Model::getInverseKinematicsStatistics(InverseKinematicsStatistics &value) const
+{
+    value = m_context->inverseKinematicsStatistics;
+}
+
+bool Model::isMaterialized() const
+{
+    return m_context->pendingSections == 0;
+}
+
+bool Model::materializeAll()
+{
+    return m_context->materialize(PrivateContext::kAllSections);
+}
+
 float32 Model::version() const
 {
     return m_context->dataInfo.version;
@@ -1718,36 +2636,43 @@ IBone *Model::findBoneRefAt(int value) const
 
 IJoint *Model::findJointRefAt(int value) const
 {
+    m_context->materialize(PrivateContext::kPhysicsSection);
     return internal::ModelHelper::findObjectAt<Joint, IJoint>(m_context->joints, value);
 }
 
 ILabel *Model::findLabelRefAt(int value) const
 {
+    m_context->materialize(PrivateContext::kMorphSection);
     return internal::ModelHelper::findObjectAt<Label, ILabel>(m_context->labels, value);
 }
 
 IMaterial *Model::findMaterialRefAt(int value) const
 {
+    m_context->materialize(PrivateContext::kGeometrySection);
     return internal::ModelHelper::findObjectAt<Material, IMaterial>(m_context->materials, value);
 }
 
 IMorph *Model::findMorphRefAt(int value) const
 {
+    m_context->materialize(PrivateContext::kMorphSection);
     return internal::ModelHelper::findObjectAt<Morph, IMorph>(m_context->morphs, value);
 }
 
 IRigidBody *Model::findRigidBodyRefAt(int value) const
 {
+    m_context->materialize(PrivateContext::kPhysicsSection);
     return internal::ModelHelper::findObjectAt<RigidBody, IRigidBody>(m_context->rigidBodies, value);
 }
 
 IVertex *Model::findVertexRefAt(int value) const
 {
+    m_context->materialize(PrivateContext::kGeometrySection);
     return internal::ModelHelper::findObjectAt<Vertex, IVertex>(m_context->vertices, value);
 }
 
 void Model::setIndices(const Array<int> &value)
 {
+    m_context->materialize(PrivateContext::kGeometrySection);
     const int nindices = value.count();
     const int nvertices = m_context->vertices.count();
     m_context->indices.clear();
@@ -1765,72 +2690,91 @@ void Model::setIndices(const Array<int> &value)
 void Model::addBone(IBone *value)
 {
     internal::ModelHelper::addObject(this, value, m_context->bones);
+    m_context->vertexStoreDirty = true;
     Bone::sortBones(m_context->bones, m_context->BPSOrderedBones, m_context->APSOrderedBones);
 }
 
 void Model::addJoint(IJoint *value)
 {
+    m_context->materialize(PrivateContext::kPhysicsSection);
     internal::ModelHelper::addObject(this, value, m_context->joints);
 }
 
 void Model::addLabel(ILabel *value)
 {
+    m_context->materialize(PrivateContext::kMorphSection);
     internal::ModelHelper::addObject(this, value, m_context->labels);
 }
 
 void Model::addMaterial(IMaterial *value)
 {
+    m_context->materialize(PrivateContext::kGeometrySection);
     internal::ModelHelper::addObject(this, value, m_context->materials);
+    m_context->vertexStoreDirty = true;
 }
 
 void Model::addMorph(IMorph *value)
 {
+    m_context->materialize(PrivateContext::kMorphSection);
     internal::ModelHelper::addObject(this, value, m_context->morphs);
 }
 
 void Model::addRigidBody(IRigidBody *value)
 {
+    m_context->materialize(PrivateContext::kPhysicsSection);
     internal::ModelHelper::addObject(this, value, m_context->rigidBodies);
 }
 
 void Model::addVertex(IVertex *value)
 {
+    m_context->materialize(PrivateContext::kGeometrySection);
     internal::ModelHelper::addObject(this, value, m_context->vertices);
+    m_context->vertexStoreDirty = true;
 }
 
 void Model::removeBone(IBone *value)
 {
     internal::ModelHelper::removeObject(this, value, m_context->bones);
+    m_context->vertexStoreDirty = true;
 }
 
 void Model::removeJoint(IJoint *value)
 {
+    m_context->materialize(PrivateContext::kPhysicsSection);
     internal::ModelHelper::removeObject(this, value, m_context->joints);
 }
 
 void Model::removeLabel(ILabel *value)
 {
+    m_context->materialize(PrivateContext::kMorphSection);
     internal::ModelHelper::removeObject(this, value, m_context->labels);
 }
 
 void Model::removeMaterial(IMaterial *value)
 {
+    m_context->materialize(PrivateContext::kGeometrySection);
     internal::ModelHelper::removeObject(this, value, m_context->materials);
+    m_context->vertexStoreDirty = true;
 }
 
 void Model::removeMorph(IMorph *value)
 {
+    m_context->materialize(PrivateContext::kMorphSection);
     internal::ModelHelper::removeObject(this, value, m_context->morphs);
 }
 
 void Model::removeRigidBody(IRigidBody *value)
 {
+    m_context->materialize(PrivateContext::kPhysicsSection);
     internal::ModelHelper::removeObject(this, value, m_context->rigidBodies);
 }
 
 void Model::removeVertex(IVertex *value)
 {
+    m_context->materialize(PrivateContext::kGeometrySection);
     internal::ModelHelper::removeObject(this, value, m_context->vertices);
+    m_context->morphedVertices.remove(static_cast<Vertex *>(value));
+    m_context->vertexStoreDirty = true;
 }
 
 void Model::addTexture(const IString *value)
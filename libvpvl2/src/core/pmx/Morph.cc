@@ -117,7 +117,8 @@ struct Morph::PrivateContext {
           type(kUnknownMorph),
           index(-1),
           hasParent(false),
-          dirty(false)
+          dirty(false),
+          hasMergedVertices(false)
     {
     }
     ~PrivateContext() {
@@ -140,6 +141,7 @@ struct Morph::PrivateContext {
         index = -1;
         hasParent = false;
         dirty = false;
+        hasMergedVertices = false;
     }
 
     static bool loadBones(const Array<pmx::Bone *> &bones, Morph *morph) {
@@ -503,6 +505,7 @@ struct Morph::PrivateContext {
     int index;
     bool hasParent;
     bool dirty;
+    bool hasMergedVertices;
 };
 
 Morph::Morph(IModel *modelRef)
@@ -926,8 +929,32 @@ void Morph::syncWeight()
     }
 }
 
+void Morph::getMergedVertexRefs(Array<pmx::Vertex *> &value)
+{
+    if (m_context->hasMergedVertices) {
+        const int nvertices = m_context->vertices.count();
+        for (int i = 0; i < nvertices; i++) {
+            if (pmx::Vertex *vertex = m_context->vertices[i]->vertex) {
+                value.append(vertex);
+            }
+        }
+        const int nuvs = m_context->uvs.count();
+        for (int i = 0; i < nuvs; i++) {
+            if (pmx::Vertex *vertex = m_context->uvs[i]->vertex) {
+                value.append(vertex);
+            }
+        }
+        m_context->hasMergedVertices = false;
+    }
+}
+
 void Morph::updateVertexMorphs(const WeightPrecision &value)
 {
+    /* merging zero weight doesn't change vertices */
+    if (value == 0) {
+        return;
+    }
+    m_context->hasMergedVertices = true;
     const int nmorphs = m_context->vertices.count();
     for (int i = 0; i < nmorphs; i++) {
         Vertex *v = m_context->vertices[i];
@@ -950,6 +977,10 @@ void Morph::updateBoneMorphs(const WeightPrecision &value)
 
 void Morph::updateUVMorphs(const WeightPrecision &value)
 {
+    if (value == 0) {
+        return;
+    }
+    m_context->hasMergedVertices = true;
     const int nmorphs = m_context->uvs.count();
     for (int i = 0; i < nmorphs; i++) {
         UV *v = m_context->uvs[i];
@@ -76,6 +76,13 @@ struct SdefUnit {
 
 #pragma pack(pop)
 
+static inline void VPVL2PMXInvalidateVertexStore(IModel *modelRef)
+{
+    if (modelRef && modelRef->type() == IModel::kPMXModel) {
+        static_cast<Model *>(modelRef)->invalidateVertexStore();
+    }
+}
+
 }
 
 namespace vpvl2
@@ -178,8 +185,15 @@ bool Vertex::preparse(uint8 *&ptr, vsize &rest, Model::DataInfo &info)
         return false;
     }
     info.verticesPtr = ptr;
+    /* records are variable size, so remember the start of each chunk for parallel parsing */
+    static const int kMinVertexChunkSize = 1024;
+    const int chunkSize = btMax((nvertices + Model::kMaxVertexChunks - 1) / Model::kMaxVertexChunks, kMinVertexChunkSize);
+    info.vertexChunkSize = chunkSize;
     vsize baseSize = sizeof(VertexUnit) + sizeof(AdditinalUVUnit) * info.additionalUVSize;
     for (int i = 0; i < nvertices; i++) {
+        if (i % chunkSize == 0) {
+            info.vertexChunkPtrs[i / chunkSize] = ptr;
+        }
         if (!internal::validateSize(ptr, baseSize, rest)) {
             VPVL2_LOG(WARNING, "Invalid size of PMX base vertex unit detected: index=" << i << " ptr=" << static_cast<const void *>(ptr) << " rest=" << rest);
             return false;
@@ -668,6 +682,7 @@ void Vertex::setOrigin(const Vector3 &value)
 {
     if (m_context->origin != value) {
         VPVL2_TRIGGER_PROPERTY_EVENTS(m_context->eventRefs, originWillChange(value, this));
+        VPVL2PMXInvalidateVertexStore(m_context->modelRef);
         m_context->origin = value;
     }
 }
@@ -676,6 +691,7 @@ void Vertex::setNormal(const Vector3 &value)
 {
     if (m_context->normal != value) {
         VPVL2_TRIGGER_PROPERTY_EVENTS(m_context->eventRefs, normalWillChange(value, this));
+        VPVL2PMXInvalidateVertexStore(m_context->modelRef);
         m_context->normal = value;
     }
 }
@@ -700,6 +716,7 @@ void Vertex::setType(Type value)
 {
     if (m_context->type != value) {
         VPVL2_TRIGGER_PROPERTY_EVENTS(m_context->eventRefs, typeWillChange(value, this));
+        VPVL2PMXInvalidateVertexStore(m_context->modelRef);
         m_context->type = value;
     }
 }
@@ -708,6 +725,7 @@ void Vertex::setEdgeSize(const EdgeSizePrecision &value)
 {
     if (m_context->edgeSize != value) {
         VPVL2_TRIGGER_PROPERTY_EVENTS(m_context->eventRefs, edgeSizeWillChange(value, this));
+        VPVL2PMXInvalidateVertexStore(m_context->modelRef);
         m_context->edgeSize = value;
     }
 }
@@ -716,6 +734,7 @@ void Vertex::setWeight(int index, const WeightPrecision &weight)
 {
     if (internal::checkBound(index, 0, kMaxBones) && m_context->weight[index] != weight) {
         VPVL2_TRIGGER_PROPERTY_EVENTS(m_context->eventRefs, weightWillChange(index, weight, this));
+        VPVL2PMXInvalidateVertexStore(m_context->modelRef);
         m_context->weight[index] = weight;
     }
 }
@@ -724,6 +743,7 @@ void Vertex::setBoneRef(int index, IBone *value)
 {
     if (internal::checkBound(index, 0, kMaxBones) && m_context->boneRefs[index] != value) {
         VPVL2_TRIGGER_PROPERTY_EVENTS(m_context->eventRefs, boneRefWillChange(index, value, this));
+        VPVL2PMXInvalidateVertexStore(m_context->modelRef);
         if (value) {
             m_context->boneRefs[index] = value;
             m_context->boneIndices[index] = value->index();
@@ -739,6 +759,7 @@ void Vertex::setMaterialRef(IMaterial *value)
 {
     if (m_context->materialRef != value) {
         VPVL2_TRIGGER_PROPERTY_EVENTS(m_context->eventRefs, materialRefWillChange(value, this));
+        VPVL2PMXInvalidateVertexStore(m_context->modelRef);
         m_context->materialRef = value ? value : Factory::sharedNullMaterialRef();
     }
 }
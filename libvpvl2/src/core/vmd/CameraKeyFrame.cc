@@ -39,6 +39,7 @@
 
 #include "vpvl2/vpvl2.h"
 #include "vpvl2/internal/util.h"
+#include "vpvl2/internal/InterpolationTableCache.h"
 
 #include "vpvl2/vmd/CameraKeyframe.h"
 
@@ -104,8 +105,7 @@ CameraKeyframe::~CameraKeyframe()
     delete m_ptr;
     m_ptr = 0;
     for (int i = 0; i < kCameraMaxInterpolationType; i++) {
-        delete[] m_interpolationTable[i];
-        m_interpolationTable[i] = 0;
+        internal::InterpolationTableCache::release(m_interpolationTable[i]);
     }
     internal::zerofill(m_linear, sizeof(m_linear));
     internal::zerofill(m_interpolationTable, sizeof(m_interpolationTable));
@@ -230,19 +230,12 @@ void CameraKeyframe::setInterpolationTable(const int8 *table)
     QuadWord v;
     for (int i = 0; i < kCameraMaxInterpolationType; i++) {
         getValueFromTable(table, i, v);
-        delete[] m_interpolationTable[i];
+        internal::InterpolationTableCache::release(m_interpolationTable[i]);
         if (m_linear[i]) {
-            m_interpolationTable[i] = 0;
             setInterpolationParameterInternal(static_cast<InterpolationType>(i), v);
             continue;
         }
-        m_interpolationTable[i] = new IKeyframe::SmoothPrecision[kTableSize + 1];
-        internal::InterpolationTable::build(v.x() / 127.0, // x1
-                                                              v.z() / 127.0, // x2
-                                                              v.y() / 127.0, // y1
-                                                              v.w() / 127.0, // y2
-                                                              kTableSize,
-                                                              m_interpolationTable[i]);
+        m_interpolationTable[i] = internal::InterpolationTableCache::acquire(v, kTableSize);
     }
 }
 
@@ -39,8 +39,11 @@
 
 #include "vpvl2/vpvl2.h"
 #include "vpvl2/internal/util.h" /* internal::snprintf */
+#include "vpvl2/internal/Culling.h"
 #include "vpvl2/cl/PMXAccelerator.h"
 
+#include <string.h> /* memcpy */
+
 #if !defined(VPVL2_LINK_GLEW) && defined(GL_ARB_draw_elements_base_vertex)
 #define GLEW_ARB_draw_elements_base_vertex 1
 #endif
@@ -117,11 +120,11 @@ PMXRenderEngine::PMXRenderEngine(IApplicationContext *applicationContextRef,
       m_dynamicBuffer(0),
       m_indexBuffer(0),
       m_defaultEffect(0),
+      m_culler(new internal::MaterialCuller(scene->cullingContextRef())),
       m_indexType(GL_UNSIGNED_INT),
       m_aabbMin(SIMD_INFINITY, SIMD_INFINITY, SIMD_INFINITY),
       m_aabbMax(-SIMD_INFINITY, -SIMD_INFINITY, -SIMD_INFINITY),
       m_cullFaceState(true),
-      m_updateEvenBuffer(true),
       m_isVertexShaderSkinning(false)
 {
     m_modelRef->getIndexBuffer(m_indexBuffer);
@@ -148,6 +151,8 @@ PMXRenderEngine::PMXRenderEngine(IApplicationContext *applicationContextRef,
 PMXRenderEngine::~PMXRenderEngine()
 {
     release();
+    delete m_culler;
+    m_culler = 0;
 }
 
 IModel *PMXRenderEngine::parentModelRef() const
@@ -161,9 +166,14 @@ bool PMXRenderEngine::upload(void *userData)
     if (!uploadMaterials(userData)) {
         return false;
     }
-    m_bundle.create(VertexBundle::kVertexBuffer, kModelDynamicVertexBufferEven, GL_DYNAMIC_DRAW, 0, m_dynamicBuffer->size());
-    m_bundle.create(VertexBundle::kVertexBuffer, kModelDynamicVertexBufferOdd, GL_DYNAMIC_DRAW, 0, m_dynamicBuffer->size());
-    VPVL2_VLOG(2, "Binding model dynamic vertex buffer to the vertex buffer object: size=" << m_dynamicBuffer->size());
+    bool allowPersistentMapping = true;
+#ifdef VPVL2_ENABLE_OPENCL
+    /* OpenCL shares each slot as a separate buffer object */
+    allowPersistentMapping = !(m_accelerator && m_accelerator->isAvailable());
+#endif
+    m_vertexStream.create(m_dynamicBuffer->size(), 0, allowPersistentMapping);
+    const int nslots = m_vertexStream.countSlots();
+    VPVL2_VLOG(2, "Binding model dynamic vertex buffer to the streaming vertex buffer: size=" << m_dynamicBuffer->size() << " slots=" << nslots << " strategy=" << m_vertexStream.strategy());
     m_bundle.create(VertexBundle::kVertexBuffer, kModelStaticVertexBuffer, GL_STATIC_DRAW, 0, m_staticBuffer->size());
     m_bundle.bind(VertexBundle::kVertexBuffer, kModelStaticVertexBuffer);
     void *address = m_bundle.map(VertexBundle::kVertexBuffer, 0, m_staticBuffer->size());
@@ -173,25 +183,17 @@ bool PMXRenderEngine::upload(void *userData)
     m_bundle.unbind(VertexBundle::kVertexBuffer);
     m_bundle.create(VertexBundle::kIndexBuffer, kModelIndexBuffer, GL_STATIC_DRAW, m_indexBuffer->bytes(), m_indexBuffer->size());
     VPVL2_VLOG(2, "Binding indices to the vertex buffer object: ptr=" << m_indexBuffer->bytes() << " size=" << m_indexBuffer->size());
-    VertexBundleLayout &bundleME = m_layouts[kVertexArrayObjectEven];
-    if (bundleME.create() && bundleME.bind()) {
-        VPVL2_VLOG(2, "Binding an vertex array object for even frame: " << bundleME.name());
-        createVertexBundle(kModelDynamicVertexBufferEven);
-    }
-    VertexBundleLayout &bundleMO = m_layouts[kVertexArrayObjectOdd];
-    if (bundleMO.create() && bundleMO.bind()) {
-        VPVL2_VLOG(2, "Binding an vertex array object for odd frame: " << bundleMO.name());
-        createVertexBundle(kModelDynamicVertexBufferOdd);
-    }
-    VertexBundleLayout &bundleEE = m_layouts[kEdgeVertexArrayObjectEven];
-    if (bundleEE.create() && bundleEE.bind()) {
-        VPVL2_VLOG(2, "Binding an edge vertex array object for even frame: " << bundleEE.name());
-        createEdgeBundle(kModelDynamicVertexBufferEven);
-    }
-    VertexBundleLayout &bundleEO = m_layouts[kEdgeVertexArrayObjectOdd];
-    if (bundleEO.create() && bundleEO.bind()) {
-        VPVL2_VLOG(2, "Binding an edge vertex array object for odd frame: " << bundleEO.name());
-        createEdgeBundle(kModelDynamicVertexBufferOdd);
+    for (int i = 0; i < nslots; i++) {
+        VertexBundleLayout &bundle = m_layouts[i];
+        if (bundle.create() && bundle.bind()) {
+            VPVL2_VLOG(2, "Binding an vertex array object for the slot " << i << ": " << bundle.name());
+            createVertexBundle(i);
+        }
+        VertexBundleLayout &edgeBundle = m_edgeLayouts[i];
+        if (edgeBundle.create() && edgeBundle.bind()) {
+            VPVL2_VLOG(2, "Binding an edge vertex array object for the slot " << i << ": " << edgeBundle.name());
+            createEdgeBundle(i);
+        }
     }
     VertexBundleLayout::unbindVertexArrayObject();
     m_bundle.unbind(VertexBundle::kVertexBuffer);
@@ -199,15 +201,17 @@ bool PMXRenderEngine::upload(void *userData)
 #ifdef VPVL2_ENABLE_OPENCL
     if (m_accelerator && m_accelerator->isAvailable()) {
         m_accelerator->release(m_accelerationBuffers);
-        m_accelerationBuffers.append(cl::PMXAccelerator::VertexBufferBridge(m_bundle.findName(kModelDynamicVertexBufferEven)));
-        m_accelerationBuffers.append(cl::PMXAccelerator::VertexBufferBridge(m_bundle.findName(kModelDynamicVertexBufferOdd)));
+        for (int i = 0; i < nslots; i++) {
+            m_accelerationBuffers.append(cl::PMXAccelerator::VertexBufferBridge(m_vertexStream.slotName(i)));
+        }
         m_accelerator->upload(m_accelerationBuffers, m_indexBuffer);
     }
 #endif
     m_sceneRef->updateModel(m_modelRef);
     m_modelRef->setVisible(true);
-    update(); // for updating even frame
-    update(); // for updating odd frame
+    for (int i = 0; i < nslots; i++) {
+        update(); // for updating all slots
+    }
     VPVL2_VLOG(2, "Created the model: " << internal::cstr(m_modelRef->name(IEncoding::kDefaultLanguage), "(null)"));
     m_applicationContextRef->stopProfileSession(IApplicationContext::kProfileUploadModelProcess, m_modelRef);
     return true;
@@ -218,17 +222,25 @@ void PMXRenderEngine::update()
     if (!m_modelRef || !m_modelRef->isVisible() || !m_currentEffectEngineRef) {
         return;
     }
-    VertexBufferObjectType vbo = m_updateEvenBuffer ? kModelDynamicVertexBufferEven : kModelDynamicVertexBufferOdd;
     m_applicationContextRef->startProfileSession(IApplicationContext::kProfileUpdateModelProcess, m_modelRef);
-    m_bundle.bind(VertexBundle::kVertexBuffer, vbo);
-    if (void *address = m_bundle.map(VertexBundle::kVertexBuffer, 0, m_dynamicBuffer->size())) {
-        m_dynamicBuffer->update(address, m_sceneRef->cameraRef()->position(), m_aabbMin, m_aabbMax);
-        m_bundle.unmap(VertexBundle::kVertexBuffer, address);
+    if (void *address = m_vertexStream.map()) {
+        const Vector3 &cameraPosition = m_sceneRef->cameraRef()->position();
+        if (m_culler->isOcclusionCullingEnabled()) {
+            /* keeps a CPU copy of skinned vertices to rasterize occluders without reading the mapped buffer */
+            const vsize size = m_dynamicBuffer->size();
+            m_stagingVertices.resize(int(size));
+            m_dynamicBuffer->update(&m_stagingVertices[0], cameraPosition, m_aabbMin, m_aabbMax);
+            memcpy(address, &m_stagingVertices[0], size);
+        }
+        else {
+            m_dynamicBuffer->update(address, cameraPosition, m_aabbMin, m_aabbMax);
+            m_stagingVertices.clear();
+        }
+        m_vertexStream.unmap(address);
     }
-    m_bundle.unbind(VertexBundle::kVertexBuffer);
 #ifdef VPVL2_ENABLE_OPENCL
     if (m_accelerator && m_accelerator->isAvailable()) {
-        const cl::PMXAccelerator::VertexBufferBridge &buffer = m_accelerationBuffers[m_updateEvenBuffer ? 0 : 1];
+        const cl::PMXAccelerator::VertexBufferBridge &buffer = m_accelerationBuffers[m_vertexStream.currentSlot()];
         m_accelerator->update(m_dynamicBuffer, buffer, m_aabbMin, m_aabbMax);
     }
 #endif
@@ -236,7 +248,6 @@ void PMXRenderEngine::update()
     m_currentEffectEngineRef->updateModelLightParameters(m_sceneRef, m_modelRef);
     m_currentEffectEngineRef->updateSceneParameters();
     m_applicationContextRef->stopProfileSession(IApplicationContext::kProfileUpdateModelProcess, m_modelRef);
-    m_updateEvenBuffer = m_updateEvenBuffer ? false :true;
     if (m_currentEffectEngineRef) {
         m_currentEffectEngineRef->useToon.setValue(true);
         m_currentEffectEngineRef->parthf.setValue(false);
@@ -273,11 +284,16 @@ void PMXRenderEngine::renderModel()
         m_currentEffectEngineRef->selfShadow.updateParameter(shadowMap);
         hasShadowMap = true;
     }
+    beginCullingPass(internal::MaterialCuller::kModelPass, IApplicationContext::kCameraMatrix);
     bindVertexBundle();
     EffectEngine::DrawPrimitiveCommand command;
     getDrawPrimitivesCommand(command);
     for (int i = 0; i < nmaterials; i++) {
         const IMaterial *material = materials[i];
+        if (!m_culler->testMaterial(i)) {
+            command.offset += material->indexRange().count;
+            continue;
+        }
         const MaterialContext &materialContext = m_materialContexts[i];
         const Color &toonColor = materialContext.toonTextureColor;
         const Color &diffuse = material->diffuse();
@@ -318,6 +334,15 @@ void PMXRenderEngine::renderModel()
         glEnable(GL_CULL_FACE);
         m_cullFaceState = true;
     }
+    if (m_stagingVertices.count() > 0 && m_currentEffectEngineRef->effect() == m_defaultEffect) {
+        Array<bool> opaqueMaterials;
+        opaqueMaterials.resize(nmaterials);
+        for (int i = 0; i < nmaterials; i++) {
+            const ITexture *textureRef = m_materialContexts[i].mainTextureRef;
+            opaqueMaterials[i] = !textureRef || reinterpret_cast<const BaseSurface::Format *>(textureRef->format())->isOpaque();
+        }
+        m_culler->rasterizeOccluders(m_modelRef, &m_stagingVertices[0], m_indexBuffer, opaqueMaterials);
+    }
     m_applicationContextRef->stopProfileSession(IApplicationContext::kProfileRenderModelProcess, m_modelRef);
 }
 
@@ -333,6 +358,7 @@ void PMXRenderEngine::renderEdge()
     Array<IMaterial *> materials;
     m_modelRef->getMaterialRefs(materials);
     const int nmaterials = materials.count();
+    beginCullingPass(internal::MaterialCuller::kEdgePass, IApplicationContext::kCameraMatrix);
     glCullFace(GL_FRONT);
     bindEdgeBundle();
     EffectEngine::DrawPrimitiveCommand command;
@@ -340,7 +366,7 @@ void PMXRenderEngine::renderEdge()
     for (int i = 0; i < nmaterials; i++) {
         const IMaterial *material = materials[i];
         const int nindices = material->indexRange().count;
-        if (material->isEdgeEnabled()) {
+        if (material->isEdgeEnabled() && m_culler->testMaterial(i)) {
             const IEffect::Technique *technique = m_currentEffectEngineRef->findTechnique("edge", i, nmaterials, false, false, true);
             updateDrawPrimitivesCommand(material, command);
             m_currentEffectEngineRef->edgeColor.setGeometryColor(material->edgeColor());
@@ -366,6 +392,7 @@ void PMXRenderEngine::renderShadow()
     Array<IMaterial *> materials;
     m_modelRef->getMaterialRefs(materials);
     const int nmaterials = materials.count();
+    beginCullingPass(internal::MaterialCuller::kShadowPass, IApplicationContext::kShadowMatrix);
     glCullFace(GL_FRONT);
     bindVertexBundle();
     EffectEngine::DrawPrimitiveCommand command;
@@ -373,7 +400,7 @@ void PMXRenderEngine::renderShadow()
     for (int i = 0; i < nmaterials; i++) {
         const IMaterial *material = materials[i];
         const int nindices = material->indexRange().count;
-        if (material->hasShadow()) {
+        if (material->hasShadow() && m_culler->testMaterial(i)) {
             const IEffect::Technique *technique = m_currentEffectEngineRef->findTechnique("shadow", i, nmaterials, false, false, true);
             updateDrawPrimitivesCommand(material, command);
             m_applicationContextRef->startProfileSession(IApplicationContext::kProfileRenderShadowMaterialDrawCall, material);
@@ -398,6 +425,7 @@ void PMXRenderEngine::renderZPlot()
     Array<IMaterial *> materials;
     m_modelRef->getMaterialRefs(materials);
     const int nmaterials = materials.count();
+    beginCullingPass(internal::MaterialCuller::kZPlotPass, IApplicationContext::kLightMatrix);
     glDisable(GL_CULL_FACE);
     bindVertexBundle();
     EffectEngine::DrawPrimitiveCommand command;
@@ -405,7 +433,7 @@ void PMXRenderEngine::renderZPlot()
     for (int i = 0; i < nmaterials; i++) {
         const IMaterial *material = materials[i];
         const int nindices = material->indexRange().count;
-        if (material->hasShadowMap()) {
+        if (material->hasShadowMap() && m_culler->testMaterial(i)) {
             const IEffect::Technique *technique = m_currentEffectEngineRef->findTechnique("zplot", i, nmaterials, false, false, true);
             updateDrawPrimitivesCommand(material, command);
             m_applicationContextRef->startProfileSession(IApplicationContext::kProfileRenderZPlotMaterialDrawCall, material);
@@ -530,6 +558,20 @@ void PMXRenderEngine::setEffect(IEffect *effectRef, IEffect::ScriptOrderType typ
 
 bool PMXRenderEngine::testVisible()
 {
+    /* skips the occlusion query if the CPU side test already rejects the model */
+    if (m_modelRef && m_currentEffectEngineRef && m_currentEffectEngineRef->effect() == m_defaultEffect) {
+        float matrix4x4[16];
+        m_applicationContextRef->getMatrix(matrix4x4, m_modelRef,
+                                           IApplicationContext::kWorldMatrix
+                                           | IApplicationContext::kViewMatrix
+                                           | IApplicationContext::kProjectionMatrix
+                                           | IApplicationContext::kCameraMatrix);
+        Vector3 aabbMin, aabbMax;
+        m_modelRef->getAabb(aabbMin, aabbMax);
+        if (!m_culler->testAabb(matrix4x4, aabbMin, aabbMax)) {
+            return false;
+        }
+    }
     GLenum target = GL_NONE;
     bool visible = true;
     if (GLEW_ARB_occlusion_query2) {
@@ -554,13 +596,11 @@ bool PMXRenderEngine::testVisible()
 
 void PMXRenderEngine::bindVertexBundle()
 {
-    VertexArrayObjectType vao;
-    VertexBufferObjectType vbo;
-    getVertexBundleType(vao, vbo);
+    int slot = m_vertexStream.currentSlot();
     m_currentEffectEngineRef->setDrawType(PrivateEffectEngine::kVertex);
-    if (!m_layouts[vao].bind()) {
-        m_bundle.bind(VertexBundle::kVertexBuffer, vbo);
-        bindDynamicVertexAttributePointers(IModel::Buffer::kVertexStride);
+    if (!m_layouts[slot].bind()) {
+        m_vertexStream.bind(slot);
+        bindDynamicVertexAttributePointers(IModel::Buffer::kVertexStride, m_vertexStream.slotOffset(slot));
         m_bundle.bind(VertexBundle::kVertexBuffer, kModelStaticVertexBuffer);
         bindStaticVertexAttributePointers();
         m_bundle.bind(VertexBundle::kIndexBuffer, kModelIndexBuffer);
@@ -569,13 +609,11 @@ void PMXRenderEngine::bindVertexBundle()
 
 void PMXRenderEngine::bindEdgeBundle()
 {
-    VertexArrayObjectType vao;
-    VertexBufferObjectType vbo;
-    getEdgeBundleType(vao, vbo);
+    int slot = m_vertexStream.currentSlot();
     m_currentEffectEngineRef->setDrawType(PrivateEffectEngine::kEdge);
-    if (!m_layouts[vao].bind()) {
-        m_bundle.bind(VertexBundle::kVertexBuffer, vbo);
-        bindDynamicVertexAttributePointers(IModel::Buffer::kEdgeVertexStride);
+    if (!m_edgeLayouts[slot].bind()) {
+        m_vertexStream.bind(slot);
+        bindDynamicVertexAttributePointers(IModel::Buffer::kEdgeVertexStride, m_vertexStream.slotOffset(slot));
         m_bundle.bind(VertexBundle::kVertexBuffer, kModelStaticVertexBuffer);
         bindStaticVertexAttributePointers();
         m_bundle.bind(VertexBundle::kIndexBuffer, kModelIndexBuffer);
@@ -678,10 +716,10 @@ void PMXRenderEngine::release()
     m_isVertexShaderSkinning = false;
 }
 
-void PMXRenderEngine::createVertexBundle(GLuint dvbo)
+void PMXRenderEngine::createVertexBundle(int slot)
 {
-    m_bundle.bind(VertexBundle::kVertexBuffer, dvbo);
-    bindDynamicVertexAttributePointers(IModel::Buffer::kVertexStride);
+    m_vertexStream.bind(slot);
+    bindDynamicVertexAttributePointers(IModel::Buffer::kVertexStride, m_vertexStream.slotOffset(slot));
     m_bundle.bind(VertexBundle::kVertexBuffer, kModelStaticVertexBuffer);
     bindStaticVertexAttributePointers();
     m_bundle.bind(VertexBundle::kIndexBuffer, kModelIndexBuffer);
@@ -692,10 +730,10 @@ void PMXRenderEngine::createVertexBundle(GLuint dvbo)
     unbindVertexBundle();
 }
 
-void PMXRenderEngine::createEdgeBundle(GLuint dvbo)
+void PMXRenderEngine::createEdgeBundle(int slot)
 {
-    m_bundle.bind(VertexBundle::kVertexBuffer, dvbo);
-    bindDynamicVertexAttributePointers(IModel::Buffer::kEdgeVertexStride);
+    m_vertexStream.bind(slot);
+    bindDynamicVertexAttributePointers(IModel::Buffer::kEdgeVertexStride, m_vertexStream.slotOffset(slot));
     m_bundle.bind(VertexBundle::kIndexBuffer, kModelIndexBuffer);
     IEffect *effectRef = m_currentEffectEngineRef->effect();
     effectRef->activateVertexAttribute(IEffect::kPositionVertexAttribute);
@@ -710,14 +748,14 @@ void PMXRenderEngine::unbindVertexBundle()
     }
 }
 
-void PMXRenderEngine::bindDynamicVertexAttributePointers(IModel::IndexBuffer::StrideType type)
+void PMXRenderEngine::bindDynamicVertexAttributePointers(IModel::IndexBuffer::StrideType type, vsize baseOffset)
 {
     vsize offset, size;
-    offset = m_dynamicBuffer->strideOffset(type);
+    offset = baseOffset + m_dynamicBuffer->strideOffset(type);
     size   = m_dynamicBuffer->strideSize();
     IEffect *effectRef = m_currentEffectEngineRef->effect();
     effectRef->setVertexAttributePointer(IEffect::kPositionVertexAttribute, IEffect::Parameter::kFloat4, size, reinterpret_cast<const GLvoid *>(offset));
-    offset = m_dynamicBuffer->strideOffset(IModel::DynamicVertexBuffer::kNormalStride);
+    offset = baseOffset + m_dynamicBuffer->strideOffset(IModel::DynamicVertexBuffer::kNormalStride);
     effectRef->setVertexAttributePointer(IEffect::kNormalVertexAttribute, IEffect::Parameter::kFloat4, size, reinterpret_cast<const GLvoid *>(offset));
 }
 
@@ -729,30 +767,6 @@ void PMXRenderEngine::bindStaticVertexAttributePointers()
     effectRef->setVertexAttributePointer(IEffect::kTextureCoordVertexAttribute, IEffect::Parameter::kFloat4, size, reinterpret_cast<const GLvoid *>(offset));
 }
 
-void PMXRenderEngine::getVertexBundleType(VertexArrayObjectType &vao, VertexBufferObjectType &vbo) const
-{
-    if (m_updateEvenBuffer) {
-        vao = kVertexArrayObjectOdd;
-        vbo = kModelDynamicVertexBufferOdd;
-    }
-    else {
-        vao = kVertexArrayObjectEven;
-        vbo = kModelDynamicVertexBufferEven;
-    }
-}
-
-void PMXRenderEngine::getEdgeBundleType(VertexArrayObjectType &vao, VertexBufferObjectType &vbo) const
-{
-    if (m_updateEvenBuffer) {
-        vao = kEdgeVertexArrayObjectOdd;
-        vbo = kModelDynamicVertexBufferOdd;
-    }
-    else {
-        vao = kEdgeVertexArrayObjectEven;
-        vbo = kModelDynamicVertexBufferEven;
-    }
-}
-
 void PMXRenderEngine::getDrawPrimitivesCommand(EffectEngine::DrawPrimitiveCommand &command) const
 {
     command.type = m_indexType;
@@ -767,6 +781,30 @@ void PMXRenderEngine::updateDrawPrimitivesCommand(const IMaterial *material, Eff
     command.count = range.count;
 }
 
+void PMXRenderEngine::beginCullingPass(int type, int flags)
+{
+    float matrix4x4[16], viewProjection[16];
+    m_applicationContextRef->getMatrix(matrix4x4, m_modelRef,
+                                       IApplicationContext::kWorldMatrix
+                                       | IApplicationContext::kViewMatrix
+                                       | IApplicationContext::kProjectionMatrix
+                                       | flags);
+    const bool isModelPass = type == internal::MaterialCuller::kModelPass;
+    if (isModelPass) {
+        m_applicationContextRef->getMatrix(viewProjection, m_modelRef,
+                                           IApplicationContext::kViewMatrix
+                                           | IApplicationContext::kProjectionMatrix
+                                           | flags);
+    }
+    /*
+     * Only the default standard effect is culled because vertex shaders of other effects may
+     * move vertices outside of the AABBs. Draw calls are still counted without AABBs.
+     */
+    const IModel::DynamicVertexBuffer *bufferRef = m_currentEffectEngineRef->effect() == m_defaultEffect ? m_dynamicBuffer : 0;
+    m_culler->begin(static_cast<internal::MaterialCuller::PassType>(type), bufferRef, matrix4x4,
+                    isModelPass ? viewProjection : 0);
+}
+
 void PMXRenderEngine::uploadToonTexture(const IMaterial *material, const IString *toonTexturePath, EffectEngine *engine, MaterialContext &context, bool shared, void *userData)
 {
     const char *name = internal::cstr(material->name(IEncoding::kDefaultLanguage), "(null)");
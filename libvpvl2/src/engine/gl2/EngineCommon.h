@@ -43,6 +43,7 @@
 #include "vpvl2/vpvl2.h"
 #include "vpvl2/ITexture.h"
 #include "vpvl2/extensions/gl/ShaderProgram.h"
+#include "vpvl2/internal/RenderStateCache.h"
 
 namespace vpvl2
 {
@@ -54,11 +55,13 @@ class BaseShaderProgram : public extensions::gl::ShaderProgram
 public:
     BaseShaderProgram()
         : ShaderProgram(),
+          m_renderStateCacheRef(0),
           m_modelViewProjectionUniformLocation(-1),
           m_positionAttributeLocation(-1)
     {
     }
     virtual ~BaseShaderProgram() {
+        m_renderStateCacheRef = 0;
         m_modelViewProjectionUniformLocation = -1;
         m_positionAttributeLocation = -1;
     }
@@ -82,14 +85,67 @@ public:
             return false;
         }
         VPVL2_VLOG(2, "Created a shader program (ID=" << m_program << ")");
+        m_uniformCache.invalidate();
         getUniformLocations();
         return true;
     }
     void setModelViewProjectionMatrix(const float value[16]) {
         glUniformMatrix4fv(m_modelViewProjectionUniformLocation, 1, GL_FALSE, value);
     }
+    void setRenderStateCacheRef(internal::RenderStateCache *value) {
+        m_renderStateCacheRef = value;
+    }
+    /* same as bindTexture2D, the capability is changed only if it differs from the cache */
+    void setCullFaceEnable(bool value) {
+        internal::RenderStateCache *cache = m_renderStateCacheRef;
+        if (!cache || cache->updateCapability(internal::RenderStateCache::kCullFace, value)) {
+            if (value) {
+                glEnable(GL_CULL_FACE);
+            }
+            else {
+                glDisable(GL_CULL_FACE);
+            }
+        }
+    }
 
 protected:
+    /* uniforms are a part of the program object, so unchanged values are skipped */
+    void setUniform1i(GLint location, GLint value) {
+        if (m_uniformCache.update1i(location, value)) {
+            glUniform1i(location, value);
+        }
+    }
+    void setUniform1f(GLint location, GLfloat value) {
+        if (m_uniformCache.update1f(location, value)) {
+            glUniform1f(location, value);
+        }
+    }
+    void setUniform2fv(GLint location, const GLfloat *value) {
+        if (m_uniformCache.updatefv(location, value, 2)) {
+            glUniform2fv(location, 1, value);
+        }
+    }
+    void setUniform3fv(GLint location, const GLfloat *value) {
+        if (m_uniformCache.updatefv(location, value, 3)) {
+            glUniform3fv(location, 1, value);
+        }
+    }
+    void setUniform4fv(GLint location, const GLfloat *value) {
+        if (m_uniformCache.updatefv(location, value, 4)) {
+            glUniform4fv(location, 1, value);
+        }
+    }
+    /* texture units are shared with other programs, so binds are skipped only while a cache is set */
+    void bindTexture2D(int unit, GLuint name) {
+        internal::RenderStateCache *cache = m_renderStateCacheRef;
+        if (!cache || cache->updateTexture(unit, name)) {
+            if (!cache || cache->updateActiveTexture(unit)) {
+                glActiveTexture(GL_TEXTURE0 + unit);
+            }
+            glBindTexture(GL_TEXTURE_2D, name);
+        }
+    }
+
     virtual void bindAttributeLocations() {
         glBindAttribLocation(m_program, IModel::Buffer::kVertexStride, "inPosition");
     }
@@ -98,6 +154,8 @@ protected:
     }
 
 private:
+    internal::UniformStateCache m_uniformCache;
+    internal::RenderStateCache *m_renderStateCacheRef;
     GLint m_modelViewProjectionUniformLocation;
     GLint m_positionAttributeLocation;
 };
@@ -142,10 +200,10 @@ public:
     }
 
     void setLightColor(const Vector3 &value) {
-        glUniform3fv(m_lightColorUniformLocation, 1, value);
+        setUniform3fv(m_lightColorUniformLocation, value);
     }
     void setLightDirection(const Vector3 &value) {
-        glUniform3fv(m_lightDirectionUniformLocation, 1, value);
+        setUniform3fv(m_lightDirectionUniformLocation, value);
     }
     void setLightViewProjectionMatrix(const GLfloat value[16]) {
         glUniformMatrix4fv(m_lightViewProjectionMatrixUniformLocation, 1, GL_FALSE, value);
@@ -160,34 +218,32 @@ public:
     }
     void setMainTexture(const ITexture *value) {
         if (value) {
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, static_cast<GLuint>(value->data()));
-            glUniform1i(m_mainTextureUniformLocation, 0);
-            glUniform1i(m_hasMainTextureUniformLocation, 1);
+            bindTexture2D(0, static_cast<GLuint>(value->data()));
+            setUniform1i(m_mainTextureUniformLocation, 0);
+            setUniform1i(m_hasMainTextureUniformLocation, 1);
         }
         else {
-            glUniform1i(m_hasMainTextureUniformLocation, 0);
+            setUniform1i(m_hasMainTextureUniformLocation, 0);
         }
     }
     void setDepthTexture(GLuint value) {
         if (value) {
-            glActiveTexture(GL_TEXTURE3);
-            glBindTexture(GL_TEXTURE_2D, value);
-            glUniform1i(m_depthTextureUniformLocation, 3);
-            glUniform1i(m_hasDepthTextureUniformLocation, 1);
+            bindTexture2D(3, value);
+            setUniform1i(m_depthTextureUniformLocation, 3);
+            setUniform1i(m_hasDepthTextureUniformLocation, 1);
         }
         else {
-            glUniform1i(m_hasDepthTextureUniformLocation, 0);
+            setUniform1i(m_hasDepthTextureUniformLocation, 0);
         }
     }
     void setDepthTextureSize(const Vector3 &value) {
-        glUniform2fv(m_depthTextureSizeUniformLocation, 1, value);
+        setUniform2fv(m_depthTextureSizeUniformLocation, value);
     }
     void setSoftShadowEnable(bool value) {
-        glUniform1f(m_enableSoftShadowUniformLocation, GLfloat(value ? 1 : 0));
+        setUniform1f(m_enableSoftShadowUniformLocation, GLfloat(value ? 1 : 0));
     }
     void setOpacity(const Scalar &value) {
-        glUniform1f(m_opacityUniformLocation, value);
+        setUniform1f(m_opacityUniformLocation, value);
     }
 
 protected:
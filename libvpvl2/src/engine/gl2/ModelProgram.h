@@ -0,0 +1,226 @@
+/**
+
+ Copyright (c) 2010-2013  hkrn
+
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or
+ without modification, are permitted provided that the following
+ conditions are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+ - Redistributions in binary form must reproduce the above
+   copyright notice, this list of conditions and the following
+   disclaimer in the documentation and/or other materials provided
+   with the distribution.
+ - Neither the name of the MMDAI project team nor the names of
+   its contributors may be used to endorse or promote products
+   derived from this software without specific prior written
+   permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef VPVL2_GL_INTERNAL_MODELPROGRAM_H_
+#define VPVL2_GL_INTERNAL_MODELPROGRAM_H_
+
+#include "EngineCommon.h"
+
+namespace vpvl2
+{
+namespace gl2
+{
+
+class ModelProgram : public ObjectProgram
+{
+public:
+    ModelProgram()
+        : ObjectProgram(),
+          m_cameraPositionUniformLocation(-1),
+          m_materialColorUniformLocation(-1),
+          m_materialSpecularUniformLocation(-1),
+          m_materialShininessUniformLocation(-1),
+          m_mainTextureBlendUniformLocation(-1),
+          m_sphereTextureBlendUniformLocation(-1),
+          m_toonTextureBlendUniformLocation(-1),
+          m_sphereTextureUniformLocation(-1),
+          m_hasSphereTextureUniformLocation(-1),
+          m_isSPHTextureUniformLocation(-1),
+          m_isSPATextureUniformLocation(-1),
+          m_isSubTextureUniformLocation(-1),
+          m_toonTextureUniformLocation(-1),
+          m_hasToonTextureUniformLocation(-1),
+          m_useToonUniformLocation(-1),
+          m_boneMatricesUniformLocation(-1)
+    {
+    }
+    ~ModelProgram() {
+        m_cameraPositionUniformLocation = -1;
+        m_materialColorUniformLocation = -1;
+        m_materialSpecularUniformLocation = -1;
+        m_materialShininessUniformLocation = -1;
+        m_mainTextureBlendUniformLocation = -1;
+        m_sphereTextureBlendUniformLocation = -1;
+        m_toonTextureBlendUniformLocation = -1;
+        m_sphereTextureUniformLocation = -1;
+        m_hasSphereTextureUniformLocation = -1;
+        m_isSPHTextureUniformLocation = -1;
+        m_isSPATextureUniformLocation = -1;
+        m_isSubTextureUniformLocation = -1;
+        m_toonTextureUniformLocation = -1;
+        m_hasToonTextureUniformLocation = -1;
+        m_useToonUniformLocation = -1;
+        m_boneMatricesUniformLocation = -1;
+    }
+
+    void setCameraPosition(const Vector3 &value) {
+        setUniform3fv(m_cameraPositionUniformLocation, value);
+    }
+    void setMaterialColor(const Color &value) {
+        setUniform4fv(m_materialColorUniformLocation, value);
+    }
+    void setMaterialSpecular(const Color &value) {
+        setUniform3fv(m_materialSpecularUniformLocation, value);
+    }
+    void setMaterialShininess(const Scalar &value) {
+        setUniform1f(m_materialShininessUniformLocation, value);
+    }
+    void setMainTextureBlend(const Color &value) {
+        setUniform4fv(m_mainTextureBlendUniformLocation, value);
+    }
+    void setSphereTextureBlend(const Color &value) {
+        setUniform4fv(m_sphereTextureBlendUniformLocation, value);
+    }
+    void setToonTextureBlend(const Color &value) {
+        setUniform4fv(m_toonTextureBlendUniformLocation, value);
+    }
+    void setToonEnable(bool value) {
+        setUniform1i(m_useToonUniformLocation, value ? 1 : 0);
+    }
+    void setSphereTexture(const ITexture *value, IMaterial::SphereTextureRenderMode mode) {
+        if (value) {
+            switch (mode) {
+            case IMaterial::kNone:
+            default:
+                setUniform1i(m_hasSphereTextureUniformLocation, 0);
+                setUniform1i(m_isSPHTextureUniformLocation, 0);
+                setUniform1i(m_isSPATextureUniformLocation, 0);
+                setUniform1i(m_isSubTextureUniformLocation, 0);
+                break;
+            case IMaterial::kMultTexture:
+                enableSphereTexture(value);
+                setUniform1i(m_isSPHTextureUniformLocation, 1);
+                setUniform1i(m_isSPATextureUniformLocation, 0);
+                setUniform1i(m_isSubTextureUniformLocation, 0);
+                break;
+            case IMaterial::kAddTexture:
+                enableSphereTexture(value);
+                setUniform1i(m_isSPHTextureUniformLocation, 0);
+                setUniform1i(m_isSPATextureUniformLocation, 1);
+                setUniform1i(m_isSubTextureUniformLocation, 0);
+                break;
+            case IMaterial::kSubTexture:
+                enableSphereTexture(value);
+                setUniform1i(m_isSPHTextureUniformLocation, 0);
+                setUniform1i(m_isSPATextureUniformLocation, 0);
+                setUniform1i(m_isSubTextureUniformLocation, 1);
+                break;
+            }
+        }
+        else {
+            setUniform1i(m_hasSphereTextureUniformLocation, 0);
+        }
+    }
+    void setToonTexture(const ITexture *value) {
+        if (value) {
+            bindTexture2D(2, static_cast<GLuint>(value->data()));
+            setUniform1i(m_toonTextureUniformLocation, 2);
+            setUniform1i(m_hasToonTextureUniformLocation, 1);
+        }
+        else {
+            setUniform1i(m_hasToonTextureUniformLocation, 0);
+        }
+    }
+    void setBoneMatrices(const Scalar *value, vsize size) {
+        glUniformMatrix4fv(m_boneMatricesUniformLocation, size, GL_FALSE, value);
+    }
+    /* double sided materials are also culled while the model is translucent */
+    void bindMaterial(const internal::MaterialUniformBlock &block,
+                      const Vector3 &lightColor,
+                      GLuint depthTexture,
+                      bool hasModelTransparent) {
+        internal::bindMaterialUniformBlock(this, block, lightColor, depthTexture);
+        setCullFaceEnable(hasModelTransparent || !block.isCullingDisabled);
+    }
+
+protected:
+    virtual void bindAttributeLocations() {
+        ObjectProgram::bindAttributeLocations();
+        glBindAttribLocation(m_program, IModel::Buffer::kUVA0Stride, "inUVA0");
+        glBindAttribLocation(m_program, IModel::Buffer::kUVA1Stride, "inUVA1");
+        glBindAttribLocation(m_program, IModel::Buffer::kBoneIndexStride, "inBoneIndices");
+        glBindAttribLocation(m_program, IModel::Buffer::kBoneWeightStride, "inBoneWeights");
+    }
+    virtual void getUniformLocations() {
+        ObjectProgram::getUniformLocations();
+        m_cameraPositionUniformLocation = glGetUniformLocation(m_program, "cameraPosition");
+        m_materialColorUniformLocation = glGetUniformLocation(m_program, "materialColor");
+        m_materialSpecularUniformLocation = glGetUniformLocation(m_program, "materialSpecular");
+        m_materialShininessUniformLocation = glGetUniformLocation(m_program, "materialShininess");
+        m_mainTextureBlendUniformLocation = glGetUniformLocation(m_program, "mainTextureBlend");
+        m_sphereTextureBlendUniformLocation = glGetUniformLocation(m_program, "sphereTextureBlend");
+        m_toonTextureBlendUniformLocation = glGetUniformLocation(m_program, "toonTextureBlend");
+        m_sphereTextureUniformLocation = glGetUniformLocation(m_program, "sphereTexture");
+        m_hasSphereTextureUniformLocation = glGetUniformLocation(m_program, "hasSphereTexture");
+        m_isSPHTextureUniformLocation = glGetUniformLocation(m_program, "isSPHTexture");
+        m_isSPATextureUniformLocation = glGetUniformLocation(m_program, "isSPATexture");
+        m_isSubTextureUniformLocation = glGetUniformLocation(m_program, "isSubTexture");
+        m_toonTextureUniformLocation = glGetUniformLocation(m_program, "toonTexture");
+        m_hasToonTextureUniformLocation = glGetUniformLocation(m_program, "hasToonTexture");
+        m_useToonUniformLocation = glGetUniformLocation(m_program, "useToon");
+        m_boneMatricesUniformLocation = glGetUniformLocation(m_program, "boneMatrices");
+    }
+
+private:
+    void enableSphereTexture(const ITexture *value) {
+        bindTexture2D(1, static_cast<GLuint>(value->data()));
+        setUniform1i(m_sphereTextureUniformLocation, 1);
+        setUniform1i(m_hasSphereTextureUniformLocation, 1);
+    }
+
+    GLint m_cameraPositionUniformLocation;
+    GLint m_materialColorUniformLocation;
+    GLint m_materialSpecularUniformLocation;
+    GLint m_materialShininessUniformLocation;
+    GLint m_mainTextureBlendUniformLocation;
+    GLint m_sphereTextureBlendUniformLocation;
+    GLint m_toonTextureBlendUniformLocation;
+    GLint m_sphereTextureUniformLocation;
+    GLint m_hasSphereTextureUniformLocation;
+    GLint m_isSPHTextureUniformLocation;
+    GLint m_isSPATextureUniformLocation;
+    GLint m_isSubTextureUniformLocation;
+    GLint m_toonTextureUniformLocation;
+    GLint m_hasToonTextureUniformLocation;
+    GLint m_useToonUniformLocation;
+    GLint m_boneMatricesUniformLocation;
+};
+
+} /* namespace gl2 */
+} /* namespace vpvl2 */
+
+#endif
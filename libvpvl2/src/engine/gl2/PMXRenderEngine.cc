@@ -40,12 +40,19 @@
 #include "vpvl2/vpvl2.h"
 
 #include "EngineCommon.h"
+#include "ModelProgram.h"
+#include "vpvl2/extensions/gl/BaseSurface.h"
+#include "vpvl2/extensions/gl/StreamingVertexBuffer.h"
 #include "vpvl2/extensions/gl/VertexBundle.h"
 #include "vpvl2/extensions/gl/VertexBundleLayout.h"
 #include "vpvl2/internal/util.h" /* internal::snprintf */
+#include "vpvl2/internal/Culling.h"
+#include "vpvl2/internal/RenderStateCache.h"
 #include "vpvl2/gl2/PMXRenderEngine.h"
 #include "vpvl2/cl/PMXAccelerator.h"
 
+#include <string.h> /* memcpy */
+
 using namespace vpvl2;
 using namespace vpvl2::gl2;
 using namespace vpvl2::extensions::gl;
@@ -54,39 +61,15 @@ namespace {
 
 enum VertexBufferObjectType
 {
-    kModelDynamicVertexBufferEven,
-    kModelDynamicVertexBufferOdd,
     kModelStaticVertexBuffer,
     kModelIndexBuffer,
     kMaxVertexBufferObjectType
 };
 
-enum VertexArrayObjectType
-{
-    kVertexArrayObjectEven,
-    kVertexArrayObjectOdd,
-    kEdgeVertexArrayObjectEven,
-    kEdgeVertexArrayObjectOdd,
-    kMaxVertexArrayObjectType
-};
-
-struct MaterialTextureRefs
+static bool IsOpaqueTexture(const ITexture *texture)
 {
-    MaterialTextureRefs()
-        : mainTextureRef(0),
-          sphereTextureRef(0),
-          toonTextureRef(0)
-    {
-    }
-    ~MaterialTextureRefs() {
-        mainTextureRef = 0;
-        sphereTextureRef = 0;
-        toonTextureRef = 0;
-    }
-    ITexture *mainTextureRef;
-    ITexture *sphereTextureRef;
-    ITexture *toonTextureRef;
-};
+    return reinterpret_cast<const BaseSurface::Format *>(texture->format())->isOpaque();
+}
 
 class ExtendedZPlotProgram : public ZPlotProgram
 {
@@ -138,13 +121,13 @@ public:
     }
 
     void setColor(const Color &value) {
-        glUniform4fv(m_colorUniformLocation, 1, value);
+        setUniform4fv(m_colorUniformLocation, value);
     }
     void setSize(const Scalar &value) {
-        glUniform1f(m_edgeSizeUniformLocation, value);
+        setUniform1f(m_edgeSizeUniformLocation, value);
     }
     void setOpacity(const Scalar &value) {
-        glUniform1f(m_opacityUniformLocation, value);
+        setUniform1f(m_opacityUniformLocation, value);
     }
     void setBoneMatrices(const Scalar *value, vsize size) {
         glUniformMatrix4fv(m_boneMatricesUniformLocation, size, GL_FALSE, value);
@@ -209,175 +192,6 @@ private:
     GLint m_boneMatricesUniformLocation;
 };
 
-class ModelProgram : public ObjectProgram
-{
-public:
-    ModelProgram()
-        : ObjectProgram(),
-          m_cameraPositionUniformLocation(-1),
-          m_materialColorUniformLocation(-1),
-          m_materialSpecularUniformLocation(-1),
-          m_materialShininessUniformLocation(-1),
-          m_mainTextureBlendUniformLocation(-1),
-          m_sphereTextureBlendUniformLocation(-1),
-          m_toonTextureBlendUniformLocation(-1),
-          m_sphereTextureUniformLocation(-1),
-          m_hasSphereTextureUniformLocation(-1),
-          m_isSPHTextureUniformLocation(-1),
-          m_isSPATextureUniformLocation(-1),
-          m_isSubTextureUniformLocation(-1),
-          m_toonTextureUniformLocation(-1),
-          m_hasToonTextureUniformLocation(-1),
-          m_useToonUniformLocation(-1),
-          m_boneMatricesUniformLocation(-1)
-    {
-    }
-    ~ModelProgram() {
-        m_cameraPositionUniformLocation = -1;
-        m_materialColorUniformLocation = -1;
-        m_materialSpecularUniformLocation = -1;
-        m_materialShininessUniformLocation = -1;
-        m_mainTextureBlendUniformLocation = -1;
-        m_sphereTextureBlendUniformLocation = -1;
-        m_toonTextureBlendUniformLocation = -1;
-        m_sphereTextureUniformLocation = -1;
-        m_hasSphereTextureUniformLocation = -1;
-        m_isSPHTextureUniformLocation = -1;
-        m_isSPATextureUniformLocation = -1;
-        m_isSubTextureUniformLocation = -1;
-        m_toonTextureUniformLocation = -1;
-        m_hasToonTextureUniformLocation = -1;
-        m_useToonUniformLocation = -1;
-        m_boneMatricesUniformLocation = -1;
-    }
-
-    void setCameraPosition(const Vector3 &value) {
-        glUniform3fv(m_cameraPositionUniformLocation, 1, value);
-    }
-    void setMaterialColor(const Color &value) {
-        glUniform4fv(m_materialColorUniformLocation, 1, value);
-    }
-    void setMaterialSpecular(const Color &value) {
-        glUniform3fv(m_materialSpecularUniformLocation, 1, value);
-    }
-    void setMaterialShininess(const Scalar &value) {
-        glUniform1f(m_materialShininessUniformLocation, value);
-    }
-    void setMainTextureBlend(const Color &value) {
-        glUniform4fv(m_mainTextureBlendUniformLocation, 1, value);
-    }
-    void setSphereTextureBlend(const Color &value) {
-        glUniform4fv(m_sphereTextureBlendUniformLocation, 1, value);
-    }
-    void setToonTextureBlend(const Color &value) {
-        glUniform4fv(m_toonTextureBlendUniformLocation, 1, value);
-    }
-    void setToonEnable(bool value) {
-        glUniform1i(m_useToonUniformLocation, value ? 1 : 0);
-    }
-    void setSphereTexture(const ITexture *value, IMaterial::SphereTextureRenderMode mode) {
-        if (value) {
-            switch (mode) {
-            case IMaterial::kNone:
-            default:
-                glUniform1i(m_hasSphereTextureUniformLocation, 0);
-                glUniform1i(m_isSPHTextureUniformLocation, 0);
-                glUniform1i(m_isSPATextureUniformLocation, 0);
-                glUniform1i(m_isSubTextureUniformLocation, 0);
-                break;
-            case IMaterial::kMultTexture:
-                enableSphereTexture(value);
-                glUniform1i(m_isSPHTextureUniformLocation, 1);
-                glUniform1i(m_isSPATextureUniformLocation, 0);
-                glUniform1i(m_isSubTextureUniformLocation, 0);
-                break;
-            case IMaterial::kAddTexture:
-                enableSphereTexture(value);
-                glUniform1i(m_isSPHTextureUniformLocation, 0);
-                glUniform1i(m_isSPATextureUniformLocation, 1);
-                glUniform1i(m_isSubTextureUniformLocation, 0);
-                break;
-            case IMaterial::kSubTexture:
-                enableSphereTexture(value);
-                glUniform1i(m_isSPHTextureUniformLocation, 0);
-                glUniform1i(m_isSPATextureUniformLocation, 0);
-                glUniform1i(m_isSubTextureUniformLocation, 1);
-                break;
-            }
-        }
-        else {
-            glUniform1i(m_hasSphereTextureUniformLocation, 0);
-        }
-    }
-    void setToonTexture(const ITexture *value) {
-        if (value) {
-            glActiveTexture(GL_TEXTURE2);
-            glBindTexture(GL_TEXTURE_2D, static_cast<GLuint>(value->data()));
-            glUniform1i(m_toonTextureUniformLocation, 2);
-            glUniform1i(m_hasToonTextureUniformLocation, 1);
-        }
-        else {
-            glUniform1i(m_hasToonTextureUniformLocation, 0);
-        }
-    }
-    void setBoneMatrices(const Scalar *value, vsize size) {
-        glUniformMatrix4fv(m_boneMatricesUniformLocation, size, GL_FALSE, value);
-    }
-
-protected:
-    virtual void bindAttributeLocations() {
-        ObjectProgram::bindAttributeLocations();
-        glBindAttribLocation(m_program, IModel::Buffer::kUVA0Stride, "inUVA0");
-        glBindAttribLocation(m_program, IModel::Buffer::kUVA1Stride, "inUVA1");
-        glBindAttribLocation(m_program, IModel::Buffer::kBoneIndexStride, "inBoneIndices");
-        glBindAttribLocation(m_program, IModel::Buffer::kBoneWeightStride, "inBoneWeights");
-    }
-    virtual void getUniformLocations() {
-        ObjectProgram::getUniformLocations();
-        m_cameraPositionUniformLocation = glGetUniformLocation(m_program, "cameraPosition");
-        m_materialColorUniformLocation = glGetUniformLocation(m_program, "materialColor");
-        m_materialSpecularUniformLocation = glGetUniformLocation(m_program, "materialSpecular");
-        m_materialShininessUniformLocation = glGetUniformLocation(m_program, "materialShininess");
-        m_mainTextureBlendUniformLocation = glGetUniformLocation(m_program, "mainTextureBlend");
-        m_sphereTextureBlendUniformLocation = glGetUniformLocation(m_program, "sphereTextureBlend");
-        m_toonTextureBlendUniformLocation = glGetUniformLocation(m_program, "toonTextureBlend");
-        m_sphereTextureUniformLocation = glGetUniformLocation(m_program, "sphereTexture");
-        m_hasSphereTextureUniformLocation = glGetUniformLocation(m_program, "hasSphereTexture");
-        m_isSPHTextureUniformLocation = glGetUniformLocation(m_program, "isSPHTexture");
-        m_isSPATextureUniformLocation = glGetUniformLocation(m_program, "isSPATexture");
-        m_isSubTextureUniformLocation = glGetUniformLocation(m_program, "isSubTexture");
-        m_toonTextureUniformLocation = glGetUniformLocation(m_program, "toonTexture");
-        m_hasToonTextureUniformLocation = glGetUniformLocation(m_program, "hasToonTexture");
-        m_useToonUniformLocation = glGetUniformLocation(m_program, "useToon");
-        m_boneMatricesUniformLocation = glGetUniformLocation(m_program, "boneMatrices");
-    }
-
-private:
-    void enableSphereTexture(const ITexture *value) {
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, static_cast<GLuint>(value->data()));
-        glUniform1i(m_sphereTextureUniformLocation, 1);
-        glUniform1i(m_hasSphereTextureUniformLocation, 1);
-    }
-
-    GLint m_cameraPositionUniformLocation;
-    GLint m_materialColorUniformLocation;
-    GLint m_materialSpecularUniformLocation;
-    GLint m_materialShininessUniformLocation;
-    GLint m_mainTextureBlendUniformLocation;
-    GLint m_sphereTextureBlendUniformLocation;
-    GLint m_toonTextureBlendUniformLocation;
-    GLint m_sphereTextureUniformLocation;
-    GLint m_hasSphereTextureUniformLocation;
-    GLint m_isSPHTextureUniformLocation;
-    GLint m_isSPATextureUniformLocation;
-    GLint m_isSubTextureUniformLocation;
-    GLint m_toonTextureUniformLocation;
-    GLint m_hasToonTextureUniformLocation;
-    GLint m_useToonUniformLocation;
-    GLint m_boneMatricesUniformLocation;
-};
-
 }
 
 namespace vpvl2
@@ -388,7 +202,7 @@ namespace gl2
 class PMXRenderEngine::PrivateContext
 {
 public:
-    PrivateContext(const IModel *model, bool isVertexShaderSkinning)
+    PrivateContext(const IModel *model, bool isVertexShaderSkinning, internal::CullingContext *cullingContextRef)
         : modelRef(model),
           indexBuffer(0),
           staticBuffer(0),
@@ -398,17 +212,23 @@ public:
           modelProgram(0),
           shadowProgram(0),
           zplotProgram(0),
+          culler(cullingContextRef),
           aabbMin(SIMD_INFINITY, SIMD_INFINITY, SIMD_INFINITY),
           aabbMax(-SIMD_INFINITY, -SIMD_INFINITY, -SIMD_INFINITY),
-          cullFaceState(true),
-          isVertexShaderSkinning(isVertexShaderSkinning),
-          updateEven(true)
+          isMaterialSortEnabled(false),
+          isVertexShaderSkinning(isVertexShaderSkinning)
     {
         model->getIndexBuffer(indexBuffer);
         model->getStaticVertexBuffer(staticBuffer);
         model->getDynamicVertexBuffer(dynamicBuffer, indexBuffer);
-        if (isVertexShaderSkinning)
+        if (isVertexShaderSkinning) {
             model->getMatrixBuffer(matrixBuffer, dynamicBuffer, indexBuffer);
+            /* fallback to CPU skinning when the model cannot be split into bone palettes */
+            if (!matrixBuffer) {
+                VPVL2_LOG(WARNING, "Falling back to CPU skinning because the matrix buffer is not available");
+                this->isVertexShaderSkinning = false;
+            }
+        }
         switch (indexBuffer->type()) {
         case IModel::IndexBuffer::kIndex32:
             indexType = GL_UNSIGNED_INT;
@@ -433,6 +253,8 @@ public:
         dynamicBuffer = 0;
         delete staticBuffer;
         staticBuffer = 0;
+        delete matrixBuffer;
+        matrixBuffer = 0;
         delete edgeProgram;
         edgeProgram = 0;
         delete modelProgram;
@@ -443,29 +265,35 @@ public:
         zplotProgram = 0;
         aabbMin.setZero();
         aabbMax.setZero();
-        cullFaceState = false;
+        isMaterialSortEnabled = false;
         isVertexShaderSkinning = false;
     }
 
-    void getVertexBundleType(VertexArrayObjectType &vao, VertexBufferObjectType &vbo) {
-        if (updateEven) {
-            vao = kVertexArrayObjectOdd;
-            vbo = kModelDynamicVertexBufferOdd;
+    template<typename TProgram>
+    void drawElements(TProgram *program, int materialIndex, int nindices, vsize offset) {
+        if (isVertexShaderSkinning) {
+            /* each sub-mesh is drawn with its own bone palette */
+            const int nsubmeshes = matrixBuffer->countSubMeshes(materialIndex);
+            const vsize size = indexBuffer->strideSize();
+            for (int i = 0; i < nsubmeshes; i++) {
+                int start = 0, count = 0;
+                matrixBuffer->getSubMeshRange(materialIndex, i, start, count);
+                program->setBoneMatrices(matrixBuffer->subMeshBytes(materialIndex, i), matrixBuffer->subMeshSize(materialIndex, i));
+                glDrawElements(GL_TRIANGLES, count, indexType, reinterpret_cast<const GLvoid *>(offset + start * size));
+            }
         }
         else {
-            vao = kVertexArrayObjectEven;
-            vbo = kModelDynamicVertexBufferEven;
+            glDrawElements(GL_TRIANGLES, nindices, indexType, reinterpret_cast<const GLvoid *>(offset));
         }
     }
-    void getEdgeBundleType(VertexArrayObjectType &vao, VertexBufferObjectType &vbo) {
-        if (updateEven) {
-            vao = kEdgeVertexArrayObjectOdd;
-            vbo = kModelDynamicVertexBufferOdd;
-        }
-        else {
-            vao = kEdgeVertexArrayObjectEven;
-            vbo = kModelDynamicVertexBufferEven;
+    void updateMaterialUniformBlocks() {
+        const int nmaterials = materialRefs.count();
+        for (int i = 0; i < nmaterials; i++) {
+            internal::MaterialUniformBlock &block = materialUniformBlocks[i];
+            const bool isMainTextureOpaque = block.mainTextureRef && IsOpaqueTexture(block.mainTextureRef);
+            block.update(materialRefs[i], isMainTextureOpaque);
         }
+        materialDrawOrder.build(materialUniformBlocks, isMaterialSortEnabled);
     }
 
     const IModel *modelRef;
@@ -478,18 +306,25 @@ public:
     ShadowProgram *shadowProgram;
     ExtendedZPlotProgram *zplotProgram;
     VertexBundle buffer;
-    VertexBundleLayout bundles[kMaxVertexArrayObjectType];
+    StreamingVertexBuffer vertexStream;
+    VertexBundleLayout bundles[StreamingVertexBuffer::kMaxSlots];
+    VertexBundleLayout edgeBundles[StreamingVertexBuffer::kMaxSlots];
     GLenum indexType;
     PointerHash<HashPtr, ITexture> allocatedTextures;
-    Array<MaterialTextureRefs> materialTextureRefs;
+    Array<IMaterial *> materialRefs;
+    Array<internal::MaterialUniformBlock> materialUniformBlocks;
+    internal::MaterialDrawOrder materialDrawOrder;
+    internal::RenderStateCache renderState;
+    internal::MaterialCuller culler;
+    /* CPU copy of the skinned vertices to rasterize occluders without reading the mapped buffer */
+    Array<uint8> stagingVertices;
     Vector3 aabbMin;
     Vector3 aabbMax;
 #ifdef VPVL2_ENABLE_OPENCL
     cl::PMXAccelerator::VertexBufferBridgeArray buffers;
 #endif
-    bool cullFaceState;
+    bool isMaterialSortEnabled;
     bool isVertexShaderSkinning;
-    bool updateEven;
 };
 
 PMXRenderEngine::PMXRenderEngine(IApplicationContext *applicationContext,
@@ -503,9 +338,9 @@ PMXRenderEngine::PMXRenderEngine(IApplicationContext *applicationContext,
       m_context(0)
 {
     bool vss = m_sceneRef->accelerationType() == Scene::kVertexShaderAccelerationType1;
-    m_context = new PrivateContext(modelRef, vss);
+    m_context = new PrivateContext(modelRef, vss, m_sceneRef->cullingContextRef());
 #ifdef VPVL2_ENABLE_OPENCL
-    if (vss || (m_accelerator && m_accelerator->isAvailable()))
+    if (m_context->isVertexShaderSkinning || (m_accelerator && m_accelerator->isAvailable()))
         m_context->dynamicBuffer->setSkinningEnable(false);
 #endif
 }
@@ -538,7 +373,7 @@ bool PMXRenderEngine::upload(void *userData)
     bool ret = true, vss = false;
     if (!m_context) {
         vss = m_sceneRef->accelerationType() == Scene::kVertexShaderAccelerationType1;
-        m_context = new PrivateContext(m_modelRef, vss);
+        m_context = new PrivateContext(m_modelRef, vss, m_sceneRef->cullingContextRef());
         m_context->dynamicBuffer->setSkinningEnable(false);
     }
     vss = m_context->isVertexShaderSkinning;
@@ -578,57 +413,61 @@ bool PMXRenderEngine::upload(void *userData)
     if (!uploadMaterials(userData)) {
         return false;
     }
+    /* blocks and the draw order must exist even if the model is rendered before the first update */
+    m_context->updateMaterialUniformBlocks();
     VertexBundle &buffer = m_context->buffer;
-    buffer.create(VertexBundle::kVertexBuffer, kModelDynamicVertexBufferEven, GL_DYNAMIC_DRAW, 0, m_context->dynamicBuffer->size());
-    buffer.create(VertexBundle::kVertexBuffer, kModelDynamicVertexBufferOdd, GL_DYNAMIC_DRAW, 0, m_context->dynamicBuffer->size());
-    VPVL2_VLOG(2, "Binding model dynamic vertex buffer to the vertex buffer object: size=" << m_context->dynamicBuffer->size());
+    StreamingVertexBuffer &vertexStream = m_context->vertexStream;
+    bool allowPersistentMapping = true;
+#ifdef VPVL2_ENABLE_OPENCL
+    /* OpenCL shares each slot as a separate buffer object */
+    allowPersistentMapping = !(m_accelerator && m_accelerator->isAvailable());
+#endif
+    vertexStream.create(m_context->dynamicBuffer->size(), 0, allowPersistentMapping);
+    const int nslots = vertexStream.countSlots();
+    VPVL2_VLOG(2, "Binding model dynamic vertex buffer to the streaming vertex buffer: size=" << m_context->dynamicBuffer->size() << " slots=" << nslots << " strategy=" << vertexStream.strategy());
     const IModel::StaticVertexBuffer *staticBuffer = m_context->staticBuffer;
     buffer.create(VertexBundle::kVertexBuffer, kModelStaticVertexBuffer, GL_STATIC_DRAW, 0, staticBuffer->size());
     buffer.bind(VertexBundle::kVertexBuffer, kModelStaticVertexBuffer);
     void *address = buffer.map(VertexBundle::kVertexBuffer, 0, staticBuffer->size());
     staticBuffer->update(address);
+    if (vss) {
+        m_context->matrixBuffer->mapBoneIndices(address, staticBuffer);
+    }
     VPVL2_VLOG(2, "Binding model static vertex buffer to the vertex buffer object: ptr=" << address << " size=" << staticBuffer->size());
     buffer.unmap(VertexBundle::kVertexBuffer, address);
     buffer.unbind(VertexBundle::kVertexBuffer);
     const IModel::IndexBuffer *indexBuffer = m_context->indexBuffer;
     buffer.create(VertexBundle::kIndexBuffer, kModelIndexBuffer, GL_STATIC_DRAW, indexBuffer->bytes(), indexBuffer->size());
     VPVL2_VLOG(2, "Binding indices to the vertex buffer object: ptr=" << indexBuffer->bytes() << " size=" << indexBuffer->size());
-    VertexBundleLayout &bundleME = m_context->bundles[kVertexArrayObjectEven];
-    if (bundleME.create() && bundleME.bind()) {
-        VPVL2_VLOG(2, "Binding an vertex array object for even frame: " << bundleME.name());
-        createVertexBundle(kModelDynamicVertexBufferEven);
-    }
-    VertexBundleLayout &bundleMO = m_context->bundles[kVertexArrayObjectOdd];
-    if (bundleMO.create() && bundleMO.bind()) {
-        VPVL2_VLOG(2, "Binding an vertex array object for odd frame: " << bundleMO.name());
-        createVertexBundle(kModelDynamicVertexBufferOdd);
-    }
-    VertexBundleLayout &bundleEE = m_context->bundles[kEdgeVertexArrayObjectEven];
-    if (bundleEE.create() && bundleEE.bind()) {
-        VPVL2_VLOG(2, "Binding an edge vertex array object for even frame: " << bundleEE.name());
-        createEdgeBundle(kModelDynamicVertexBufferEven);
-    }
-    VertexBundleLayout &bundleEO = m_context->bundles[kEdgeVertexArrayObjectOdd];
-    if (bundleEO.create() && bundleEO.bind()) {
-        VPVL2_VLOG(2, "Binding an edge vertex array object for odd frame: " << bundleEO.name());
-        createEdgeBundle(kModelDynamicVertexBufferOdd);
+    for (int i = 0; i < nslots; i++) {
+        VertexBundleLayout &bundle = m_context->bundles[i];
+        if (bundle.create() && bundle.bind()) {
+            VPVL2_VLOG(2, "Binding an vertex array object for the slot " << i << ": " << bundle.name());
+            createVertexBundle(i);
+        }
+        VertexBundleLayout &edgeBundle = m_context->edgeBundles[i];
+        if (edgeBundle.create() && edgeBundle.bind()) {
+            VPVL2_VLOG(2, "Binding an edge vertex array object for the slot " << i << ": " << edgeBundle.name());
+            createEdgeBundle(i);
+        }
     }
     buffer.unbind(VertexBundle::kVertexBuffer);
     buffer.unbind(VertexBundle::kIndexBuffer);
     VertexBundleLayout::unbindVertexArrayObject();
 #ifdef VPVL2_ENABLE_OPENCL
     if (m_accelerator && m_accelerator->isAvailable()) {
-        const VertexBundle &buffer = m_context->buffer;
         cl::PMXAccelerator::VertexBufferBridgeArray &buffers = m_context->buffers;
         m_accelerator->release(buffers);
-        buffers.append(cl::PMXAccelerator::VertexBufferBridge(buffer.findName(kModelDynamicVertexBufferEven)));
-        buffers.append(cl::PMXAccelerator::VertexBufferBridge(buffer.findName(kModelDynamicVertexBufferOdd)));
+        for (int i = 0; i < nslots; i++) {
+            buffers.append(cl::PMXAccelerator::VertexBufferBridge(vertexStream.slotName(i)));
+        }
         m_accelerator->upload(buffers, m_context->indexBuffer);
     }
 #endif
     m_modelRef->setVisible(true);
-    update(); // for updating even frame
-    update(); // for updating odd frame
+    for (int i = 0; i < nslots; i++) {
+        update(); // for updating all slots
+    }
     VPVL2_VLOG(2, "Created the model: jp=" << internal::cstr(m_modelRef->name(IEncoding::kJapanese), "(null)") << " en=" << internal::cstr(m_modelRef->name(IEncoding::kEnglish), "(null)"));
     m_applicationContextRef->stopProfileSession(IApplicationContext::kProfileUploadModelProcess, m_modelRef);
     return ret;
@@ -639,29 +478,37 @@ void PMXRenderEngine::update()
     if (!m_modelRef || !m_modelRef->isVisible() || !m_context)
         return;
     m_applicationContextRef->startProfileSession(IApplicationContext::kProfileUpdateModelProcess, m_modelRef);
-    VertexBufferObjectType vbo = m_context->updateEven
-            ? kModelDynamicVertexBufferEven : kModelDynamicVertexBufferOdd;
     IModel::DynamicVertexBuffer *dynamicBuffer = m_context->dynamicBuffer;
-    m_context->buffer.bind(VertexBundle::kVertexBuffer, vbo);
-    if (void *address = m_context->buffer.map(VertexBundle::kVertexBuffer, 0, dynamicBuffer->size())) {
+    StreamingVertexBuffer &vertexStream = m_context->vertexStream;
+    /* skinning writes into the slot directly if it is persistently mapped */
+    if (void *address = vertexStream.map()) {
         if (m_context->isVertexShaderSkinning) {
             m_context->matrixBuffer->update(address);
         }
+        else if (m_context->culler.isOcclusionCullingEnabled()) {
+            const ICamera *camera = m_sceneRef->cameraRef();
+            Array<uint8> &stagingVertices = m_context->stagingVertices;
+            const vsize size = dynamicBuffer->size();
+            stagingVertices.resize(int(size));
+            dynamicBuffer->update(&stagingVertices[0], camera->position(), m_context->aabbMin, m_context->aabbMax);
+            memcpy(address, &stagingVertices[0], size);
+        }
         else {
             const ICamera *camera = m_sceneRef->cameraRef();
             dynamicBuffer->update(address, camera->position(), m_context->aabbMin, m_context->aabbMax);
+            m_context->stagingVertices.clear();
         }
-        m_context->buffer.unmap(VertexBundle::kVertexBuffer, address);
+        vertexStream.unmap(address);
     }
-    m_context->buffer.unbind(VertexBundle::kVertexBuffer);
 #ifdef VPVL2_ENABLE_OPENCL
     if (m_accelerator && m_accelerator->isAvailable()) {
-        const cl::PMXAccelerator::VertexBufferBridge &buffer = m_context->buffers[m_context->updateEven ? 0 : 1];
+        const cl::PMXAccelerator::VertexBufferBridge &buffer = m_context->buffers[vertexStream.currentSlot()];
         m_accelerator->update(dynamicBuffer, buffer, m_context->aabbMin, m_context->aabbMax);
     }
 #endif
     m_modelRef->setAabb(m_context->aabbMin, m_context->aabbMax);
-    m_context->updateEven = m_context->updateEven ? false :true;
+    /* material morphs and asynchronously loaded textures change blocks, the light is applied at render */
+    m_context->updateMaterialUniformBlocks();
     m_applicationContextRef->stopProfileSession(IApplicationContext::kProfileUpdateModelProcess, m_modelRef);
 }
 
@@ -670,6 +517,7 @@ void PMXRenderEngine::setUpdateOptions(int options)
     if (m_context) {
         IModel::DynamicVertexBuffer *dynamicBuffer = m_context->dynamicBuffer;
         dynamicBuffer->setParallelUpdateEnable(internal::hasFlagBits(options, kParallelUpdate));
+        m_context->isMaterialSortEnabled = internal::hasFlagBits(options, kSortOpaqueMaterials);
     }
 }
 
@@ -679,13 +527,24 @@ void PMXRenderEngine::renderModel()
         return;
     m_applicationContextRef->startProfileSession(IApplicationContext::kProfileRenderModelProcess, m_modelRef);
     ModelProgram *modelProgram = m_context->modelProgram;
+    internal::RenderStateCache &renderState = m_context->renderState;
+    /* other render engines may change texture units and capabilities between passes */
+    renderState.invalidate();
+    renderState.setCapability(internal::RenderStateCache::kCullFace, true);
+    modelProgram->setRenderStateCacheRef(&renderState);
     modelProgram->bind();
-    float matrix4x4[16];
+    internal::MaterialCuller &culler = m_context->culler;
+    float matrix4x4[16], viewProjection[16];
     m_applicationContextRef->getMatrix(matrix4x4, m_modelRef,
                                   IApplicationContext::kWorldMatrix
                                   | IApplicationContext::kViewMatrix
                                   | IApplicationContext::kProjectionMatrix
                                   | IApplicationContext::kCameraMatrix);
+    m_applicationContextRef->getMatrix(viewProjection, m_modelRef,
+                                  IApplicationContext::kViewMatrix
+                                  | IApplicationContext::kProjectionMatrix
+                                  | IApplicationContext::kCameraMatrix);
+    culler.begin(internal::MaterialCuller::kModelPass, m_context->dynamicBuffer, matrix4x4, viewProjection);
     modelProgram->setModelViewProjectionMatrix(matrix4x4);
     m_applicationContextRef->getMatrix(matrix4x4, m_modelRef,
                                   IApplicationContext::kWorldMatrix
@@ -711,58 +570,37 @@ void PMXRenderEngine::renderModel()
     modelProgram->setCameraPosition(m_sceneRef->cameraRef()->lookAt());
     const Scalar &opacity = m_modelRef->opacity();
     modelProgram->setOpacity(opacity);
-    Array<IMaterial *> materials;
-    m_modelRef->getMaterialRefs(materials);
-    const int nmaterials = materials.count();
+    const Array<IMaterial *> &materials = m_context->materialRefs;
+    const Array<internal::MaterialUniformBlock> &blocks = m_context->materialUniformBlocks;
+    const internal::MaterialDrawOrder &drawOrder = m_context->materialDrawOrder;
+    const int nmaterials = drawOrder.count();
     const bool hasModelTransparent = !btFuzzyZero(opacity - 1.0f),
             isVertexShaderSkinning = m_context->isVertexShaderSkinning;
-    const Vector3 &lc = light->color();
-    bool &cullFaceState = m_context->cullFaceState;
-    Color diffuse, specular;
-    vsize offset = 0, size = m_context->indexBuffer->strideSize();
     bindVertexBundle();
     for (int i = 0; i < nmaterials; i++) {
-        const IMaterial *material = materials[i];
-        const MaterialTextureRefs &materialPrivate = m_context->materialTextureRefs[i];
-        const Color &ma = material->ambient(), &md = material->diffuse(), &ms = material->specular();
-        diffuse.setValue(ma.x() + md.x() * lc.x(), ma.y() + md.y() * lc.y(), ma.z() + md.z() * lc.z(), md.w());
-        specular.setValue(ms.x() * lc.x(), ms.y() * lc.y(), ms.z() * lc.z(), 1.0);
-        modelProgram->setMaterialColor(diffuse);
-        modelProgram->setMaterialSpecular(specular);
-        modelProgram->setMaterialShininess(material->shininess());
-        modelProgram->setMainTextureBlend(material->mainTextureBlend());
-        modelProgram->setSphereTextureBlend(material->sphereTextureBlend());
-        modelProgram->setToonTextureBlend(material->toonTextureBlend());
-        modelProgram->setMainTexture(materialPrivate.mainTextureRef);
-        modelProgram->setSphereTexture(materialPrivate.sphereTextureRef, material->sphereTextureRenderMode());
-        modelProgram->setToonTexture(materialPrivate.toonTextureRef);
-        if (textureID && material->isSelfShadowEnabled())
-            modelProgram->setDepthTexture(textureID);
-        else
-            modelProgram->setDepthTexture(0);
-        if (isVertexShaderSkinning) {
-            IModel::MatrixBuffer *matrixBuffer = m_context->matrixBuffer;
-            modelProgram->setBoneMatrices(matrixBuffer->bytes(i), matrixBuffer->size(i));
-        }
-        if (!hasModelTransparent && cullFaceState && material->isCullingDisabled()) {
-            glDisable(GL_CULL_FACE);
-            cullFaceState = false;
+        const int materialIndex = drawOrder.at(i);
+        if (!culler.testMaterial(materialIndex)) {
+            continue;
         }
-        else if (!cullFaceState && !material->isCullingDisabled()) {
-            glEnable(GL_CULL_FACE);
-            cullFaceState = true;
-        }
-        const int nindices = material->indexRange().count;
+        const internal::MaterialUniformBlock &block = blocks[materialIndex];
+        modelProgram->bindMaterial(block, light->color(), textureID, hasModelTransparent);
+        const IMaterial *material = materials[materialIndex];
         m_applicationContextRef->startProfileSession(IApplicationContext::kProfileRenderModelMaterialDrawCall, material);
-        glDrawElements(GL_TRIANGLES, nindices, m_context->indexType, reinterpret_cast<const GLvoid *>(offset));
+        m_context->drawElements(modelProgram, materialIndex, block.nindices, block.indexOffset);
         m_applicationContextRef->stopProfileSession(IApplicationContext::kProfileRenderModelMaterialDrawCall, material);
-        offset += nindices * size;
     }
     unbindVertexBundle();
+    modelProgram->setCullFaceEnable(true);
     modelProgram->unbind();
-    if (!cullFaceState) {
-        glEnable(GL_CULL_FACE);
-        cullFaceState = true;
+    modelProgram->setRenderStateCacheRef(0);
+    const Array<uint8> &stagingVertices = m_context->stagingVertices;
+    if (!isVertexShaderSkinning && stagingVertices.count() > 0) {
+        Array<bool> opaqueMaterials;
+        opaqueMaterials.resize(blocks.count());
+        for (int i = 0; i < blocks.count(); i++) {
+            opaqueMaterials[i] = blocks[i].isOpaque;
+        }
+        culler.rasterizeOccluders(m_modelRef, &stagingVertices[0], m_context->indexBuffer, opaqueMaterials);
     }
     m_applicationContextRef->stopProfileSession(IApplicationContext::kProfileRenderModelProcess, m_modelRef);
 }
@@ -781,6 +619,8 @@ void PMXRenderEngine::renderShadow()
                                   | IApplicationContext::kProjectionMatrix
                                   | IApplicationContext::kShadowMatrix);
     shadowProgram->setModelViewProjectionMatrix(matrix4x4);
+    internal::MaterialCuller &culler = m_context->culler;
+    culler.begin(internal::MaterialCuller::kShadowPass, m_context->dynamicBuffer, matrix4x4, 0);
     const ILight *light = m_sceneRef->lightRef();
     shadowProgram->setLightColor(light->color());
     shadowProgram->setLightDirection(light->direction());
@@ -794,13 +634,9 @@ void PMXRenderEngine::renderShadow()
     for (int i = 0; i < nmaterials; i++) {
         const IMaterial *material = materials[i];
         const int nindices = material->indexRange().count;
-        if (material->hasShadow()) {
-            if (isVertexShaderSkinning) {
-                IModel::MatrixBuffer *matrixBuffer = m_context->matrixBuffer;
-                shadowProgram->setBoneMatrices(matrixBuffer->bytes(i), matrixBuffer->size(i));
-            }
+        if (material->hasShadow() && culler.testMaterial(i)) {
             m_applicationContextRef->startProfileSession(IApplicationContext::kProfileRenderShadowMaterialDrawCall, material);
-            glDrawElements(GL_TRIANGLES, nindices, m_context->indexType, reinterpret_cast<const GLvoid *>(offset));
+            m_context->drawElements(shadowProgram, i, nindices, offset);
             m_applicationContextRef->stopProfileSession(IApplicationContext::kProfileRenderShadowMaterialDrawCall, material);
         }
         offset += nindices * size;
@@ -826,6 +662,8 @@ void PMXRenderEngine::renderEdge()
                                   | IApplicationContext::kProjectionMatrix
                                   | IApplicationContext::kCameraMatrix);
     edgeProgram->setModelViewProjectionMatrix(matrix4x4);
+    internal::MaterialCuller &culler = m_context->culler;
+    culler.begin(internal::MaterialCuller::kEdgePass, m_context->dynamicBuffer, matrix4x4, 0);
     edgeProgram->setOpacity(opacity);
     Array<IMaterial *> materials;
     m_modelRef->getMaterialRefs(materials);
@@ -846,14 +684,12 @@ void PMXRenderEngine::renderEdge()
         const IMaterial *material = materials[i];
         const int nindices = material->indexRange().count;
         edgeProgram->setColor(material->edgeColor());
-        if (material->isEdgeEnabled()) {
+        if (material->isEdgeEnabled() && culler.testMaterial(i)) {
             if (isVertexShaderSkinning) {
-                IModel::MatrixBuffer *matrixBuffer = m_context->matrixBuffer;
-                edgeProgram->setBoneMatrices(matrixBuffer->bytes(i), matrixBuffer->size(i));
                 edgeProgram->setSize(Scalar(material->edgeSize() * edgeScaleFactor));
             }
             m_applicationContextRef->startProfileSession(IApplicationContext::kProfileRenderEdgeMateiralDrawCall, material);
-            glDrawElements(GL_TRIANGLES, nindices, m_context->indexType, reinterpret_cast<const GLvoid *>(offset));
+            m_context->drawElements(edgeProgram, i, nindices, offset);
             m_applicationContextRef->stopProfileSession(IApplicationContext::kProfileRenderEdgeMateiralDrawCall, material);
         }
         offset += nindices * size;
@@ -880,6 +716,8 @@ void PMXRenderEngine::renderZPlot()
                                   | IApplicationContext::kProjectionMatrix
                                   | IApplicationContext::kLightMatrix);
     zplotProgram->setModelViewProjectionMatrix(matrix4x4);
+    internal::MaterialCuller &culler = m_context->culler;
+    culler.begin(internal::MaterialCuller::kZPlotPass, m_context->dynamicBuffer, matrix4x4, 0);
     Array<IMaterial *> materials;
     m_modelRef->getMaterialRefs(materials);
     const int nmaterials = materials.count();
@@ -890,13 +728,9 @@ void PMXRenderEngine::renderZPlot()
     for (int i = 0; i < nmaterials; i++) {
         const IMaterial *material = materials[i];
         const int nindices = material->indexRange().count;
-        if (material->hasShadowMap()) {
-            if (isVertexShaderSkinning) {
-                IModel::MatrixBuffer *matrixBuffer = m_context->matrixBuffer;
-                zplotProgram->setBoneMatrices(matrixBuffer->bytes(i), matrixBuffer->size(i));
-            }
+        if (material->hasShadowMap() && culler.testMaterial(i)) {
             m_applicationContextRef->startProfileSession(IApplicationContext::kProfileRenderZPlotMaterialDrawCall, material);
-            glDrawElements(GL_TRIANGLES, nindices, m_context->indexType, reinterpret_cast<const GLvoid *>(offset));
+            m_context->drawElements(zplotProgram, i, nindices, offset);
             m_applicationContextRef->stopProfileSession(IApplicationContext::kProfileRenderZPlotMaterialDrawCall, material);
         }
         offset += nindices * size;
@@ -944,7 +778,17 @@ void PMXRenderEngine::setEffect(IEffect * /* effectRef */, IEffect::ScriptOrderT
 
 bool PMXRenderEngine::testVisible()
 {
-    return true;
+    if (!m_modelRef || !m_context)
+        return true;
+    float matrix4x4[16];
+    m_applicationContextRef->getMatrix(matrix4x4, m_modelRef,
+                                  IApplicationContext::kWorldMatrix
+                                  | IApplicationContext::kViewMatrix
+                                  | IApplicationContext::kProjectionMatrix
+                                  | IApplicationContext::kCameraMatrix);
+    Vector3 aabbMin, aabbMax;
+    m_modelRef->getAabb(aabbMin, aabbMax);
+    return m_context->culler.testAabb(matrix4x4, aabbMin, aabbMax);
 }
 
 bool PMXRenderEngine::createProgram(BaseShaderProgram *program,
@@ -976,12 +820,18 @@ bool PMXRenderEngine::uploadMaterials(void *userData)
     m_modelRef->getMaterialRefs(materials);
     const int nmaterials = materials.count();
     IApplicationContext::TextureDataBridge bridge(IApplicationContext::kTexture2D);
-    m_context->materialTextureRefs.resize(nmaterials);
+    Array<internal::MaterialUniformBlock> &blocks = m_context->materialUniformBlocks;
+    const vsize size = m_context->indexBuffer->strideSize();
+    vsize offset = 0;
+    m_context->materialRefs.copy(materials);
+    blocks.resize(nmaterials);
     for (int i = 0; i < nmaterials; i++) {
         const IMaterial *material = materials[i];
         const IString *name = material->name(IEncoding::kDefaultLanguage); (void) name;
         const int materialIndex = material->index(); (void) materialIndex;
-        MaterialTextureRefs &materialPrivate = m_context->materialTextureRefs[i];
+        internal::MaterialUniformBlock &materialPrivate = blocks[i];
+        materialPrivate.indexOffset = offset;
+        offset += material->indexRange().count * size;
         bridge.flags = IApplicationContext::kTexture2D | IApplicationContext::kAsyncLoadingTexture;
         if (const IString *mainTexturePath = material->mainTexture()) {
             if (m_applicationContextRef->uploadTexture(mainTexturePath, bridge, userData)) {
@@ -1038,11 +888,12 @@ bool PMXRenderEngine::uploadMaterials(void *userData)
     return true;
 }
 
-void PMXRenderEngine::createVertexBundle(GLuint dvbo)
+void PMXRenderEngine::createVertexBundle(int slot)
 {
     VertexBundle &buffer = m_context->buffer;
-    buffer.bind(VertexBundle::kVertexBuffer, dvbo);
-    bindDynamicVertexAttributePointers();
+    const StreamingVertexBuffer &vertexStream = m_context->vertexStream;
+    vertexStream.bind(slot);
+    bindDynamicVertexAttributePointers(vertexStream.slotOffset(slot));
     buffer.bind(VertexBundle::kVertexBuffer, kModelStaticVertexBuffer);
     bindStaticVertexAttributePointers();
     buffer.bind(VertexBundle::kIndexBuffer, kModelIndexBuffer);
@@ -1054,11 +905,12 @@ void PMXRenderEngine::createVertexBundle(GLuint dvbo)
     VertexBundleLayout::unbindVertexArrayObject();
 }
 
-void PMXRenderEngine::createEdgeBundle(GLuint dvbo)
+void PMXRenderEngine::createEdgeBundle(int slot)
 {
     VertexBundle &buffer = m_context->buffer;
-    buffer.bind(VertexBundle::kVertexBuffer, dvbo);
-    bindEdgeVertexAttributePointers();
+    const StreamingVertexBuffer &vertexStream = m_context->vertexStream;
+    vertexStream.bind(slot);
+    bindEdgeVertexAttributePointers(vertexStream.slotOffset(slot));
     buffer.bind(VertexBundle::kVertexBuffer, kModelStaticVertexBuffer);
     bindStaticVertexAttributePointers();
     buffer.bind(VertexBundle::kIndexBuffer, kModelIndexBuffer);
@@ -1068,13 +920,12 @@ void PMXRenderEngine::createEdgeBundle(GLuint dvbo)
 
 void PMXRenderEngine::bindVertexBundle()
 {
-    VertexArrayObjectType vao;
-    VertexBufferObjectType vbo;
-    m_context->getVertexBundleType(vao, vbo);
-    if (!m_context->bundles[vao].bind()) {
+    const StreamingVertexBuffer &vertexStream = m_context->vertexStream;
+    int slot = vertexStream.currentSlot();
+    if (!m_context->bundles[slot].bind()) {
         VertexBundle &buffer = m_context->buffer;
-        buffer.bind(VertexBundle::kVertexBuffer, vbo);
-        bindDynamicVertexAttributePointers();
+        vertexStream.bind(slot);
+        bindDynamicVertexAttributePointers(vertexStream.slotOffset(slot));
         buffer.bind(VertexBundle::kVertexBuffer, kModelStaticVertexBuffer);
         bindStaticVertexAttributePointers();
         buffer.bind(VertexBundle::kIndexBuffer, kModelIndexBuffer);
@@ -1083,13 +934,12 @@ void PMXRenderEngine::bindVertexBundle()
 
 void PMXRenderEngine::bindEdgeBundle()
 {
-    VertexArrayObjectType vao;
-    VertexBufferObjectType vbo;
-    m_context->getEdgeBundleType(vao, vbo);
-    if (!m_context->bundles[vao].bind()) {
+    const StreamingVertexBuffer &vertexStream = m_context->vertexStream;
+    int slot = vertexStream.currentSlot();
+    if (!m_context->edgeBundles[slot].bind()) {
         VertexBundle &buffer = m_context->buffer;
-        buffer.bind(VertexBundle::kVertexBuffer, vbo);
-        bindEdgeVertexAttributePointers();
+        vertexStream.bind(slot);
+        bindEdgeVertexAttributePointers(vertexStream.slotOffset(slot));
         buffer.bind(VertexBundle::kVertexBuffer, kModelStaticVertexBuffer);
         bindStaticVertexAttributePointers();
         buffer.bind(VertexBundle::kIndexBuffer, kModelIndexBuffer);
@@ -1105,35 +955,35 @@ void PMXRenderEngine::unbindVertexBundle()
     }
 }
 
-void PMXRenderEngine::bindDynamicVertexAttributePointers()
+void PMXRenderEngine::bindDynamicVertexAttributePointers(vsize baseOffset)
 {
     const IModel::DynamicVertexBuffer *dynamicBuffer = m_context->dynamicBuffer;
     vsize offset, size;
-    offset = dynamicBuffer->strideOffset(IModel::DynamicVertexBuffer::kVertexStride);
+    offset = baseOffset + dynamicBuffer->strideOffset(IModel::DynamicVertexBuffer::kVertexStride);
     size   = dynamicBuffer->strideSize();
     glVertexAttribPointer(IModel::Buffer::kVertexStride, 3, GL_FLOAT, GL_FALSE,
                           size, reinterpret_cast<const GLvoid *>(offset));
-    offset = dynamicBuffer->strideOffset(IModel::DynamicVertexBuffer::kNormalStride);
+    offset = baseOffset + dynamicBuffer->strideOffset(IModel::DynamicVertexBuffer::kNormalStride);
     glVertexAttribPointer(IModel::Buffer::kNormalStride, 3, GL_FLOAT, GL_FALSE,
                           size, reinterpret_cast<const GLvoid *>(offset));
-    offset = dynamicBuffer->strideOffset(IModel::DynamicVertexBuffer::kUVA0Stride);
+    offset = baseOffset + dynamicBuffer->strideOffset(IModel::DynamicVertexBuffer::kUVA0Stride);
     glVertexAttribPointer(IModel::Buffer::kUVA0Stride, 4, GL_FLOAT, GL_FALSE,
                           size, reinterpret_cast<const GLvoid *>(offset));
-    offset = dynamicBuffer->strideOffset(IModel::DynamicVertexBuffer::kUVA1Stride);
+    offset = baseOffset + dynamicBuffer->strideOffset(IModel::DynamicVertexBuffer::kUVA1Stride);
     glVertexAttribPointer(IModel::Buffer::kUVA1Stride, 4, GL_FLOAT, GL_FALSE,
                           size, reinterpret_cast<const GLvoid *>(offset));
 }
 
-void PMXRenderEngine::bindEdgeVertexAttributePointers()
+void PMXRenderEngine::bindEdgeVertexAttributePointers(vsize baseOffset)
 {
     const IModel::DynamicVertexBuffer *dynamicBuffer = m_context->dynamicBuffer;
     vsize offset, size;
-    offset = dynamicBuffer->strideOffset(IModel::DynamicVertexBuffer::kEdgeVertexStride);
+    offset = baseOffset + dynamicBuffer->strideOffset(IModel::DynamicVertexBuffer::kEdgeVertexStride);
     size   = dynamicBuffer->strideSize();
     glVertexAttribPointer(IModel::Buffer::kVertexStride, 3, GL_FLOAT, GL_FALSE,
                           size, reinterpret_cast<const GLvoid *>(offset));
     if (m_context->isVertexShaderSkinning) {
-        offset = dynamicBuffer->strideOffset(IModel::DynamicVertexBuffer::kNormalStride);
+        offset = baseOffset + dynamicBuffer->strideOffset(IModel::DynamicVertexBuffer::kNormalStride);
         glVertexAttribPointer(IModel::Buffer::kNormalStride, 3, GL_FLOAT, GL_FALSE,
                               size, reinterpret_cast<const GLvoid *>(offset));
         glVertexAttribPointer(IModel::Buffer::kEdgeSizeStride, 4, GL_FLOAT, GL_FALSE,
@@ -38,6 +38,8 @@
 #include <vpvl2/vpvl2.h>
 #include <vpvl2/extensions/Archive.h>
 #include <vpvl2/extensions/icu4c/String.h>
+#include <vpvl2/internal/ParallelProcessors.h>
+#include <vpvl2/internal/Thread.h>
 
 #include <map>
 #include <unicode/regex.h>
@@ -52,67 +54,335 @@ namespace extensions
 using namespace icu4c;
 
 struct Archive::PrivateContext {
+    static const uint32 kReadChunkSize = 65536;
+
     struct CaseLess {
         bool operator()(const UnicodeString &left, const UnicodeString &right) const {
             return left.caseCompare(right, 0) == -1;
         }
     };
+    /* raw names are compared case insensitive only in ASCII letters not to break Shift-JIS */
+    struct RawCaseLess {
+        static char toLower(char c) {
+            return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+        }
+        bool operator()(const std::string &left, const std::string &right) const {
+            const vsize size = btMin(left.size(), right.size());
+            for (vsize i = 0; i < size; i++) {
+                const char l = toLower(left[i]), r = toLower(right[i]);
+                if (l != r) {
+                    return l < r;
+                }
+            }
+            return left.size() < right.size();
+        }
+    };
+    struct IndexLess {
+        bool operator()(int left, int right) const {
+            return left < right;
+        }
+    };
+    struct Entry {
+        Entry()
+            : uncompressedSize(0),
+              decoded(false)
+        {
+            position.pos_in_zip_directory = 0;
+            position.num_of_file = 0;
+        }
+        std::string rawPath;
+        mutable UnicodeString name;
+        unz_file_pos position;
+        uLong uncompressedSize;
+        mutable bool decoded;
+    };
+    struct CachedData {
+        CachedData()
+            : lastUsed(0)
+        {
+        }
+        std::string bytes;
+        mutable uint64 lastUsed;
+    };
+    /* inflates entries with its own handle so that entries can be inflated concurrently */
+    struct UncompressTask {
+        UncompressTask(const std::string &path, const std::vector<Entry> &entries)
+            : pathRef(&path),
+              entriesRef(&entries)
+        {
+        }
+        void addEntry(int index) {
+            indices.append(index);
+            errors.append(kOpenCurrentFileError);
+            bytes.push_back(std::string());
+        }
+        void execute() {
+            /* the archive is opened once per task instead of once per entry */
+            if (unzFile file = unzOpen(pathRef->c_str())) {
+                const int nindices = indices.count();
+                for (int i = 0; i < nindices; i++) {
+                    const Entry &entry = (*entriesRef)[indices[i]];
+                    unz_file_pos position = entry.position;
+                    std::string &output = bytes[i];
+                    output.resize(entry.uncompressedSize);
+                    if (unzGoToFilePos(file, &position) == UNZ_OK) {
+                        errors[i] = readCurrentFile(file, entry.rawPath, output.empty() ? 0 : reinterpret_cast<uint8 *>(&output[0]), output.size());
+                    }
+                    else {
+                        errors[i] = kGetCurrentFileError;
+                    }
+                }
+                unzClose(file);
+            }
+        }
+        const std::string *pathRef;
+        const std::vector<Entry> *entriesRef;
+        Array<int> indices;
+        Array<Archive::ErrorType> errors;
+        std::vector<std::string> bytes;
+    };
 
     PrivateContext(IEncoding *encodingRef)
         : file(0),
           error(kNone),
-          encodingRef(encodingRef)
+          encodingRef(encodingRef),
+          cacheSize(0),
+          maxCacheSize(0),
+          clock(0),
+          unicodeIndexed(false)
     {
     }
     ~PrivateContext() {
         close();
     }
 
+    static Archive::ErrorType readCurrentFile(unzFile file, const std::string &rawPath, uint8 *buffer, vsize size) {
+        int err = unzOpenCurrentFile(file);
+        if (err != Z_OK) {
+            VPVL2_LOG(WARNING, "Cannot open the file " << rawPath << " in zip: " << err);
+            return kOpenCurrentFileError;
+        }
+        /* stream into the buffer chunk by chunk instead of inflating whole entry at once */
+        vsize offset = 0;
+        while (offset < size) {
+            const uint32 chunkSize = uint32(btMin(size - offset, vsize(kReadChunkSize)));
+            err = unzReadCurrentFile(file, buffer + offset, chunkSize);
+            if (err <= 0) {
+                break;
+            }
+            offset += err;
+        }
+        if (err < 0) {
+            VPVL2_LOG(WARNING, "Cannot read the file " << rawPath << " in zip: " << err);
+            unzCloseCurrentFile(file);
+            return kReadCurrentFileError;
+        }
+        else if (offset < size) {
+            VPVL2_LOG(WARNING, "Unexpected end of the file " << rawPath << " in zip: " << offset << " of " << size);
+            unzCloseCurrentFile(file);
+            return kReadCurrentFileError;
+        }
+        err = unzCloseCurrentFile(file);
+        if (err != Z_OK) {
+            VPVL2_LOG(WARNING, "Cannot close the file " << rawPath << " in zip: " << err);
+            return kCloseCurrentFileError;
+        }
+        return kNone;
+    }
+    static bool isASCII(const std::string &value) {
+        const vsize size = value.size();
+        for (vsize i = 0; i < size; i++) {
+            if (uint8(value[i]) >= 0x80) {
+                return false;
+            }
+        }
+        return true;
+    }
+    static bool toASCII(const UnicodeString &value, std::string &output) {
+        const int length = value.length();
+        output.resize(length);
+        for (int i = 0; i < length; i++) {
+            const UChar c = value.charAt(i);
+            if (c >= 0x80) {
+                return false;
+            }
+            output[i] = char(c);
+        }
+        return true;
+    }
+
     bool close() {
-        originalEntries.clear();
-        unicodePath2RawPath.clear();
+        entries.clear();
+        rawPath2Index.clear();
+        unicodePath2Index.clear();
+        unicodeIndexed = false;
+        cachedEntries.clear();
+        cacheSize = 0;
         int ret = unzClose(file);
         file = 0;
         return ret == Z_OK;
     }
-    bool uncompressEntry(const UnicodeString &entry, const unz_file_info &finfo) {
-        std::string &bytes = originalEntries[entry];
-        uint32 size(finfo.uncompressed_size);
-        bytes.resize(size);
-        VPVL2_VLOG(1, "filename=" << String::toStdString(entry) << " size=" << size);
-        int err = unzOpenCurrentFile(file);
-        if (err != Z_OK) {
-            VPVL2_LOG(WARNING, "Cannot open the file " << String::toStdString(entry) << " in zip: " << err);
-            error = kOpenCurrentFileError;
+    bool buildIndex() {
+        unz_file_info info;
+        int err = unzGetGlobalInfo(file, &header);
+        if (err != UNZ_OK) {
             return false;
         }
-        err = unzReadCurrentFile(file, &bytes[0], size);
-        if (err < 0) {
-            VPVL2_LOG(WARNING, "Cannot read the file " << String::toStdString(entry) << " in zip: " << err);
-            error = kReadCurrentFileError;
+        const uLong nentries = header.number_entry;
+        entries.reserve(nentries);
+        for (uLong i = 0; i < nentries; i++) {
+            Entry entry;
+            err = unzGetCurrentFileInfo(file, &info, 0, 0, 0, 0, 0, 0);
+            if (err == UNZ_OK && (info.compression_method == 0 || info.compression_method == Z_DEFLATED)) {
+                entry.rawPath.resize(info.size_filename);
+                err = unzGetCurrentFileInfo(file, &info, &entry.rawPath[0], info.size_filename, 0, 0, 0, 0);
+                if (err == UNZ_OK) {
+                    err = unzGetFilePos(file, &entry.position);
+                }
+            }
+            if (err != UNZ_OK || (info.compression_method != 0 && info.compression_method != Z_DEFLATED)) {
+                VPVL2_LOG(WARNING, "Cannot get current file " << entry.rawPath << " in zip: " << err);
+                error = kGetCurrentFileError;
+                break;
+            }
+            entry.uncompressedSize = info.uncompressed_size;
+            rawPath2Index.insert(std::make_pair(entry.rawPath, int(entries.size())));
+            entries.push_back(entry);
+            if (i + 1 < nentries) {
+                err = unzGoToNextFile(file);
+                if (err != UNZ_OK) {
+                    VPVL2_LOG(WARNING, "Cannot seek next current file from " << entry.rawPath << " in zip: " << err);
+                    error = kGoToNextFileError;
+                    break;
+                }
+            }
+        }
+        return err == UNZ_OK;
+    }
+    const UnicodeString &entryName(int index) const {
+        const Entry &entry = entries[index];
+        if (!entry.decoded) {
+            /* ASCII names (most of textures) don't need ICU conversion */
+            if (isASCII(entry.rawPath)) {
+                entry.name = UnicodeString::fromUTF8(entry.rawPath);
+            }
+            else {
+                const uint8 *ptr = reinterpret_cast<const uint8 *>(entry.rawPath.data());
+                if (IString *s = encodingRef->toString(ptr, entry.rawPath.size(), IString::kShiftJIS)) {
+                    entry.name = static_cast<const String *>(s)->value();
+                    delete s;
+                }
+            }
+            entry.decoded = true;
+        }
+        return entry.name;
+    }
+    int findEntryIndex(const UnicodeString &name) const {
+        const UnicodeString &key = resolvePath(name);
+        std::string rawKey;
+        return toASCII(key, rawKey) ? findRawEntryIndex(rawKey) : findUnicodeEntryIndex(key);
+    }
+    int findEntryIndex(const std::string &utf8Name) const {
+        /* ASCII names are looked up as raw bytes without converting to UnicodeString */
+        return isASCII(utf8Name) ? findRawEntryIndex(utf8Name) : findUnicodeEntryIndex(UnicodeString::fromUTF8(utf8Name));
+    }
+    int findRawEntryIndex(const std::string &key) const {
+        RawPath2IndexMap::const_iterator it = rawPath2Index.find(key);
+        return it != rawPath2Index.end() ? it->second : -1;
+    }
+    int findUnicodeEntryIndex(const UnicodeString &key) const {
+        /* decodes only names having non ASCII characters at the first lookup with them */
+        if (!unicodeIndexed) {
+            const int nentries = int(entries.size());
+            for (int i = 0; i < nentries; i++) {
+                if (!isASCII(entries[i].rawPath)) {
+                    unicodePath2Index.insert(std::make_pair(entryName(i), i));
+                }
+            }
+            unicodeIndexed = true;
+        }
+        UnicodePath2IndexMap::const_iterator it = unicodePath2Index.find(key);
+        return it != unicodePath2Index.end() ? it->second : -1;
+    }
+    bool isValidIndex(int index) const {
+        return internal::checkBound(index, 0, int(entries.size()));
+    }
+    bool uncompressEntry(int index) {
+        std::string bytes;
+        bytes.resize(entries[index].uncompressedSize);
+        if (readEntry(index, bytes.empty() ? 0 : reinterpret_cast<uint8 *>(&bytes[0]), bytes.size())) {
+            storeEntry(index, bytes);
+            return true;
+        }
+        return false;
+    }
+    bool readEntry(int index, uint8 *buffer, vsize size) {
+        const Entry &entry = entries[index];
+        unz_file_pos position = entry.position;
+        if (size < entry.uncompressedSize) {
+            VPVL2_LOG(WARNING, "Buffer is too small to read the file " << entry.rawPath << ": " << size);
             return false;
         }
-        err = unzCloseCurrentFile(file);
-        if (err != Z_OK) {
-            VPVL2_LOG(WARNING, "Cannot close the file " << String::toStdString(entry) << " in zip: " << err);
-            error = kCloseCurrentFileError;
+        int err = unzGoToFilePos(file, &position);
+        if (err != UNZ_OK) {
+            VPVL2_LOG(WARNING, "Cannot locate to the file " << entry.rawPath << " in zip: " << err);
+            error = kGetCurrentFileError;
+            return false;
+        }
+        VPVL2_VLOG(1, "filename=" << entry.rawPath << " size=" << entry.uncompressedSize);
+        Archive::ErrorType ret = readCurrentFile(file, entry.rawPath, buffer, entry.uncompressedSize);
+        if (ret != kNone) {
+            error = ret;
             return false;
         }
         return true;
     }
+    void storeEntry(int index, std::string &bytes) {
+        const UnicodeString &name = entryName(index);
+        CachedData &data = cachedEntries[name];
+        cacheSize -= data.bytes.size();
+        data.bytes.swap(bytes);
+        data.lastUsed = ++clock;
+        cacheSize += data.bytes.size();
+        evictEntries(name);
+    }
+    void evictEntries(const UnicodeString &protectedName) {
+        while (maxCacheSize > 0 && cacheSize > maxCacheSize && cachedEntries.size() > 1) {
+            EntryDataMap::iterator it = cachedEntries.begin(), lru = cachedEntries.end();
+            while (it != cachedEntries.end()) {
+                if (it->first.caseCompare(protectedName, 0) != 0 && (lru == cachedEntries.end() || it->second.lastUsed < lru->second.lastUsed)) {
+                    lru = it;
+                }
+                ++it;
+            }
+            if (lru == cachedEntries.end()) {
+                break;
+            }
+            cacheSize -= lru->second.bytes.size();
+            cachedEntries.erase(lru);
+        }
+    }
     UnicodeString resolvePath(const UnicodeString &value) const {
         return basePath.isEmpty() ? value : basePath + '/' + value;
     }
 
-    typedef std::map<UnicodeString, std::string, CaseLess> EntryDataMap;
-    typedef std::map<UnicodeString, std::string, CaseLess> UnicodePath2RawPathMap;
+    typedef std::map<UnicodeString, CachedData, CaseLess> EntryDataMap;
+    typedef std::map<std::string, int, RawCaseLess> RawPath2IndexMap;
+    typedef std::map<UnicodeString, int, CaseLess> UnicodePath2IndexMap;
     unzFile file;
     unz_global_info header;
     Archive::ErrorType error;
     const IEncoding *encodingRef;
-    EntryDataMap originalEntries;
-    UnicodePath2RawPathMap unicodePath2RawPath;
+    std::string path;
+    std::vector<Entry> entries;
+    RawPath2IndexMap rawPath2Index;
+    mutable UnicodePath2IndexMap unicodePath2Index;
+    EntryDataMap cachedEntries;
     UnicodeString basePath;
+    vsize cacheSize;
+    vsize maxCacheSize;
+    mutable uint64 clock;
+    mutable bool unicodeIndexed;
 };
 
 Archive::Archive(IEncoding *encodingRef)
@@ -127,61 +397,27 @@ Archive::~Archive()
     m_context = 0;
 }
 
-bool Archive::open(const IString *filename, EntryNames &entries)
+bool Archive::open(const IString *filename)
 {
-    m_context->file = unzOpen(reinterpret_cast<const char *>(filename->toByteArray()));
+    m_context->close();
+    m_context->path = reinterpret_cast<const char *>(filename->toByteArray());
+    m_context->file = unzOpen(m_context->path.c_str());
     if (m_context->file) {
-        unz_file_info info;
-        std::string path;
-        int err = unzGetGlobalInfo(m_context->file, &m_context->header);
-        if (err == UNZ_OK) {
-            uLong nentries = m_context->header.number_entry;
-            for (uLong i = 0; i < nentries; i++) {
-                err = unzGetCurrentFileInfo(m_context->file, &info, 0, 0, 0, 0, 0, 0);
-                if (err == UNZ_OK && (info.compression_method == 0 || info.compression_method == Z_DEFLATED)) {
-                    path.resize(info.size_filename);
-                    err = unzGetCurrentFileInfo(m_context->file, &info, &path[0], info.size_filename, 0, 0, 0, 0);
-                    if (err == UNZ_OK) {
-                        const uint8 *ptr = reinterpret_cast<const uint8 *>(path.data());
-                        IString *s = m_context->encodingRef->toString(ptr, path.size(), IString::kShiftJIS);
-                        UnicodeString value = static_cast<const String *>(s)->value();
-                        entries.push_back(value);
-                        m_context->unicodePath2RawPath.insert(std::make_pair(value, path));
-                        delete s;
-                    }
-                    else {
-                        VPVL2_LOG(WARNING, "Cannot get current file " << path << " in zip: " << err);
-                        m_context->error = kGetCurrentFileError;
-                        break;
-                    }
-                }
-                else {
-                    VPVL2_LOG(WARNING, "Cannot get current file " << path << " in zip: " << err);
-                    m_context->error = kGetCurrentFileError;
-                    break;
-                }
-                if (i + 1 < nentries) {
-                    err = unzGoToNextFile(m_context->file);
-                    if (err != UNZ_OK) {
-                        VPVL2_LOG(WARNING, "Cannot seek next current file from " << path << " in zip: " << err);
-                        m_context->error = kGoToNextFileError;
-                        break;
-                    }
-                }
-            }
-            if (err == Z_OK) {
-                err = unzGoToFirstFile(m_context->file);
-                if (err != Z_OK) {
-                    VPVL2_LOG(WARNING, "Cannot seek to the first file in zip: " << err);
-                    m_context->error = kGoToFirstFileError;
-                }
-            }
-        }
-        return err == Z_OK;
+        return m_context->buildIndex();
     }
     return false;
 }
 
+bool Archive::open(const IString *filename, EntryNames &entries)
+{
+    bool ok = open(filename);
+    const int nentries = int(m_context->entries.size());
+    for (int i = 0; i < nentries; i++) {
+        entries.push_back(m_context->entryName(i));
+    }
+    return ok;
+}
+
 bool Archive::close()
 {
     return m_context->close();
@@ -192,72 +428,121 @@ bool Archive::uncompress(const EntrySet &entries)
     if (m_context->file == 0) {
         return false;
     }
-    unz_file_info info;
-    std::string filename, entry;
-    uLong nentries = m_context->header.number_entry;
-    int err = Z_OK;
-    for (uLong i = 0; i < nentries; i++) {
-        err = unzGetCurrentFileInfo(m_context->file, &info, 0, 0, 0, 0, 0, 0);
-        if (err == UNZ_OK && (info.compression_method == 0 || info.compression_method == Z_DEFLATED)) {
-            filename.resize(info.size_filename);
-            err = unzGetCurrentFileInfo(m_context->file, &info, &filename[0], info.size_filename, 0, 0, 0, 0);
-            if (err == UNZ_OK) {
-                const uint8 *ptr = reinterpret_cast<const uint8 *>(filename.data());
-                if (IString *name = m_context->encodingRef->toString(ptr, filename.size(), IString::kShiftJIS)) {
-                    /* normalize filename with lower */
-                    entry.assign(String::toStdString(static_cast<const String *>(name)->value().toLower()));
-                    delete name;
-                }
-                if (entries.find(entry) != entries.end() && !m_context->uncompressEntry(UnicodeString::fromUTF8(entry), info)) {
-                    return false;
-                }
-            }
-            else {
-                m_context->error = kGetCurrentFileError;
-                break;
-            }
+    /* requested names are already lower case and looked up case insensitive */
+    Array<int> indices;
+    for (EntrySet::const_iterator it = entries.begin(); it != entries.end(); ++it) {
+        const int index = m_context->findEntryIndex(*it);
+        if (index >= 0) {
+            indices.append(index);
         }
-        else {
-            m_context->error = kGetCurrentFileError;
-            break;
+    }
+    indices.sort(PrivateContext::IndexLess());
+    const int nindices = indices.count();
+    if (nindices > 1) {
+        const int ntasks = btMin(nindices, btMax(internal::Thread::countProcessors(), 1));
+        PointerArray<PrivateContext::UncompressTask> tasks;
+        for (int i = 0; i < ntasks; i++) {
+            tasks.append(new PrivateContext::UncompressTask(m_context->path, m_context->entries));
         }
-        if (i + 1 < nentries) {
-            err = unzGoToNextFile(m_context->file);
-            if (err != UNZ_OK) {
-                VPVL2_LOG(WARNING, "Cannot seek next current file in zip: " << err);
-                m_context->error = kGoToNextFileError;
-                break;
+        for (int i = 0; i < nindices; i++) {
+            tasks[i % ntasks]->addEntry(indices[i]);
+        }
+        internal::ParallelTaskProcessor<PrivateContext::UncompressTask> processor(&tasks);
+        processor.execute();
+        bool ok = true;
+        /* entries are stored in the order of the archive as the serial path does */
+        for (int i = 0; i < nindices && ok; i++) {
+            PrivateContext::UncompressTask *task = tasks[i % ntasks];
+            const int slot = i / ntasks, index = indices[i];
+            std::string &bytes = task->bytes[slot];
+            /* retry with the opened handle in case that the file cannot be opened again (e.g. removed) */
+            if (task->errors[slot] != kNone) {
+                ok = m_context->readEntry(index, bytes.empty() ? 0 : reinterpret_cast<uint8 *>(&bytes[0]), bytes.size());
+            }
+            if (ok) {
+                m_context->storeEntry(index, bytes);
             }
         }
+        tasks.releaseAll();
+        return ok;
     }
-    if (err == Z_OK) {
-        err = unzGoToFirstFile(m_context->file);
-        if (err != Z_OK) {
-            VPVL2_LOG(WARNING, "Cannot seek to the first file in zip: " << err);
-            m_context->error = kGoToFirstFileError;
-        }
+    else if (nindices == 1) {
+        return m_context->uncompressEntry(indices[0]);
     }
-    return err == Z_OK;
+    return true;
 }
 
 bool Archive::uncompressEntry(const UnicodeString &name)
 {
-    const UnicodeString &key = m_context->resolvePath(name);
-    PrivateContext::UnicodePath2RawPathMap::const_iterator it = m_context->unicodePath2RawPath.find(key);
-    bool ok = false;
-    if (it != m_context->unicodePath2RawPath.end()) {
-        int err = unzLocateFile(m_context->file, it->second.c_str(), 1);
-        if (err == Z_OK) {
-            unz_file_info finfo;
-            unzGetCurrentFileInfo(m_context->file, &finfo, 0, 0, 0, 0, 0, 0);
-            ok = m_context->uncompressEntry(it->first, finfo);
-            unzGoToFirstFile(m_context->file);
+    const int index = m_context->findEntryIndex(name);
+    if (index >= 0) {
+        return m_context->uncompressEntry(index);
+    }
+    VPVL2_LOG(WARNING, "Cannot locate to the file " << String::toStdString(name) << " in zip");
+    return false;
+}
+
+bool Archive::uncompressEntry(int index)
+{
+    return m_context->isValidIndex(index) && m_context->uncompressEntry(index);
+}
+
+int Archive::countEntries() const
+{
+    return int(m_context->entries.size());
+}
+
+UnicodeString Archive::entryName(int index) const
+{
+    return m_context->isValidIndex(index) ? m_context->entryName(index) : UnicodeString();
+}
+
+bool Archive::entryEndsWith(int index, const UnicodeString &suffix) const
+{
+    if (!m_context->isValidIndex(index)) {
+        return false;
+    }
+    std::string rawSuffix;
+    if (PrivateContext::toASCII(suffix, rawSuffix)) {
+        /* an ASCII suffix is compared with raw bytes as '.' never appears in trail bytes of Shift-JIS */
+        const std::string &rawPath = m_context->entries[index].rawPath;
+        const vsize size = rawSuffix.size();
+        if (rawPath.size() < size) {
+            return false;
         }
-        else {
-            VPVL2_LOG(WARNING, "Cannot locate to the file << " << String::toStdString(name) << " in zip: " << err);
+        const vsize offset = rawPath.size() - size;
+        for (vsize i = 0; i < size; i++) {
+            if (PrivateContext::RawCaseLess::toLower(rawPath[offset + i]) != PrivateContext::RawCaseLess::toLower(rawSuffix[i])) {
+                return false;
+            }
         }
+        return true;
     }
-    return ok;
+    return m_context->entryName(index).endsWith(suffix);
+}
+
+bool Archive::getEntrySize(const UnicodeString &name, vsize &size) const
+{
+    const int index = m_context->findEntryIndex(name);
+    size = index >= 0 ? m_context->entries[index].uncompressedSize : 0;
+    return index >= 0;
+}
+
+bool Archive::readEntry(const UnicodeString &name, uint8 *buffer, vsize size)
+{
+    const int index = m_context->findEntryIndex(name);
+    return index >= 0 && m_context->readEntry(index, buffer, size);
+}
+
+bool Archive::readEntry(const UnicodeString &name, std::string &buffer)
+{
+    const int index = m_context->findEntryIndex(name);
+    if (index >= 0) {
+        /* reuses capacity of the buffer if it's large enough */
+        buffer.resize(m_context->entries[index].uncompressedSize);
+        return m_context->readEntry(index, buffer.empty() ? 0 : reinterpret_cast<uint8 *>(&buffer[0]), buffer.size());
+    }
+    return false;
 }
 
 void Archive::setBasePath(const UnicodeString &value)
@@ -265,6 +550,22 @@ void Archive::setBasePath(const UnicodeString &value)
     m_context->basePath = value;
 }
 
+vsize Archive::maxCacheSize() const
+{
+    return m_context->maxCacheSize;
+}
+
+vsize Archive::cacheSize() const
+{
+    return m_context->cacheSize;
+}
+
+void Archive::setMaxCacheSize(vsize value)
+{
+    m_context->maxCacheSize = value;
+    m_context->evictEntries(UnicodeString());
+}
+
 Archive::ErrorType Archive::error() const
 {
     return m_context->error;
@@ -272,9 +573,9 @@ Archive::ErrorType Archive::error() const
 
 const Archive::EntryNames Archive::entryNames() const
 {
-    PrivateContext::EntryDataMap::const_iterator it = m_context->originalEntries.begin();
+    PrivateContext::EntryDataMap::const_iterator it = m_context->cachedEntries.begin();
     EntryNames names;
-    while (it != m_context->originalEntries.end()) {
+    while (it != m_context->cachedEntries.end()) {
         names.push_back(it->first);
         ++it;
     }
@@ -283,8 +584,12 @@ const Archive::EntryNames Archive::entryNames() const
 
 const std::string *Archive::dataRef(const UnicodeString &name) const
 {
-    PrivateContext::EntryDataMap::const_iterator it = m_context->originalEntries.find(m_context->resolvePath(name));
-    return it != m_context->originalEntries.end() ? &it->second : 0;
+    PrivateContext::EntryDataMap::const_iterator it = m_context->cachedEntries.find(m_context->resolvePath(name));
+    if (it != m_context->cachedEntries.end()) {
+        it->second.lastUsed = ++m_context->clock;
+        return &it->second.bytes;
+    }
+    return 0;
 }
 
 } /* namespace extensions */
@@ -39,7 +39,11 @@
 
 /* libvpvl2 */
 #include <vpvl2/vpvl2.h>
+#include <vpvl2/internal/BlockCompressor.h>
+#include <vpvl2/internal/Profiler.h>
+#include <vpvl2/internal/Thread.h>
 #include <vpvl2/internal/util.h>
+#include <vpvl2/internal/WorkerPool.h>
 #include <vpvl2/extensions/Archive.h>
 #include <vpvl2/extensions/fx/Util.h>
 #include <vpvl2/extensions/gl/FrameBufferObject.h>
@@ -52,11 +56,19 @@
 #endif
 
 /* STL */
+#include <cerrno>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <sstream>
 #include <set>
 
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
 #ifdef __clang__
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wself-assign"
@@ -139,6 +151,136 @@ static inline const char *DebugMessageTypeToString(GLenum value)
     }
 }
 
+static inline const char *ProfileTypeToString(int value)
+{
+    switch (value) {
+    case IApplicationContext::kProfileUploadModelProcess:
+        return "UploadModel";
+    case IApplicationContext::kProfileRenderModelProcess:
+        return "RenderModel";
+    case IApplicationContext::kProfileRenderModelMaterialDrawCall:
+        return "RenderModelMaterial";
+    case IApplicationContext::kProfileRenderEdgeProcess:
+        return "RenderEdge";
+    case IApplicationContext::kProfileRenderEdgeMateiralDrawCall:
+        return "RenderEdgeMaterial";
+    case IApplicationContext::kProfileRenderShadowProcess:
+        return "RenderShadow";
+    case IApplicationContext::kProfileRenderShadowMaterialDrawCall:
+        return "RenderShadowMaterial";
+    case IApplicationContext::kProfileRenderZPlotProcess:
+        return "RenderZPlot";
+    case IApplicationContext::kProfileRenderZPlotMaterialDrawCall:
+        return "RenderZPlotMaterial";
+    case IApplicationContext::kProfileUpdateModelProcess:
+        return "UpdateModel";
+    case IApplicationContext::kProfileSeekMotionProcess:
+        return "SeekMotion";
+    case IApplicationContext::kProfileUpdateMorphProcess:
+        return "UpdateMorph";
+    case IApplicationContext::kProfileSolveInverseKinematicsProcess:
+        return "SolveInverseKinematics";
+    case IApplicationContext::kProfileStepPhysicsProcess:
+        return "StepPhysics";
+    case IApplicationContext::kProfileSkinningModelProcess:
+        return "SkinningModel";
+    default:
+        return "Unknown";
+    }
+}
+
+static void WriteJSONString(std::ostream &stream, const std::string &value)
+{
+    stream << '"';
+    const vsize length = value.size();
+    for (vsize i = 0; i < length; i++) {
+        const char c = value[i];
+        switch (c) {
+        case '"':
+            stream << "\\\"";
+            break;
+        case '\\':
+            stream << "\\\\";
+            break;
+        case '\n':
+            stream << "\\n";
+            break;
+        case '\r':
+            stream << "\\r";
+            break;
+        case '\t':
+            stream << "\\t";
+            break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                char escaped[8];
+                internal::snprintf(escaped, sizeof(escaped), "\\u%04x", int(c));
+                stream << escaped;
+            }
+            else {
+                stream << c;
+            }
+            break;
+        }
+    }
+    stream << '"';
+}
+
+static void WriteJSONPointer(std::ostream &stream, const void *value)
+{
+    char buffer[32];
+    internal::snprintf(buffer, sizeof(buffer), "\"%p\"", value);
+    stream << buffer;
+}
+
+static void CollectProfileNames(const Scene *sceneRef, std::map<const void *, std::string> &names)
+{
+    /* only objects still alive in the scene are named as spans may refer deleted objects */
+    if (!sceneRef) {
+        return;
+    }
+    Array<IModel *> models;
+    Array<IMaterial *> materials;
+    sceneRef->getModelRefs(models);
+    const int nmodels = models.count();
+    for (int i = 0; i < nmodels; i++) {
+        const IModel *model = models[i];
+        const IString *modelName = model->name(IEncoding::kDefaultLanguage);
+        const std::string &prefix = modelName ? String::toStdString(static_cast<const String *>(modelName)->value()) : std::string();
+        names[model] = prefix;
+        model->getMaterialRefs(materials);
+        const int nmaterials = materials.count();
+        for (int j = 0; j < nmaterials; j++) {
+            const IMaterial *material = materials[j];
+            const IString *materialName = material->name(IEncoding::kDefaultLanguage);
+            names[material] = prefix + "/" + (materialName ? String::toStdString(static_cast<const String *>(materialName)->value()) : std::string());
+        }
+    }
+    Array<IMotion *> motions;
+    sceneRef->getMotionRefs(motions);
+    const int nmotions = motions.count();
+    for (int i = 0; i < nmotions; i++) {
+        const IMotion *motion = motions[i];
+        if (const IString *motionName = motion->name()) {
+            names[motion] = String::toStdString(static_cast<const String *>(motionName)->value());
+        }
+    }
+}
+
+static bool DecodeToonColor(const uint8 *data, vsize size, Color &value)
+{
+    int x = 0, y = 0, ncomponents = 0;
+    if (stbi_uc *ptr = stbi_load_from_memory(data, int(size), &x, &y, &ncomponents, 4)) {
+        /* the bottom right pixel of the toon texture is the shadow color as MMD does */
+        const stbi_uc *pixel = ptr + (vsize(y - 1) * x + (x - 1)) * 4;
+        static const Scalar den = 255.0;
+        value.setValue(pixel[0] / den, pixel[1] / den, pixel[2] / den, pixel[3] / den);
+        stbi_image_free(ptr);
+        return true;
+    }
+    return false;
+}
+
 } /* namespace anonymous */
 
 #ifndef VPVL2_LINK_GLOG
@@ -163,7 +305,8 @@ using namespace icu4c;
 BaseApplicationContext::ModelContext::ModelContext(BaseApplicationContext *applicationContextRef, vpvl2::extensions::Archive *archiveRef, const IString *directory)
     : m_directoryRef(directory),
       m_archiveRef(archiveRef),
-      m_applicationContextRef(applicationContextRef)
+      m_applicationContextRef(applicationContextRef),
+      m_textureCacheRef(applicationContextRef ? applicationContextRef->textureCacheRef() : 0)
 {
 }
 
@@ -171,6 +314,7 @@ BaseApplicationContext::ModelContext::~ModelContext()
 {
     m_archiveRef = 0;
     m_applicationContextRef = 0;
+    m_textureCacheRef = 0;
     m_directoryRef = 0;
 }
 
@@ -214,6 +358,68 @@ int BaseApplicationContext::ModelContext::countCachedTextures() const
     return m_textureRefCache.size();
 }
 
+TextureCache::Key BaseApplicationContext::ModelContext::createSharedTextureKey(const uint8 *data, vsize size, const TextureDataBridge &bridge)
+{
+    return TextureCache::createKey(data, size, sharedTextureFlags(bridge));
+}
+
+bool BaseApplicationContext::ModelContext::findSharedTexture(const UnicodeString &path, TextureDataBridge &bridge)
+{
+    if (m_textureCacheRef) {
+        if (ITexture *textureRef = m_textureCacheRef->find(String::toStdString(path), sharedTextureFlags(bridge))) {
+            VPVL2_VLOG(2, String::toStdString(path) << " is shared with other model: ID=" << textureRef->data());
+            bridge.dataRef = textureRef;
+            addTextureCache(path, textureRef);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool BaseApplicationContext::ModelContext::findSharedTexture(const TextureCache::Key &contentKey,
+                                                             const UnicodeString &key,
+                                                             const UnicodeString &path,
+                                                             TextureDataBridge &bridge)
+{
+    if (m_textureCacheRef) {
+        if (ITexture *textureRef = m_textureCacheRef->find(contentKey, String::toStdString(path))) {
+            VPVL2_VLOG(2, String::toStdString(key) << " has the same content with the shared texture: ID=" << textureRef->data());
+            bridge.dataRef = textureRef;
+            addTextureCache(key, textureRef);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool BaseApplicationContext::ModelContext::shareTexture(const TextureCache::Key &contentKey,
+                                                        const UnicodeString &key,
+                                                        const UnicodeString &path,
+                                                        TextureDataBridge &bridge)
+{
+    ITexture *texturePtr = bridge.dataRef;
+    if (!m_textureCacheRef || !texturePtr) {
+        return texturePtr != 0;
+    }
+    const vsize bytes = TextureCache::estimateBytes(texturePtr->size(), internal::hasFlagBits(bridge.flags, IApplicationContext::kGenerateTextureMipmap));
+    /* the cache takes ownership of the texture and the model uses the shared reference instead */
+    ITexture *textureRef = m_textureCacheRef->insert(contentKey, String::toStdString(path), texturePtr, bytes);
+    for (TextureCacheMap::iterator it = m_textureRefCache.begin(); it != m_textureRefCache.end(); ++it) {
+        if (it->second == texturePtr) {
+            it->second = textureRef;
+        }
+    }
+    m_textureRefCache[key] = textureRef;
+    bridge.dataRef = textureRef;
+    return textureRef != 0;
+}
+
+int BaseApplicationContext::ModelContext::sharedTextureFlags(const TextureDataBridge &bridge)
+{
+    /* both flags change the texture object itself (mipmap levels and wrap mode) */
+    return bridge.flags & (IApplicationContext::kToonTexture | IApplicationContext::kGenerateTextureMipmap);
+}
+
 ITexture *BaseApplicationContext::ModelContext::uploadTexture(const void *ptr,
                                                               const BaseSurface::Format &format,
                                                               const Vector3 &size,
@@ -322,7 +528,7 @@ bool BaseApplicationContext::ModelContext::uploadTextureCached(const UnicodeStri
     MapBuffer buffer(m_applicationContextRef);
     /* Loading major image format (BMP/JPG/PNG/TGA/DDS) texture with stb_image.c */
     if (m_applicationContextRef->mapFile(path, &buffer)) {
-        texturePtr = uploadTexture(buffer.address, buffer.size, internal::hasFlagBits(bridge.flags, IApplicationContext::kGenerateTextureMipmap));
+        texturePtr = createTexture(buffer.address, buffer.size, bridge);
         if (!texturePtr) {
             VPVL2_LOG(WARNING, "Cannot load texture from " << String::toStdString(path) << ": " << stbi_failure_reason());
             return false;
@@ -337,7 +543,7 @@ bool BaseApplicationContext::ModelContext::uploadTextureCached(const uint8 *data
         VPVL2_VLOG(2, String::toStdString(key) << " is already cached, skipped.");
         return true;
     }
-    ITexture *texturePtr = uploadTexture(data, size, internal::hasFlagBits(bridge.flags, IApplicationContext::kGenerateTextureMipmap));
+    ITexture *texturePtr = createTexture(data, size, bridge);
     if (!texturePtr) {
         VPVL2_LOG(WARNING, "Cannot load texture with key " << String::toStdString(key) << ": " << stbi_failure_reason());
         return false;
@@ -345,6 +551,632 @@ bool BaseApplicationContext::ModelContext::uploadTextureCached(const uint8 *data
     return cacheTexture(key, texturePtr, bridge);
 }
 
+class BaseApplicationContext::TextureLoader {
+public:
+    enum Compression {
+        kNoCompression,
+        kAutoCompression,
+        kBC1Compression,
+        kBC3Compression
+    };
+    class ImageTexture;
+    struct Image {
+        Image()
+            : bufferPtr(0),
+              bytesRef(0),
+              nbytes(0),
+              compressed(false)
+        {
+        }
+        ~Image() {
+            delete bufferPtr;
+            bufferPtr = 0;
+            bytesRef = 0;
+        }
+        void setPixels() {
+            bytesRef = &pixels[0];
+            nbytes = pixels.size();
+        }
+        /* the memory mapped cache file or the decoded pixels */
+        MapBuffer *bufferPtr;
+        std::vector<uint8> pixels;
+        const uint8 *bytesRef;
+        vsize nbytes;
+        std::vector<vsize> offsets;
+        BaseSurface::Format format;
+        Vector3 size;
+        bool compressed;
+    };
+    struct Job {
+        Job(const uint8 *data, vsize size, int flags)
+            : textureRef(0),
+              bytes(data, data + size),
+              flags(flags),
+              ok(false)
+        {
+        }
+        ~Job() {
+            textureRef = 0;
+        }
+        ImageTexture *textureRef;
+        std::vector<uint8> bytes;
+        Image image;
+        int flags;
+        bool ok;
+    };
+    class ImageTexture : public Texture2D {
+    public:
+        ImageTexture(Job *jobRef)
+            : Texture2D(BaseSurface::Format(GL_RGBA, GL_RGBA8, GL_UNSIGNED_BYTE, GL_TEXTURE_2D), Vector3(1, 1, 1), 0),
+              m_jobRef(jobRef)
+        {
+        }
+        ~ImageTexture() {
+            /* the texture may be deleted by the render engine before the upload */
+            if (m_jobRef) {
+                m_jobRef->textureRef = 0;
+                m_jobRef = 0;
+            }
+        }
+
+        void createPlaceholder() {
+            static const uint8 kWhitePixel[] = { 0xff, 0xff, 0xff, 0xff };
+            create();
+            bind();
+            glTexSubImage2D(m_format.target, 0, 0, 0, 1, 1, m_format.external, m_format.type, kWhitePixel);
+            unbind();
+        }
+        void upload(const Image &image) {
+            const int nlevels = int(image.offsets.size());
+            const BaseSurface::Format &format = image.format;
+            bind();
+            for (int i = 0; i < nlevels; i++) {
+                const GLsizei width = btMax(GLsizei(image.size.x()) >> i, 1), height = btMax(GLsizei(image.size.y()) >> i, 1);
+                const vsize offset = image.offsets[i], end = i + 1 < nlevels ? image.offsets[i + 1] : image.nbytes;
+                if (image.compressed) {
+                    glCompressedTexImage2D(m_format.target, i, format.internal, width, height, 0, GLsizei(end - offset), image.bytesRef + offset);
+                }
+                else {
+                    glTexImage2D(m_format.target, i, format.internal, width, height, 0, format.external, format.type, image.bytesRef + offset);
+                }
+            }
+            unbind();
+            m_format.internal = format.internal;
+            m_format.external = format.external;
+            m_format.type = format.type;
+            m_size = image.size;
+        }
+        void detach() {
+            m_jobRef = 0;
+        }
+
+    private:
+        Job *m_jobRef;
+    };
+
+    TextureLoader(const BaseApplicationContext *applicationContextRef, TextureCache *textureCacheRef, int nthreads, int capacity)
+        : m_applicationContextRef(applicationContextRef),
+          m_textureCacheRef(textureCacheRef),
+          m_pool(0),
+          m_queue(capacity),
+          m_compression(kNoCompression)
+    {
+        if (nthreads >= 0) {
+            m_pool = new internal::WorkerPool(nthreads);
+            VPVL2_VLOG(1, "Started texture decoder threads: nthreads=" << m_pool->countThreads() << " capacity=" << capacity);
+        }
+    }
+    ~TextureLoader() {
+        /* wake up workers waiting for the full queue before joining them */
+        m_queue.close();
+        delete m_pool;
+        m_pool = 0;
+        const int njobs = m_jobs.count();
+        for (int i = 0; i < njobs; i++) {
+            Job *job = m_jobs[i];
+            if (ImageTexture *textureRef = job->textureRef) {
+                textureRef->detach();
+            }
+        }
+        m_jobs.releaseAll();
+        m_applicationContextRef = 0;
+        m_textureCacheRef = 0;
+    }
+
+    void setDiskCache(const UnicodeString &directory, Compression compression) {
+        m_cacheDirectory = String::toStdString(directory);
+        m_compression = compression;
+#ifdef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+        if (!GLEW_EXT_texture_compression_s3tc) {
+            m_compression = kNoCompression;
+        }
+#else
+        m_compression = kNoCompression;
+#endif
+        if (!makeDirectory(m_cacheDirectory)) {
+            VPVL2_LOG(WARNING, "Cannot create the texture cache directory and disabled the disk cache: " << m_cacheDirectory);
+            m_cacheDirectory.clear();
+            return;
+        }
+        VPVL2_VLOG(1, "Enabled texture disk cache: directory=" << m_cacheDirectory << " compression=" << m_compression);
+    }
+    ITexture *load(const uint8 *data, vsize size, int flags) {
+        Job *job = m_jobs.append(new Job(data, size, flags));
+        ImageTexture *texture = new ImageTexture(job);
+        texture->createPlaceholder();
+        job->textureRef = texture;
+        if (m_pool && m_pool->countThreads() > 0 && internal::hasFlagBits(flags, IApplicationContext::kAsyncLoadingTexture)) {
+            m_pool->enqueue(new DecodeTask(this, job));
+        }
+        else {
+            /* the bounded queue would block the GL thread if no worker is available */
+            execute(job);
+            if (!job->ok) {
+                job->textureRef = 0;
+                texture->detach();
+                delete texture;
+                texture = 0;
+            }
+            complete(job);
+        }
+        return texture;
+    }
+    int upload(int64 budget) {
+        internal::ElapsedTimer timer;
+        Job *job = 0;
+        int nuploaded = 0;
+        /* upload at least one texture per call to make progress even if the budget is too small */
+        while (m_jobs.count() > 0 && (nuploaded == 0 || timer.elapsed() < budget) && m_queue.tryPop(job)) {
+            complete(job);
+            nuploaded++;
+        }
+        return m_jobs.count();
+    }
+    void wait() {
+        Job *job = 0;
+        while (m_jobs.count() > 0 && m_queue.pop(job)) {
+            complete(job);
+        }
+    }
+    int countPendingTextures() const {
+        return m_jobs.count();
+    }
+
+private:
+    static const uint32 kCacheVersion = 2;
+    /* larger than GL_MAX_TEXTURE_SIZE of any implementation to reject broken headers */
+    static const uint32 kMaxCacheTextureSize = 65536;
+    struct CacheHeader {
+        uint8 signature[4];
+        uint32 version;
+        uint64 hash;
+        uint64 size;
+        uint32 flags;
+        uint32 width;
+        uint32 height;
+        uint32 nlevels;
+        uint32 internal;
+        uint32 external;
+        uint32 type;
+        uint32 compressed;
+        uint32 compression;
+    };
+    class DecodeTask : public internal::WorkerPool::ITask {
+    public:
+        DecodeTask(TextureLoader *loaderRef, Job *jobRef)
+            : m_loaderRef(loaderRef),
+              m_jobRef(jobRef)
+        {
+        }
+        ~DecodeTask() {
+            m_loaderRef = 0;
+            m_jobRef = 0;
+        }
+        void execute() {
+            m_loaderRef->execute(m_jobRef);
+            /* blocks while the GL thread has not consumed decoded textures yet */
+            m_loaderRef->m_queue.push(m_jobRef);
+        }
+
+    private:
+        TextureLoader *m_loaderRef;
+        Job *m_jobRef;
+    };
+
+    static bool decode(const uint8 *data, vsize size, bool mipmap, Image &image) {
+        int x = 0, y = 0, ncomponents = 0;
+#ifdef VPVL2_LINK_FREEIMAGE
+        FIMEMORY *memory = FreeImage_OpenMemory(const_cast<uint8_t *>(data), size);
+        FREE_IMAGE_FORMAT format = FreeImage_GetFileTypeFromMemory(memory);
+        if (format != FIF_UNKNOWN) {
+            if (FIBITMAP *bitmap = FreeImage_LoadFromMemory(format, memory)) {
+                if (FIBITMAP *bitmap32 = FreeImage_ConvertTo32Bits(bitmap)) {
+                    FreeImage_FlipVertical(bitmap32);
+                    const int width = FreeImage_GetWidth(bitmap32), height = FreeImage_GetHeight(bitmap32), pitch = FreeImage_GetPitch(bitmap32);
+                    const uint8 *bits = FreeImage_GetBits(bitmap32);
+                    image.pixels.resize(vsize(width) * height * 4);
+                    for (int i = 0; i < height; i++) {
+                        memcpy(&image.pixels[vsize(i) * width * 4], bits + i * pitch, vsize(width) * 4);
+                    }
+                    image.format = BaseSurface::Format(GL_BGRA, GL_RGBA8, GL_UNSIGNED_INT_8_8_8_8_REV, GL_TEXTURE_2D);
+                    image.size.setValue(Scalar(width), Scalar(height), 1);
+                    FreeImage_Unload(bitmap32);
+                }
+                FreeImage_Unload(bitmap);
+            }
+        }
+        FreeImage_CloseMemory(memory);
+        if (!image.pixels.empty()) {
+            generateMipmaps(mipmap, image);
+            return true;
+        }
+#endif
+        /* Loading major image format (BMP/JPG/PNG/TGA/DDS) texture with stb_image.c */
+        if (stbi_uc *ptr = stbi_load_from_memory(data, size, &x, &y, &ncomponents, 4)) {
+            image.pixels.assign(ptr, ptr + vsize(x) * y * 4);
+            image.format = BaseSurface::Format(GL_RGBA, GL_RGBA8, GL_UNSIGNED_INT_8_8_8_8_REV, GL_TEXTURE_2D);
+            image.size.setValue(Scalar(x), Scalar(y), 1);
+            stbi_image_free(ptr);
+            generateMipmaps(mipmap, image);
+            return true;
+        }
+        return false;
+    }
+    static void generateMipmaps(bool mipmap, Image &image) {
+        int width = int(image.size.x()), height = int(image.size.y());
+        image.offsets.push_back(0);
+        if (!mipmap) {
+            image.setPixels();
+            return;
+        }
+        /* 2x2 box filter per channel, the channel order does not matter */
+        while (width > 1 || height > 1) {
+            const int newWidth = btMax(width >> 1, 1), newHeight = btMax(height >> 1, 1);
+            const vsize source = image.offsets.back(), dest = image.pixels.size();
+            image.pixels.resize(dest + vsize(newWidth) * newHeight * 4);
+            for (int y = 0; y < newHeight; y++) {
+                const int y0 = btMin(y * 2, height - 1), y1 = btMin(y * 2 + 1, height - 1);
+                for (int x = 0; x < newWidth; x++) {
+                    const int x0 = btMin(x * 2, width - 1), x1 = btMin(x * 2 + 1, width - 1);
+                    const uint8 *p00 = &image.pixels[source + (vsize(y0) * width + x0) * 4];
+                    const uint8 *p01 = &image.pixels[source + (vsize(y0) * width + x1) * 4];
+                    const uint8 *p10 = &image.pixels[source + (vsize(y1) * width + x0) * 4];
+                    const uint8 *p11 = &image.pixels[source + (vsize(y1) * width + x1) * 4];
+                    uint8 *output = &image.pixels[dest + (vsize(y) * newWidth + x) * 4];
+                    for (int c = 0; c < 4; c++) {
+                        output[c] = uint8((int(p00[c]) + p01[c] + p10[c] + p11[c] + 2) >> 2);
+                    }
+                }
+            }
+            image.offsets.push_back(dest);
+            width = newWidth;
+            height = newHeight;
+        }
+        image.setPixels();
+    }
+    void compress(int flags, Image &image) const {
+#ifdef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+        /* toon textures are small gradients and block compression causes visible banding */
+        if (m_compression == kNoCompression || internal::hasFlagBits(flags, IApplicationContext::kToonTexture)) {
+            return;
+        }
+        const int width = int(image.size.x()), height = int(image.size.y());
+        const bool alpha = m_compression == kBC3Compression
+                || (m_compression == kAutoCompression && internal::BlockCompressor::hasTransparentPixels(&image.pixels[0], width, height));
+        const bool bgra = image.format.external == GL_BGRA;
+        const int nlevels = int(image.offsets.size());
+        std::vector<uint8> compressed;
+        std::vector<vsize> offsets;
+        for (int i = 0; i < nlevels; i++) {
+            const int levelWidth = btMax(width >> i, 1), levelHeight = btMax(height >> i, 1);
+            const vsize offset = compressed.size();
+            compressed.resize(offset + internal::BlockCompressor::compressedSize(levelWidth, levelHeight, alpha));
+            internal::BlockCompressor::compress(&image.pixels[image.offsets[i]], levelWidth, levelHeight, alpha, bgra, &compressed[offset]);
+            offsets.push_back(offset);
+        }
+        image.pixels.swap(compressed);
+        image.offsets.swap(offsets);
+        image.format = BaseSurface::Format(0, alpha ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT, 0, GL_TEXTURE_2D);
+        image.compressed = true;
+        image.setPixels();
+#else
+        (void) flags;
+        (void) image;
+#endif
+    }
+    static bool makeDirectory(const std::string &path) {
+        /* creates parent directories first like "mkdir -p" */
+        std::string::size_type offset = 0;
+        while (offset != std::string::npos) {
+            offset = path.find_first_of("/\\", offset + 1);
+            const std::string &directory = path.substr(0, offset);
+            /* skips the drive letter such as "C:" */
+            if (directory.empty() || directory[directory.size() - 1] == ':') {
+                continue;
+            }
+#ifdef _WIN32
+            int ret = _mkdir(directory.c_str());
+#else
+            int ret = mkdir(directory.c_str(), 0755);
+#endif
+            if (ret != 0 && errno != EEXIST) {
+                return false;
+            }
+        }
+        return true;
+    }
+    static vsize cacheLevelSize(const CacheHeader &header, int level) {
+        const int width = btMax(int(header.width) >> level, 1), height = btMax(int(header.height) >> level, 1);
+        if (header.compressed) {
+#ifdef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+            return internal::BlockCompressor::compressedSize(width, height, header.internal == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT);
+#else
+            return 0;
+#endif
+        }
+        return vsize(width) * vsize(height) * 4;
+    }
+    static bool isValidCacheFormat(const CacheHeader &header) {
+        if (header.compressed) {
+#ifdef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+            return header.internal == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT || header.internal == GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+#else
+            return false;
+#endif
+        }
+        return header.internal == GL_RGBA8;
+    }
+    std::string cachePath(const TextureCache::Key &key) const {
+        char name[80];
+        internal::snprintf(name, sizeof(name), "%016llx-%llx-%x-%d.vptc", static_cast<unsigned long long>(key.hash),
+                           static_cast<unsigned long long>(key.size), key.flags, int(m_compression));
+        return m_cacheDirectory + "/" + name;
+    }
+    bool readCache(const TextureCache::Key &key, Image &image) const {
+        const std::string &path = cachePath(key);
+        MapBuffer *buffer = new MapBuffer(m_applicationContextRef);
+        if (!m_applicationContextRef->existsFile(UnicodeString::fromUTF8(path)) || !m_applicationContextRef->mapFile(UnicodeString::fromUTF8(path), buffer)) {
+            delete buffer;
+            return false;
+        }
+        CacheHeader header;
+        const vsize headerSize = sizeof(header);
+        bool ok = buffer->size >= headerSize;
+        if (ok) {
+            memcpy(&header, buffer->address, headerSize);
+            ok = memcmp(header.signature, "VPTC", sizeof(header.signature)) == 0 && header.version == kCacheVersion
+                    && header.hash == key.hash && header.size == key.size && int(header.flags) == key.flags
+                    && header.compression == uint32(m_compression) && isValidCacheFormat(header)
+                    && header.width > 0 && header.width <= kMaxCacheTextureSize
+                    && header.height > 0 && header.height <= kMaxCacheTextureSize
+                    && header.nlevels > 0 && header.nlevels <= 32 && (btMax(header.width, header.height) >> (header.nlevels - 1)) > 0
+                    && buffer->size >= headerSize + header.nlevels * sizeof(uint64);
+        }
+        if (ok) {
+            const vsize offsetsSize = header.nlevels * sizeof(uint64);
+            image.bytesRef = buffer->address + headerSize + offsetsSize;
+            image.nbytes = buffer->size - headerSize - offsetsSize;
+            /* levels are packed without gaps so each offset must match sizes of the previous levels */
+            vsize expectedOffset = 0;
+            for (uint32 i = 0; i < header.nlevels && ok; i++) {
+                uint64 offset = 0;
+                memcpy(&offset, buffer->address + headerSize + i * sizeof(offset), sizeof(offset));
+                ok = offset == expectedOffset;
+                expectedOffset += cacheLevelSize(header, int(i));
+                image.offsets.push_back(vsize(offset));
+            }
+            ok = ok && expectedOffset == image.nbytes;
+            image.format = BaseSurface::Format(header.external, header.internal, header.type, GL_TEXTURE_2D);
+            image.size.setValue(Scalar(header.width), Scalar(header.height), 1);
+            image.compressed = header.compressed != 0;
+        }
+        if (!ok) {
+            VPVL2_LOG(WARNING, "Ignored the invalid texture cache: " << path);
+            image.offsets.clear();
+            image.bytesRef = 0;
+            delete buffer;
+            return false;
+        }
+        image.bufferPtr = buffer;
+        return true;
+    }
+    void writeCache(const TextureCache::Key &key, const Image &image) const {
+        const std::string &path = cachePath(key);
+        /* write to the temporary file first not to expose the incomplete file to the other thread */
+        char suffix[32];
+        internal::snprintf(suffix, sizeof(suffix), ".%p.tmp", static_cast<const void *>(&image));
+        const std::string &temporaryPath = path + suffix;
+        std::ofstream stream(temporaryPath.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!stream.is_open()) {
+            VPVL2_LOG(WARNING, "Cannot open the texture cache to write: " << temporaryPath);
+            return;
+        }
+        CacheHeader header;
+        memcpy(header.signature, "VPTC", sizeof(header.signature));
+        header.version = kCacheVersion;
+        header.hash = key.hash;
+        header.size = key.size;
+        header.flags = uint32(key.flags);
+        header.width = uint32(image.size.x());
+        header.height = uint32(image.size.y());
+        header.nlevels = uint32(image.offsets.size());
+        header.internal = image.format.internal;
+        header.external = image.format.external;
+        header.type = image.format.type;
+        header.compressed = image.compressed ? 1 : 0;
+        header.compression = uint32(m_compression);
+        stream.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        for (uint32 i = 0; i < header.nlevels; i++) {
+            const uint64 offset = image.offsets[i];
+            stream.write(reinterpret_cast<const char *>(&offset), sizeof(offset));
+        }
+        stream.write(reinterpret_cast<const char *>(image.bytesRef), image.nbytes);
+        stream.close();
+        if (stream.fail() || std::rename(temporaryPath.c_str(), path.c_str()) != 0) {
+            VPVL2_LOG(WARNING, "Cannot write the texture cache: " << path);
+            std::remove(temporaryPath.c_str());
+        }
+    }
+    void execute(Job *job) {
+        const uint8 *data = job->bytes.empty() ? 0 : &job->bytes[0];
+        const vsize size = job->bytes.size();
+        const bool mipmap = internal::hasFlagBits(job->flags, IApplicationContext::kGenerateTextureMipmap);
+        if (!data) {
+            job->ok = false;
+        }
+        else if (m_cacheDirectory.empty()) {
+            job->ok = decode(data, size, mipmap, job->image);
+        }
+        else {
+            const TextureCache::Key &key = ModelContext::createSharedTextureKey(data, size, TextureDataBridge(job->flags));
+            job->ok = readCache(key, job->image);
+            if (!job->ok && decode(data, size, mipmap, job->image)) {
+                compress(job->flags, job->image);
+                writeCache(key, job->image);
+                job->ok = true;
+            }
+        }
+        std::vector<uint8>().swap(job->bytes);
+    }
+    void complete(Job *job) {
+        if (ImageTexture *textureRef = job->textureRef) {
+            const Image &image = job->image;
+            if (job->ok) {
+                textureRef->upload(image);
+                /* the placeholder was charged when it was shared, charge the uploaded levels instead */
+                m_textureCacheRef->updateBytes(textureRef, image.nbytes);
+                VPVL2_VLOG(2, "Uploaded a decoded texture: ID=" << textureRef->data() << " width=" << image.size.x() << " height=" << image.size.y() << " levels=" << image.offsets.size() << " compressed=" << image.compressed);
+            }
+            else {
+                VPVL2_LOG(WARNING, "Cannot decode the texture asynchronously: ID=" << textureRef->data());
+            }
+            textureRef->detach();
+        }
+        m_jobs.remove(job);
+        delete job;
+    }
+
+    const BaseApplicationContext *m_applicationContextRef;
+    TextureCache *m_textureCacheRef;
+    internal::WorkerPool *m_pool;
+    internal::BoundedQueue<Job *> m_queue;
+    PointerArray<Job> m_jobs;
+    std::string m_cacheDirectory;
+    Compression m_compression;
+
+    VPVL2_DISABLE_COPY_AND_ASSIGN(TextureLoader)
+};
+
+ITexture *BaseApplicationContext::ModelContext::createTexture(const uint8 *data, vsize size, const TextureDataBridge &bridge)
+{
+    if (TextureLoader *loaderRef = m_applicationContextRef->textureLoaderRef()) {
+        return loaderRef->load(data, size, bridge.flags);
+    }
+    return uploadTexture(data, size, internal::hasFlagBits(bridge.flags, IApplicationContext::kGenerateTextureMipmap));
+}
+
+class BaseApplicationContext::ProfileTimer {
+public:
+    /* tracks from 1 are assigned to threads by internal::Profiler */
+    static const int kTrack = 0;
+
+    static bool isSupported() {
+        return GLEW_ARB_timer_query != 0;
+    }
+
+    ProfileTimer()
+        : m_offset(0)
+    {
+        /* maps the GPU clock to the CPU clock to put both in the same timeline */
+        GLint64 timestamp = 0;
+        glGetInteger64v(GL_TIMESTAMP, &timestamp);
+        m_offset = internal::ElapsedTimer::currentMicroseconds() - timestamp / 1000;
+    }
+    ~ProfileTimer() {
+        m_queries.releaseAll();
+    }
+
+    void start(int type, const void *arg) {
+        Query *query = 0;
+        if (const int nqueries = m_freeQueryRefs.count()) {
+            query = m_freeQueryRefs[nqueries - 1];
+            m_freeQueryRefs.removeAt(nqueries - 1);
+        }
+        else {
+            query = m_queries.append(new Query());
+        }
+        query->type = type;
+        query->argRef = arg;
+        glQueryCounter(query->names[0], GL_TIMESTAMP);
+        m_openQueryRefs.append(query);
+    }
+    void stop() {
+        const int nqueries = m_openQueryRefs.count();
+        if (nqueries > 0) {
+            Query *query = m_openQueryRefs[nqueries - 1];
+            m_openQueryRefs.removeAt(nqueries - 1);
+            glQueryCounter(query->names[1], GL_TIMESTAMP);
+            m_pendingQueryRefs.append(query);
+            /* polls results without stalling after the outermost session is closed */
+            if (nqueries == 1) {
+                resolve(false);
+            }
+        }
+    }
+    void resolve(bool wait) {
+        const int nqueries = m_pendingQueryRefs.count();
+        int nresolved = 0;
+        while (nresolved < nqueries) {
+            Query *query = m_pendingQueryRefs[nresolved];
+            if (!wait) {
+                GLint available = 0;
+                glGetQueryObjectiv(query->names[1], GL_QUERY_RESULT_AVAILABLE, &available);
+                /* queries complete in order of submission */
+                if (!available) {
+                    break;
+                }
+            }
+            GLuint64 start = 0, end = 0;
+            glGetQueryObjectui64v(query->names[0], GL_QUERY_RESULT, &start);
+            glGetQueryObjectui64v(query->names[1], GL_QUERY_RESULT, &end);
+            internal::Profiler::record(query->type, query->argRef, int64(start / 1000) + m_offset, int64(end / 1000) + m_offset, kTrack);
+            m_freeQueryRefs.append(query);
+            nresolved++;
+        }
+        if (nresolved > 0) {
+            Array<Query *> queries;
+            for (int i = nresolved; i < nqueries; i++) {
+                queries.append(m_pendingQueryRefs[i]);
+            }
+            m_pendingQueryRefs.copy(queries);
+        }
+    }
+
+private:
+    struct Query {
+        Query()
+            : argRef(0),
+              type(0)
+        {
+            glGenQueries(2, names);
+        }
+        ~Query() {
+            glDeleteQueries(2, names);
+        }
+        GLuint names[2];
+        const void *argRef;
+        int type;
+    };
+
+    PointerArray<Query> m_queries;
+    Array<Query *> m_freeQueryRefs;
+    Array<Query *> m_openQueryRefs;
+    Array<Query *> m_pendingQueryRefs;
+    int64 m_offset;
+
+    VPVL2_DISABLE_COPY_AND_ASSIGN(ProfileTimer)
+};
+
 bool BaseApplicationContext::initializeOnce(const char *argv0)
 {
     VPVL2_CHECK(argv0);
@@ -382,14 +1214,34 @@ BaseApplicationContext::BaseApplicationContext(Scene *sceneRef, IEncoding *encod
       m_cameraViewMatrix(1),
       m_cameraProjectionMatrix(1),
       m_textureSampler(0),
-      m_toonTextureSampler(0)
+      m_toonTextureSampler(0),
     #if defined(VPVL2_ENABLE_NVIDIA_CG) || defined(VPVL2_LINK_NVFX)
-    ,
       m_effectPathPtr(0),
-      m_msaaSamples(0)
+      m_msaaSamples(0),
     #endif /* VPVL2_ENABLE_NVIDIA_CG */
+      m_textureLoader(0),
+      m_profileTimer(0)
 {
     FreeImage_Initialise();
+    if (m_configRef) {
+        /* budget of the shared texture cache in megabytes */
+        int budget = m_configRef->value("texture.cache.budget", int(TextureCache::kDefaultBudget / (1024 * 1024)));
+        m_textureCache.setBudget(vsize(btMax(budget, 0)) * 1024 * 1024);
+        if (m_configRef->value("profile.enabled", false)) {
+            internal::Profiler::setCapacity(m_configRef->value("profile.capacity", int(internal::Profiler::kDefaultCapacity)));
+            internal::Profiler::setEnabled(true);
+        }
+        if (m_sceneRef) {
+            int flags = 0;
+            if (m_configRef->value("culling.frustum.enabled", true)) {
+                flags |= Scene::kFrustumCulling;
+            }
+            if (m_configRef->value("culling.occlusion.enabled", false)) {
+                flags |= Scene::kOcclusionCulling;
+            }
+            m_sceneRef->setCullingFlags(flags);
+        }
+    }
 }
 
 void BaseApplicationContext::initialize(bool enableDebug)
@@ -413,6 +1265,10 @@ void BaseApplicationContext::initialize(bool enableDebug)
         glSamplerParameteri(m_toonTextureSampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
         glSamplerParameteri(m_toonTextureSampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     }
+    if (m_configRef && m_configRef->value("profile.gpu.enabled", false)
+            && internal::Profiler::isEnabled() && ProfileTimer::isSupported()) {
+        m_profileTimer = new ProfileTimer();
+    }
 #if defined(VPVL2_ENABLE_NVIDIA_CG) || defined(VPVL2_LINK_NVFX)
     glGetIntegerv(GL_MAX_SAMPLES, &m_msaaSamples);
 #endif /* VPVL2_ENABLE_NVIDIA_CG */
@@ -444,7 +1300,7 @@ bool BaseApplicationContext::uploadTexture(const IString *name, TextureDataBridg
                 if (!context->findTextureCache(newToonPath, bridge)) {
                     /* fallback to default texture loader */
                     VPVL2_VLOG(2, "Try loading a system default toon texture from archive: " << String::toStdString(newToonPath));
-                    ret = context->uploadTextureCached(newToonPath, bridge);
+                    ret = uploadTextureShared(newToonPath, false, bridge, context);
                 }
             }
             else if (context->archiveRef()) {
@@ -473,11 +1329,37 @@ bool BaseApplicationContext::uploadTexture(const IString *name, TextureDataBridg
 
 bool BaseApplicationContext::uploadSystemToonTexture(const UnicodeString &name, TextureDataBridge &bridge, ModelContext *context)
 {
-    MapBuffer buffer(this);
     String s(toonDirectory());
     const UnicodeString &path = createPath(&s, name);
     /* open a (system) toon texture from library resource */
-    return mapFile(path, &buffer) ? context->uploadTextureCached(buffer.address, buffer.size, path, bridge) : false;
+    return uploadTextureShared(path, false, bridge, context);
+}
+
+bool BaseApplicationContext::loadToonColor(const IString *name, const ModelContext *context, Color &value) const
+{
+    if (!name) {
+        return false;
+    }
+    const UnicodeString &n = static_cast<const String *>(name)->value();
+    if (Archive *archiveRef = context ? context->archiveRef() : 0) {
+        archiveRef->uncompressEntry(n);
+        if (const std::string *bytesRef = archiveRef->dataRef(n)) {
+            if (DecodeToonColor(reinterpret_cast<const uint8 *>(bytesRef->data()), bytesRef->size(), value)) {
+                return true;
+            }
+        }
+    }
+    MapBuffer buffer(this);
+    if (context && mapFile(createPath(context->directoryRef(), name), &buffer)) {
+        return DecodeToonColor(buffer.address, buffer.size, value);
+    }
+    /* falls back to the system toon texture (toon01.bmp to toon10.bmp) */
+    MapBuffer systemBuffer(this);
+    String s(toonDirectory());
+    if (mapFile(createPath(&s, name), &systemBuffer)) {
+        return DecodeToonColor(systemBuffer.address, systemBuffer.size, value);
+    }
+    return false;
 }
 
 bool BaseApplicationContext::uploadTextureCached(const UnicodeString &name, const UnicodeString &path, TextureDataBridge &bridge, ModelContext *context)
@@ -490,10 +1372,10 @@ bool BaseApplicationContext::uploadTextureCached(const UnicodeString &name, cons
             const uint8 *ptr = reinterpret_cast<const uint8 *>(bytesRef->data());
             vsize size = bytesRef->size();
             if (name.endsWith(".jpg") || name.endsWith(".png") || name.endsWith(".bmp")) {
-                return uploadTextureOpaque(ptr, size, name, context, bridge);
+                return uploadTextureShared(ptr, size, name, true, bridge, context);
             }
             else {
-                return context->uploadTextureCached(ptr, size, path, bridge);
+                return uploadTextureShared(ptr, size, path, false, bridge, context);
             }
         }
         VPVL2_LOG(WARNING, "Cannot load a bridge from archive: " << String::toStdString(name));
@@ -505,10 +1387,47 @@ bool BaseApplicationContext::uploadTextureCached(const UnicodeString &name, cons
         return true; /* skip */
     }
     else if (name.endsWith(".jpg") || name.endsWith(".png") || name.endsWith(".bmp")) {
-        return uploadTextureOpaque(path, context, bridge);
+        return uploadTextureShared(path, true, bridge, context);
     }
     /* fallback to default texture loader */
-    return context->uploadTextureCached(path, bridge);
+    return uploadTextureShared(path, false, bridge, context);
+}
+
+bool BaseApplicationContext::uploadTextureShared(const UnicodeString &path, bool opaque, TextureDataBridge &bridge, ModelContext *context)
+{
+    if (path.isEmpty() || path[path.length() - 1] == '/' || context->findTextureCache(path, bridge)) {
+        VPVL2_VLOG(2, String::toStdString(path) << " is already cached, skipped.");
+        return true;
+    }
+    else if (context->findSharedTexture(path, bridge)) {
+        return true;
+    }
+    MapBuffer buffer(this);
+    if (!mapFile(path, &buffer)) {
+        return opaque ? uploadTextureOpaque(path, context, bridge) : context->uploadTextureCached(path, bridge);
+    }
+    /* hash the encoded bytes to share the same image loaded from the different path */
+    const TextureCache::Key &contentKey = ModelContext::createSharedTextureKey(buffer.address, buffer.size, bridge);
+    if (context->findSharedTexture(contentKey, path, path, bridge)) {
+        return true;
+    }
+    bool ok = opaque ? uploadTextureOpaque(path, context, bridge) : context->uploadTextureCached(buffer.address, buffer.size, path, bridge);
+    return ok && context->shareTexture(contentKey, path, path, bridge);
+}
+
+bool BaseApplicationContext::uploadTextureShared(const uint8 *data, vsize size, const UnicodeString &key, bool opaque, TextureDataBridge &bridge, ModelContext *context)
+{
+    if (context->findTextureCache(key, bridge)) {
+        VPVL2_VLOG(2, String::toStdString(key) << " is already cached, skipped.");
+        return true;
+    }
+    /* the key is relative to the archive, so only the content is used to find the shared texture */
+    const TextureCache::Key &contentKey = ModelContext::createSharedTextureKey(data, size, bridge);
+    if (context->findSharedTexture(contentKey, key, UnicodeString(), bridge)) {
+        return true;
+    }
+    bool ok = opaque ? uploadTextureOpaque(data, size, key, context, bridge) : context->uploadTextureCached(data, size, key, bridge);
+    return ok && context->shareTexture(contentKey, key, UnicodeString(), bridge);
 }
 
 bool BaseApplicationContext::uploadTextureOpaque(const uint8 *data, vsize size, const UnicodeString &key, ModelContext *context, TextureDataBridge &bridge)
@@ -748,12 +1667,23 @@ bool BaseApplicationContext::hasExtension(const void *namePtr) const
     return m_extensions.find(static_cast<const char *>(namePtr)) != m_extensions.end();
 }
 
-void BaseApplicationContext::startProfileSession(ProfileType /* type */, const void * /* arg */)
+void BaseApplicationContext::startProfileSession(ProfileType type, const void *arg)
 {
+    if (internal::Profiler::isEnabled()) {
+        internal::Profiler::begin(type, arg);
+        if (m_profileTimer) {
+            m_profileTimer->start(type, arg);
+        }
+    }
 }
 
 void BaseApplicationContext::stopProfileSession(ProfileType /* type */, const void * /* arg */)
 {
+    /* sessions are nested, so the latest open session is closed */
+    internal::Profiler::end();
+    if (m_profileTimer) {
+        m_profileTimer->stop();
+    }
 }
 
 #if defined(VPVL2_ENABLE_NVIDIA_CG) || defined(VPVL2_LINK_NVFX)
@@ -1309,8 +2239,149 @@ void BaseApplicationContext::debugMessageCallback(GLenum source, GLenum type, GL
     }
 }
 
+TextureCache *BaseApplicationContext::textureCacheRef()
+{
+    return &m_textureCache;
+}
+
+int BaseApplicationContext::uploadDecodedTextures(int64 budget)
+{
+    return m_textureLoader ? m_textureLoader->upload(budget) : 0;
+}
+
+void BaseApplicationContext::waitForDecodedTextures()
+{
+    if (m_textureLoader) {
+        m_textureLoader->wait();
+    }
+}
+
+int BaseApplicationContext::countPendingTextures() const
+{
+    return m_textureLoader ? m_textureLoader->countPendingTextures() : 0;
+}
+
+bool BaseApplicationContext::saveProfileTrace(const UnicodeString &path)
+{
+    if (m_profileTimer) {
+        m_profileTimer->resolve(true);
+    }
+    Array<internal::Profiler::Span> spans;
+    Array<internal::Profiler::Stats> stats;
+    internal::Profiler::collect(spans);
+    internal::Profiler::aggregate(spans, stats);
+    std::map<const void *, std::string> names;
+    CollectProfileNames(m_sceneRef, names);
+    const std::string &filePath = String::toStdString(path);
+    std::ofstream stream(filePath.c_str(), std::ios::out | std::ios::trunc);
+    if (!stream.is_open()) {
+        VPVL2_LOG(WARNING, "Cannot open the profile trace to write: " << filePath);
+        return false;
+    }
+    /* Chrome trace event format (chrome://tracing), timestamps are in microseconds */
+    const int nspans = spans.count();
+    const int64 origin = nspans > 0 ? spans[0].start : 0;
+    std::set<int> tracks;
+    stream << "{\"traceEvents\":[";
+    for (int i = 0; i < nspans; i++) {
+        const internal::Profiler::Span &span = spans[i];
+        const std::map<const void *, std::string>::const_iterator it = names.find(span.argRef);
+        stream << (i > 0 ? ",\n" : "\n") << "{\"name\":\"" << ProfileTypeToString(span.type)
+               << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << span.track
+               << ",\"ts\":" << (span.start - origin) << ",\"dur\":" << (span.end - span.start)
+               << ",\"args\":{\"ref\":";
+        WriteJSONPointer(stream, span.argRef);
+        stream << ",\"parent\":";
+        WriteJSONPointer(stream, span.parentArgRef);
+        if (it != names.end()) {
+            stream << ",\"label\":";
+            WriteJSONString(stream, it->second);
+        }
+        stream << "}}";
+        tracks.insert(span.track);
+    }
+    for (std::set<int>::const_iterator it = tracks.begin(); it != tracks.end(); ++it) {
+        const int track = *it;
+        std::ostringstream name;
+        if (track == ProfileTimer::kTrack) {
+            name << "GPU";
+        }
+        else {
+            name << "Thread " << track;
+        }
+        stream << (nspans > 0 ? ",\n" : "\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << track << ",\"args\":{\"name\":";
+        WriteJSONString(stream, name.str());
+        stream << "}}";
+    }
+    /* aggregated per type and argument (per-model and per-material) statistics in microseconds */
+    stream << "\n],\"displayTimeUnit\":\"ms\",\"stats\":[";
+    const int nstats = stats.count();
+    for (int i = 0; i < nstats; i++) {
+        const internal::Profiler::Stats &value = stats[i];
+        const std::map<const void *, std::string>::const_iterator it = names.find(value.argRef);
+        stream << (i > 0 ? ",\n" : "\n") << "{\"name\":\"" << ProfileTypeToString(value.type) << "\",\"ref\":";
+        WriteJSONPointer(stream, value.argRef);
+        stream << ",\"parent\":";
+        WriteJSONPointer(stream, value.parentArgRef);
+        if (it != names.end()) {
+            stream << ",\"label\":";
+            WriteJSONString(stream, it->second);
+        }
+        stream << ",\"count\":" << value.count << ",\"total\":" << value.total
+               << ",\"min\":" << value.min << ",\"max\":" << value.max
+               << ",\"average\":" << (value.total / btMax(value.count, 1)) << "}";
+    }
+    stream << "\n]}\n";
+    stream.close();
+    if (stream.fail()) {
+        VPVL2_LOG(WARNING, "Cannot write the profile trace: " << filePath);
+        return false;
+    }
+    return true;
+}
+
+BaseApplicationContext::TextureLoader *BaseApplicationContext::textureLoaderRef()
+{
+    if (!m_textureLoader && m_configRef) {
+        const bool async = m_configRef->value("texture.async.enabled", false);
+        const UnicodeString &cacheDirectory = m_configRef->value("texture.disk.cache.path", UnicodeString());
+        if (async || !cacheDirectory.isEmpty()) {
+            /* negative number of threads disables the worker pool and decodes in the GL thread */
+            int nthreads = async ? btMax(m_configRef->value("texture.async.threads", 0), 0) : -1;
+            int capacity = m_configRef->value("texture.async.queue", 4);
+            m_textureLoader = new TextureLoader(this, &m_textureCache, nthreads, capacity);
+            if (!cacheDirectory.isEmpty()) {
+                const UnicodeString &compression = m_configRef->value("texture.disk.cache.compression", UnicodeString("auto"));
+                TextureLoader::Compression value = TextureLoader::kAutoCompression;
+                if (compression == "none") {
+                    value = TextureLoader::kNoCompression;
+                }
+                else if (compression == "bc1") {
+                    value = TextureLoader::kBC1Compression;
+                }
+                else if (compression == "bc3") {
+                    value = TextureLoader::kBC3Compression;
+                }
+                m_textureLoader->setDiskCache(cacheDirectory, value);
+            }
+        }
+    }
+    return m_textureLoader;
+}
+
 void BaseApplicationContext::release()
 {
+    if (m_configRef && m_sceneRef) {
+        const UnicodeString &tracePath = m_configRef->value("profile.trace.path", UnicodeString());
+        if (!tracePath.isEmpty()) {
+            saveProfileTrace(tracePath);
+        }
+    }
+    delete m_profileTimer;
+    m_profileTimer = 0;
+    delete m_textureLoader;
+    m_textureLoader = 0;
+    m_textureCache.purge();
     if (GLEW_ARB_sampler_objects) {
         glDeleteSamplers(1, &m_textureSampler);
         glDeleteSamplers(1, &m_toonTextureSampler);
@@ -37,8 +37,11 @@
 
 #include <vpvl2/extensions/World.h>
 
+#include <vpvl2/IApplicationContext.h>
 #include <vpvl2/IModel.h>
 #include <vpvl2/Scene.h>
+#include <vpvl2/internal/ParallelProcessors.h>
+#include <vpvl2/internal/Profiler.h>
 
 /* Bullet Physics */
 #ifdef __clang__
@@ -48,7 +51,9 @@
 #include <BulletCollision/BroadphaseCollision/btDbvtBroadphase.h>
 #include <BulletCollision/CollisionDispatch/btDefaultCollisionConfiguration.h>
 #include <BulletDynamics/ConstraintSolver/btSequentialImpulseConstraintSolver.h>
+#include <BulletDynamics/ConstraintSolver/btTypedConstraint.h>
 #include <BulletDynamics/Dynamics/btDiscreteDynamicsWorld.h>
+#include <BulletDynamics/Dynamics/btRigidBody.h>
 #ifdef __clang__
 #pragma clang diagnostic pop
 #endif
@@ -59,50 +64,228 @@ namespace extensions
 {
 
 struct World::PrivateContext {
-    PrivateContext()
-        : dispatcher(0),
-          broadphase(0),
-          solver(0),
-          world(0),
+    /* one dynamics world and its collision pipeline shared by the models joined to it */
+    struct Simulation {
+        Simulation(const Configuration &configuration)
+            : dispatcher(0),
+              broadphase(0),
+              solver(0),
+              world(0),
+              delta(0),
+              fixedTimeStep(0),
+              maxSubSteps(0),
+              enableSleeping(configuration.enableSleeping)
+        {
+            dispatcher = new btCollisionDispatcher(&config);
+            broadphase = new btDbvtBroadphase();
+            solver = new btSequentialImpulseConstraintSolver();
+            world = new btDiscreteDynamicsWorld(dispatcher, broadphase, solver, &config);
+            btContactSolverInfo &info = world->getSolverInfo();
+            info.m_numIterations = configuration.numSolverIterations;
+            if (configuration.enableRandomizeOrder) {
+                info.m_solverMode |= SOLVER_RANDMIZE_ORDER;
+            }
+            else {
+                info.m_solverMode &= ~SOLVER_RANDMIZE_ORDER;
+            }
+            /* AABBs of sleeping bodies don't change so only active ones are updated */
+            world->setForceUpdateAllAabbs(!enableSleeping);
+        }
+        ~Simulation() {
+            /* the world refers the others so it must be deleted first */
+            delete world;
+            world = 0;
+            delete solver;
+            solver = 0;
+            delete broadphase;
+            broadphase = 0;
+            delete dispatcher;
+            dispatcher = 0;
+        }
+
+        static bool isMoving(const btRigidBody *body) {
+            /* velocities of kinematic bodies are zero after stepping so compare with the last saved transform */
+            Transform transform = body->getWorldTransform();
+            if (const btMotionState *state = body->getMotionState()) {
+                state->getWorldTransform(transform);
+            }
+            return !(transform == body->getInterpolationWorldTransform());
+        }
+        static void allowSleeping(btRigidBody *body) {
+            /* bone-following bodies are kept awake to move their jointed bodies */
+            if (!body->isStaticOrKinematicObject()) {
+                body->forceActivationState(ACTIVE_TAG);
+                body->activate(true);
+            }
+        }
+
+        void execute() {
+            if (enableSleeping) {
+                wakeUpJointedBodies();
+            }
+            world->stepSimulation(delta, maxSubSteps, fixedTimeStep);
+        }
+        void addRigidBody(btRigidBody *body) {
+            world->addRigidBody(body);
+            if (enableSleeping) {
+                allowSleeping(body);
+            }
+        }
+        void joinModel(IModel *model) {
+            model->joinWorld(world);
+            modelRefs.append(model);
+            if (enableSleeping) {
+                allowAllSleeping();
+            }
+        }
+        void leaveModel(IModel *model) {
+            model->leaveWorld(world);
+            modelRefs.remove(model);
+        }
+        bool containsModel(const IModel *model) const {
+            const int nmodels = modelRefs.count();
+            for (int i = 0; i < nmodels; i++) {
+                if (modelRefs[i] == model) {
+                    return true;
+                }
+            }
+            return false;
+        }
+        void resetMotionState() {
+            resetMotionState(modelRefs);
+            world->getBroadphase()->resetPool(dispatcher);
+        }
+        void resetMotionState(const Array<IModel *> &targetModelRefs) {
+            const int nmodels = targetModelRefs.count();
+            for (int i = 0; i < nmodels; i++) {
+                IModel *model = targetModelRefs[i];
+                model->resetMotionState(world);
+            }
+            solver->reset();
+            if (enableSleeping) {
+                /* bodies are teleported by seeking so all of them must be simulated again */
+                allowAllSleeping();
+            }
+        }
+        void allowAllSleeping() {
+            const btCollisionObjectArray &objects = world->getCollisionObjectArray();
+            const int nobjects = objects.size();
+            for (int i = 0; i < nobjects; i++) {
+                if (btRigidBody *body = btRigidBody::upcast(objects[i])) {
+                    allowSleeping(body);
+                }
+            }
+        }
+        /*
+         * Bullet doesn't merge kinematic bodies into simulation islands and only contacts wake
+         * sleeping bodies up, so a sleeping body jointed to a moving bone-following body (hair
+         * or skirt) must be woken up explicitly.
+         */
+        void wakeUpJointedBodies() {
+            const int nconstraints = world->getNumConstraints();
+            for (int i = 0; i < nconstraints; i++) {
+                btTypedConstraint *constraint = world->getConstraint(i);
+                btRigidBody &bodyA = constraint->getRigidBodyA(), &bodyB = constraint->getRigidBodyB();
+                if (bodyA.isActive() != bodyB.isActive()) {
+                    btRigidBody &sleeping = bodyA.isActive() ? bodyB : bodyA;
+                    const btRigidBody &active = bodyA.isActive() ? bodyA : bodyB;
+                    if (!active.isKinematicObject() || isMoving(&active)) {
+                        sleeping.activate();
+                    }
+                }
+            }
+        }
+
+        Array<IModel *> modelRefs;
+        btDefaultCollisionConfiguration config;
+        btCollisionDispatcher *dispatcher;
+        btDbvtBroadphase *broadphase;
+        btSequentialImpulseConstraintSolver *solver;
+        btDiscreteDynamicsWorld *world;
+        Scalar delta;
+        Scalar fixedTimeStep;
+        int maxSubSteps;
+        const bool enableSleeping;
+    };
+    struct ResetMotionStateTask {
+        ResetMotionStateTask(Simulation *simulation)
+            : simulationRef(simulation)
+        {
+        }
+        void execute() {
+            simulationRef->resetMotionState();
+        }
+        Simulation *simulationRef;
+    };
+
+    PrivateContext(const Configuration &c)
+        : configuration(c),
+          shared(c),
           motionFPS(0),
           fixedTimeStep(0),
           maxSubSteps(0)
     {
-        dispatcher = new btCollisionDispatcher(&config);
-        broadphase = new btDbvtBroadphase();
-        solver = new btSequentialImpulseConstraintSolver();
-        world = new btDiscreteDynamicsWorld(dispatcher, broadphase, solver, &config);
     }
     ~PrivateContext() {
-        delete dispatcher;
-        dispatcher = 0;
-        delete broadphase;
-        broadphase = 0;
-        delete solver;
-        solver = 0;
-        delete world;
-        world = 0;
+        islands.releaseAll();
         motionFPS = 0;
         maxSubSteps = 0;
         fixedTimeStep = 0;
     }
 
-    btDefaultCollisionConfiguration config;
-    btCollisionDispatcher *dispatcher;
-    btDbvtBroadphase *broadphase;
-    btSequentialImpulseConstraintSolver *solver;
-    btDiscreteDynamicsWorld *world;
+    int findIslandIndex(const IModel *model) const {
+        const int nislands = islands.count();
+        for (int i = 0; i < nislands; i++) {
+            if (islands[i]->containsModel(model)) {
+                return i;
+            }
+        }
+        return -1;
+    }
+    Simulation *createIsland(const Vector3 &gravity) {
+        Simulation *island = islands.append(new Simulation(configuration));
+        island->world->setGravity(gravity);
+        island->solver->setRandSeed(shared.solver->getRandSeed());
+        return island;
+    }
+    void removeIslandAt(int index) {
+        Simulation *island = islands[index];
+        islands.removeAt(index);
+        delete island;
+    }
+
+    const Configuration configuration;
+    Simulation shared;
+    PointerArray<Simulation> islands;
     Scalar motionFPS;
     Scalar fixedTimeStep;
     int maxSubSteps;
 };
 
 const int World::kDefaultMaxSubSteps = 2;
+const int World::kDefaultNumSolverIterations = 10;
+
+World::Configuration::Configuration()
+    : numSolverIterations(kDefaultNumSolverIterations),
+      enableRandomizeOrder(false),
+      enableModelIslands(false),
+      enableSleeping(false)
+{
+}
 
 World::World()
     : m_context(0)
 {
-    m_context = new PrivateContext();
+    m_context = new PrivateContext(Configuration());
+    setGravity(vpvl2::Vector3(0.0f, -9.8f, 0.0f));
+    setPreferredFPS(vpvl2::Scene::defaultFPS());
+    setMaxSubSteps(kDefaultMaxSubSteps);
+}
+
+World::World(const Configuration &configuration)
+    : m_context(0)
+{
+    m_context = new PrivateContext(configuration);
     setGravity(vpvl2::Vector3(0.0f, -9.8f, 0.0f));
     setPreferredFPS(vpvl2::Scene::defaultFPS());
     setMaxSubSteps(kDefaultMaxSubSteps);
@@ -114,24 +297,39 @@ World::~World()
     m_context = 0;
 }
 
+const World::Configuration &World::configuration() const
+{
+    return m_context->configuration;
+}
+
 const vpvl2::Vector3 World::gravity() const
 {
-    return m_context->world->getGravity();
+    return m_context->shared.world->getGravity();
 }
 
 btDiscreteDynamicsWorld *World::dynamicWorldRef() const
 {
-    return m_context->world;
+    return m_context->shared.world;
+}
+
+btDiscreteDynamicsWorld *World::findDynamicWorldRef(const IModel *model) const
+{
+    int index = m_context->findIslandIndex(model);
+    return index >= 0 ? m_context->islands[index]->world : m_context->shared.world;
 }
 
 void World::setGravity(const vpvl2::Vector3 &value)
 {
-    m_context->world->setGravity(value);
+    m_context->shared.world->setGravity(value);
+    const int nislands = m_context->islands.count();
+    for (int i = 0; i < nislands; i++) {
+        m_context->islands[i]->world->setGravity(value);
+    }
 }
 
 unsigned long World::randSeed() const
 {
-    return m_context->solver->getRandSeed();
+    return m_context->shared.solver->getRandSeed();
 }
 
 Scalar World::motionFPS() const
@@ -151,7 +349,11 @@ int World::maxSubSteps() const
 
 void World::setRandSeed(unsigned long value)
 {
-    m_context->solver->setRandSeed(value);
+    m_context->shared.solver->setRandSeed(value);
+    const int nislands = m_context->islands.count();
+    for (int i = 0; i < nislands; i++) {
+        m_context->islands[i]->solver->setRandSeed(value);
+    }
 }
 
 void World::setPreferredFPS(const Scalar &value)
@@ -167,17 +369,156 @@ void World::setMaxSubSteps(int value)
 
 void World::addRigidBody(btRigidBody *value)
 {
-    m_context->world->addRigidBody(value);
+    m_context->shared.addRigidBody(value);
 }
 
 void World::removeRigidBody(btRigidBody *value)
 {
-    m_context->world->removeRigidBody(value);
+    m_context->shared.world->removeRigidBody(value);
+}
+
+void World::addModel(IModel *value)
+{
+    if (!value || m_context->shared.containsModel(value) || m_context->findIslandIndex(value) >= 0) {
+        return;
+    }
+    if (m_context->configuration.enableModelIslands) {
+        PrivateContext::Simulation *island = m_context->createIsland(gravity());
+        island->joinModel(value);
+    }
+    else {
+        m_context->shared.joinModel(value);
+    }
+}
+
+void World::removeModel(IModel *value)
+{
+    int index = m_context->findIslandIndex(value);
+    if (index >= 0) {
+        PrivateContext::Simulation *island = m_context->islands[index];
+        island->leaveModel(value);
+        if (island->modelRefs.count() == 0) {
+            m_context->removeIslandAt(index);
+        }
+    }
+    else if (m_context->shared.containsModel(value)) {
+        m_context->shared.leaveModel(value);
+    }
+}
+
+void World::linkModels(IModel *model1, IModel *model2)
+{
+    int index1 = m_context->findIslandIndex(model1), index2 = m_context->findIslandIndex(model2);
+    if (index1 < 0 || index2 < 0 || index1 == index2) {
+        return;
+    }
+    /* moves all models of the second island into the first one */
+    PrivateContext::Simulation *dest = m_context->islands[index1], *source = m_context->islands[index2];
+    while (source->modelRefs.count() > 0) {
+        IModel *model = source->modelRefs[0];
+        source->leaveModel(model);
+        dest->joinModel(model);
+    }
+    m_context->removeIslandAt(index2);
+}
+
+void World::unlinkModel(IModel *value)
+{
+    int index = m_context->findIslandIndex(value);
+    if (index >= 0) {
+        PrivateContext::Simulation *island = m_context->islands[index];
+        if (island->modelRefs.count() > 1) {
+            island->leaveModel(value);
+            m_context->createIsland(gravity())->joinModel(value);
+        }
+    }
+}
+
+bool World::isLinked(const IModel *model1, const IModel *model2) const
+{
+    int index = m_context->findIslandIndex(model1);
+    return index >= 0 && m_context->islands[index]->containsModel(model2);
+}
+
+int World::countIslands() const
+{
+    return m_context->islands.count();
+}
+
+void World::resetMotionState()
+{
+    m_context->shared.resetMotionState();
+    const int nislands = m_context->islands.count();
+    PointerArray<PrivateContext::ResetMotionStateTask> tasks;
+    for (int i = 0; i < nislands; i++) {
+        tasks.append(new PrivateContext::ResetMotionStateTask(m_context->islands[i]));
+    }
+    internal::ParallelTaskProcessor<PrivateContext::ResetMotionStateTask> processor(&tasks);
+    processor.execute();
+    tasks.releaseAll();
+}
+
+void World::resetMotionState(const Array<IModel *> &models)
+{
+    PointerArray<PrivateContext::ResetMotionStateTask> tasks;
+    Array<IModel *> sharedModelRefs;
+    const int nmodels = models.count();
+    for (int i = 0; i < nmodels; i++) {
+        IModel *model = models[i];
+        int index = m_context->findIslandIndex(model);
+        if (index >= 0) {
+            /* linked models interact each other so the whole island is reset */
+            PrivateContext::Simulation *island = m_context->islands[index];
+            bool found = false;
+            const int ntasks = tasks.count();
+            for (int j = 0; j < ntasks; j++) {
+                if (tasks[j]->simulationRef == island) {
+                    found = true;
+                    break;
+                }
+            }
+            if (!found) {
+                tasks.append(new PrivateContext::ResetMotionStateTask(island));
+            }
+        }
+        else if (m_context->shared.containsModel(model)) {
+            sharedModelRefs.append(model);
+        }
+    }
+    if (sharedModelRefs.count() > 0) {
+        m_context->shared.resetMotionState(sharedModelRefs);
+    }
+    internal::ParallelTaskProcessor<PrivateContext::ResetMotionStateTask> processor(&tasks);
+    processor.execute();
+    tasks.releaseAll();
 }
 
 void World::stepSimulation(const vpvl2::Scalar &delta)
 {
-    m_context->world->stepSimulation(delta, m_context->maxSubSteps, m_context->fixedTimeStep);
+    internal::ScopedProfile profile(IApplicationContext::kProfileStepPhysicsProcess, this);
+    PrivateContext::Simulation &shared = m_context->shared;
+    shared.delta = delta;
+    shared.maxSubSteps = m_context->maxSubSteps;
+    shared.fixedTimeStep = m_context->fixedTimeStep;
+    shared.execute();
+    const int nislands = m_context->islands.count();
+    for (int i = 0; i < nislands; i++) {
+        PrivateContext::Simulation *island = m_context->islands[i];
+        island->delta = delta;
+        island->maxSubSteps = m_context->maxSubSteps;
+        island->fixedTimeStep = m_context->fixedTimeStep;
+    }
+#ifdef BT_NO_PROFILE
+    if (nislands > 1) {
+        internal::ParallelTaskProcessor<PrivateContext::Simulation> processor(&m_context->islands);
+        processor.execute();
+        return;
+    }
+#endif
+    /* CProfileManager of Bullet is not thread safe unless it's built with BT_NO_PROFILE */
+    for (int i = 0; i < nislands; i++) {
+        m_context->islands[i]->execute();
+    }
 }
 
 } /* namespace extensions */
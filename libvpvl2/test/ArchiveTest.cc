@@ -143,3 +143,97 @@ TEST(ArchiveTest, UncompressWithSetBasePath)
     ASSERT_TRUE(dataRef2);
     ASSERT_EQ(dataRef2, dataRef);
 }
+
+TEST(ArchiveTest, OpenWithoutEntryNames)
+{
+    Encoding encoding(0);
+    Archive archive(&encoding);
+    QFile file(":misc/test.zip");
+    QScopedPointer<QTemporaryFile> temp(QTemporaryFile::createLocalFile(file));
+    ASSERT_TRUE(temp);
+    temp->setAutoRemove(true);
+    String path(Util::fromQString(temp->fileName()));
+    ASSERT_TRUE(archive.open(&path));
+    vsize size = 0;
+    ASSERT_TRUE(archive.getEntrySize("path/to/entry.txt", size));
+    ASSERT_EQ(vsize(10), size);
+    /* lookup is case insensitive */
+    ASSERT_TRUE(archive.getEntrySize("FOO.TXT", size));
+    ASSERT_EQ(vsize(4), size);
+    ASSERT_FALSE(archive.getEntrySize("not_found.txt", size));
+    ASSERT_EQ(vsize(0), size);
+}
+
+TEST(ArchiveTest, LookupEntriesByIndex)
+{
+    Encoding encoding(0);
+    Archive archive(&encoding);
+    QFile file(":misc/test.zip");
+    QScopedPointer<QTemporaryFile> temp(QTemporaryFile::createLocalFile(file));
+    ASSERT_TRUE(temp);
+    temp->setAutoRemove(true);
+    String path(Util::fromQString(temp->fileName()));
+    ASSERT_TRUE(archive.open(&path));
+    ASSERT_EQ(AllEntries().size(), archive.countEntries());
+    int found = -1;
+    for (int i = 0; i < archive.countEntries(); i++) {
+        if (archive.entryEndsWith(i, "/ENTRY.TXT")) {
+            found = i;
+        }
+    }
+    ASSERT_GE(found, 0);
+    ASSERT_TRUE(archive.entryName(found) == "path/to/entry.txt");
+    ASSERT_TRUE(archive.uncompressEntry(found));
+    ASSERT_STREQ("entry.txt\n", archive.dataRef("path/to/entry.txt")->c_str());
+    /* out of range */
+    ASSERT_FALSE(archive.entryEndsWith(archive.countEntries(), ".txt"));
+    ASSERT_FALSE(archive.uncompressEntry(-1));
+    ASSERT_TRUE(archive.entryName(-1).isEmpty());
+}
+
+TEST(ArchiveTest, ReadEntryIntoBuffer)
+{
+    Encoding encoding(0);
+    Archive archive(&encoding);
+    Archive::EntryNames entries;
+    UncompressArchive(archive, entries);
+    std::string buffer;
+    ASSERT_TRUE(archive.readEntry("path/to/entry.txt", buffer));
+    ASSERT_STREQ("entry.txt\n", buffer.c_str());
+    ASSERT_TRUE(archive.readEntry("foo.txt", buffer));
+    ASSERT_STREQ("foo\n", buffer.c_str());
+    uint8 bytes[16] = { 0 };
+    ASSERT_TRUE(archive.readEntry("bar.txt", bytes, sizeof(bytes)));
+    ASSERT_STREQ("bar\n", reinterpret_cast<const char *>(bytes));
+    /* too small buffer */
+    ASSERT_FALSE(archive.readEntry("bar.txt", bytes, 2));
+    ASSERT_FALSE(archive.readEntry("not_found.txt", buffer));
+    /* readEntry doesn't cache uncompressed data */
+    ASSERT_FALSE(archive.dataRef("foo.txt"));
+    ASSERT_EQ(vsize(0), archive.cacheSize());
+}
+
+TEST(ArchiveTest, EvictLeastRecentlyUsedEntries)
+{
+    Encoding encoding(0);
+    Archive archive(&encoding);
+    Archive::EntryNames entries;
+    UncompressArchive(archive, entries);
+    ASSERT_EQ(vsize(0), archive.maxCacheSize());
+    archive.setMaxCacheSize(8);
+    ASSERT_TRUE(archive.uncompressEntry("foo.txt"));
+    ASSERT_TRUE(archive.uncompressEntry("bar.txt"));
+    ASSERT_EQ(vsize(8), archive.cacheSize());
+    /* touch foo.txt to make bar.txt least recently used */
+    ASSERT_TRUE(archive.dataRef("foo.txt"));
+    ASSERT_TRUE(archive.uncompressEntry("baz.txt"));
+    ASSERT_EQ(vsize(8), archive.cacheSize());
+    ASSERT_TRUE(archive.dataRef("foo.txt"));
+    ASSERT_FALSE(archive.dataRef("bar.txt"));
+    ASSERT_STREQ("baz\n", archive.dataRef("baz.txt")->c_str());
+    /* the latest entry is kept even if it exceeds the limit */
+    archive.setMaxCacheSize(1);
+    ASSERT_TRUE(archive.uncompressEntry("path/to/entry.txt"));
+    ASSERT_TRUE(archive.dataRef("path/to/entry.txt"));
+    ASSERT_EQ(vsize(10), archive.cacheSize());
+}
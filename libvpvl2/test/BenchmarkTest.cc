@@ -0,0 +1,308 @@
+#include "Common.h"
+
+#include "vpvl2/vpvl2.h"
+#include "vpvl2/extensions/World.h"
+#include "vpvl2/extensions/icu4c/Encoding.h"
+#include "vpvl2/pmx/Bone.h"
+#include "vpvl2/pmx/Material.h"
+#include "vpvl2/pmx/Model.h"
+#include "vpvl2/pmx/Vertex.h"
+#include "vpvl2/internal/MotionHelper.h"
+#include "vpvl2/vmd/BoneKeyframe.h"
+
+#include <QDir>
+#include <QElapsedTimer>
+#include <iostream>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#ifdef VPVL2_LINK_INTEL_TBB
+#include <tbb/task_scheduler_init.h>
+#endif
+
+using namespace ::testing;
+using namespace vpvl2;
+using namespace vpvl2::pmx;
+using namespace vpvl2::extensions::icu4c;
+
+/*
+ * Benchmarks are disabled by default. Run them explicitly with
+ * "--gtest_also_run_disabled_tests --gtest_filter=*Benchmark*".
+ */
+
+namespace
+{
+
+static const int kNumIterations = 32;
+
+static void BuildSkinnedModel(Model &model, int nvertices)
+{
+    static const int kNumBones = 16;
+    Array<Bone *> bones;
+    for (int i = 0; i < kNumBones; i++) {
+        Bone *bone = static_cast<Bone *>(model.createBone());
+        model.addBone(bone);
+        bone->setLocalTransform(Transform(Quaternion(Vector3(0, 1, 0), 0.1f * i), Vector3(0.1f * i, 0, 0)));
+        bones.append(bone);
+    }
+    Material *material = static_cast<Material *>(model.createMaterial());
+    model.addMaterial(material);
+    for (int i = 0; i < nvertices; i++) {
+        Vertex *vertex = static_cast<Vertex *>(model.createVertex());
+        model.addVertex(vertex);
+        vertex->setType(IVertex::kBdef2);
+        vertex->setOrigin(Vector3(0.001f * (i % 1000), 0.001f * (i / 1000), 0));
+        vertex->setNormal(Vector3(0, 0, 1));
+        vertex->setBoneRef(0, bones[i % kNumBones]);
+        vertex->setBoneRef(1, bones[(i + 1) % kNumBones]);
+        vertex->setWeight(0, 0.25f + 0.5f * (i % 2));
+        vertex->setMaterialRef(material);
+    }
+}
+
+static void SetThreadCount(int value)
+{
+#ifdef _OPENMP
+    omp_set_num_threads(value);
+#else
+    (void) value;
+#endif
+}
+
+static int MaxThreadCount()
+{
+#if defined(_OPENMP)
+    return omp_get_num_procs();
+#elif defined(VPVL2_LINK_INTEL_TBB)
+    return tbb::task_scheduler_init::default_num_threads();
+#else
+    return 1;
+#endif
+}
+
+}
+
+TEST(BenchmarkTest, DISABLED_ParallelSkinningVertexProcessorScaling)
+{
+    Encoding encoding(0);
+    Model model(&encoding);
+    const int nvertices = 262144;
+    BuildSkinnedModel(model, nvertices);
+    IModel::IndexBuffer *indexBuffer = 0;
+    model.getIndexBuffer(indexBuffer);
+    QScopedPointer<IModel::IndexBuffer> indexBufferPtr(indexBuffer);
+    IModel::DynamicVertexBuffer *dynamicBuffer = 0;
+    model.getDynamicVertexBuffer(dynamicBuffer, indexBuffer);
+    QScopedPointer<IModel::DynamicVertexBuffer> dynamicBufferPtr(dynamicBuffer);
+    dynamicBuffer->setParallelUpdateEnable(true);
+    Array<uint8> bytes;
+    bytes.resize(int(dynamicBuffer->size()));
+    const int maxThreads = MaxThreadCount();
+    Vector3 baseMin, baseMax;
+    for (int nthreads = 1; ; nthreads = btMin(nthreads * 2, maxThreads)) {
+        SetThreadCount(nthreads);
+#ifdef VPVL2_LINK_INTEL_TBB
+        tbb::task_scheduler_init scheduler(nthreads);
+#endif
+        Vector3 aabbMin, aabbMax;
+        /* warm up caches and thread pools before measuring */
+        dynamicBuffer->update(&bytes[0], kZeroV3, aabbMin, aabbMax);
+        QElapsedTimer timer;
+        timer.start();
+        for (int i = 0; i < kNumIterations; i++) {
+            dynamicBuffer->update(&bytes[0], kZeroV3, aabbMin, aabbMax);
+        }
+        const qint64 elapsed = btMax(timer.nsecsElapsed(), qint64(1));
+        const double verticesPerSecond = (double(nvertices) * kNumIterations) / (elapsed / 1000000000.0);
+        std::cout << "threads=" << nthreads << " vertices/sec=" << verticesPerSecond << std::endl;
+        /* AABB reduction must not depend on the thread count */
+        if (nthreads == 1) {
+            baseMin = aabbMin;
+            baseMax = aabbMax;
+        }
+        else {
+            ASSERT_TRUE(CompareVector(baseMin, aabbMin));
+            ASSERT_TRUE(CompareVector(baseMax, aabbMax));
+        }
+        if (nthreads >= maxThreads) {
+            break;
+        }
+    }
+}
+
+TEST(BenchmarkTest, DISABLED_FindKeyframeIndicesSequentialAndScrub)
+{
+    static const int kNumKeyframes = 20000;
+    static const int kNumSeeks = 1000000;
+    Array<IKeyframe *> keyframes;
+    for (int i = 0; i < kNumKeyframes; i++) {
+        vmd::BoneKeyframe *keyframe = new vmd::BoneKeyframe(0);
+        keyframe->setTimeIndex(i * 3);
+        keyframes.append(keyframe);
+    }
+    const IKeyframe::TimeIndex duration = keyframes[kNumKeyframes - 1]->timeIndex();
+    Array<IKeyframe::TimeIndex> randomIndices;
+    qsrand(42);
+    for (int i = 0; i < kNumSeeks; i++) {
+        randomIndices.append(IKeyframe::TimeIndex(qrand() % int(duration)));
+    }
+    IKeyframe::TimeIndex current;
+    int lastIndex = 0, fromIndex, toIndex;
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < kNumSeeks; i++) {
+        const IKeyframe::TimeIndex seekIndex = duration * i / kNumSeeks;
+        internal::MotionHelper::findKeyframeIndices(seekIndex, current, lastIndex, fromIndex, toIndex, keyframes);
+    }
+    const qint64 sequential = timer.nsecsElapsed();
+    lastIndex = 0;
+    timer.restart();
+    for (int i = 0; i < kNumSeeks; i++) {
+        internal::MotionHelper::findKeyframeIndices(randomIndices[i], current, lastIndex, fromIndex, toIndex, keyframes);
+    }
+    const qint64 scrub = timer.nsecsElapsed();
+    std::cout << "keyframes=" << kNumKeyframes
+              << " sequential ns/seek=" << double(sequential) / kNumSeeks
+              << " scrub ns/seek=" << double(scrub) / kNumSeeks << std::endl;
+    keyframes.releaseAll();
+}
+
+TEST(BenchmarkTest, DISABLED_PMXLoadSerialAndParallel)
+{
+    static const int kNumLoads = 8;
+    const QStringList &filenames = QDir::current().entryList(QStringList() << "*.pmx", QDir::Files);
+    foreach (const QString &filename, filenames) {
+        QFile file(filename);
+        if (!file.open(QFile::ReadOnly)) {
+            continue;
+        }
+        const QByteArray &bytes = file.readAll();
+        const uint8 *data = reinterpret_cast<const uint8 *>(bytes.constData());
+        Encoding::Dictionary dict;
+        Encoding encoding(&dict);
+        qint64 elapsed[2];
+        for (int i = 0; i < 2; i++) {
+            const bool parallel = i == 1;
+            QElapsedTimer timer;
+            timer.start();
+            for (int j = 0; j < kNumLoads; j++) {
+                Model model(&encoding);
+                model.setParallelLoadEnable(parallel);
+                ASSERT_TRUE(model.load(data, bytes.size()));
+            }
+            elapsed[i] = timer.nsecsElapsed();
+        }
+        std::cout << qPrintable(filename)
+                  << " serial ms/load=" << elapsed[0] / (1000000.0 * kNumLoads)
+                  << " parallel ms/load=" << elapsed[1] / (1000000.0 * kNumLoads) << std::endl;
+    }
+}
+
+TEST(BenchmarkTest, DISABLED_PMXVertexCacheStatistics)
+{
+    static const int kCacheSizes[] = { 16, 32 };
+    const QStringList &filenames = QDir::current().entryList(QStringList() << "*.pmx", QDir::Files);
+    foreach (const QString &filename, filenames) {
+        QFile file(filename);
+        if (!file.open(QFile::ReadOnly)) {
+            continue;
+        }
+        const QByteArray &bytes = file.readAll();
+        const uint8 *data = reinterpret_cast<const uint8 *>(bytes.constData());
+        Encoding::Dictionary dict;
+        Encoding encoding(&dict);
+        for (int i = 0; i < int(sizeof(kCacheSizes) / sizeof(kCacheSizes[0])); i++) {
+            const int cacheSize = kCacheSizes[i];
+            Model model(&encoding);
+            ASSERT_TRUE(model.load(data, bytes.size()));
+            Scalar beforeACMR, beforeATVR, afterACMR, afterATVR;
+            model.getVertexCacheStatistics(cacheSize, beforeACMR, beforeATVR);
+            QElapsedTimer timer;
+            timer.start();
+            model.optimizeVertexCache(cacheSize);
+            const qint64 elapsed = timer.nsecsElapsed();
+            model.getVertexCacheStatistics(cacheSize, afterACMR, afterATVR);
+            std::cout << qPrintable(filename) << " cache=" << cacheSize
+                      << " ACMR=" << beforeACMR << "=>" << afterACMR
+                      << " ATVR=" << beforeATVR << "=>" << afterATVR
+                      << " ms=" << elapsed / 1000000.0 << std::endl;
+        }
+    }
+}
+
+TEST(BenchmarkTest, DISABLED_IncrementalBoneUpdate)
+{
+    static const int kNumBones = 1024;
+    static const int kNumUpdates = 1000;
+    static const char *kModeNames[] = { "full", "idle", "partial" };
+    Encoding encoding(0);
+    for (int mode = 0; mode < 3; mode++) {
+        Model model(&encoding);
+        Array<Bone *> bones;
+        BuildBoneTree(model, kNumBones, 4, bones);
+        model.setIncrementalBoneUpdateEnable(mode != 0);
+        model.performUpdate();
+        QElapsedTimer timer;
+        timer.start();
+        for (int i = 0; i < kNumUpdates; i++) {
+            if (mode == 2) {
+                /* animates one leaf bone per frame like a hand or facial motion */
+                Bone *bone = bones[kNumBones - 1 - (i % 64)];
+                bone->setLocalOrientation(Quaternion(Vector3(0, 0, 1), 0.001f * i));
+            }
+            model.performUpdate();
+        }
+        std::cout << "bones=" << kNumBones << " mode=" << kModeNames[mode]
+                  << " us/update=" << timer.nsecsElapsed() / (1000.0 * kNumUpdates) << std::endl;
+    }
+}
+
+TEST(BenchmarkTest, DISABLED_WorldStepSimulation)
+{
+    static const int kNumCopies = 4;
+    static const int kNumSteps = 600;
+    static const char *kModeNames[] = { "shared", "islands", "islands+sleeping" };
+    const QStringList &filenames = QDir::current().entryList(QStringList() << "*.pmx", QDir::Files);
+    QList<QByteArray> fixtures;
+    foreach (const QString &filename, filenames) {
+        QFile file(filename);
+        if (file.open(QFile::ReadOnly)) {
+            fixtures.append(file.readAll());
+        }
+    }
+    Encoding::Dictionary dict;
+    Encoding encoding(&dict);
+    for (int mode = 0; mode < 3; mode++) {
+        extensions::World::Configuration configuration;
+        configuration.enableModelIslands = mode >= 1;
+        configuration.enableSleeping = mode == 2;
+        extensions::World world(configuration);
+        PointerArray<Model> models;
+        foreach (const QByteArray &bytes, fixtures) {
+            for (int i = 0; i < kNumCopies; i++) {
+                Model *model = models.append(new Model(&encoding));
+                ASSERT_TRUE(model->load(reinterpret_cast<const uint8 *>(bytes.constData()), bytes.size()));
+                model->setPhysicsEnable(true);
+                world.addModel(model);
+            }
+        }
+        const Scalar &timeStep = world.fixedTimeStep();
+        const int nmodels = models.count();
+        QElapsedTimer timer;
+        timer.start();
+        for (int i = 0; i < kNumSteps; i++) {
+            world.stepSimulation(timeStep);
+            for (int j = 0; j < nmodels; j++) {
+                models[j]->performUpdate();
+            }
+        }
+        const qint64 elapsed = timer.nsecsElapsed();
+        std::cout << "models=" << nmodels << " mode=" << kModeNames[mode]
+                  << " ms/step=" << elapsed / (1000000.0 * kNumSteps) << std::endl;
+        for (int i = 0; i < nmodels; i++) {
+            world.removeModel(models[i]);
+        }
+        models.releaseAll();
+    }
+}
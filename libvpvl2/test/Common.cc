@@ -3,6 +3,7 @@
 #include "vpvl2/pmx/Bone.h"
 #include "vpvl2/pmx/Joint.h"
 #include "vpvl2/pmx/Material.h"
+#include "vpvl2/pmx/Model.h"
 #include "vpvl2/pmx/RigidBody.h"
 #include "vpvl2/pmx/Vertex.h"
 
@@ -582,3 +583,21 @@ void AssertMatrix(const float *expected, const float *actual)
                                                 << i;
     }
 }
+
+void BuildBoneTree(Model &model, int nbones, int nchildren, Array<Bone *> &bones)
+{
+    for (int i = 0; i < nbones; i++) {
+        Bone *bone = static_cast<Bone *>(model.createBone());
+        model.addBone(bone);
+        bone->setOrigin(Vector3(0.1f * (i % 3), 0.2f * i, 0));
+        if (i > 0) {
+            bone->setParentBoneRef(bones[(i - 1) / nchildren]);
+        }
+        bones.append(bone);
+    }
+    /* the last bone inherits rotation of the second bone to cover dependencies outside of the tree */
+    Bone *bone = bones[nbones - 1];
+    bone->setInherentRotationEnable(true);
+    bone->setInherentTranslationEnable(true);
+    bone->setParentInherentBoneRef(bones[1], 0.5f);
+}
@@ -26,6 +26,7 @@ std::ostream& operator <<(std::ostream &os, const QuadWord &value);
 namespace pmx {
 class Bone;
 class Joint;
+class Model;
 class RigidBody;
 class Vertex;
 }
@@ -70,6 +71,9 @@ static const float kEpsilon = 0.000001;
 
 void AssertMatrix(const float *expected, const float *actual);
 
+/* builds a tree of nbones bones that each bone has nchildren children at most */
+void BuildBoneTree(vpvl2::pmx::Model &model, int nbones, int nchildren, vpvl2::Array<vpvl2::pmx::Bone *> &bones);
+
 struct ScopedPointerListDeleter {
     template<typename T>
     static inline void cleanup(vpvl2::Array<T *> *list) {
@@ -1,7 +1,18 @@
 #include "Common.h"
+#include "vpvl2/IApplicationContext.h"
+#include "vpvl2/extensions/gl/BufferRing.h"
 #include "vpvl2/extensions/icu4c/String.h"
+#include "vpvl2/internal/BlockCompressor.h"
+#include "vpvl2/internal/Culling.h"
 #include "vpvl2/internal/MotionHelper.h"
+#include "vpvl2/internal/Profiler.h"
+#include "vpvl2/internal/RenderStateCache.h"
+#include "vpvl2/internal/WorkerPool.h"
 #include "vpvl2/internal/util.h"
+#include "vpvl2/pmx/Material.h"
+#include "vpvl2/vmd/BoneKeyframe.h"
+#include "mock/Model.h"
+#include <cstddef>
 #include <limits>
 
 using namespace ::testing;
@@ -16,6 +27,73 @@ TEST(InternalTest, Lerp)
     ASSERT_EQ(3.0, vpvl2::internal::MotionHelper::lerp(4, 2, 0.5));
 }
 
+namespace
+{
+
+/* the previous linear scan implementation used as a reference */
+static void FindKeyframeIndicesLinear(const IKeyframe::TimeIndex &seekIndex,
+                                      IKeyframe::TimeIndex &currentKeyframe,
+                                      int &lastIndex,
+                                      int &fromIndex,
+                                      int &toIndex,
+                                      const Array<IKeyframe *> &keyframes)
+{
+    const int nframes = keyframes.count();
+    currentKeyframe = btMin(seekIndex, keyframes[nframes - 1]->timeIndex());
+    fromIndex = toIndex = 0;
+    if (currentKeyframe >= keyframes[lastIndex]->timeIndex()) {
+        for (int i = lastIndex; i < nframes; i++) {
+            if (currentKeyframe <= keyframes[i]->timeIndex()) {
+                toIndex = i;
+                break;
+            }
+        }
+    }
+    else {
+        for (int i = 0; i <= lastIndex && i < nframes; i++) {
+            if (currentKeyframe <= keyframes[i]->timeIndex()) {
+                toIndex = i;
+                break;
+            }
+        }
+    }
+    if (toIndex >= nframes) {
+        toIndex = nframes - 1;
+    }
+    fromIndex = toIndex <= 1 ? 0 : toIndex - 1;
+    lastIndex = fromIndex;
+}
+
+}
+
+TEST(InternalTest, FindKeyframeIndices)
+{
+    Array<IKeyframe *> keyframes;
+    IKeyframe::TimeIndex timeIndex = 0;
+    for (int i = 0; i < 500; i++) {
+        vmd::BoneKeyframe *keyframe = new vmd::BoneKeyframe(0);
+        keyframe->setTimeIndex(timeIndex);
+        keyframes.append(keyframe);
+        /* contains keyframes that have the same time index */
+        timeIndex += i % 7 == 0 ? 0 : (i % 5) + 1;
+    }
+    IKeyframe::TimeIndex expectedCurrent, actualCurrent;
+    int expectedLastIndex = 0, actualLastIndex = 0, expectedFrom, expectedTo, actualFrom, actualTo;
+    qsrand(42);
+    for (int i = 0; i < 10000; i++) {
+        /* mixes sequential playback, short steps back and random jumps including out of range */
+        const IKeyframe::TimeIndex seekIndex = i % 3 == 0 ? IKeyframe::TimeIndex(qrand() % int(timeIndex + 100))
+                                                          : actualCurrent + (i % 3 == 1 ? 1.5 : -0.5);
+        FindKeyframeIndicesLinear(seekIndex, expectedCurrent, expectedLastIndex, expectedFrom, expectedTo, keyframes);
+        MotionHelper::findKeyframeIndices(seekIndex, actualCurrent, actualLastIndex, actualFrom, actualTo, keyframes);
+        ASSERT_EQ(expectedCurrent, actualCurrent);
+        ASSERT_EQ(expectedFrom, actualFrom) << "seekIndex=" << seekIndex;
+        ASSERT_EQ(expectedTo, actualTo) << "seekIndex=" << seekIndex;
+        ASSERT_EQ(expectedLastIndex, actualLastIndex);
+    }
+    keyframes.releaseAll();
+}
+
 TEST(InternalTest, Size32)
 {
     QByteArray bytes;
@@ -244,3 +322,1051 @@ TEST(InternalTest, ToggleFlag)
     vpvl2::internal::toggleFlag(0x0400, false, flag);
     ASSERT_EQ(0x0000, int(flag));
 }
+
+namespace {
+
+class CountTask : public WorkerPool::ITask {
+public:
+    CountTask(Mutex *mutexRef, int *counterRef)
+        : m_mutexRef(mutexRef),
+          m_counterRef(counterRef)
+    {
+    }
+    void execute() {
+        ScopedLock locker(*m_mutexRef);
+        (*m_counterRef)++;
+    }
+
+private:
+    Mutex *m_mutexRef;
+    int *m_counterRef;
+};
+
+struct PushResult {
+    PushResult()
+        : npushed(0),
+          nfailed(0)
+    {
+    }
+    Mutex mutex;
+    Condition condition;
+    int npushed;
+    int nfailed;
+};
+
+class PushTask : public WorkerPool::ITask {
+public:
+    PushTask(BoundedQueue<int> *queueRef, int value, PushResult *resultRef)
+        : m_queueRef(queueRef),
+          m_value(value),
+          m_resultRef(resultRef)
+    {
+    }
+    void execute() {
+        bool ok = m_queueRef->push(m_value);
+        ScopedLock locker(m_resultRef->mutex);
+        if (ok) {
+            m_resultRef->npushed++;
+        }
+        else {
+            m_resultRef->nfailed++;
+        }
+        m_resultRef->condition.notifyAll();
+    }
+
+private:
+    BoundedQueue<int> *m_queueRef;
+    int m_value;
+    PushResult *m_resultRef;
+};
+
+}
+
+TEST(InternalTest, WorkerPoolExecutesAllTasks)
+{
+    Mutex mutex;
+    int counter = 0;
+    WorkerPool pool(4);
+    ASSERT_EQ(4, pool.countThreads());
+    for (int i = 0; i < 1000; i++) {
+        pool.enqueue(new CountTask(&mutex, &counter));
+    }
+    pool.waitForCompletion();
+    ASSERT_EQ(0, pool.countPendingTasks());
+    ASSERT_EQ(1000, counter);
+}
+
+TEST(InternalTest, BoundedQueueBlocksProducers)
+{
+    BoundedQueue<int> queue(2);
+    PushResult result;
+    int sum = 0, value = 0;
+    {
+        WorkerPool pool(2);
+        for (int i = 1; i <= 10; i++) {
+            pool.enqueue(new PushTask(&queue, i, &result));
+        }
+        /* producers wait for the consumer instead of growing the queue */
+        for (int i = 0; i < 10; i++) {
+            ASSERT_LE(queue.count(), queue.capacity());
+            ASSERT_TRUE(queue.pop(value));
+            sum += value;
+        }
+        pool.waitForCompletion();
+    }
+    ASSERT_EQ(55, sum);
+    ASSERT_EQ(10, result.npushed);
+    ASSERT_EQ(0, result.nfailed);
+    ASSERT_FALSE(queue.tryPop(value));
+    /* closing the queue wakes up the waiting producer */
+    PushResult closed;
+    {
+        WorkerPool pool(1);
+        pool.enqueue(new PushTask(&queue, 1, &closed));
+        pool.enqueue(new PushTask(&queue, 2, &closed));
+        pool.enqueue(new PushTask(&queue, 3, &closed));
+        {
+            ScopedLock locker(closed.mutex);
+            while (closed.npushed < queue.capacity()) {
+                closed.condition.wait(closed.mutex);
+            }
+        }
+        queue.close();
+        pool.waitForCompletion();
+    }
+    ASSERT_EQ(2, closed.npushed);
+    ASSERT_EQ(1, closed.nfailed);
+    ASSERT_TRUE(queue.pop(value));
+    ASSERT_EQ(1, value);
+    ASSERT_TRUE(queue.pop(value));
+    ASSERT_EQ(2, value);
+    ASSERT_FALSE(queue.pop(value));
+}
+
+namespace {
+
+void decodeBC1ColorBlock(const uint8 *input, uint8 *block)
+{
+    const uint16 color0 = uint16(input[0] | input[1] << 8), color1 = uint16(input[2] | input[3] << 8);
+    const int colors[2][3] = {
+        { ((color0 >> 11) & 0x1f) * 255 / 31, ((color0 >> 5) & 0x3f) * 255 / 63, (color0 & 0x1f) * 255 / 31 },
+        { ((color1 >> 11) & 0x1f) * 255 / 31, ((color1 >> 5) & 0x3f) * 255 / 63, (color1 & 0x1f) * 255 / 31 }
+    };
+    const uint32 indices = uint32(input[4] | input[5] << 8 | input[6] << 16 | uint32(input[7]) << 24);
+    for (int i = 0; i < 16; i++) {
+        const int index = (indices >> (i * 2)) & 0x3;
+        for (int c = 0; c < 3; c++) {
+            const int values[] = { colors[0][c], colors[1][c], (colors[0][c] * 2 + colors[1][c]) / 3, (colors[0][c] + colors[1][c] * 2) / 3 };
+            block[i * 4 + c] = uint8(values[index]);
+        }
+    }
+}
+
+void decodeBC3AlphaBlock(const uint8 *input, uint8 *block)
+{
+    const int alpha0 = input[0], alpha1 = input[1];
+    uint64 indices = 0;
+    for (int i = 0; i < 6; i++) {
+        indices |= uint64(input[2 + i]) << (i * 8);
+    }
+    for (int i = 0; i < 16; i++) {
+        const int index = int((indices >> (i * 3)) & 0x7);
+        int value = 0;
+        if (index == 0) {
+            value = alpha0;
+        }
+        else if (index == 1) {
+            value = alpha1;
+        }
+        else {
+            value = ((8 - index) * alpha0 + (index - 1) * alpha1) / 7;
+        }
+        block[i * 4 + 3] = uint8(value);
+    }
+}
+
+}
+
+TEST(InternalTest, BlockCompressorSize)
+{
+    ASSERT_EQ(vsize(8), BlockCompressor::compressedSize(1, 1, false));
+    ASSERT_EQ(vsize(16), BlockCompressor::compressedSize(5, 3, false));
+    ASSERT_EQ(vsize(64), BlockCompressor::compressedSize(8, 8, true));
+}
+
+TEST(InternalTest, BlockCompressorBC1)
+{
+    uint8 pixels[8 * 8 * 4], compressed[4 * 8], block[16 * 4];
+    for (int y = 0; y < 8; y++) {
+        for (int x = 0; x < 8; x++) {
+            uint8 *p = pixels + (y * 8 + x) * 4;
+            /* colors along the anti diagonal of the RGB cube */
+            p[0] = uint8((y * 8 + x) * 4);
+            p[1] = uint8(255 - (y * 8 + x) * 4);
+            p[2] = 0x80;
+            p[3] = 0xff;
+        }
+    }
+    ASSERT_FALSE(BlockCompressor::hasTransparentPixels(pixels, 8, 8));
+    BlockCompressor::compress(pixels, 8, 8, false, false, compressed);
+    for (int i = 0; i < 4; i++) {
+        const int bx = (i % 2) * 4, by = (i / 2) * 4;
+        decodeBC1ColorBlock(compressed + i * 8, block);
+        for (int j = 0; j < 16; j++) {
+            const uint8 *p = pixels + ((by + j / 4) * 8 + bx + j % 4) * 4;
+            for (int c = 0; c < 3; c++) {
+                ASSERT_NEAR(int(p[c]), int(block[j * 4 + c]), 12);
+            }
+        }
+    }
+    /* BGRA is swizzled to RGBA before encoding */
+    uint8 bgra[4 * 4 * 4];
+    for (int i = 0; i < 16; i++) {
+        bgra[i * 4 + 0] = 0x00;
+        bgra[i * 4 + 1] = 0x00;
+        bgra[i * 4 + 2] = 0xff;
+        bgra[i * 4 + 3] = 0xff;
+    }
+    BlockCompressor::compress(bgra, 4, 4, false, true, compressed);
+    decodeBC1ColorBlock(compressed, block);
+    ASSERT_EQ(0xff, int(block[0]));
+    ASSERT_EQ(0x00, int(block[2]));
+}
+
+TEST(InternalTest, BlockCompressorBC3)
+{
+    uint8 pixels[4 * 4 * 4], compressed[16], block[16 * 4];
+    for (int i = 0; i < 16; i++) {
+        pixels[i * 4 + 0] = 0xff;
+        pixels[i * 4 + 1] = 0xff;
+        pixels[i * 4 + 2] = 0xff;
+        pixels[i * 4 + 3] = uint8(i * 17);
+    }
+    ASSERT_TRUE(BlockCompressor::hasTransparentPixels(pixels, 4, 4));
+    BlockCompressor::compress(pixels, 4, 4, true, false, compressed);
+    decodeBC3AlphaBlock(compressed, block);
+    decodeBC1ColorBlock(compressed + 8, block);
+    for (int i = 0; i < 16; i++) {
+        ASSERT_NEAR(int(pixels[i * 4 + 3]), int(block[i * 4 + 3]), 19);
+        ASSERT_EQ(0xff, int(block[i * 4 + 0]));
+    }
+}
+
+TEST(InternalTest, ProfilerRecordsNestedSpans)
+{
+    if (!Profiler::isAvailable()) {
+        return;
+    }
+    int model, material;
+    Array<Profiler::Span> spans;
+    Profiler::reset();
+    Profiler::setEnabled(true);
+    Profiler::begin(IApplicationContext::kProfileRenderModelProcess, &model);
+    Profiler::begin(IApplicationContext::kProfileRenderModelMaterialDrawCall, &material);
+    Profiler::end();
+    Profiler::end();
+    /* unbalanced end call must be ignored */
+    Profiler::end();
+    Profiler::setEnabled(false);
+    Profiler::begin(IApplicationContext::kProfileRenderModelProcess, &model);
+    Profiler::end();
+    Profiler::collect(spans);
+    ASSERT_EQ(2, spans.count());
+    const Profiler::Span &outer = spans[0], &inner = spans[1];
+    ASSERT_EQ(IApplicationContext::kProfileRenderModelProcess, outer.type);
+    ASSERT_EQ(&model, outer.argRef);
+    ASSERT_EQ(0, outer.depth);
+    ASSERT_EQ(IApplicationContext::kProfileRenderModelMaterialDrawCall, inner.type);
+    ASSERT_EQ(&material, inner.argRef);
+    ASSERT_EQ(&model, inner.parentArgRef);
+    ASSERT_EQ(1, inner.depth);
+    ASSERT_LE(outer.start, inner.start);
+    ASSERT_GE(outer.end, inner.end);
+    ASSERT_EQ(outer.track, inner.track);
+    Profiler::reset();
+}
+
+TEST(InternalTest, ProfilerAggregatesByArgument)
+{
+    if (!Profiler::isAvailable()) {
+        return;
+    }
+    int material1, material2;
+    Array<Profiler::Span> spans;
+    Array<Profiler::Stats> stats;
+    Profiler::reset();
+    Profiler::setEnabled(true);
+    Profiler::record(IApplicationContext::kProfileRenderModelMaterialDrawCall, &material1, 0, 10, 0);
+    Profiler::record(IApplicationContext::kProfileRenderModelMaterialDrawCall, &material1, 20, 50, 0);
+    Profiler::record(IApplicationContext::kProfileRenderModelMaterialDrawCall, &material2, 60, 65, 0);
+    Profiler::setEnabled(false);
+    Profiler::collect(spans);
+    Profiler::aggregate(spans, stats);
+    ASSERT_EQ(2, stats.count());
+    ASSERT_EQ(&material1, stats[0].argRef);
+    ASSERT_EQ(2, stats[0].count);
+    ASSERT_EQ(40, stats[0].total);
+    ASSERT_EQ(10, stats[0].min);
+    ASSERT_EQ(30, stats[0].max);
+    ASSERT_EQ(&material2, stats[1].argRef);
+    ASSERT_EQ(1, stats[1].count);
+    ASSERT_EQ(5, stats[1].total);
+    Profiler::reset();
+}
+
+TEST(InternalTest, ProfilerRingBufferKeepsLatestSpans)
+{
+    if (!Profiler::isAvailable()) {
+        return;
+    }
+    Array<Profiler::Span> spans;
+    Profiler::setCapacity(4);
+    Profiler::setEnabled(true);
+    for (int i = 0; i < 10; i++) {
+        Profiler::record(IApplicationContext::kProfileSeekMotionProcess, 0, i, i + 1, 0);
+    }
+    Profiler::setEnabled(false);
+    Profiler::collect(spans);
+    ASSERT_EQ(4, spans.count());
+    for (int i = 0; i < 4; i++) {
+        ASSERT_EQ(6 + i, spans[i].start);
+    }
+    Profiler::setCapacity(Profiler::kDefaultCapacity);
+}
+
+namespace {
+
+static const float32 kIdentityMatrix[] = {
+    1, 0, 0, 0,
+    0, 1, 0, 0,
+    0, 0, 1, 0,
+    0, 0, 0, 1
+};
+
+struct MaterialAabbVertex {
+    float32 position[4];
+    float32 edge[4];
+};
+
+struct MaterialAabbVertexBuffer : IModel::DynamicVertexBuffer {
+    vsize size() const { return 0; }
+    vsize strideOffset(StrideType type) const {
+        return type == kEdgeVertexStride ? offsetof(MaterialAabbVertex, edge) : offsetof(MaterialAabbVertex, position);
+    }
+    vsize strideSize() const { return sizeof(MaterialAabbVertex); }
+    const void *ident() const { return this; }
+    void update(void * /* address */, const Vector3 & /* cameraPosition */, Vector3 & /* aabbMin */, Vector3 & /* aabbMax */) const {}
+    void setParallelUpdateEnable(bool /* value */) {}
+    void setSkinningEnable(bool /* value */) {}
+    bool getMaterialAabb(int materialIndex, Vector3 &aabbMin, Vector3 &aabbMax) const {
+        return aabbs.get(materialIndex, aabbMin, aabbMax);
+    }
+    MaterialAabbList aabbs;
+};
+
+struct MaterialAabbIndexBuffer : IModel::IndexBuffer {
+    vsize size() const { return strideSize() * indices.count(); }
+    vsize strideOffset(StrideType /* type */) const { return 0; }
+    vsize strideSize() const { return sizeof(int); }
+    const void *ident() const { return this; }
+    const void *bytes() const { return &indices[0]; }
+    int indexAt(int value) const { return indices[value]; }
+    Type type() const { return kIndex32; }
+    Array<int> indices;
+};
+
+static void SetMaterialAabbVertex(MaterialAabbVertex &vertex, const Vector3 &position, const Vector3 &edge)
+{
+    for (int i = 0; i < 3; i++) {
+        vertex.position[i] = position[i];
+        vertex.edge[i] = edge[i];
+    }
+    vertex.position[3] = vertex.edge[3] = 0;
+}
+
+/* materials of which index ranges are laid out in order as the model does */
+struct MaterialAabbModel {
+    MaterialAabbModel(const int *indices, const int *nmaterialIndices, int nmaterials) {
+        int nindices = 0;
+        for (int i = 0; i < nmaterials; i++) {
+            pmx::Material *material = materials.append(new pmx::Material(0));
+            IMaterial::IndexRange range;
+            range.start = nindices;
+            range.count = nmaterialIndices[i];
+            range.end = nindices + range.count;
+            material->setIndexRange(range);
+            material->setDiffuse(Color(1, 1, 1, 1));
+            materialRefs.append(material);
+            nindices += range.count;
+        }
+        for (int i = 0; i < nindices; i++) {
+            indexBuffer.indices.append(indices[i]);
+        }
+    }
+    ~MaterialAabbModel() {
+        materials.releaseAll();
+    }
+    /* reduces even and odd vertices in different slots as skinning processors do */
+    void update(MaterialAabbList &list, const MaterialAabbVertex *vertices, int nvertices) const {
+        list.build(materialRefs, &indexBuffer, nvertices);
+        list.beginReduction(2);
+        for (int i = 0; i < nvertices; i++) {
+            const float32 *position = vertices[i].position, *edge = vertices[i].edge;
+            list.reduce(i % 2, i, Vector3(position[0], position[1], position[2]), Vector3(edge[0], edge[1], edge[2]));
+        }
+        list.endReduction(2);
+    }
+    void getMaterialRefs(Array<IMaterial *> &value) const {
+        value.copy(materialRefs);
+    }
+    MaterialAabbIndexBuffer indexBuffer;
+    PointerArray<pmx::Material> materials;
+    Array<IMaterial *> materialRefs;
+};
+
+static void RasterizeQuad(OcclusionBuffer &buffer, const Scalar &left, const Scalar &right, const Scalar &depth)
+{
+    const Vector3 v0(left, -1, depth), v1(right, -1, depth), v2(right, 1, depth), v3(left, 1, depth);
+    buffer.rasterizeTriangle(v0, v1, v2);
+    buffer.rasterizeTriangle(v0, v2, v3);
+}
+
+}
+
+TEST(InternalTest, ViewFrustumIntersectsAabb)
+{
+    ViewFrustum frustum;
+    frustum.setMatrix(kIdentityMatrix);
+    ASSERT_TRUE(frustum.intersectsAabb(Vector3(-0.5, -0.5, -0.5), Vector3(0.5, 0.5, 0.5)));
+    /* partially inside */
+    ASSERT_TRUE(frustum.intersectsAabb(Vector3(0.5, 0.5, 0.5), Vector3(2, 2, 2)));
+    /* larger than the frustum */
+    ASSERT_TRUE(frustum.intersectsAabb(Vector3(-4, -4, -4), Vector3(4, 4, 4)));
+    ASSERT_FALSE(frustum.intersectsAabb(Vector3(1.5, -0.5, -0.5), Vector3(2, 0.5, 0.5)));
+    ASSERT_FALSE(frustum.intersectsAabb(Vector3(-0.5, -0.5, -3), Vector3(0.5, 0.5, -2)));
+    Vector3 ndcMin, ndcMax;
+    ASSERT_TRUE(frustum.projectAabb(Vector3(-0.5, -0.25, 0), Vector3(0.5, 0.25, 0.5), ndcMin, ndcMax));
+    ASSERT_FLOAT_EQ(-0.5f, ndcMin.x());
+    ASSERT_FLOAT_EQ(0.25f, ndcMax.y());
+    ASSERT_FLOAT_EQ(0.0f, ndcMin.z());
+    /* translation along x by 4 moves everything outside */
+    float32 matrix[16];
+    memcpy(matrix, kIdentityMatrix, sizeof(matrix));
+    matrix[12] = 4;
+    frustum.setMatrix(matrix);
+    ASSERT_FALSE(frustum.intersectsAabb(Vector3(-0.5, -0.5, -0.5), Vector3(0.5, 0.5, 0.5)));
+}
+
+TEST(InternalTest, OcclusionBufferTestsCoveredRectangles)
+{
+    OcclusionBuffer buffer;
+    ASSERT_FALSE(buffer.isOccluded(Vector3(-0.5, -0.5, 0.5), Vector3(0.5, 0.5, 0.6)));
+    /* covers the left half of the screen */
+    RasterizeQuad(buffer, -1, 0, 0);
+    ASSERT_EQ(2, buffer.countRasterizedTriangles());
+    ASSERT_FLOAT_EQ(0.0f, buffer.depthAt(0, 0));
+    ASSERT_EQ(SIMD_INFINITY, buffer.depthAt(buffer.width() - 1, 0));
+    ASSERT_TRUE(buffer.isOccluded(Vector3(-0.8f, -0.5, 0.5), Vector3(-0.2f, 0.5, 0.6)));
+    /* in front of the occluder */
+    ASSERT_FALSE(buffer.isOccluded(Vector3(-0.8f, -0.5, -0.5), Vector3(-0.2f, 0.5, 0.6)));
+    /* crosses the uncovered half */
+    ASSERT_FALSE(buffer.isOccluded(Vector3(-0.5, -0.5, 0.5), Vector3(0.5, 0.5, 0.6)));
+    /* the nearest occluder is kept and windings do not matter */
+    const Vector3 v0(-1, -1, -0.5), v1(0, 1, -0.5), v2(0, -1, -0.5);
+    buffer.rasterizeTriangle(v0, v1, v2);
+    ASSERT_FLOAT_EQ(-0.5f, buffer.depthAt(buffer.width() / 2 - 1, 0));
+    buffer.clear();
+    ASSERT_EQ(0, buffer.countRasterizedTriangles());
+    ASSERT_FALSE(buffer.isOccluded(Vector3(-0.8f, -0.5, 0.5), Vector3(-0.2f, 0.5, 0.6)));
+}
+
+TEST(InternalTest, MaterialAabbListUnitesSharedVertices)
+{
+    MaterialAabbVertex vertices[6];
+    for (int i = 0; i < 6; i++) {
+        const Vector3 position(i, i * 2, -i);
+        SetMaterialAabbVertex(vertices[i], position, position + Vector3(0, 0, 1));
+    }
+    /* the vertices 0 and 2 are shared by both materials and the index 9 is out of range */
+    const int indices[] = { 0, 1, 2, 2, 3, 5, 5, 4, 0, 9, 0, 0 };
+    const int nmaterialIndices[] = { 3, 9, 0 };
+    MaterialAabbModel model(indices, nmaterialIndices, 3);
+    MaterialAabbList list;
+    ASSERT_FALSE(list.isBuilt());
+    model.update(list, vertices, 6);
+    ASSERT_TRUE(list.isBuilt());
+    ASSERT_EQ(3, list.count());
+    Vector3 aabbMin, aabbMax;
+    ASSERT_TRUE(list.get(0, aabbMin, aabbMax));
+    ASSERT_TRUE(CompareVector(Vector3(0, 0, -2), aabbMin));
+    ASSERT_TRUE(CompareVector(Vector3(2, 4, 1), aabbMax));
+    ASSERT_TRUE(list.get(1, aabbMin, aabbMax));
+    ASSERT_TRUE(CompareVector(Vector3(0, 0, -5), aabbMin));
+    ASSERT_TRUE(CompareVector(Vector3(5, 10, 1), aabbMax));
+    /* material without vertices and out of range */
+    ASSERT_FALSE(list.get(2, aabbMin, aabbMax));
+    ASSERT_FALSE(list.get(3, aabbMin, aabbMax));
+    list.invalidate();
+    ASSERT_TRUE(list.isBuilt());
+    ASSERT_FALSE(list.get(0, aabbMin, aabbMax));
+    /* vertices out of range are ignored */
+    list.beginReduction(1);
+    list.reduce(0, 9, Vector3(1, 1, 1), Vector3(1, 1, 1));
+    list.endReduction(1);
+    ASSERT_EQ(3, list.count());
+    ASSERT_FALSE(list.get(0, aabbMin, aabbMax));
+}
+
+TEST(InternalTest, MaterialCullerCountsDrawCalls)
+{
+    MaterialAabbVertex vertices[4];
+    SetMaterialAabbVertex(vertices[0], Vector3(-0.5, -0.5, 0.2f), Vector3(-0.5, -0.5, 0.2f));
+    SetMaterialAabbVertex(vertices[1], Vector3(-0.2f, 0.5, 0.5), Vector3(-0.2f, 0.5, 0.5));
+    SetMaterialAabbVertex(vertices[2], Vector3(2, 2, 2), Vector3(2, 2, 2));
+    SetMaterialAabbVertex(vertices[3], Vector3(3, 3, 3), Vector3(3, 3, 3));
+    const int indices[] = { 0, 1, 0, 2, 3, 2 };
+    const int nmaterialIndices[] = { 3, 3, 0 };
+    MaterialAabbModel model(indices, nmaterialIndices, 3);
+    MaterialAabbVertexBuffer buffer;
+    model.update(buffer.aabbs, vertices, 4);
+    CullingContext context;
+    context.setFlags(Scene::kFrustumCulling);
+    MaterialCuller culler(&context);
+    culler.begin(MaterialCuller::kModelPass, &buffer, kIdentityMatrix, kIdentityMatrix);
+    ASSERT_TRUE(culler.testMaterial(0));
+    ASSERT_FALSE(culler.testMaterial(1));
+    /* the material 2 has no AABB and is always drawn */
+    ASSERT_TRUE(culler.testMaterial(2));
+    ASSERT_EQ(2, context.countDrawCalls());
+    ASSERT_EQ(1, context.countFrustumCulledDrawCalls());
+    ASSERT_EQ(0, context.countOcclusionCulledDrawCalls());
+    ASSERT_FALSE(culler.testAabb(kIdentityMatrix, Vector3(2, 2, 2), Vector3(3, 3, 3)));
+    context.setFlags(Scene::kFrustumCulling | Scene::kOcclusionCulling);
+    culler.begin(MaterialCuller::kModelPass, &buffer, kIdentityMatrix, kIdentityMatrix);
+    RasterizeQuad(*context.occlusionBufferRef(), -1, 0, 0);
+    ASSERT_FALSE(culler.testMaterial(0));
+    ASSERT_EQ(1, context.countOcclusionCulledDrawCalls());
+    /* the shadow pass does not use the occlusion buffer of the camera */
+    culler.begin(MaterialCuller::kShadowPass, &buffer, kIdentityMatrix, 0);
+    ASSERT_TRUE(culler.testMaterial(0));
+    /* same view projection keeps occluders */
+    culler.begin(MaterialCuller::kModelPass, &buffer, kIdentityMatrix, kIdentityMatrix);
+    ASSERT_FALSE(culler.testMaterial(0));
+    context.invalidate();
+    ASSERT_EQ(0, context.countDrawCalls());
+    ASSERT_TRUE(culler.testMaterial(0));
+    /* no culling without AABBs of the buffer */
+    culler.begin(MaterialCuller::kModelPass, 0, kIdentityMatrix, kIdentityMatrix);
+    ASSERT_TRUE(culler.testMaterial(1));
+    MaterialCuller disabled(0);
+    ASSERT_TRUE(disabled.testMaterial(1));
+}
+
+TEST(InternalTest, MaterialCullerSkipsTranslucentOccluders)
+{
+    /* the material 0 covers the left half of the screen and the material 1 covers the right half */
+    MaterialAabbVertex vertices[8];
+    const Scalar xs[] = { -1, 0, 0, -1, 0, 1, 1, 0 }, ys[] = { -1, -1, 1, 1, -1, -1, 1, 1 };
+    for (int i = 0; i < 8; i++) {
+        const Vector3 position(xs[i], ys[i], 0);
+        SetMaterialAabbVertex(vertices[i], position, position);
+    }
+    const int indices[] = { 0, 1, 2, 0, 2, 3, 4, 5, 6, 4, 6, 7 };
+    const int nmaterialIndices[] = { 6, 6 };
+    MaterialAabbModel aabbModel(indices, nmaterialIndices, 2);
+    MaterialAabbVertexBuffer buffer;
+    aabbModel.update(buffer.aabbs, vertices, 8);
+    MockIModel model;
+    EXPECT_CALL(model, opacity()).WillRepeatedly(Return(1));
+    EXPECT_CALL(model, getMaterialRefs(_)).WillRepeatedly(Invoke(&aabbModel, &MaterialAabbModel::getMaterialRefs));
+    CullingContext context;
+    context.setFlags(Scene::kFrustumCulling | Scene::kOcclusionCulling);
+    MaterialCuller culler(&context);
+    culler.begin(MaterialCuller::kModelPass, &buffer, kIdentityMatrix, kIdentityMatrix);
+    ASSERT_TRUE(culler.testMaterial(0));
+    ASSERT_TRUE(culler.testMaterial(1));
+    /* the main texture of the material 1 has alpha channel and may cut out pixels */
+    Array<bool> opaqueMaterials;
+    opaqueMaterials.append(true);
+    opaqueMaterials.append(false);
+    culler.rasterizeOccluders(&model, reinterpret_cast<const uint8 *>(vertices), &aabbModel.indexBuffer, opaqueMaterials);
+    const OcclusionBuffer *occlusionBuffer = context.occlusionBufferRef();
+    ASSERT_EQ(2, occlusionBuffer->countRasterizedTriangles());
+    ASSERT_TRUE(occlusionBuffer->isOccluded(Vector3(-0.8f, -0.5, 0.5), Vector3(-0.2f, 0.5, 0.6)));
+    ASSERT_FALSE(occlusionBuffer->isOccluded(Vector3(0.2f, -0.5, 0.5), Vector3(0.8f, 0.5, 0.6)));
+    /* double sided materials are not occluders either */
+    pmx::Material *material = aabbModel.materials[0];
+    material->setFlags(IMaterial::kDisableCulling);
+    context.invalidate();
+    culler.rasterizeOccluders(&model, reinterpret_cast<const uint8 *>(vertices), &aabbModel.indexBuffer, opaqueMaterials);
+    ASSERT_EQ(0, occlusionBuffer->countRasterizedTriangles());
+}
+
+namespace {
+
+struct NamedTexture : ITexture {
+    NamedTexture(intptr_t name) : name(name) {}
+    void create() {}
+    void bind() {}
+    void resize(const Vector3 & /* size */) {}
+    void unbind() {}
+    void release() {}
+    Vector3 size() const { return kZeroV3; }
+    intptr_t data() const { return name; }
+    intptr_t sampler() const { return 0; }
+    intptr_t format() const { return 0; }
+    intptr_t name;
+};
+
+/* counts GL calls that gl2::ModelProgram issues through the caches */
+struct RecordedGLCalls {
+    RecordedGLCalls() : nlocations(0) { reset(); }
+    /* locations are kept to be unique in the process */
+    void reset() {
+        nuniforms = nbinds = nactiveTextures = ncapabilities = 0;
+    }
+    int nuniforms;
+    int nbinds;
+    int nactiveTextures;
+    int ncapabilities;
+    GLint nlocations;
+};
+static RecordedGLCalls g_recordedGLCalls;
+
+static void RecordUniform1i(GLint /* location */, GLint /* value */) { g_recordedGLCalls.nuniforms++; }
+static void RecordUniform1f(GLint /* location */, GLfloat /* value */) { g_recordedGLCalls.nuniforms++; }
+static void RecordUniformfv(GLint /* location */, GLsizei /* count */, const GLfloat * /* value */) { g_recordedGLCalls.nuniforms++; }
+static void RecordUniformMatrixfv(GLint /* location */, GLsizei /* count */, GLboolean /* transpose */, const GLfloat * /* value */) { g_recordedGLCalls.nuniforms++; }
+static void RecordActiveTexture(GLenum /* unit */) { g_recordedGLCalls.nactiveTextures++; }
+static void RecordBindTexture(GLenum /* target */, GLuint /* name */) { g_recordedGLCalls.nbinds++; }
+static void RecordCapability(GLenum /* capability */) { g_recordedGLCalls.ncapabilities++; }
+static GLint RecordGetUniformLocation(GLuint /* program */, const GLchar * /* name */) { return g_recordedGLCalls.nlocations++; }
+static void RecordBindAttribLocation(GLuint /* program */, GLuint /* index */, const GLchar * /* name */) {}
+static GLuint RecordCreateProgram() { return 1; }
+static GLuint RecordCreateShader(GLenum /* type */) { return 1; }
+static void RecordShaderSource(GLuint /* shader */, GLsizei /* count */, const GLchar *const * /* source */, const GLint * /* length */) {}
+static void RecordObject(GLuint /* object */) {}
+static void RecordAttachShader(GLuint /* program */, GLuint /* shader */) {}
+static void RecordGetObjectiv(GLuint /* object */, GLenum /* name */, GLint *value) { *value = GL_TRUE; }
+static void RecordGetInfoLog(GLuint /* object */, GLsizei /* size */, GLsizei * /* length */, GLchar * /* log */) {}
+
+}
+
+/*
+ * compiles the model program of gl2::PMXRenderEngine against the recording functions above.
+ * namespaces are renamed not to be mixed with the program compiled into the library.
+ */
+#undef glUniform1i
+#undef glUniform1f
+#undef glUniform2fv
+#undef glUniform3fv
+#undef glUniform4fv
+#undef glUniformMatrix3fv
+#undef glUniformMatrix4fv
+#undef glActiveTexture
+#undef glBindTexture
+#undef glEnable
+#undef glDisable
+#undef glGetUniformLocation
+#undef glBindAttribLocation
+#undef glCreateProgram
+#undef glDeleteProgram
+#undef glCreateShader
+#undef glShaderSource
+#undef glCompileShader
+#undef glGetShaderiv
+#undef glGetShaderInfoLog
+#undef glAttachShader
+#undef glDeleteShader
+#undef glLinkProgram
+#undef glGetProgramiv
+#undef glGetProgramInfoLog
+#undef glUseProgram
+#define glUniform1i RecordUniform1i
+#define glUniform1f RecordUniform1f
+#define glUniform2fv RecordUniformfv
+#define glUniform3fv RecordUniformfv
+#define glUniform4fv RecordUniformfv
+#define glUniformMatrix3fv RecordUniformMatrixfv
+#define glUniformMatrix4fv RecordUniformMatrixfv
+#define glActiveTexture RecordActiveTexture
+#define glBindTexture RecordBindTexture
+#define glEnable RecordCapability
+#define glDisable RecordCapability
+#define glGetUniformLocation RecordGetUniformLocation
+#define glBindAttribLocation RecordBindAttribLocation
+#define glCreateProgram RecordCreateProgram
+#define glDeleteProgram RecordObject
+#define glCreateShader RecordCreateShader
+#define glShaderSource RecordShaderSource
+#define glCompileShader RecordObject
+#define glGetShaderiv RecordGetObjectiv
+#define glGetShaderInfoLog RecordGetInfoLog
+#define glAttachShader RecordAttachShader
+#define glDeleteShader RecordObject
+#define glLinkProgram RecordObject
+#define glGetProgramiv RecordGetObjectiv
+#define glGetProgramInfoLog RecordGetInfoLog
+#define glUseProgram RecordObject
+#define gl gl_recording
+#define gl2 gl2_recording
+#include "../../src/engine/gl2/ModelProgram.h"
+typedef vpvl2::gl2::ModelProgram RecordingModelProgram;
+#undef gl2
+#undef gl
+#undef glUniform1i
+#undef glUniform1f
+#undef glUniform2fv
+#undef glUniform3fv
+#undef glUniform4fv
+#undef glUniformMatrix3fv
+#undef glUniformMatrix4fv
+#undef glActiveTexture
+#undef glBindTexture
+#undef glEnable
+#undef glDisable
+#undef glGetUniformLocation
+#undef glBindAttribLocation
+#undef glCreateProgram
+#undef glDeleteProgram
+#undef glCreateShader
+#undef glShaderSource
+#undef glCompileShader
+#undef glGetShaderiv
+#undef glGetShaderInfoLog
+#undef glAttachShader
+#undef glDeleteShader
+#undef glLinkProgram
+#undef glGetProgramiv
+#undef glGetProgramInfoLog
+#undef glUseProgram
+
+namespace {
+
+/* same as the material loop of gl2::PMXRenderEngine#renderModel */
+static void RenderMaterials(RecordingModelProgram &program,
+                            RenderStateCache &renderState,
+                            const Array<MaterialUniformBlock> &blocks,
+                            const MaterialDrawOrder &order,
+                            const Vector3 &lightColor)
+{
+    renderState.invalidate();
+    renderState.setCapability(RenderStateCache::kCullFace, true);
+    program.setRenderStateCacheRef(&renderState);
+    const int nmaterials = order.count();
+    for (int i = 0; i < nmaterials; i++) {
+        program.bindMaterial(blocks[order.at(i)], lightColor, 0, false);
+    }
+    program.setCullFaceEnable(true);
+    program.setRenderStateCacheRef(0);
+}
+
+static void SetMaterialUniformBlock(MaterialUniformBlock &block, ITexture *mainTexture, bool isCullingDisabled, bool isOpaque)
+{
+    block.ambient.setValue(0.2f, 0.2f, 0.2f, 1);
+    block.diffuse.setValue(0.5, 0.5, 0.5, 1);
+    block.specular.setValue(0.1f, 0.1f, 0.1f, 1);
+    block.shininess = 8;
+    block.mainTextureBlend = block.sphereTextureBlend = block.toonTextureBlend = Color(1, 1, 1, 1);
+    block.mainTextureRef = mainTexture;
+    block.isCullingDisabled = isCullingDisabled;
+    block.isOpaque = isOpaque;
+}
+
+/* records values passed from bindMaterialUniformBlock without GL */
+struct MaterialValueRecorder {
+    MaterialValueRecorder()
+        : shininess(0),
+          mainTextureRef(0),
+          sphereTextureRef(0),
+          toonTextureRef(0),
+          sphereTextureRenderMode(IMaterial::kNone),
+          depthTexture(0)
+    {
+    }
+    void setMaterialColor(const Color &value) { color = value; }
+    void setMaterialSpecular(const Color &value) { specular = value; }
+    void setMaterialShininess(const Scalar &value) { shininess = value; }
+    void setMainTextureBlend(const Color &value) { mainTextureBlend = value; }
+    void setSphereTextureBlend(const Color &value) { sphereTextureBlend = value; }
+    void setToonTextureBlend(const Color &value) { toonTextureBlend = value; }
+    void setMainTexture(const ITexture *value) { mainTextureRef = value; }
+    void setSphereTexture(const ITexture *value, IMaterial::SphereTextureRenderMode mode) {
+        sphereTextureRef = value;
+        sphereTextureRenderMode = mode;
+    }
+    void setToonTexture(const ITexture *value) { toonTextureRef = value; }
+    void setDepthTexture(uint32 value) { depthTexture = value; }
+    Color color;
+    Color specular;
+    Color mainTextureBlend;
+    Color sphereTextureBlend;
+    Color toonTextureBlend;
+    Scalar shininess;
+    const ITexture *mainTextureRef;
+    const ITexture *sphereTextureRef;
+    const ITexture *toonTextureRef;
+    IMaterial::SphereTextureRenderMode sphereTextureRenderMode;
+    uint32 depthTexture;
+};
+
+}
+
+TEST(InternalTest, MaterialUniformBlockAppliesLightAtBind)
+{
+    pmx::Material material(0);
+    material.setAmbient(Color(0.1f, 0.2f, 0.3f, 1));
+    material.setDiffuse(Color(0.4f, 0.6f, 0.8f, 1));
+    material.setSpecular(Color(0.2f, 0.4f, 0.6f, 1));
+    material.setShininess(16);
+    material.setFlags(IMaterial::kEnableSelfShadow);
+    MaterialUniformBlock block;
+    block.update(&material, false);
+    /* colors are kept as the material has and the light is applied at bind */
+    ASSERT_TRUE(CompareVector(material.ambient(), block.ambient));
+    ASSERT_TRUE(CompareVector(material.diffuse(), block.diffuse));
+    ASSERT_TRUE(CompareVector(material.specular(), block.specular));
+    ASSERT_FLOAT_EQ(16, block.shininess);
+    ASSERT_TRUE(block.isSelfShadowEnabled);
+    /* a material without the main texture is opaque unless its diffuse is translucent */
+    ASSERT_TRUE(block.isOpaque);
+    NamedTexture texture(1);
+    block.mainTextureRef = &texture;
+    block.update(&material, false);
+    ASSERT_FALSE(block.isOpaque);
+    block.update(&material, true);
+    ASSERT_TRUE(block.isOpaque);
+    MaterialValueRecorder recorder;
+    bindMaterialUniformBlock(&recorder, block, Vector3(0.5f, 0.5f, 0.5f), 7);
+    ASSERT_TRUE(CompareVector(Color(0.3f, 0.5f, 0.7f, 1), recorder.color));
+    ASSERT_TRUE(CompareVector(Color(0.1f, 0.2f, 0.3f, 1), recorder.specular));
+    ASSERT_FLOAT_EQ(16, recorder.shininess);
+    ASSERT_EQ(&texture, recorder.mainTextureRef);
+    ASSERT_EQ(uint32(7), recorder.depthTexture);
+    material.setDiffuse(Color(0.4f, 0.6f, 0.8f, 0.5f));
+    material.setFlags(0);
+    block.update(&material, true);
+    ASSERT_FALSE(block.isOpaque);
+    bindMaterialUniformBlock(&recorder, block, Vector3(1, 1, 1), 7);
+    ASSERT_TRUE(CompareVector(Color(0.5f, 0.8f, 1.1f, 0.5f), recorder.color));
+    /* the depth texture is bound only if self shadow is enabled */
+    ASSERT_EQ(uint32(0), recorder.depthTexture);
+}
+
+TEST(InternalTest, StateCachesSkipUnchangedValues)
+{
+    UniformStateCache uniforms;
+    ASSERT_TRUE(uniforms.update1i(0, 1));
+    ASSERT_FALSE(uniforms.update1i(0, 1));
+    ASSERT_TRUE(uniforms.update1i(0, 2));
+    /* inactive uniforms are never issued */
+    ASSERT_FALSE(uniforms.update1i(-1, 2));
+    const float32 v1[] = { 1, 2, 3 }, v2[] = { 1, 2, 4 };
+    ASSERT_TRUE(uniforms.updatefv(1, v1, 3));
+    ASSERT_FALSE(uniforms.updatefv(1, v1, 3));
+    ASSERT_TRUE(uniforms.updatefv(1, v2, 3));
+    ASSERT_TRUE(uniforms.updatefv(1, v2, 2));
+    /* the integer and the float of the same location are different values */
+    ASSERT_TRUE(uniforms.update1f(0, 2));
+    ASSERT_TRUE(uniforms.update1i(0, 2));
+    ASSERT_TRUE(uniforms.update1i(UniformStateCache::kMaxLocations, 1));
+    ASSERT_TRUE(uniforms.update1i(UniformStateCache::kMaxLocations, 1));
+    uniforms.invalidate();
+    ASSERT_TRUE(uniforms.update1i(0, 2));
+    RenderStateCache renderState;
+    ASSERT_TRUE(renderState.updateTexture(0, 5));
+    ASSERT_FALSE(renderState.updateTexture(0, 5));
+    ASSERT_TRUE(renderState.updateTexture(1, 5));
+    ASSERT_TRUE(renderState.updateActiveTexture(1));
+    ASSERT_FALSE(renderState.updateActiveTexture(1));
+    ASSERT_TRUE(renderState.updateCapability(RenderStateCache::kCullFace, true));
+    ASSERT_FALSE(renderState.updateCapability(RenderStateCache::kCullFace, true));
+    renderState.setCapability(RenderStateCache::kCullFace, false);
+    ASSERT_TRUE(renderState.updateCapability(RenderStateCache::kCullFace, true));
+    renderState.invalidate();
+    ASSERT_TRUE(renderState.updateTexture(0, 5));
+    ASSERT_TRUE(renderState.updateActiveTexture(1));
+    ASSERT_TRUE(renderState.updateCapability(RenderStateCache::kCullFace, true));
+}
+
+TEST(InternalTest, MaterialDrawOrderSortsOpaqueRuns)
+{
+    NamedTexture textures[] = { NamedTexture(1), NamedTexture(2) };
+    ITexture *a = &textures[0], *b = &textures[1];
+    Array<MaterialUniformBlock> blocks;
+    blocks.resize(5);
+    SetMaterialUniformBlock(blocks[0], b, false, true);
+    SetMaterialUniformBlock(blocks[1], a, false, true);
+    SetMaterialUniformBlock(blocks[2], a, false, false);
+    SetMaterialUniformBlock(blocks[3], b, false, true);
+    SetMaterialUniformBlock(blocks[4], a, false, true);
+    MaterialDrawOrder order;
+    order.build(blocks, false);
+    ASSERT_EQ(5, order.count());
+    for (int i = 0; i < 5; i++) {
+        ASSERT_EQ(i, order.at(i));
+    }
+    /* the translucent material 2 splits opaque materials into two runs */
+    order.build(blocks, true);
+    const int expected1[] = { 1, 0, 2, 4, 3 };
+    for (int i = 0; i < 5; i++) {
+        ASSERT_EQ(expected1[i], order.at(i));
+    }
+    blocks[2].isOpaque = true;
+    order.build(blocks, true);
+    const int expected2[] = { 1, 2, 4, 0, 3 };
+    for (int i = 0; i < 5; i++) {
+        ASSERT_EQ(expected2[i], order.at(i));
+    }
+    /* double sided materials are drawn after single sided materials of the same run */
+    blocks[1].isCullingDisabled = true;
+    MaterialDrawOrder order2;
+    order2.build(blocks, true);
+    const int expected3[] = { 2, 4, 0, 3, 1 };
+    for (int i = 0; i < 5; i++) {
+        ASSERT_EQ(expected3[i], order2.at(i));
+    }
+}
+
+TEST(InternalTest, MaterialUniformBlocksSkipRedundantGLCalls)
+{
+    NamedTexture textures[] = { NamedTexture(1), NamedTexture(2) };
+    ITexture *a = &textures[0], *b = &textures[1];
+    Array<MaterialUniformBlock> blocks;
+    blocks.resize(4);
+    SetMaterialUniformBlock(blocks[0], a, false, true);
+    SetMaterialUniformBlock(blocks[1], b, true, true);
+    SetMaterialUniformBlock(blocks[2], a, false, true);
+    SetMaterialUniformBlock(blocks[3], b, false, true);
+    RenderStateCache renderState;
+    RecordingModelProgram program;
+    program.create();
+    ASSERT_TRUE(program.linkProgram());
+    MaterialDrawOrder order;
+    order.build(blocks, false);
+    const Vector3 lightColor(1, 1, 1);
+    g_recordedGLCalls.reset();
+    RenderMaterials(program, renderState, blocks, order, lightColor);
+    /* 6 colors and 5 texture uniforms of the first material, others have same values */
+    ASSERT_EQ(11, g_recordedGLCalls.nuniforms);
+    ASSERT_EQ(4, g_recordedGLCalls.nbinds);
+    ASSERT_EQ(1, g_recordedGLCalls.nactiveTextures);
+    ASSERT_EQ(2, g_recordedGLCalls.ncapabilities);
+    /* uniforms are kept by the program but texture units are invalidated per frame */
+    g_recordedGLCalls.reset();
+    RenderMaterials(program, renderState, blocks, order, lightColor);
+    ASSERT_EQ(0, g_recordedGLCalls.nuniforms);
+    ASSERT_EQ(4, g_recordedGLCalls.nbinds);
+    ASSERT_EQ(1, g_recordedGLCalls.nactiveTextures);
+    ASSERT_EQ(2, g_recordedGLCalls.ncapabilities);
+    g_recordedGLCalls.reset();
+    order.build(blocks, true);
+    RenderMaterials(program, renderState, blocks, order, lightColor);
+    ASSERT_EQ(0, g_recordedGLCalls.nuniforms);
+    ASSERT_EQ(2, g_recordedGLCalls.nbinds);
+    ASSERT_EQ(1, g_recordedGLCalls.nactiveTextures);
+    ASSERT_EQ(2, g_recordedGLCalls.ncapabilities);
+    /* changed color of a material is issued only once */
+    blocks[2].diffuse.setValue(1, 0, 0, 1);
+    g_recordedGLCalls.reset();
+    RenderMaterials(program, renderState, blocks, order, lightColor);
+    ASSERT_EQ(2, g_recordedGLCalls.nuniforms);
+    /* the light is applied at render, so changing it issues the color and the specular */
+    blocks[2].diffuse = blocks[0].diffuse;
+    RenderMaterials(program, renderState, blocks, order, lightColor);
+    g_recordedGLCalls.reset();
+    RenderMaterials(program, renderState, blocks, order, Vector3(0.5, 0.5, 0.5));
+    ASSERT_EQ(2, g_recordedGLCalls.nuniforms);
+}
+
+namespace {
+
+class RecordingFenceDelegate : public vpvl2::extensions::gl::BufferRing::Delegate {
+public:
+    typedef vpvl2::extensions::gl::BufferRing::Fence Fence;
+    RecordingFenceDelegate()
+        : signaled(true),
+          ncreated(0),
+          nwaited(0),
+          ndeleted(0)
+    {
+    }
+    Fence createFence() {
+        return ++ncreated;
+    }
+    bool isFenceSignaled(Fence /* fence */) {
+        return signaled;
+    }
+    void waitFence(Fence /* fence */) {
+        nwaited++;
+    }
+    void deleteFence(Fence /* fence */) {
+        ndeleted++;
+    }
+    bool signaled;
+    int ncreated;
+    int nwaited;
+    int ndeleted;
+};
+
+}
+
+TEST(InternalTest, BufferRingRotatesSlotsWithFences)
+{
+    using vpvl2::extensions::gl::BufferRing;
+    RecordingFenceDelegate delegate;
+    BufferRing ring;
+    ASSERT_EQ(-1, ring.acquire());
+    ring.reset(3, &delegate);
+    ASSERT_EQ(3, ring.countSlots());
+    ASSERT_EQ(-1, ring.currentSlot());
+    ASSERT_EQ(0, ring.acquire());
+    ring.commit();
+    ASSERT_EQ(0, ring.currentSlot());
+    ASSERT_EQ(0, delegate.ncreated);
+    /* the fence of the drawn slot is placed at the next acquire */
+    ASSERT_EQ(1, ring.acquire());
+    ring.commit();
+    ASSERT_TRUE(ring.hasFence(0));
+    ASSERT_FALSE(ring.hasFence(1));
+    ASSERT_EQ(2, ring.acquire());
+    ring.commit();
+    ASSERT_EQ(2, delegate.ncreated);
+    /* the signaled fence of the reused slot is deleted without waiting */
+    ASSERT_EQ(0, ring.acquire());
+    ring.commit();
+    ASSERT_FALSE(ring.hasFence(0));
+    ASSERT_EQ(0, delegate.nwaited);
+    ASSERT_EQ(1, delegate.ndeleted);
+    ASSERT_EQ(0, ring.countStalls());
+    /* the GPU still reads the slot */
+    delegate.signaled = false;
+    ASSERT_EQ(1, ring.acquire());
+    ring.commit();
+    ASSERT_EQ(1, delegate.nwaited);
+    ASSERT_EQ(1, ring.countStalls());
+    ASSERT_EQ(2, delegate.ndeleted);
+    /* remaining fences are deleted at releasing */
+    ring.release();
+    ASSERT_EQ(delegate.ncreated, delegate.ndeleted);
+    ASSERT_EQ(0, ring.countSlots());
+}
+
+TEST(InternalTest, BufferRingWithoutDelegate)
+{
+    using vpvl2::extensions::gl::BufferRing;
+    BufferRing ring;
+    ring.reset(0, 0);
+    ASSERT_EQ(1, ring.countSlots());
+    ring.reset(BufferRing::kMaxSlots + 1, 0);
+    ASSERT_EQ(int(BufferRing::kMaxSlots), ring.countSlots());
+    ring.reset(2, 0);
+    for (int i = 0; i < 4; i++) {
+        ASSERT_EQ(i % 2, ring.acquire());
+        ring.commit();
+        ASSERT_EQ(i % 2, ring.currentSlot());
+        ASSERT_FALSE(ring.hasFence(0));
+        ASSERT_FALSE(ring.hasFence(1));
+    }
+    ASSERT_EQ(0, ring.countStalls());
+}
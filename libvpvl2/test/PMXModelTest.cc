@@ -13,6 +13,7 @@
 #include "vpvl2/pmx/Morph.h"
 #include "vpvl2/pmx/RigidBody.h"
 #include "vpvl2/pmx/Vertex.h"
+#include "vpvl2/internal/VertexStore.h"
 
 #include "mock/Bone.h"
 #include "mock/Joint.h"
@@ -49,12 +50,63 @@ static void SetVertex(Vertex &vertex, Vertex::Type type, const Array<Bone *> &bo
     vertex.setSdefR1(Vector3(0.61, 0.62, 0.63));
 }
 
+static void BuildMorphedModel(Model &model, int nvertices, Array<Morph *> &morphs)
+{
+    Array<Vertex *> vertices;
+    for (int i = 0; i < nvertices; i++) {
+        Vertex *vertex = static_cast<Vertex *>(model.createVertex());
+        model.addVertex(vertex);
+        vertices.append(vertex);
+    }
+    /* vertex morphs share some vertices each other */
+    for (int i = 0; i < 4; i++) {
+        Morph *morph = static_cast<Morph *>(model.createMorph());
+        morph->setType(IMorph::kVertexMorph);
+        for (int j = i * 8; j < i * 8 + 24 && j < nvertices; j++) {
+            Morph::Vertex *v = new Morph::Vertex();
+            v->vertex = vertices[j];
+            v->index = j;
+            v->position.setValue(0.1f * i, 0.01f * j, -0.2f);
+            morph->addVertexMorph(v);
+        }
+        model.addMorph(morph);
+        morphs.append(morph);
+    }
+    for (int i = 0; i < 2; i++) {
+        Morph *morph = static_cast<Morph *>(model.createMorph());
+        morph->setType(i == 0 ? IMorph::kTexCoordMorph : IMorph::kUVA1Morph);
+        for (int j = nvertices / 2; j < nvertices; j += 3) {
+            Morph::UV *v = new Morph::UV();
+            v->vertex = vertices[j];
+            v->index = j;
+            v->offset = i;
+            v->position.setValue(0.5f, 0.01f * j, 0.25f * i, 1);
+            morph->addUVMorph(v);
+        }
+        model.addMorph(morph);
+        morphs.append(morph);
+    }
+    Morph *group = static_cast<Morph *>(model.createMorph());
+    group->setType(IMorph::kGroupMorph);
+    for (int i = 0; i < 2; i++) {
+        Morph::Group *v = new Morph::Group();
+        v->morph = morphs[i * 5];
+        v->index = i * 5;
+        v->fixedWeight = 0.5f;
+        group->addGroupMorph(v);
+    }
+    model.addMorph(group);
+    morphs.append(group);
+}
+
 class PMXFragmentTest : public TestWithParam<vsize> {};
 
 class PMXFragmentWithUVTest : public TestWithParam< tuple<vsize, pmx::Morph::Type > > {};
 
 class PMXLanguageTest : public TestWithParam<IEncoding::LanguageType> {};
 
+class PMXVectorizedSkinningTest : public TestWithParam<internal::VertexStore::KernelType> {};
+
 }
 
 TEST(PMXPropertyEventListener, HandleBonePropertyEvents)
@@ -1006,6 +1058,9 @@ INSTANTIATE_TEST_CASE_P(PMXModelInstance, PMXFragmentWithUVTest, Combine(Values(
                                                                                 pmx::Morph::kUVA2Morph,
                                                                                 pmx::Morph::kUVA3Morph,
                                                                                 pmx::Morph::kUVA4Morph)));
+INSTANTIATE_TEST_CASE_P(PMXModelInstance, PMXVectorizedSkinningTest, Values(internal::VertexStore::kScalarKernel,
+                                                                           internal::VertexStore::kSSE2Kernel,
+                                                                           internal::VertexStore::kAVXKernel));
 INSTANTIATE_TEST_CASE_P(PMXModelInstance, PMXLanguageTest, Values(IEncoding::kDefaultLanguage,
                                                                   IEncoding::kJapanese,
                                                                   IEncoding::kEnglish));
@@ -1508,6 +1563,139 @@ TEST(PMXVertexTest, PerformSkinningBdef2WeightHalf)
     ASSERT_TRUE(CompareVector(n2, normal));
 }
 
+TEST_P(PMXVectorizedSkinningTest, MatchesPerVertexSkinning)
+{
+    const internal::VertexStore::KernelType kernelType = GetParam();
+    /* kernels not compiled in fall back to the scalar kernel that would be compared with itself */
+    if (kernelType > internal::VertexStore::defaultKernelType()) {
+        std::cerr << "[  SKIPPED ] kernel type " << kernelType << " is not compiled in this binary" << std::endl;
+        return;
+    }
+    Encoding encoding(0);
+    Model model(&encoding);
+    const Transform transforms[] = {
+        Transform(Quaternion(Vector3(0, 1, 0), 0.3), Vector3(1, 2, 3)),
+        Transform(Quaternion(Vector3(1, 0, 0), -0.7), Vector3(-0.5, 0.25, 4)),
+        Transform(Quaternion(Vector3(0, 0, 1), 1.1), Vector3(0.1, -3, 0.7)),
+        Transform(Matrix3x3::getIdentity().scaled(Vector3(0.5, 0.5, 0.5)), Vector3(2, 0, -1))
+    };
+    const int nbones = sizeof(transforms) / sizeof(transforms[0]);
+    Array<Bone *> bones;
+    for (int i = 0; i < nbones; i++) {
+        Bone *bone = static_cast<Bone *>(model.createBone());
+        model.addBone(bone);
+        bone->setLocalTransform(transforms[i]);
+        bones.append(bone);
+    }
+    Material *material = static_cast<Material *>(model.createMaterial());
+    model.addMaterial(material);
+    material->setEdgeSize(1.5);
+    model.setEdgeWidth(0.75);
+    const IVertex::Type types[] = {
+        IVertex::kBdef1, IVertex::kBdef2, IVertex::kBdef4, IVertex::kSdef
+    };
+    const IVertex::WeightPrecision weights[] = { 0.3f, 1.0f, 0.0f, 0.55f };
+    /* number of vertices is not multiple of lane size to cover remainders */
+    const int nvertices = 37;
+    for (int i = 0; i < nvertices; i++) {
+        Vertex *vertex = static_cast<Vertex *>(model.createVertex());
+        model.addVertex(vertex);
+        vertex->setType(types[i % 4]);
+        vertex->setOrigin(Vector3(0.1f * i, -0.2f * i, 0.05f * i + 1));
+        vertex->setNormal(Vector3(0.3f, 0.1f * (i % 7), -0.5f).normalized());
+        vertex->setEdgeSize(0.25f * (i % 3));
+        vertex->setMaterialRef(i % 5 == 0 ? 0 : material);
+        for (int j = 0; j < 4; j++) {
+            vertex->setBoneRef(j, bones[(i + j) % nbones]);
+            vertex->setWeight(j, weights[(i + j) % 4]);
+        }
+        Morph::Vertex morph;
+        morph.position.setValue(0.01f * i, 0.02f, -0.03f * i);
+        vertex->mergeMorph(&morph, 0.5);
+    }
+    /* the material refers all vertices to compare AABBs of the material */
+    Array<int> indices;
+    for (int i = 0; i < nvertices; i++) {
+        indices.append(i);
+    }
+    model.setIndices(indices);
+    IMaterial::IndexRange range;
+    range.start = 0;
+    range.count = range.end = nvertices;
+    material->setIndexRange(range);
+    IModel::IndexBuffer *indexBuffer = 0;
+    model.getIndexBuffer(indexBuffer);
+    QScopedPointer<IModel::IndexBuffer> indexBufferPtr(indexBuffer);
+    IModel::DynamicVertexBuffer *dynamicBuffer = 0;
+    model.getDynamicVertexBuffer(dynamicBuffer, indexBuffer);
+    QScopedPointer<IModel::DynamicVertexBuffer> dynamicBufferPtr(dynamicBuffer);
+    ASSERT_TRUE(dynamicBuffer);
+    const vsize size = dynamicBuffer->size(), stride = dynamicBuffer->strideSize();
+    Array<uint8> expected, actual;
+    expected.resize(int(size));
+    actual.resize(int(size));
+    const Vector3 cameraPosition(0, 10, -50);
+    Vector3 expectedMin, expectedMax, actualMin, actualMax, expectedMaterialMin, expectedMaterialMax, actualMaterialMin, actualMaterialMax;
+    dynamicBuffer->update(&expected[0], cameraPosition, expectedMin, expectedMax);
+    ASSERT_TRUE(dynamicBuffer->getMaterialAabb(0, expectedMaterialMin, expectedMaterialMax));
+    model.setVectorizedSkinningEnable(true);
+    model.vertexStoreRef()->setKernelType(kernelType);
+    dynamicBuffer->update(&actual[0], cameraPosition, actualMin, actualMax);
+    ASSERT_TRUE(dynamicBuffer->getMaterialAabb(0, actualMaterialMin, actualMaterialMax));
+    const IModel::Buffer::StrideType strideTypes[] = {
+        IModel::Buffer::kVertexStride,
+        IModel::Buffer::kNormalStride,
+        IModel::Buffer::kMorphDeltaStride,
+        IModel::Buffer::kEdgeVertexStride
+    };
+    /* compare bit pattern of xyz (position and delta) and xyzw (normal with edge size and edge with index) */
+    const vsize components[] = { 3, 4, 3, 4 };
+    for (int i = 0; i < nvertices; i++) {
+        for (int j = 0; j < 4; j++) {
+            const vsize offset = stride * i + dynamicBuffer->strideOffset(strideTypes[j]);
+            ASSERT_EQ(0, std::memcmp(&expected[int(offset)], &actual[int(offset)], sizeof(float32) * components[j]))
+                    << "vertex=" << i << " stride=" << strideTypes[j];
+        }
+    }
+    for (int i = 0; i < 3; i++) {
+        ASSERT_EQ(expectedMin[i], actualMin[i]);
+        ASSERT_EQ(expectedMax[i], actualMax[i]);
+        ASSERT_EQ(expectedMaterialMin[i], actualMaterialMin[i]);
+        ASSERT_EQ(expectedMaterialMax[i], actualMaterialMax[i]);
+    }
+}
+
+TEST(PMXModelTest, ParallelUpdateAabb)
+{
+    Encoding encoding(0);
+    Model model(&encoding);
+    Vector3 expectedMin(SIMD_INFINITY, SIMD_INFINITY, SIMD_INFINITY),
+            expectedMax(-SIMD_INFINITY, -SIMD_INFINITY, -SIMD_INFINITY);
+    /* spans several chunks with a remainder */
+    const int nvertices = 1000;
+    for (int i = 0; i < nvertices; i++) {
+        Vertex *vertex = static_cast<Vertex *>(model.createVertex());
+        model.addVertex(vertex);
+        const Vector3 origin(std::sin(i * 0.1f) * i, std::cos(i * 0.3f), -0.01f * i);
+        vertex->setOrigin(origin);
+        expectedMin.setMin(origin);
+        expectedMax.setMax(origin);
+    }
+    IModel::IndexBuffer *indexBuffer = 0;
+    model.getIndexBuffer(indexBuffer);
+    QScopedPointer<IModel::IndexBuffer> indexBufferPtr(indexBuffer);
+    IModel::DynamicVertexBuffer *dynamicBuffer = 0;
+    model.getDynamicVertexBuffer(dynamicBuffer, indexBuffer);
+    QScopedPointer<IModel::DynamicVertexBuffer> dynamicBufferPtr(dynamicBuffer);
+    dynamicBuffer->setParallelUpdateEnable(true);
+    Array<uint8> bytes;
+    bytes.resize(int(dynamicBuffer->size()));
+    Vector3 aabbMin, aabbMax;
+    dynamicBuffer->update(&bytes[0], kZeroV3, aabbMin, aabbMax);
+    ASSERT_TRUE(CompareVector(expectedMin, aabbMin));
+    ASSERT_TRUE(CompareVector(expectedMax, aabbMax));
+}
+
 TEST(PMXModelTest, AddAndRemoveBone)
 {
     Encoding encoding(0);
@@ -1678,6 +1866,449 @@ TEST(PMXModelTest, ParseEmpty)
     ASSERT_EQ(Model::kInvalidHeaderError, model.error());
 }
 
+TEST(PMXModelTest, IncrementalBoneUpdate)
+{
+    Encoding encoding(0);
+    Model expected(&encoding), actual(&encoding);
+    const int nbones = 31;
+    Array<Bone *> expectedBones, actualBones;
+    BuildBoneTree(expected, nbones, 2, expectedBones);
+    BuildBoneTree(actual, nbones, 2, actualBones);
+    expected.setIncrementalBoneUpdateEnable(false);
+    ASSERT_TRUE(actual.isIncrementalBoneUpdateEnabled());
+    for (int frame = 0; frame < 16; frame++) {
+        /* animates a few bones and the rest keep their values as motions do */
+        const int target = (frame * 7) % nbones;
+        for (int i = 0; i < nbones; i++) {
+            const Quaternion &rotation = i == target ? Quaternion(Vector3(0, 0, 1), 0.1f * (frame + 1)) : Quaternion::getIdentity();
+            const Vector3 &translation = i == 1 ? Vector3(0, 0.05f * (frame / 4), 0) : kZeroV3;
+            expectedBones[i]->setLocalOrientation(rotation);
+            expectedBones[i]->setLocalTranslation(translation);
+            actualBones[i]->setLocalOrientation(rotation);
+            actualBones[i]->setLocalTranslation(translation);
+        }
+        expected.performUpdate();
+        actual.performUpdate();
+        for (int i = 0; i < nbones; i++) {
+            const Transform &e = expectedBones[i]->localTransform(), &a = actualBones[i]->localTransform();
+            ASSERT_TRUE(CompareVector(e.getOrigin(), a.getOrigin())) << "frame=" << frame << " bone=" << i;
+            ASSERT_TRUE(CompareVector(e.getRotation(), a.getRotation())) << "frame=" << frame << " bone=" << i;
+            ASSERT_FALSE(actualBones[i]->isDirty());
+        }
+    }
+    /* changing a bone makes its descendants dirty only */
+    actualBones[2]->setLocalOrientation(Quaternion(Vector3(1, 0, 0), 0.5f));
+    ASSERT_TRUE(actualBones[2]->isDirty());
+    ASSERT_FALSE(actualBones[3]->propagateDirty());
+    ASSERT_TRUE(actualBones[5]->propagateDirty());
+    ASSERT_TRUE(actualBones[5]->isDirty());
+    ASSERT_FALSE(actualBones[1]->isDirty());
+    actual.performUpdate();
+    for (int i = 0; i < nbones; i++) {
+        ASSERT_FALSE(actualBones[i]->isDirty());
+    }
+    /* local transforms overwritten by rigid bodies or pose edits must be updated too */
+    actualBones[4]->setLocalTransform(Transform::getIdentity());
+    ASSERT_TRUE(actualBones[4]->isDirty());
+    actual.performUpdate();
+    for (int i = 0; i < nbones; i++) {
+        ASSERT_FALSE(actualBones[i]->isDirty());
+    }
+}
+
+TEST(PMXModelTest, SparseMorphUpdate)
+{
+    Encoding encoding(0);
+    Model expected(&encoding), actual(&encoding);
+    const int nvertices = 64;
+    Array<Morph *> expectedMorphs, actualMorphs;
+    BuildMorphedModel(expected, nvertices, expectedMorphs);
+    BuildMorphedModel(actual, nvertices, actualMorphs);
+    expected.setSparseMorphUpdateEnable(false);
+    ASSERT_TRUE(actual.isSparseMorphUpdateEnabled());
+    const int nmorphs = expectedMorphs.count();
+    /* weights go up and back to zero to check vertices morphed in previous frames are reset */
+    const IMorph::WeightPrecision weights[][7] = {
+        { 0, 0, 0, 0, 0, 0, 0 },
+        { 1, 0, 0, 0, 0, 0, 0 },
+        { 0.5, 0.25, 0, 0, 1, 0, 0 },
+        { 0, 0.25, 0.75, 0, 0, 1, 0 },
+        { 0, 0, 0, 1, 0, 0, 1 },
+        { 0, 0, 0, 0, 0, 0, 1 },
+        { 0, 0, 0, 0, 0, 0, 0 },
+        { 0.3, 0.3, 0.3, 0.3, 0.3, 0.3, 0.3 },
+        { 0, 0, 0, 0, 0, 0, 0 }
+    };
+    const int nframes = sizeof(weights) / sizeof(weights[0]);
+    for (int frame = 0; frame < nframes; frame++) {
+        for (int i = 0; i < nmorphs; i++) {
+            expectedMorphs[i]->setWeight(weights[frame][i]);
+            actualMorphs[i]->setWeight(weights[frame][i]);
+        }
+        expected.performUpdate();
+        actual.performUpdate();
+        Array<IVertex *> expectedVertices, actualVertices;
+        expected.getVertexRefs(expectedVertices);
+        actual.getVertexRefs(actualVertices);
+        for (int i = 0; i < nvertices; i++) {
+            const IVertex *e = expectedVertices[i], *a = actualVertices[i];
+            ASSERT_TRUE(CompareVector(e->delta(), a->delta())) << "frame=" << frame << " vertex=" << i;
+            for (int j = 0; j < Vertex::kMaxMorphs; j++) {
+                ASSERT_TRUE(CompareVector(e->uv(j), a->uv(j))) << "frame=" << frame << " vertex=" << i << " uv=" << j;
+            }
+        }
+    }
+}
+
+TEST(PMXModelTest, BonePaletteSubMeshes)
+{
+    Encoding encoding(0);
+    Model model(&encoding);
+    Array<Bone *> bones;
+    const int nbones = 32, ntriangles = 48, nmaterials = 2, maxPaletteSize = 8;
+    BuildBoneTree(model, nbones, 2, bones);
+    /* each triangle refers four bones so materials cannot be drawn with a single palette */
+    Array<int> indices;
+    for (int i = 0; i < ntriangles; i++) {
+        for (int j = 0; j < 3; j++) {
+            Array<Bone *> vertexBones;
+            vertexBones.append(bones[(i + j) % nbones]);
+            vertexBones.append(bones[(i + j + 1) % nbones]);
+            Vertex *vertex = static_cast<Vertex *>(model.createVertex());
+            SetVertex(*vertex, Vertex::kBdef2, vertexBones);
+            model.addVertex(vertex);
+            indices.append(i * 3 + j);
+        }
+    }
+    model.setIndices(indices);
+    for (int i = 0; i < nmaterials; i++) {
+        Material *material = static_cast<Material *>(model.createMaterial());
+        IMaterial::IndexRange range;
+        range.count = ntriangles / nmaterials * 3;
+        range.start = i * range.count;
+        range.end = range.start + range.count;
+        material->setIndexRange(range);
+        model.addMaterial(material);
+    }
+    for (int i = 0; i < nbones; i++) {
+        bones[i]->setLocalOrientation(Quaternion(Vector3(0, 0, 1), 0.05f * i));
+    }
+    model.performUpdate();
+    model.setMaxBonePaletteSize(maxPaletteSize);
+    IModel::IndexBuffer *indexBuffer = 0;
+    IModel::StaticVertexBuffer *staticBuffer = 0;
+    IModel::DynamicVertexBuffer *dynamicBuffer = 0;
+    IModel::MatrixBuffer *matrixBuffer = 0;
+    model.getIndexBuffer(indexBuffer);
+    QScopedPointer<IModel::IndexBuffer> indexBufferPtr(indexBuffer);
+    model.getStaticVertexBuffer(staticBuffer);
+    QScopedPointer<IModel::StaticVertexBuffer> staticBufferPtr(staticBuffer);
+    model.getDynamicVertexBuffer(dynamicBuffer, indexBuffer);
+    QScopedPointer<IModel::DynamicVertexBuffer> dynamicBufferPtr(dynamicBuffer);
+    model.getMatrixBuffer(matrixBuffer, dynamicBuffer, indexBuffer);
+    QScopedPointer<IModel::MatrixBuffer> matrixBufferPtr(matrixBuffer);
+    ASSERT_TRUE(matrixBuffer);
+    Array<Scalar> staticBytes, dynamicBytes;
+    staticBytes.resize(int(staticBuffer->size() / sizeof(Scalar)));
+    dynamicBytes.resize(int(dynamicBuffer->size() / sizeof(Scalar)));
+    staticBuffer->update(&staticBytes[0]);
+    matrixBuffer->mapBoneIndices(&staticBytes[0], staticBuffer);
+    matrixBuffer->update(&dynamicBytes[0]);
+    const uint8 *boneIndicesPtr = reinterpret_cast<const uint8 *>(&staticBytes[0]) + staticBuffer->strideOffset(IModel::Buffer::kBoneIndexStride);
+    const vsize stride = staticBuffer->strideSize();
+    Scalar expected[16];
+    int materialOffset = 0;
+    for (int i = 0; i < nmaterials; i++) {
+        const int nindices = ntriangles / nmaterials * 3, nsubmeshes = matrixBuffer->countSubMeshes(i);
+        ASSERT_GT(nsubmeshes, 1);
+        /* sub-meshes must cover the material contiguously */
+        int nextOffset = 0;
+        for (int j = 0; j < nsubmeshes; j++) {
+            int offset, count;
+            matrixBuffer->getSubMeshRange(i, j, offset, count);
+            ASSERT_EQ(nextOffset, offset);
+            ASSERT_EQ(0, count % 3);
+            const int paletteSize = int(matrixBuffer->subMeshSize(i, j));
+            ASSERT_LE(paletteSize, maxPaletteSize);
+            const float *matrices = matrixBuffer->subMeshBytes(i, j);
+            for (int k = offset; k < offset + count; k++) {
+                const int vertexIndex = indexBuffer->indexAt(materialOffset + k);
+                const float *boneIndices = reinterpret_cast<const float *>(boneIndicesPtr + stride * vertexIndex);
+                const IVertex *vertex = model.vertices()[vertexIndex];
+                for (int l = 0; l < 2; l++) {
+                    const int slot = int(boneIndices[l]);
+                    ASSERT_LT(slot, paletteSize);
+                    vertex->boneRef(l)->localTransform().getOpenGLMatrix(expected);
+                    for (int m = 0; m < 16; m++) {
+                        ASSERT_FLOAT_EQ(expected[m], matrices[slot * 16 + m]) << "material=" << i << " submesh=" << j << " index=" << k;
+                    }
+                }
+            }
+            nextOffset = offset + count;
+        }
+        ASSERT_EQ(nindices, nextOffset);
+        materialOffset += nindices;
+    }
+    /* the model falls back when bones of a triangle exceed the palette */
+    model.setMaxBonePaletteSize(2);
+    model.getMatrixBuffer(matrixBuffer, dynamicBuffer, indexBuffer);
+    matrixBufferPtr.take();
+    ASSERT_FALSE(matrixBuffer);
+}
+
+TEST(PMXModelTest, IndexTypeByVertexCount)
+{
+    /* the width of indices depends on the count of vertices even if there are more indices */
+    const int nvertices[] = { 3, 256, 257, 65536, 65537 };
+    const IModel::IndexBuffer::Type types[] = {
+        IModel::IndexBuffer::kIndex8,
+        IModel::IndexBuffer::kIndex8,
+        IModel::IndexBuffer::kIndex16,
+        IModel::IndexBuffer::kIndex16,
+        IModel::IndexBuffer::kIndex32
+    };
+    for (int i = 0; i < int(sizeof(nvertices) / sizeof(nvertices[0])); i++) {
+        Encoding encoding(0);
+        Model model(&encoding);
+        for (int j = 0; j < nvertices[i]; j++) {
+            model.addVertex(model.createVertex());
+        }
+        Array<int> indices;
+        const int nindices = 70000 * 3;
+        for (int j = 0; j < nindices; j++) {
+            indices.append(j % nvertices[i]);
+        }
+        model.setIndices(indices);
+        IModel::IndexBuffer *indexBuffer = 0;
+        model.getIndexBuffer(indexBuffer);
+        QScopedPointer<IModel::IndexBuffer> indexBufferPtr(indexBuffer);
+        ASSERT_EQ(types[i], indexBuffer->type()) << "vertices=" << nvertices[i];
+        int maxIndex = 0;
+        for (int j = 0; j < nindices; j++) {
+            maxIndex = qMax(maxIndex, indexBuffer->indexAt(j));
+        }
+        ASSERT_EQ(nvertices[i] - 1, maxIndex) << "vertices=" << nvertices[i];
+    }
+}
+
+TEST(PMXModelTest, OptimizeVertexCache)
+{
+    Encoding encoding(0);
+    Model model(&encoding);
+    const int size = 24, stride = size + 1, nmaterials = 2;
+    /* vertices remember their original indices to compare triangles after reordering */
+    for (int i = 0; i < stride * stride; i++) {
+        Vertex *vertex = static_cast<Vertex *>(model.createVertex());
+        vertex->setOrigin(Vector3(Scalar(i), 0, 0));
+        model.addVertex(vertex);
+    }
+    QList<int> triangles;
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            const int v = y * stride + x;
+            triangles << v << v + 1 << v + stride << v + 1 << v + stride + 1 << v + stride;
+        }
+    }
+    /* shuffles triangles deterministically to make the cache locality worse */
+    const int ntriangles = triangles.size() / 3;
+    unsigned int seed = 12345;
+    for (int i = ntriangles - 1; i > 0; i--) {
+        seed = seed * 1103515245 + 12345;
+        const int j = int((seed >> 16) % (i + 1));
+        for (int k = 0; k < 3; k++) {
+            triangles.swap(i * 3 + k, j * 3 + k);
+        }
+    }
+    Array<int> indices;
+    foreach (int index, triangles) {
+        indices.append(index);
+    }
+    model.setIndices(indices);
+    for (int i = 0; i < nmaterials; i++) {
+        Material *material = static_cast<Material *>(model.createMaterial());
+        IMaterial::IndexRange range;
+        range.count = ntriangles / nmaterials * 3;
+        range.start = i * range.count;
+        range.end = range.start + range.count;
+        material->setIndexRange(range);
+        model.addMaterial(material);
+    }
+    Morph *morph = static_cast<Morph *>(model.createMorph());
+    morph->setType(IMorph::kVertexMorph);
+    Morph::Vertex *morphVertex = new Morph::Vertex();
+    morphVertex->vertex = model.vertices()[7];
+    morphVertex->index = 7;
+    morph->addVertexMorph(morphVertex);
+    model.addMorph(morph);
+    const int cacheSize = 16;
+    Scalar beforeACMR, beforeATVR, afterACMR, afterATVR;
+    model.getVertexCacheStatistics(cacheSize, beforeACMR, beforeATVR);
+    QList<qint64> expected[nmaterials], actual[nmaterials];
+    const int nindicesPerMaterial = ntriangles / nmaterials * 3;
+    for (int i = 0; i < ntriangles * 3; i += 3) {
+        QList<int> triangle;
+        triangle << triangles[i] << triangles[i + 1] << triangles[i + 2];
+        qSort(triangle);
+        expected[i / nindicesPerMaterial] << (qint64(triangle[0]) << 40 | qint64(triangle[1]) << 20 | triangle[2]);
+    }
+    model.optimizeVertexCache(cacheSize);
+    model.getVertexCacheStatistics(cacheSize, afterACMR, afterATVR);
+    ASSERT_LT(afterACMR, beforeACMR);
+    ASSERT_LT(afterATVR, beforeATVR);
+    ASSERT_GE(afterATVR, Scalar(1));
+    /* each material keeps the same set of triangles */
+    const Array<int> &optimizedIndices = model.indices();
+    const Array<Vertex *> &vertices = model.vertices();
+    for (int i = 0; i < ntriangles * 3; i += 3) {
+        QList<int> triangle;
+        for (int j = 0; j < 3; j++) {
+            const Vertex *vertex = vertices[optimizedIndices[i + j]];
+            ASSERT_EQ(optimizedIndices[i + j], vertex->index());
+            triangle << int(vertex->origin().x());
+        }
+        qSort(triangle);
+        actual[i / nindicesPerMaterial] << (qint64(triangle[0]) << 40 | qint64(triangle[1]) << 20 | triangle[2]);
+    }
+    for (int i = 0; i < nmaterials; i++) {
+        qSort(expected[i]);
+        qSort(actual[i]);
+        ASSERT_TRUE(expected[i] == actual[i]) << "material=" << i;
+    }
+    /* vertices are stored in order of the first reference */
+    ASSERT_EQ(0, optimizedIndices[0]);
+    ASSERT_EQ(int(morphVertex->index), morphVertex->vertex->index());
+    ASSERT_EQ(Scalar(7), morphVertex->vertex->origin().x());
+}
+
+TEST(PMXModelTest, InverseKinematicsEarlyExit)
+{
+    QFile file("miku.pmx");
+    if (file.open(QFile::ReadOnly)) {
+        const QByteArray &bytes = file.readAll();
+        const uint8 *data = reinterpret_cast<const uint8 *>(bytes.constData());
+        const vsize size = bytes.size();
+        Encoding::Dictionary dict;
+        Encoding encoding(&dict);
+        pmx::Model expected(&encoding), actual(&encoding);
+        ASSERT_TRUE(expected.load(data, size));
+        ASSERT_TRUE(actual.load(data, size));
+        expected.setInverseKinematicsThreshold(0);
+        ASSERT_GT(actual.inverseKinematicsThreshold(), Scalar(0));
+        Model::InverseKinematicsStatistics e, a;
+        /* effectors are already placed on IK bones in the rest pose */
+        expected.performUpdate();
+        actual.performUpdate();
+        expected.getInverseKinematicsStatistics(e);
+        actual.getInverseKinematicsStatistics(a);
+        ASSERT_GT(e.nchains, 0);
+        ASSERT_EQ(e.nchains, a.nchains);
+        ASSERT_LT(a.niterations, e.niterations);
+        /* moved IK bones must be solved as well as without the threshold */
+        const Array<Bone *> &expectedBones = expected.bones(), &actualBones = actual.bones();
+        const int nbones = expectedBones.count();
+        for (int i = 0; i < nbones; i++) {
+            if (expectedBones[i]->hasInverseKinematics()) {
+                expectedBones[i]->setLocalTranslation(Vector3(0, 0.5f, -0.5f));
+                actualBones[i]->setLocalTranslation(Vector3(0, 0.5f, -0.5f));
+            }
+        }
+        expected.performUpdate();
+        actual.performUpdate();
+        expected.getInverseKinematicsStatistics(e);
+        actual.getInverseKinematicsStatistics(a);
+        ASSERT_EQ(e.nchains, a.nchains);
+        ASSERT_LE(a.niterations, e.niterations);
+        ASSERT_LE(a.maxResidual, e.maxResidual + Scalar(1.0e-3));
+        ASSERT_LE(a.nconverged, a.nchains);
+    }
+}
+
+TEST(PMXModelTest, LazyLoadRealPMX)
+{
+    QFile file("miku.pmx");
+    if (file.open(QFile::ReadOnly)) {
+        /* mapped data must be kept alive until the model is materialized */
+        const vsize size = file.size();
+        const uint8 *data = file.map(0, size);
+        ASSERT_TRUE(data);
+        Encoding::Dictionary dict;
+        Encoding encoding(&dict);
+        pmx::Model expected(&encoding), actual(&encoding);
+        ASSERT_TRUE(expected.load(data, size));
+        actual.setLazyLoadEnable(true);
+        ASSERT_TRUE(actual.load(data, size));
+        ASSERT_FALSE(actual.isMaterialized());
+        ASSERT_TRUE(actual.name(IEncoding::kJapanese)->equals(expected.name(IEncoding::kJapanese)));
+        ASSERT_EQ(expected.bones().count(), actual.bones().count());
+        /* counts are taken from the preparsed data */
+        const IModel::ObjectType types[] = {
+            IModel::kVertex, IModel::kIndex, IModel::kMaterial, IModel::kMorph, IModel::kRigidBody, IModel::kJoint
+        };
+        for (int i = 0; i < int(sizeof(types) / sizeof(types[0])); i++) {
+            ASSERT_EQ(expected.count(types[i]), actual.count(types[i]));
+        }
+        ASSERT_FALSE(actual.isMaterialized());
+        /* render engines get the index buffer before touching any other geometry */
+        IModel::IndexBuffer *expectedIndexBuffer = 0, *actualIndexBuffer = 0;
+        expected.getIndexBuffer(expectedIndexBuffer);
+        actual.getIndexBuffer(actualIndexBuffer);
+        QScopedPointer<IModel::IndexBuffer> expectedIndexBufferPtr(expectedIndexBuffer), actualIndexBufferPtr(actualIndexBuffer);
+        ASSERT_EQ(expectedIndexBuffer->size(), actualIndexBuffer->size());
+        ASSERT_EQ(expectedIndexBuffer->type(), actualIndexBuffer->type());
+        /* accessing vertices materializes only the geometry section */
+        ASSERT_EQ(expected.vertices().count(), actual.vertices().count());
+        ASSERT_EQ(expected.materials().count(), actual.materials().count());
+        ASSERT_FALSE(actual.isMaterialized());
+        ASSERT_TRUE(actual.materializeAll());
+        ASSERT_TRUE(actual.isMaterialized());
+        ASSERT_EQ(expected.morphs().count(), actual.morphs().count());
+        ASSERT_EQ(expected.labels().count(), actual.labels().count());
+        ASSERT_EQ(expected.joints().count(), actual.joints().count());
+        ASSERT_EQ(expected.estimateSize(), actual.estimateSize());
+    }
+}
+
+TEST(PMXModelTest, ParallelLoadRealPMX)
+{
+    QFile file("miku.pmx");
+    if (file.open(QFile::ReadOnly)) {
+        const QByteArray &bytes = file.readAll();
+        const uint8 *data = reinterpret_cast<const uint8 *>(bytes.constData());
+        const vsize size = bytes.size();
+        Encoding::Dictionary dict;
+        Encoding encoding(&dict);
+        pmx::Model expected(&encoding), actual(&encoding);
+        ASSERT_TRUE(expected.load(data, size));
+        actual.setParallelLoadEnable(true);
+        ASSERT_TRUE(actual.load(data, size));
+        const IModel::ObjectType types[] = {
+            IModel::kVertex, IModel::kIndex, IModel::kMaterial, IModel::kBone,
+            IModel::kIK, IModel::kMorph, IModel::kRigidBody, IModel::kJoint, IModel::kTexture
+        };
+        for (int i = 0; i < int(sizeof(types) / sizeof(types[0])); i++) {
+            ASSERT_EQ(expected.count(types[i]), actual.count(types[i]));
+        }
+        /* vertices parsed from chunks must keep their original order */
+        Array<IVertex *> expectedVertices, actualVertices;
+        expected.getVertexRefs(expectedVertices);
+        actual.getVertexRefs(actualVertices);
+        const int nvertices = expectedVertices.count();
+        for (int i = 0; i < nvertices; i++) {
+            const IVertex *e = expectedVertices[i], *a = actualVertices[i];
+            ASSERT_EQ(i, a->index());
+            ASSERT_TRUE(CompareVector(e->origin(), a->origin()));
+            ASSERT_EQ(e->materialRef()->index(), a->materialRef()->index());
+            ASSERT_EQ(e->boneRef(0)->index(), a->boneRef(0)->index());
+        }
+        ASSERT_EQ(expected.estimateSize(), actual.estimateSize());
+        QByteArray expectedBytes(int(expected.estimateSize()), 0), actualBytes(int(actual.estimateSize()), 0);
+        vsize written;
+        expected.save(reinterpret_cast<uint8 *>(expectedBytes.data()), written);
+        actual.save(reinterpret_cast<uint8 *>(actualBytes.data()), written);
+        ASSERT_EQ(expectedBytes, actualBytes);
+    }
+}
+
 TEST(PMXModelTest, ParseRealPMX)
 {
     QFile file("miku.pmx");
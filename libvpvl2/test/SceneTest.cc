@@ -1,5 +1,7 @@
 #include "Common.h"
 
+#include <btBulletDynamicsCommon.h>
+
 #include "vpvl2/vpvl2.h"
 #include "vpvl2/IApplicationContext.h"
 #include "vpvl2/extensions/icu4c/Encoding.h"
@@ -20,6 +22,7 @@
 #include "vpvl2/gl2/AssetRenderEngine.h"
 #include "vpvl2/gl2/PMXRenderEngine.h"
 #include "vpvl2/extensions/World.h"
+#include "vpvl2/internal/PhysicsCache.h"
 
 using namespace ::testing;
 using namespace std::tr1;
@@ -248,6 +251,39 @@ TEST(SceneTest, Update)
     }
 }
 
+TEST(SceneTest, ParallelUpdateModels)
+{
+    Scene scene(true);
+    String s(UnicodeString::fromUTF8("This is a test model."));
+    MockIModel *models[4];
+    for (int i = 0; i < 4; i++) {
+        QScopedPointer<MockIRenderEngine> engine(new MockIRenderEngine());
+        QScopedPointer<MockIModel> model(new MockIModel());
+        EXPECT_CALL(*engine, update()).WillOnce(Return());
+        /* ignore setting setParentSceneRef */
+        EXPECT_CALL(*model, type()).WillRepeatedly(Return(IModel::kMaxModelType));
+        EXPECT_CALL(*model, performUpdate()).Times(1);
+        EXPECT_CALL(*model, joinWorld(0)).Times(1);
+        EXPECT_CALL(*model, name(IEncoding::kDefaultLanguage)).WillRepeatedly(Return(&s));
+        models[i] = model.data();
+        scene.addModel(model.take(), engine.take(), 0);
+    }
+    /* two motions bound to the same model and one motion without the parent model */
+    MockIMotion motions[3];
+    for (int i = 0; i < 3; i++) {
+        MockIMotion &motion = motions[i];
+        EXPECT_CALL(motion, type()).WillRepeatedly(Return(IMotion::kMaxMotionType));
+        EXPECT_CALL(motion, parentModelRef()).WillRepeatedly(Return(i < 2 ? models[0] : 0));
+        EXPECT_CALL(motion, seek(42)).WillOnce(Return());
+        scene.addMotion(&motion);
+    }
+    scene.seek(42, Scene::kUpdateModels | Scene::kParallelUpdateModels);
+    scene.update(Scene::kUpdateAll | Scene::kParallelUpdateModels);
+    for (int i = 0; i < 3; i++) {
+        scene.removeMotion(&motions[i]);
+    }
+}
+
 TEST(SceneTest, AdvanceMotions)
 {
     Scene scene(true);
@@ -541,6 +577,231 @@ TEST(SceneTest, SetWorldRef)
     }
 }
 
+TEST(SceneTest, WorldModelIslands)
+{
+    {
+        // 1. models join the shared world by default
+        extensions::World world;
+        ASSERT_FALSE(world.configuration().enableModelIslands);
+        btDiscreteDynamicsWorld *worldRef = world.dynamicWorldRef();
+        MockIModel model;
+        EXPECT_CALL(model, joinWorld(worldRef)).Times(1);
+        EXPECT_CALL(model, leaveWorld(worldRef)).Times(1);
+        world.addModel(&model);
+        ASSERT_EQ(0, world.countIslands());
+        ASSERT_EQ(worldRef, world.findDynamicWorldRef(&model));
+        world.removeModel(&model);
+    }
+    {
+        // 2. each model gets its own dynamics world
+        extensions::World::Configuration configuration;
+        configuration.enableModelIslands = true;
+        configuration.numSolverIterations = 4;
+        extensions::World world(configuration);
+        world.setGravity(Vector3(0, -1, 0));
+        ASSERT_EQ(4, world.configuration().numSolverIterations);
+        ASSERT_EQ(4, world.dynamicWorldRef()->getSolverInfo().m_numIterations);
+        MockIModel model1, model2;
+        EXPECT_CALL(model1, joinWorld(_)).Times(1);
+        EXPECT_CALL(model2, joinWorld(_)).Times(1);
+        world.addModel(&model1);
+        world.addModel(&model2);
+        ASSERT_EQ(2, world.countIslands());
+        btDiscreteDynamicsWorld *island1 = world.findDynamicWorldRef(&model1);
+        btDiscreteDynamicsWorld *island2 = world.findDynamicWorldRef(&model2);
+        ASSERT_NE(world.dynamicWorldRef(), island1);
+        ASSERT_NE(island1, island2);
+        ASSERT_EQ(4, island1->getSolverInfo().m_numIterations);
+        ASSERT_TRUE(CompareVector(Vector3(0, -1, 0), island2->getGravity()));
+        world.stepSimulation(world.fixedTimeStep());
+        EXPECT_CALL(model1, leaveWorld(island1)).Times(1);
+        world.removeModel(&model1);
+        ASSERT_EQ(1, world.countIslands());
+        ASSERT_EQ(world.dynamicWorldRef(), world.findDynamicWorldRef(&model1));
+        EXPECT_CALL(model2, leaveWorld(island2)).Times(1);
+        world.removeModel(&model2);
+        ASSERT_EQ(0, world.countIslands());
+    }
+}
+
+TEST(SceneTest, WorldLinkModels)
+{
+    extensions::World::Configuration configuration;
+    configuration.enableModelIslands = true;
+    extensions::World world(configuration);
+    MockIModel model1, model2, model3;
+    EXPECT_CALL(model1, joinWorld(_)).Times(AnyNumber());
+    EXPECT_CALL(model1, leaveWorld(_)).Times(AnyNumber());
+    EXPECT_CALL(model2, joinWorld(_)).Times(AnyNumber());
+    EXPECT_CALL(model2, leaveWorld(_)).Times(AnyNumber());
+    EXPECT_CALL(model3, joinWorld(_)).Times(AnyNumber());
+    EXPECT_CALL(model3, leaveWorld(_)).Times(AnyNumber());
+    world.addModel(&model1);
+    world.addModel(&model2);
+    world.addModel(&model3);
+    ASSERT_EQ(3, world.countIslands());
+    ASSERT_FALSE(world.isLinked(&model1, &model2));
+    world.linkModels(&model1, &model2);
+    ASSERT_EQ(2, world.countIslands());
+    ASSERT_TRUE(world.isLinked(&model1, &model2));
+    ASSERT_TRUE(world.isLinked(&model2, &model1));
+    ASSERT_FALSE(world.isLinked(&model1, &model3));
+    ASSERT_EQ(world.findDynamicWorldRef(&model1), world.findDynamicWorldRef(&model2));
+    ASSERT_NE(world.findDynamicWorldRef(&model1), world.findDynamicWorldRef(&model3));
+    world.unlinkModel(&model2);
+    ASSERT_EQ(3, world.countIslands());
+    ASSERT_FALSE(world.isLinked(&model1, &model2));
+    ASSERT_NE(world.findDynamicWorldRef(&model1), world.findDynamicWorldRef(&model2));
+    world.removeModel(&model1);
+    world.removeModel(&model2);
+    world.removeModel(&model3);
+    ASSERT_EQ(0, world.countIslands());
+}
+
+TEST(SceneTest, WorldSleepingRigidBodies)
+{
+    static const int kNumSteps = 240;
+    btSphereShape shape(0.5f);
+    for (int i = 0; i < 2; i++) {
+        const bool enableSleeping = i == 1;
+        extensions::World::Configuration configuration;
+        configuration.enableSleeping = enableSleeping;
+        extensions::World world(configuration);
+        world.setGravity(kZeroV3);
+        /* a bone-following body and a dynamic body jointed to it like a hair */
+        btRigidBody kinematicBody(btRigidBody::btRigidBodyConstructionInfo(0, 0, &shape));
+        kinematicBody.setCollisionFlags(kinematicBody.getCollisionFlags() | btCollisionObject::CF_KINEMATIC_OBJECT);
+        kinematicBody.setActivationState(DISABLE_DEACTIVATION);
+        btRigidBody::btRigidBodyConstructionInfo info(1, 0, &shape, Vector3(1, 1, 1));
+        info.m_startWorldTransform.setOrigin(Vector3(0, -2, 0));
+        btRigidBody dynamicBody(info);
+        dynamicBody.setActivationState(DISABLE_DEACTIVATION);
+        btPoint2PointConstraint constraint(kinematicBody, dynamicBody, Vector3(0, -1, 0), Vector3(0, 1, 0));
+        world.addRigidBody(&kinematicBody);
+        world.addRigidBody(&dynamicBody);
+        world.dynamicWorldRef()->addConstraint(&constraint);
+        for (int j = 0; j < kNumSteps; j++) {
+            world.stepSimulation(world.fixedTimeStep());
+        }
+        ASSERT_EQ(!enableSleeping, dynamicBody.isActive());
+        ASSERT_TRUE(kinematicBody.isActive());
+        /* moving the bone-following body must wake the jointed body up */
+        Transform transform(Transform::getIdentity());
+        transform.setOrigin(Vector3(0.5f, 0, 0));
+        kinematicBody.setWorldTransform(transform);
+        world.stepSimulation(world.fixedTimeStep());
+        ASSERT_TRUE(dynamicBody.isActive());
+        world.dynamicWorldRef()->removeConstraint(&constraint);
+        world.removeRigidBody(&dynamicBody);
+        world.removeRigidBody(&kinematicBody);
+    }
+}
+
+TEST(SceneTest, SetPhysicsWorldRef)
+{
+    extensions::World::Configuration configuration;
+    configuration.enableModelIslands = true;
+    extensions::World world(configuration);
+    String s(UnicodeString::fromUTF8("This is a test model."));
+    MockIModel model1, model2;
+    MockIRenderEngine engine1, engine2;
+    MockIModel *models[] = { &model1, &model2 };
+    for (int i = 0; i < 2; i++) {
+        MockIModel *model = models[i];
+        /* ignore setting setParentSceneRef */
+        EXPECT_CALL(*model, type()).WillRepeatedly(Return(IModel::kMaxModelType));
+        EXPECT_CALL(*model, name(IEncoding::kDefaultLanguage)).WillRepeatedly(Return(&s));
+        EXPECT_CALL(*model, isPhysicsEnabled()).WillRepeatedly(Return(true));
+        EXPECT_CALL(*model, joinWorld(0)).Times(1);
+    }
+    Scene scene(false);
+    scene.addModel(&model1, &engine1, 0);
+    scene.addModel(&model2, &engine2, 0);
+    /* models already added are joined to each island */
+    EXPECT_CALL(model1, joinWorld(_)).Times(1);
+    EXPECT_CALL(model2, joinWorld(_)).Times(1);
+    scene.setPhysicsWorldRef(&world);
+    ASSERT_EQ(2, world.countIslands());
+    btDiscreteDynamicsWorld *island1 = world.findDynamicWorldRef(&model1);
+    btDiscreteDynamicsWorld *island2 = world.findDynamicWorldRef(&model2);
+    /* all models are reset at first and only the seeked model is reset after that */
+    EXPECT_CALL(model1, resetMotionState(island1)).Times(3);
+    EXPECT_CALL(model2, resetMotionState(island2)).Times(2);
+    scene.update(Scene::kResetDirtyMotionState);
+    MockIMotion motion;
+    EXPECT_CALL(motion, type()).WillRepeatedly(Return(IMotion::kMaxMotionType));
+    EXPECT_CALL(motion, parentModelRef()).WillRepeatedly(Return(&model1));
+    EXPECT_CALL(motion, seek(0)).WillOnce(Return());
+    scene.addMotion(&motion);
+    scene.seek(0, Scene::kUpdateModels);
+    scene.update(Scene::kResetDirtyMotionState);
+    /* nothing should be reset without seeking */
+    scene.update(Scene::kResetDirtyMotionState);
+    /* explicit reset resets all models regardless of their states */
+    scene.update(Scene::kResetMotionState);
+    scene.removeMotion(&motion);
+    EXPECT_CALL(model1, leaveWorld(island1)).Times(1);
+    EXPECT_CALL(model2, leaveWorld(island2)).Times(1);
+    scene.setPhysicsWorldRef(0);
+    ASSERT_EQ(0, world.countIslands());
+}
+
+TEST(SceneTest, PhysicsCacheRecordAndRestore)
+{
+    static const int kNumFrames = 75;
+    static const int kNumBodies = 8;
+    internal::PhysicsCache cache;
+    Array<Transform> transforms, actual;
+    transforms.resize(kNumBodies);
+    for (int i = 0; i < kNumFrames; i++) {
+        for (int j = 0; j < kNumBodies; j++) {
+            const Quaternion rotation(Vector3(0, 1, 0), 0.05f * i + j);
+            transforms[j] = Transform(rotation, Vector3(0.01f * i, 10.0f + j, -0.02f * i * j));
+        }
+        cache.record(i, transforms);
+    }
+    ASSERT_EQ(kNumFrames, cache.countFrames());
+    /* quantized deltas must be smaller than raw transforms */
+    ASSERT_LT(cache.estimateSize(), vsize(kNumFrames * kNumBodies * sizeof(Transform)));
+    static const int kFrameIndices[] = { 0, 1, 29, 30, 31, 59, 74 };
+    for (int i = 0; i < int(sizeof(kFrameIndices) / sizeof(kFrameIndices[0])); i++) {
+        const int frameIndex = kFrameIndices[i];
+        ASSERT_TRUE(cache.restore(frameIndex, actual));
+        ASSERT_EQ(kNumBodies, actual.count());
+        for (int j = 0; j < kNumBodies; j++) {
+            const Quaternion expected(Vector3(0, 1, 0), 0.05f * frameIndex + j);
+            const Quaternion &rotation = actual[j].getRotation();
+            ASSERT_NEAR(1.0f, btFabs(expected.dot(rotation)), 1.0e-4f);
+            ASSERT_NEAR(0.01f * frameIndex, actual[j].getOrigin().x(), 1.0e-3f);
+            ASSERT_NEAR(10.0f + j, actual[j].getOrigin().y(), 1.0e-3f);
+            ASSERT_NEAR(-0.02f * frameIndex * j, actual[j].getOrigin().z(), 1.0e-3f);
+        }
+    }
+    ASSERT_FALSE(cache.restore(kNumFrames, actual));
+    /* editing a keyframe invalidates all frames after it */
+    cache.invalidate(40);
+    ASSERT_EQ(40, cache.countFrames());
+    ASSERT_TRUE(cache.contains(39));
+    ASSERT_FALSE(cache.contains(40));
+    ASSERT_TRUE(cache.restore(39, actual));
+    cache.clear();
+    ASSERT_EQ(0, cache.countFrames());
+}
+
+TEST(SceneTest, PhysicsCacheEnable)
+{
+    Scene scene(true);
+    ASSERT_FALSE(scene.isPhysicsCacheEnabled());
+    scene.setPhysicsCacheEnable(true);
+    ASSERT_TRUE(scene.isPhysicsCacheEnabled());
+    /* should not be crashed without models */
+    scene.update(Scene::kUpdateModels);
+    scene.update(Scene::kUpdateModels | Scene::kResetMotionState);
+    scene.invalidatePhysicsCache(0, 0);
+    scene.setPhysicsCacheEnable(false);
+    ASSERT_FALSE(scene.isPhysicsCacheEnabled());
+}
+
 TEST(SceneTest, CreateRenderEngine)
 {
     Scene scene(true);
@@ -0,0 +1,141 @@
+#include "Common.h"
+#include "vpvl2/IApplicationContext.h"
+#include "vpvl2/extensions/TextureCache.h"
+
+using namespace ::testing;
+using namespace vpvl2;
+using namespace vpvl2::extensions;
+
+namespace {
+
+class FakeTexture : public ITexture {
+public:
+    FakeTexture(intptr_t name, int *ndeleted)
+        : m_name(name),
+          m_ndeleted(ndeleted)
+    {
+    }
+    ~FakeTexture() {
+        (*m_ndeleted)++;
+    }
+
+    void create() {}
+    void bind() {}
+    void resize(const Vector3 & /* size */) {}
+    void unbind() {}
+    void release() {}
+    Vector3 size() const { return Vector3(16, 16, 1); }
+    intptr_t data() const { return m_name; }
+    intptr_t sampler() const { return 0; }
+    intptr_t format() const { return 0; }
+
+private:
+    intptr_t m_name;
+    int *m_ndeleted;
+};
+
+const uint8 kImageA[] = { 'B', 'M', 0x1, 0x2, 0x3 };
+const uint8 kImageB[] = { 'B', 'M', 0x3, 0x2, 0x1 };
+
+}
+
+TEST(TextureCacheTest, ShareByContent)
+{
+    TextureCache cache;
+    int ndeleted = 0;
+    const TextureCache::Key &key = TextureCache::createKey(kImageA, sizeof(kImageA), 0);
+    ASSERT_FALSE(cache.find(key, "a/tex.bmp"));
+    QScopedPointer<ITexture> first(cache.insert(key, "a/tex.bmp", new FakeTexture(42, &ndeleted), 1024));
+    ASSERT_TRUE(first);
+    ASSERT_EQ(intptr_t(42), first->data());
+    /* same content from the other path */
+    QScopedPointer<ITexture> second(cache.find(TextureCache::createKey(kImageA, sizeof(kImageA), 0), "b/tex.bmp"));
+    ASSERT_TRUE(second);
+    ASSERT_EQ(intptr_t(42), second->data());
+    /* both paths are fast path now */
+    QScopedPointer<ITexture> third(cache.find("b/tex.bmp", 0));
+    ASSERT_TRUE(third);
+    ASSERT_FALSE(cache.find("b/tex.bmp", IApplicationContext::kToonTexture));
+    /* different flags or content must not be shared */
+    ASSERT_FALSE(cache.find(TextureCache::createKey(kImageA, sizeof(kImageA), IApplicationContext::kToonTexture), ""));
+    ASSERT_FALSE(cache.find(TextureCache::createKey(kImageB, sizeof(kImageB), 0), ""));
+    ASSERT_EQ(1, cache.countTextures());
+    ASSERT_EQ(2, cache.countHits());
+    ASSERT_EQ(3, cache.countMisses());
+    ASSERT_EQ(vsize(1024), cache.totalBytes());
+    /* inserting the duplicated texture deletes it and returns the shared one */
+    QScopedPointer<ITexture> fourth(cache.insert(key, "", new FakeTexture(43, &ndeleted), 1024));
+    ASSERT_EQ(1, ndeleted);
+    ASSERT_EQ(intptr_t(42), fourth->data());
+    ASSERT_EQ(vsize(1024), cache.totalBytes());
+}
+
+TEST(TextureCacheTest, RefcountAndEviction)
+{
+    TextureCache cache(2048);
+    int ndeleted = 0;
+    const TextureCache::Key &keyA = TextureCache::createKey(kImageA, sizeof(kImageA), 0);
+    const TextureCache::Key &keyB = TextureCache::createKey(kImageB, sizeof(kImageB), 0);
+    ITexture *a1 = cache.insert(keyA, "a.bmp", new FakeTexture(1, &ndeleted), 1024);
+    ITexture *a2 = cache.find("a.bmp", 0);
+    delete a1;
+    /* still referenced */
+    ASSERT_EQ(0, ndeleted);
+    ASSERT_EQ(0, cache.countUnusedTextures());
+    delete a2;
+    /* unreferenced but kept within budget */
+    ASSERT_EQ(0, ndeleted);
+    ASSERT_EQ(1, cache.countUnusedTextures());
+    ITexture *b = cache.insert(keyB, "b.bmp", new FakeTexture(2, &ndeleted), 1536);
+    /* over budget, the unreferenced texture is evicted */
+    ASSERT_EQ(1, ndeleted);
+    ASSERT_EQ(1, cache.countEvictions());
+    ASSERT_EQ(vsize(1536), cache.totalBytes());
+    ASSERT_FALSE(cache.find("a.bmp", 0));
+    /* referenced texture is never evicted even if over budget */
+    cache.setBudget(0);
+    ASSERT_EQ(1, ndeleted);
+    delete b;
+    ASSERT_EQ(2, ndeleted);
+    ASSERT_EQ(0, cache.countTextures());
+    ASSERT_EQ(vsize(0), cache.totalBytes());
+}
+
+TEST(TextureCacheTest, UpdateBytesOfPlaceholder)
+{
+    TextureCache cache(2048);
+    int ndeleted = 0;
+    FakeTexture *placeholder = new FakeTexture(1, &ndeleted);
+    ITexture *a = cache.insert(TextureCache::createKey(kImageA, sizeof(kImageA), 0), "a.bmp", placeholder, 4);
+    ASSERT_EQ(vsize(4), cache.totalBytes());
+    /* the decoded image replaces the placeholder */
+    cache.updateBytes(placeholder, 1024);
+    ASSERT_EQ(vsize(1024), cache.totalBytes());
+    ITexture *b = cache.insert(TextureCache::createKey(kImageB, sizeof(kImageB), 0), "b.bmp", new FakeTexture(2, &ndeleted), 1536);
+    delete a;
+    /* charged by the real size so the unreferenced texture is evicted */
+    ASSERT_EQ(1, ndeleted);
+    ASSERT_EQ(1, cache.countEvictions());
+    ASSERT_EQ(vsize(1536), cache.totalBytes());
+    /* textures not cached are ignored */
+    cache.updateBytes(placeholder, 4096);
+    ASSERT_EQ(vsize(1536), cache.totalBytes());
+    delete b;
+}
+
+TEST(TextureCacheTest, OutliveCache)
+{
+    int ndeleted = 0;
+    ITexture *texture = 0;
+    {
+        TextureCache cache;
+        const TextureCache::Key &key = TextureCache::createKey(kImageA, sizeof(kImageA), 0);
+        texture = cache.insert(key, "a.bmp", new FakeTexture(1, &ndeleted), 1024);
+        delete cache.insert(TextureCache::createKey(kImageB, sizeof(kImageB), 0), "", new FakeTexture(2, &ndeleted), 1024);
+    }
+    /* the unreferenced texture is deleted with the cache */
+    ASSERT_EQ(1, ndeleted);
+    ASSERT_EQ(intptr_t(1), texture->data());
+    delete texture;
+    ASSERT_EQ(2, ndeleted);
+}
@@ -12,6 +12,7 @@
 #include "vpvl2/vmd/MorphAnimation.h"
 #include "vpvl2/vmd/MorphKeyframe.h"
 #include "vpvl2/vmd/Motion.h"
+#include "vpvl2/internal/InterpolationTableCache.h"
 
 #include "mock/Bone.h"
 #include "mock/Model.h"
@@ -424,6 +425,31 @@ TEST(VMDMotionTest, BoneInterpolation)
     CompareBoneInterpolationMatrix(p, frame);
 }
 
+TEST(VMDMotionTest, ShareInterpolationTable)
+{
+    Encoding encoding(0);
+    internal::InterpolationTableCache::Stats before, shared, after;
+    internal::InterpolationTableCache::getStats(before);
+    {
+        vmd::BoneKeyframe frame1(&encoding), frame2(&encoding);
+        const QuadWord p(8, 9, 10, 11);
+        frame1.setInterpolationParameter(vmd::BoneKeyframe::kBonePositionX, p);
+        frame2.setInterpolationParameter(vmd::BoneKeyframe::kBonePositionX, p);
+        /* keyframes with the same control points refer the same table */
+        ASSERT_EQ(frame1.interpolationTable()[0], frame2.interpolationTable()[0]);
+        internal::InterpolationTableCache::getStats(shared);
+        ASSERT_EQ(before.nreferences + 2, shared.nreferences);
+        ASSERT_LT(before.savedBytes, shared.savedBytes);
+        frame2.setInterpolationParameter(vmd::BoneKeyframe::kBonePositionX, QuadWord(12, 13, 14, 15));
+        ASSERT_NE(frame1.interpolationTable()[0], frame2.interpolationTable()[0]);
+    }
+    internal::InterpolationTableCache::getStats(after);
+    ASSERT_EQ(before.ntables, after.ntables);
+    ASSERT_EQ(before.nreferences, after.nreferences);
+    ASSERT_EQ(before.allocatedBytes, after.allocatedBytes);
+    ASSERT_EQ(before.savedBytes, after.savedBytes);
+}
+
 TEST(VMDMotionTest, CameraInterpolation)
 {
     vmd::CameraKeyframe frame;